@@ -0,0 +1,567 @@
+/*
+ python/seqalign.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+// CPython extension searching a database in process, built from libalign.a
+// by python/setup.py (make python). The hits of a search are handed to
+// Python as views of the results' own memory (NumPy arrays if NumPy is
+// installed, memoryviews if not), without copying, and the GIL is released
+// while a database loads or is searched.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "alignment_search.h"
+#include "alignment_scoring_load.h"
+#include "alignment_prefilter.h"
+
+typedef struct
+{
+    PyObject_HEAD
+    sw_db_t *db;
+    bool global;    // global scores may be negative, so min_score defaults lower
+    bool busy;      // a handle can't be searched by two threads at once
+} DatabaseObject;
+
+typedef struct
+{
+    PyObject_HEAD
+    sw_results_t results;
+} ResultsObject;
+
+// One field of every hit of a Results, exported as a strided buffer over
+// the sw_hit_t array
+typedef struct
+{
+    PyObject_HEAD
+    ResultsObject *owner;
+    size_t offset;
+    Py_ssize_t itemsize;
+    const char *format;
+    Py_ssize_t shape, stride;
+} HitFieldObject;
+
+static PyTypeObject DatabaseType, ResultsType, HitFieldType;
+
+// numpy.asarray, or None if NumPy isn't installed
+static PyObject *np_asarray = NULL;
+
+/*
+ * Hit fields
+ */
+
+static int hitfield_getbuffer(PyObject *obj, Py_buffer *view, int flags) {
+    HitFieldObject *f = (HitFieldObject *) obj;
+    static char empty;
+
+    if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "hits are read-only");
+        return -1;
+    }
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+        PyErr_SetString(PyExc_BufferError, "hit fields are strided");
+        return -1;
+    }
+
+    const sw_results_t *res = &f->owner->results;
+    f->shape = (Py_ssize_t) res->num_hits;
+    f->stride = (Py_ssize_t) sizeof(sw_hit_t);
+
+    view->buf = res->num_hits > 0 ? (char *) res->hits + f->offset : &empty;
+    view->obj = obj;
+    Py_INCREF(obj);
+    view->len = f->shape * f->itemsize;
+    view->readonly = 1;
+    view->itemsize = f->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *) f->format : NULL;
+    view->ndim = 1;
+    view->shape = &f->shape;
+    view->strides = &f->stride;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static void hitfield_dealloc(HitFieldObject *f) {
+    Py_XDECREF(f->owner);
+    Py_TYPE(f)->tp_free((PyObject *) f);
+}
+
+static PyBufferProcs hitfield_as_buffer = {hitfield_getbuffer, NULL};
+
+static PyTypeObject HitFieldType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "seqalign._HitField",
+    .tp_basicsize = sizeof(HitFieldObject),
+    .tp_dealloc = (destructor) hitfield_dealloc,
+    .tp_as_buffer = &hitfield_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "One field of the hits of a search, as a buffer",
+};
+
+// A NumPy array (or memoryview) of one field of the hits, sharing their memory
+static PyObject *hit_field(ResultsObject *owner, size_t offset, Py_ssize_t itemsize,
+                           const char *format) {
+    HitFieldObject *f = PyObject_New(HitFieldObject, &HitFieldType);
+    if (f == NULL) return NULL;
+    Py_INCREF(owner);
+    f->owner = owner;
+    f->offset = offset;
+    f->itemsize = itemsize;
+    f->format = format;
+
+    PyObject *view = np_asarray != Py_None ? PyObject_CallOneArg(np_asarray, (PyObject *) f)
+                                           : PyMemoryView_FromObject((PyObject *) f);
+    Py_DECREF(f);
+    return view;
+}
+
+/*
+ * Results
+ */
+
+static void results_dealloc(ResultsObject *r) {
+    sw_results_dealloc(&r->results);
+    Py_TYPE(r)->tp_free((PyObject *) r);
+}
+
+static Py_ssize_t results_len(ResultsObject *r) {
+    return (Py_ssize_t) r->results.num_hits;
+}
+
+static PyObject *results_entries(ResultsObject *r, void *closure) {
+    (void) closure;
+    return hit_field(r, offsetof(sw_hit_t, entry), sizeof(size_t), sizeof(size_t) == 8 ? "Q" : "I");
+}
+
+static PyObject *results_scores(ResultsObject *r, void *closure) {
+    (void) closure;
+    return hit_field(r, offsetof(sw_hit_t, score), sizeof(int32_t), "i");
+}
+
+static PyObject *results_bit_scores(ResultsObject *r, void *closure) {
+    (void) closure;
+    return hit_field(r, offsetof(sw_hit_t, bit_score), sizeof(double), "d");
+}
+
+static PyObject *results_evalues(ResultsObject *r, void *closure) {
+    (void) closure;
+    return hit_field(r, offsetof(sw_hit_t, evalue), sizeof(double), "d");
+}
+
+static PyObject *results_query_ends(ResultsObject *r, void *closure) {
+    (void) closure;
+    return hit_field(r, offsetof(sw_hit_t, query_end), sizeof(size_t), sizeof(size_t) == 8 ? "Q" : "I");
+}
+
+static PyObject *results_entry_ends(ResultsObject *r, void *closure) {
+    (void) closure;
+    return hit_field(r, offsetof(sw_hit_t, entry_end), sizeof(size_t), sizeof(size_t) == 8 ? "Q" : "I");
+}
+
+static PyGetSetDef results_getset[] = {
+    {"entries", (getter) results_entries, NULL, "0-based database entry of each hit", NULL},
+    {"scores", (getter) results_scores, NULL, "Alignment score of each hit (int32)", NULL},
+    {"bit_scores", (getter) results_bit_scores, NULL, "Bit score of each hit, with stats=True", NULL},
+    {"evalues", (getter) results_evalues, NULL, "E-value of each hit, with stats=True", NULL},
+    {"query_ends", (getter) results_query_ends, NULL,
+     "1-based query position where each hit's best alignment ends, with ends=True", NULL},
+    {"entry_ends", (getter) results_entry_ends, NULL,
+     "1-based entry position where each hit's best alignment ends, with ends=True", NULL},
+    {NULL}
+};
+
+static PyMemberDef results_members[] = {
+    {"num_entries", T_PYSSIZET, offsetof(ResultsObject, results.num_entries), READONLY,
+     "Database entries scanned"},
+    {"num_filtered", T_PYSSIZET, offsetof(ResultsObject, results.num_filtered), READONLY,
+     "Entries skipped by the filters"},
+    {"kernel_time", T_DOUBLE, offsetof(ResultsObject, results.kernel_time), READONLY,
+     "Seconds spent aligning"},
+    {"prefilter_time", T_DOUBLE, offsetof(ResultsObject, results.prefilter_time), READONLY,
+     "Seconds spent in the filters"},
+    {NULL}
+};
+
+static PySequenceMethods results_as_sequence = {.sq_length = (lenfunc) results_len};
+
+static PyTypeObject ResultsType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "seqalign.Results",
+    .tp_basicsize = sizeof(ResultsObject),
+    .tp_dealloc = (destructor) results_dealloc,
+    .tp_as_sequence = &results_as_sequence,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Hits of a search, in database order unless max_hits was given",
+    .tp_getset = results_getset,
+    .tp_members = results_members,
+};
+
+static ResultsObject *results_new(void) {
+    ResultsObject *r = PyObject_New(ResultsObject, &ResultsType);
+    if (r != NULL) sw_results_alloc(&r->results);
+    return r;
+}
+
+/*
+ * Database
+ */
+
+static int database_init(DatabaseObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"path", "matrix", "match", "mismatch", "gap_open", "gap_extend",
+                             "mode", "alphabet", NULL};
+    const char *path, *matrix = NULL, *mode = "local", *alphabet = "protein";
+    PyObject *match = Py_None, *mismatch = Py_None;
+    int gap_open = -2, gap_extend = -1;
+    scoring_t scoring;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|zOOiiss", kwlist, &path, &matrix, &match,
+                                     &mismatch, &gap_open, &gap_extend, &mode, &alphabet)) {
+        return -1;
+    }
+    if (self->db != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Database is already open");
+        return -1;
+    }
+
+    // the defaults of bin/smith_waterman
+    scoring_system_default(&scoring);
+    scoring.match = 2;
+    scoring.mismatch = -2;
+    scoring.gap_open = (score_t) gap_open;
+    scoring.gap_extend = (score_t) gap_extend;
+
+    if (strcmp(mode, "local") == 0) scoring.mode = ALIGN_LOCAL;
+    else if (strcmp(mode, "global") == 0) scoring.mode = ALIGN_GLOBAL;
+    else {
+        PyErr_Format(PyExc_ValueError, "mode must be 'local' or 'global', not '%s'", mode);
+        return -1;
+    }
+
+    if (strcmp(alphabet, "protein") == 0) scoring.alphabet = ALPHABET_PROTEIN;
+    else if (strcmp(alphabet, "dna") == 0) scoring.alphabet = ALPHABET_DNA;
+    else if (strcmp(alphabet, "rna") == 0) scoring.alphabet = ALPHABET_RNA;
+    else {
+        PyErr_Format(PyExc_ValueError, "alphabet must be 'protein', 'dna' or 'rna', not '%s'",
+                     alphabet);
+        return -1;
+    }
+
+    if (match != Py_None && (scoring.match = (int) PyLong_AsLong(match)) == -1 && PyErr_Occurred())
+        return -1;
+    if (mismatch != Py_None && (scoring.mismatch = (int) PyLong_AsLong(mismatch)) == -1 &&
+        PyErr_Occurred())
+        return -1;
+
+    if (matrix != NULL) {
+        gzFile file = gzopen(matrix, "r");
+        if (file == NULL) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, matrix);
+            return -1;
+        }
+        const char *err_msg;
+        int err_line;
+        int err = align_scoring_try_load_matrix(file, &scoring, true, &err_msg, &err_line);
+        gzclose(file);
+        if (err != 0 && err_line != -1) {
+            PyErr_Format(PyExc_ValueError, "%s: line %i: %s", matrix, err_line, err_msg);
+            return -1;
+        } else if (err != 0) {
+            PyErr_Format(PyExc_ValueError, "%s: %s", matrix, err_msg);
+            return -1;
+        }
+        // match/mismatch only for pairs the matrix doesn't have, if given
+        if (match == Py_None) scoring.use_match_mismatch = false;
+    }
+
+    if (scoring.use_match_mismatch && scoring.match < scoring.mismatch) {
+        PyErr_SetString(PyExc_ValueError, "match should not be less than mismatch");
+        return -1;
+    }
+
+    sw_db_t *db;
+    Py_BEGIN_ALLOW_THREADS
+    db = sw_db_open(path, &scoring);
+    Py_END_ALLOW_THREADS
+
+    if (db == NULL) {
+        PyErr_Format(PyExc_OSError, "couldn't load database %s", path);
+        return -1;
+    }
+    self->db = db;
+    self->global = scoring.mode == ALIGN_GLOBAL;
+    return 0;
+}
+
+static void database_dealloc(DatabaseObject *self) {
+    if (self->db != NULL) sw_db_close(self->db);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static bool database_check(DatabaseObject *self) {
+    if (self->db == NULL) {
+        PyErr_SetString(PyExc_ValueError, "Database is closed");
+        return false;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "Database is being searched by another thread");
+        return false;
+    }
+    return true;
+}
+
+// Search options from the keyword arguments of search/search_batch
+static bool parse_opts(DatabaseObject *self, PyObject *kwds, sw_search_opts_t *opts) {
+    static char *kwlist[] = {"min_score", "max_hits", "prefilter", "ungapped", "word_score",
+                             "stats", "max_evalue", "ends", NULL};
+    PyObject *min_score = Py_None;
+    Py_ssize_t max_hits = 0;
+    int prefilter = 0, ungapped = 0, word_score = PREFILTER_WORD_SCORE, stats = 0, ends = 0;
+    double max_evalue = 0;
+    PyObject *empty = PyTuple_New(0);
+
+    int ok = PyArg_ParseTupleAndKeywords(empty, kwds, "|Oniiipdp", kwlist, &min_score, &max_hits,
+                                         &prefilter, &ungapped, &word_score, &stats, &max_evalue,
+                                         &ends);
+    Py_DECREF(empty);
+    if (!ok) return false;
+
+    if (max_hits < 0 || prefilter < 0 || ungapped < 0 || max_evalue < 0) {
+        PyErr_SetString(PyExc_ValueError, "max_hits, prefilter, ungapped and max_evalue can't be negative");
+        return false;
+    }
+    if (prefilter > INT16_MAX || ungapped > INT16_MAX) {
+        PyErr_Format(PyExc_ValueError, "prefilter and ungapped can't be more than %i", INT16_MAX);
+        return false;
+    }
+
+    sw_search_opts_init(opts);
+    // global scores are usually negative, report them all
+    if (self->global) opts->min_score = INT16_MIN;
+    if (min_score != Py_None) {
+        long score = PyLong_AsLong(min_score);
+        if (score == -1 && PyErr_Occurred()) return false;
+        if (score < INT16_MIN || score > INT16_MAX) {
+            PyErr_Format(PyExc_ValueError, "min_score must be between %i and %i", INT16_MIN,
+                         INT16_MAX);
+            return false;
+        }
+        opts->min_score = (score_t) score;
+    }
+    opts->max_hits = (size_t) max_hits;
+    if (prefilter > 0 || ungapped > 0) {
+        opts->exact = false;
+        opts->prefilter_score = (score_t) prefilter;
+        opts->ungapped_cutoff = (score_t) ungapped;
+    }
+    opts->prefilter_word_score = word_score;
+    opts->stats = stats || max_evalue > 0;
+    opts->max_evalue = max_evalue;
+    opts->ends = ends;
+    return true;
+}
+
+static PyObject *database_search(DatabaseObject *self, PyObject *args, PyObject *kwds) {
+    const char *query;
+    Py_ssize_t query_len;
+    sw_search_opts_t opts;
+    int status;
+
+    if (!PyArg_ParseTuple(args, "s#", &query, &query_len)) return NULL;
+    if (!database_check(self) || !parse_opts(self, kwds, &opts)) return NULL;
+
+    ResultsObject *r = results_new();
+    if (r == NULL) return NULL;
+
+    // query points into the str, which args keeps alive
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    status = sw_search(self->db, query, (size_t) query_len, &opts, &r->results);
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+
+    if (status != 0) {
+        Py_DECREF(r);
+        PyErr_SetString(PyExc_ValueError, "search failed, see the message on stderr");
+        return NULL;
+    }
+    return (PyObject *) r;
+}
+
+static PyObject *database_search_batch(DatabaseObject *self, PyObject *args, PyObject *kwds) {
+    PyObject *seq, *list = NULL, *fast;
+    sw_search_opts_t opts;
+    Py_ssize_t i, n;
+    int status;
+
+    if (!PyArg_ParseTuple(args, "O", &seq)) return NULL;
+    if (!database_check(self) || !parse_opts(self, kwds, &opts)) return NULL;
+    if ((fast = PySequence_Fast(seq, "queries must be a sequence of str")) == NULL) return NULL;
+
+    n = PySequence_Fast_GET_SIZE(fast);
+    const char **queries = PyMem_Malloc(sizeof(char *) * (size_t) (n + 1));
+    size_t *query_lens = PyMem_Malloc(sizeof(size_t) * (size_t) (n + 1));
+    sw_results_t *results = PyMem_Calloc((size_t) (n + 1), sizeof(sw_results_t));
+    if (queries == NULL || query_lens == NULL || results == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for (i = 0; i < n; i++) {
+        Py_ssize_t len;
+        queries[i] = PyUnicode_AsUTF8AndSize(PySequence_Fast_GET_ITEM(fast, i), &len);
+        if (queries[i] == NULL) goto done;
+        query_lens[i] = (size_t) len;
+    }
+
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    status = sw_search_batch(self->db, queries, query_lens, (size_t) n, &opts, results);
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+
+    if (status != 0) {
+        PyErr_SetString(PyExc_ValueError, "search failed, see the message on stderr");
+        goto done;
+    }
+
+    // each Results takes over the hits of its query
+    if ((list = PyList_New(n)) == NULL) goto done;
+    for (i = 0; i < n; i++) {
+        ResultsObject *r = results_new();
+        if (r == NULL) {
+            Py_CLEAR(list);
+            goto done;
+        }
+        r->results = results[i];
+        sw_results_alloc(&results[i]);
+        PyList_SET_ITEM(list, i, (PyObject *) r);
+    }
+
+done:
+    if (results != NULL) {
+        for (i = 0; i < n; i++) sw_results_dealloc(&results[i]);
+    }
+    PyMem_Free(results);
+    PyMem_Free(query_lens);
+    PyMem_Free(queries);
+    Py_DECREF(fast);
+    return list;
+}
+
+static PyObject *database_name(DatabaseObject *self, PyObject *arg) {
+    Py_ssize_t e = PyNumber_AsSsize_t(arg, PyExc_IndexError);
+    if (e == -1 && PyErr_Occurred()) return NULL;
+    if (!database_check(self)) return NULL;
+    if (e < 0 || (size_t) e >= sw_db_num_entries(self->db)) {
+        PyErr_SetString(PyExc_IndexError, "entry out of range");
+        return NULL;
+    }
+    return PyUnicode_FromString(sw_db_entry_name(self->db, (size_t) e));
+}
+
+static PyObject *database_close(DatabaseObject *self, PyObject *unused) {
+    (void) unused;
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "Database is being searched by another thread");
+        return NULL;
+    }
+    if (self->db != NULL) sw_db_close(self->db);
+    self->db = NULL;
+    Py_RETURN_NONE;
+}
+
+static Py_ssize_t database_len(DatabaseObject *self) {
+    return self->db != NULL ? (Py_ssize_t) sw_db_num_entries(self->db) : 0;
+}
+
+static PyObject *database_num_residues(DatabaseObject *self, void *closure) {
+    (void) closure;
+    return PyLong_FromSize_t(self->db != NULL ? sw_db_num_residues(self->db) : 0);
+}
+
+static PyMethodDef database_methods[] = {
+    {"search", (PyCFunction) (void (*)(void)) database_search, METH_VARARGS | METH_KEYWORDS,
+     "search(query, min_score=None, max_hits=0, prefilter=0, ungapped=0, word_score=11,\n"
+     "       stats=False, max_evalue=0, ends=False) -> Results\n\n"
+     "Aligns query (residues) against every entry. The options are those of\n"
+     "bin/smith_waterman; prefilter and ungapped turn the filters on, and ends\n"
+     "finds where each hit's best alignment ends (local alignment only)."},
+    {"search_batch", (PyCFunction) (void (*)(void)) database_search_batch,
+     METH_VARARGS | METH_KEYWORDS,
+     "search_batch(queries, **options) -> list of Results\n\n"
+     "Aligns several queries in one pass over the database, as sw_search_batch."},
+    {"name", (PyCFunction) database_name, METH_O, "name(entry) -> the entry's FASTA header"},
+    {"close", (PyCFunction) database_close, METH_NOARGS, "Frees the database"},
+    {NULL}
+};
+
+static PyGetSetDef database_getset[] = {
+    {"num_residues", (getter) database_num_residues, NULL, "Residues of all the entries", NULL},
+    {NULL}
+};
+
+static PySequenceMethods database_as_sequence = {.sq_length = (lenfunc) database_len};
+
+static PyTypeObject DatabaseType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "seqalign.Database",
+    .tp_basicsize = sizeof(DatabaseObject),
+    .tp_dealloc = (destructor) database_dealloc,
+    .tp_as_sequence = &database_as_sequence,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .tp_doc = "Database(path, matrix=None, match=None, mismatch=None, gap_open=-2,\n"
+              "         gap_extend=-1, mode='local', alphabet='protein')\n\n"
+              "A FASTA/FASTQ database loaded and packed for searching, with the\n"
+              "scoring of bin/smith_waterman (match 2, mismatch -2 unless matrix is given).",
+    .tp_methods = database_methods,
+    .tp_getset = database_getset,
+    .tp_init = (initproc) database_init,
+    .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef seqalign_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "seqalign",
+    .m_doc = "In-process Smith-Waterman database search",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_seqalign(void) {
+    if (PyType_Ready(&DatabaseType) < 0 || PyType_Ready(&ResultsType) < 0 ||
+        PyType_Ready(&HitFieldType) < 0) {
+        return NULL;
+    }
+
+    PyObject *numpy = PyImport_ImportModule("numpy");
+    if (numpy != NULL) {
+        np_asarray = PyObject_GetAttrString(numpy, "asarray");
+        Py_DECREF(numpy);
+        if (np_asarray == NULL) return NULL;
+    } else if (PyErr_ExceptionMatches(PyExc_ImportError)) {
+        PyErr_Clear();
+        np_asarray = Py_None;
+        Py_INCREF(Py_None);
+    } else {
+        return NULL;
+    }
+
+    PyObject *m = PyModule_Create(&seqalign_module);
+    if (m == NULL) return NULL;
+
+    Py_INCREF(&DatabaseType);
+    Py_INCREF(&ResultsType);
+    if (PyModule_AddObject(m, "Database", (PyObject *) &DatabaseType) < 0 ||
+        PyModule_AddObject(m, "Results", (PyObject *) &ResultsType) < 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
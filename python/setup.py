@@ -0,0 +1,18 @@
+"""
+Builds the seqalign extension against ../src/libalign.a, run `make python`
+from the top of the repository.
+"""
+
+from setuptools import setup, Extension
+
+seqalign = Extension(
+    'seqalign',
+    sources=['seqalign.c'],
+    include_dirs=['../src', '../libs'],
+    extra_objects=['../src/libalign.a', '../libs/string_buffer/libstrbuf.a'],
+    libraries=['z', 'm', 'pthread'],
+    extra_compile_args=['-std=c11', '-march=native', '-mavx2', '-fopenmp'],
+    extra_link_args=['-fopenmp'],
+)
+
+setup(name='seqalign', version='0.1', ext_modules=[seqalign])
@@ -20,18 +20,64 @@
 
 const size_t FULL_VECTOR_SIZE = 32 / sizeof(score_t);
 
+// Lanes of a vector of 32-bit scores
+#define WIDE_VECTOR_SIZE 8
+
+// Stands in for states that can't be reached, far enough from the smallest
+// score that adding penalties doesn't saturate (or wrap, with 32-bit scores)
+#define SCORE_UNREACHABLE (INT16_MIN / 2)
+#define WIDE_SCORE_UNREACHABLE (INT32_MIN / 2)
+
+// The kernels below are instantiated for 16 lanes of 16-bit scores or, when
+// wide, 8 lanes of 32-bit scores: the same 32 bytes per column of the row
+// buffers. 16-bit adds saturate, so a lane that overflows stays at INT16_MAX
+// and can be aligned again with 32-bit scores.
+static inline __attribute__((always_inline))
+__m256i v_set1(int32_t x, bool wide) {
+    return wide ? _mm256_set1_epi32(x) : _mm256_set1_epi16((int16_t) x);
+}
+
+static inline __attribute__((always_inline))
+__m256i v_adds(__m256i a, __m256i b, bool wide) {
+    return wide ? _mm256_add_epi32(a, b) : _mm256_adds_epi16(a, b);
+}
+
+static inline __attribute__((always_inline))
+__m256i v_max(__m256i a, __m256i b, bool wide) {
+    return wide ? _mm256_max_epi32(a, b) : _mm256_max_epi16(a, b);
+}
+
+// Score in one lane of a vector
+static inline int32_t v_lane(__m256i v, size_t lane, bool wide) {
+    alignas(32) int32_t wide_lanes[WIDE_VECTOR_SIZE];
+    alignas(32) int16_t lanes[16];
+    if (wide) {
+        _mm256_store_si256((__m256i *) wide_lanes, v);
+        return wide_lanes[lane];
+    }
+    _mm256_store_si256((__m256i *) lanes, v);
+    return lanes[lane];
+}
+
 /**
  * Looks up the score for aligning characters a and a batch of b's and determines if they match.
  *
- * @param scoring          Pointer to the scoring_t structure.
- * @param a_index          Index of sequence a character
+ * @param swap_scores      Scores of character a against each index, its row
+ *                         of the substitution matrix or of a query profile
  * @param b_indexes        DB indexes vector batch
+ * @param wide             Look up 8 lanes as 32-bit scores rather than 16
  * @return                 The scores for aligning a and the batch of b's.
  */
-inline static __m256i scoring_lookup(const scoring_t *scoring, int8_t a_index, const int8_t *b_indexes) {
-    // base address (the row) of the swap_scores for a_index
-    const int8_t *swap_scores = scoring->swap_scores[a_index];
+static inline __attribute__((always_inline))
+__m256i scoring_lookup(const int8_t *swap_scores, const int8_t *b_indexes, bool wide) {
     alignas(32) int16_t indexes[16];
+    alignas(32) int32_t wide_indexes[WIDE_VECTOR_SIZE];
+    if (wide) {
+        for (int32_t i = 0; i < WIDE_VECTOR_SIZE; i++) {
+            wide_indexes[i] = swap_scores[b_indexes[i]];
+        }
+        return _mm256_load_si256((__m256i *) wide_indexes);
+    }
     // tried loop unrolling here but doesn't really help
     // (-O3 probably auto unrolls)
     // also considered using avx instructions for lookup
@@ -43,27 +89,133 @@ inline static __m256i scoring_lookup(const scoring_t *scoring, int8_t a_index, c
     return _mm256_load_si256((__m256i *) indexes);
 }
 
-// Fill in traceback matrix for an ENTIRE BATCH
-void alignment_fill_matrices(aligner_t *aligner) {
+// Substitution scores of query residue a_index against a row of the batch.
+// b_row is the row widened to the lane width, only used for match/mismatch,
+// which is a comparison rather than a lookup.
+static inline __attribute__((always_inline))
+__m256i substitution_scores(const scoring_t *scoring, int8_t a_index,
+                            const int8_t *b_indexes, __m256i b_row,
+                            __m256i match, __m256i mismatch, bool match_mismatch, bool wide) {
+    if (match_mismatch) {
+        __m256i same = wide ? _mm256_cmpeq_epi32(b_row, _mm256_set1_epi32(a_index))
+                            : _mm256_cmpeq_epi16(b_row, _mm256_set1_epi16(a_index));
+        return _mm256_blendv_epi8(mismatch, match, same);
+    }
+    return scoring_lookup(scoring->swap_scores[a_index], b_indexes, wide);
+}
+
+// Scores of query position seq_i against a row of the batch, from the query
+// profile if there is one
+static inline __attribute__((always_inline))
+__m256i query_scores(const aligner_t *aligner, size_t seq_i,
+                     const int8_t *b_indexes, __m256i b_row,
+                     __m256i match, __m256i mismatch, bool match_mismatch, bool profile,
+                     bool wide) {
+    if (profile) return scoring_lookup(aligner->query_profile[seq_i], b_indexes, wide);
+    return substitution_scores(aligner->scoring, aligner->seq_a_indexes[seq_i], b_indexes,
+                               b_row, match, mismatch, match_mismatch, wide);
+}
+
+// b_indexes is 32-byte aligned, or 8 bytes past that for the second half of
+// a row in 32-bit lanes
+static inline __attribute__((always_inline))
+__m256i batch_row(const int8_t *b_indexes, bool match_mismatch, bool wide) {
+    if (!match_mismatch) return _mm256_setzero_si256();
+    if (wide) return _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) b_indexes));
+    return _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i *) b_indexes));
+}
+
+// Lane refilling: the entries of the lanes in mask have ended, write out
+// their best scores and start those lanes again from the zero boundary row.
+// Returns the best scores with those lanes cleared.
+static __m256i refill_lanes(aligner_t *aligner, uint16_t mask, __m256i max_scores_vec,
+                            size_t *cursor) {
+    alignas(32) score_t best[16];
+    alignas(32) int16_t keep[16];
+    size_t lane, i;
+
+    _mm256_store_si256((__m256i *) best, max_scores_vec);
+    for (lane = 0; lane < FULL_VECTOR_SIZE; lane++) {
+        keep[lane] = (mask >> lane) & 1 ? 0 : -1;
+        if (!keep[lane]) aligner->seq_b_scores[cursor[lane]++] = best[lane];
+    }
+
+    __m256i keep_v = _mm256_load_si256((__m256i *) keep);
+    for (i = 0; i < aligner->score_width; i++) {
+        __m256i *match = (__m256i *) (aligner->curr_match_scores + i * FULL_VECTOR_SIZE);
+        __m256i *gap_a = (__m256i *) (aligner->curr_gap_a_scores + i * FULL_VECTOR_SIZE);
+        __m256i *gap_b = (__m256i *) (aligner->curr_gap_b_scores + i * FULL_VECTOR_SIZE);
+        _mm256_store_si256(match, _mm256_and_si256(_mm256_load_si256(match), keep_v));
+        _mm256_store_si256(gap_a, _mm256_and_si256(_mm256_load_si256(gap_a), keep_v));
+        _mm256_store_si256(gap_b, _mm256_and_si256(_mm256_load_si256(gap_b), keep_v));
+    }
+    return _mm256_and_si256(max_scores_vec, keep_v);
+}
+
+// Keep the best cell of each lane in the row so far, and its 1-based query
+// position, with 32-bit scores
+static inline __attribute__((always_inline))
+void row_best_update(__m256i h, size_t seq_i, __m256i *row_best, __m256i *row_best_i) {
+    __m256i better = _mm256_cmpgt_epi32(h, *row_best);
+    *row_best = _mm256_max_epi32(h, *row_best);
+    *row_best_i = _mm256_blendv_epi8(*row_best_i, _mm256_set1_epi32((int32_t) (seq_i + 1)), better);
+}
+
+// Lanes whose best cell of row seq_j beats their best before the row, or
+// ties it nearer the start of the query, now end there. Ties go to the
+// first best cell in query order, then in sequence order, as the scalar
+// aligner finds them.
+static void row_best_ends(aligner_t *aligner, size_t first_lane, size_t seq_j,
+                          __m256i row_best, __m256i row_best_i, __m256i prev_best,
+                          __m256i *end_i) {
+    __m256i tie = _mm256_and_si256(_mm256_cmpeq_epi32(row_best, prev_best),
+                                   _mm256_cmpgt_epi32(*end_i, row_best_i));
+    tie = _mm256_and_si256(tie, _mm256_cmpgt_epi32(row_best, _mm256_setzero_si256()));
+    __m256i better = _mm256_or_si256(_mm256_cmpgt_epi32(row_best, prev_best), tie);
+    unsigned lanes = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(better));
+
+    *end_i = _mm256_blendv_epi8(*end_i, row_best_i, better);
+    for (; lanes != 0; lanes &= lanes - 1) {
+        size_t lane = (size_t) __builtin_ctz(lanes);
+        aligner->best_end_a[first_lane + lane] = (size_t) v_lane(row_best_i, lane, true);
+        aligner->best_end_b[first_lane + lane] = seq_j + 1;
+    }
+}
+
+// Fill in traceback matrix for an ENTIRE BATCH. Instantiated below for each
+// kind of scoring scheme so the flags are constants. With linear gaps
+// (gap_open 0) a gap state is always the best state next to it minus
+// gap_extend, so only the best state is kept. A query profile (PSSM) brings
+// its own scores for each query position, and maybe its own gap penalties
+// (position_gaps). When wide, 32-bit scores of the 8 lanes from first_lane
+// are written to wide_scores[first_lane, first_lane + 8) instead of
+// max_scores, lane refilling isn't supported and the ends of the best
+// alignments are kept if best_end_a is set.
+static inline __attribute__((always_inline))
+void fill_matrices(aligner_t *aligner, bool match_mismatch, bool affine,
+                   bool profile, bool position_gaps,
+                   bool wide, size_t first_lane, int32_t *wide_scores) {
     score_t *curr_match_scores = aligner->curr_match_scores;
     score_t *curr_gap_a_scores = aligner->curr_gap_a_scores;
     score_t *curr_gap_b_scores = aligner->curr_gap_b_scores;
-    int8_t * seq_a_indices = aligner->seq_a_indexes;
-    int8_t * seq_b_indices = aligner->seq_b_batch_indexes;
+    int8_t * seq_b_indices = aligner->seq_b_batch_indexes + first_lane;
     const scoring_t *scoring = aligner->scoring;
     size_t score_width = aligner->score_width;
     size_t score_height = aligner->score_height;
     size_t i, j;
 
-    __m256i gap_open_penalty = _mm256_set1_epi16(scoring->gap_extend + scoring->gap_open);
-    __m256i gap_extend_penalty = _mm256_set1_epi16(scoring->gap_extend);
+    __m256i gap_open_penalty = v_set1(scoring->gap_extend + scoring->gap_open, wide);
+    __m256i gap_extend_penalty = v_set1(scoring->gap_extend, wide);
     __m256i min_v = _mm256_setzero_si256();
+    __m256i match = v_set1(scoring->match, wide);
+    __m256i mismatch = v_set1(scoring->mismatch, wide);
 
     // null checks
     assert(curr_match_scores != NULL);
     assert(curr_gap_a_scores != NULL);
     assert(curr_gap_b_scores != NULL);
     assert(scoring != NULL);
+    assert(!wide || aligner->seq_b_ends == NULL);
 
     size_t seq_i, seq_j, len_i = score_width - 1, len_j = score_height - 1;
     size_t index, index_right;
@@ -71,6 +223,15 @@ void alignment_fill_matrices(aligner_t *aligner) {
     // reset match scores
     __m256i max_scores_vec = _mm256_setzero_si256();
 
+    // best cell of each lane in the current row, for the ends
+    bool ends = wide && aligner->best_end_a != NULL;
+    __m256i row_best = _mm256_setzero_si256(), row_best_i = _mm256_setzero_si256();
+    __m256i prev_best = _mm256_setzero_si256(), end_i = _mm256_setzero_si256();
+    if (ends) {
+        memset(aligner->best_end_a + first_lane, 0, sizeof(size_t) * WIDE_VECTOR_SIZE);
+        memset(aligner->best_end_b + first_lane, 0, sizeof(size_t) * WIDE_VECTOR_SIZE);
+    }
+
     // reset match and gap matrices
     // The shape is height x width x b
     // I need to reset first col and first row of each batch
@@ -85,7 +246,50 @@ void alignment_fill_matrices(aligner_t *aligner) {
     }
 
 
+    // next score of each lane when refilling lanes
+    size_t cursor[16];
+    if (aligner->seq_b_ends != NULL) {
+        memcpy(cursor, aligner->seq_b_lane_first, sizeof(cursor));
+    }
+
     for (seq_j = 0; seq_j < len_j; seq_j++) {
+        const int8_t *b_indexes = seq_b_indices + (seq_j * FULL_VECTOR_SIZE);
+        __m256i b_row = batch_row(b_indexes, match_mismatch, wide);
+
+        if (aligner->seq_b_ends != NULL && aligner->seq_b_ends[seq_j] != 0) {
+            max_scores_vec = refill_lanes(aligner, aligner->seq_b_ends[seq_j], max_scores_vec, cursor);
+        }
+        if (ends) {
+            if (seq_j > 0) row_best_ends(aligner, first_lane, seq_j - 1, row_best, row_best_i, prev_best, &end_i);
+            prev_best = max_scores_vec;
+            row_best = _mm256_setzero_si256();
+        }
+
+        if (!affine) {
+            // H[i][j] = MAX(0, H[i-1][j-1] + substitution_penalty, H[i-1][j] + gap_extend, H[i][j-1] + gap_extend)
+            __m256i score_left = _mm256_setzero_si256();
+            __m256i score_up_left = _mm256_setzero_si256();
+            index = FULL_VECTOR_SIZE;
+
+            for (seq_i = 0; seq_i < len_i; seq_i++) {
+                __m256i substitution_penalty = query_scores(aligner, seq_i, b_indexes, b_row, match, mismatch,
+                                                            match_mismatch, profile, wide);
+                __m256i score_up = _mm256_load_si256((__m256i *) (curr_match_scores + index));
+
+                __m256i score_curr = v_adds(score_up_left, substitution_penalty, wide);
+                score_curr = v_max(score_curr, v_adds(score_up, gap_open_penalty, wide), wide);
+                score_curr = v_max(score_curr, v_adds(score_left, gap_open_penalty, wide), wide);
+                score_curr = v_max(score_curr, min_v, wide);
+                max_scores_vec = v_max(score_curr, max_scores_vec, wide);
+                if (ends) row_best_update(score_curr, seq_i, &row_best, &row_best_i);
+
+                _mm256_store_si256((__m256i *) (curr_match_scores + index), score_curr);
+                score_up_left = score_up;
+                score_left = score_curr;
+                index += FULL_VECTOR_SIZE;
+            }
+            continue;
+        }
 
         // init these to zeros since we know the the left boundary is all zeros
         __m256i match_score_left = _mm256_setzero_si256();
@@ -104,8 +308,15 @@ void alignment_fill_matrices(aligner_t *aligner) {
 
 
             // substitution penalty
-            __m256i substitution_penalty = scoring_lookup(scoring, seq_a_indices[seq_i],
-                                                          seq_b_indices + (seq_j * FULL_VECTOR_SIZE));
+            __m256i substitution_penalty = query_scores(aligner, seq_i, b_indexes, b_row, match, mismatch,
+                                                        match_mismatch, profile, wide);
+
+            // gaps next to this query position
+            if (position_gaps) {
+                gap_open_penalty = v_set1(aligner->query_gap_extend[seq_i] +
+                                          aligner->query_gap_open[seq_i], wide);
+                gap_extend_penalty = v_set1(aligner->query_gap_extend[seq_i], wide);
+            }
 
 
             // Currently index has the values of the table from the previous iteration of seq_j (i.e. the row)
@@ -121,16 +332,17 @@ void alignment_fill_matrices(aligner_t *aligner) {
             //                                     min);
             // H[i][j] = MAX(0, H[i-1][j-1] + substitution_penalty, F[i-1][j-1] + substitution_penalty, E[i-1][j-1] + substitution_penalty)
 
-            __m256i match_score_curr = _mm256_add_epi16(match_score_up_left, substitution_penalty);
-            __m256i gap_a_score_val = _mm256_add_epi16(gap_a_score_up_left, substitution_penalty);
-            __m256i gap_b_score_val = _mm256_add_epi16(gap_b_score_up_left, substitution_penalty);
-            match_score_curr = _mm256_max_epi16(match_score_curr, gap_a_score_val);
-            match_score_curr = _mm256_max_epi16(match_score_curr, gap_b_score_val);
-            match_score_curr = _mm256_max_epi16(match_score_curr, min_v);
+            __m256i match_score_curr = v_adds(match_score_up_left, substitution_penalty, wide);
+            __m256i gap_a_score_val = v_adds(gap_a_score_up_left, substitution_penalty, wide);
+            __m256i gap_b_score_val = v_adds(gap_b_score_up_left, substitution_penalty, wide);
+            match_score_curr = v_max(match_score_curr, gap_a_score_val, wide);
+            match_score_curr = v_max(match_score_curr, gap_b_score_val, wide);
+            match_score_curr = v_max(match_score_curr, min_v, wide);
 
             // update best score
             // equal to: max_scores_vec[i] = (match_score[i] > max_scores_vec[i]) ? match_score[i] : max_scores_vec[i];
-            max_scores_vec = _mm256_max_epi16(match_score_curr, max_scores_vec);
+            max_scores_vec = v_max(match_score_curr, max_scores_vec, wide);
+            if (ends) row_best_update(match_score_curr, seq_i, &row_best, &row_best_i);
 
             // Update gap_a_scores[i][j]
             //          gap_a_scores[index]
@@ -139,12 +351,12 @@ void alignment_fill_matrices(aligner_t *aligner) {
             //                         gap_b_scores[index_up] + gap_open_penalty,
             //                         min);
             // E[i][j] = MAX( 0, H[i-1][j] + gap_open_penalty, E[i-1][j] + gap_extend_penalty , F[i-1][j] + gap_open_penalty )
-            __m256i match_score_val = _mm256_add_epi16(match_score_up, gap_open_penalty);
-            gap_a_score_val = _mm256_add_epi16(gap_a_score_up, gap_extend_penalty);
-            gap_b_score_val = _mm256_add_epi16(gap_b_score_up, gap_open_penalty);
-            __m256i gap_a_score_curr = _mm256_max_epi16(match_score_val, gap_a_score_val);
-            gap_a_score_curr = _mm256_max_epi16(gap_a_score_curr, gap_b_score_val);
-            gap_a_score_curr = _mm256_max_epi16(gap_a_score_curr, min_v);
+            __m256i match_score_val = v_adds(match_score_up, gap_open_penalty, wide);
+            gap_a_score_val = v_adds(gap_a_score_up, gap_extend_penalty, wide);
+            gap_b_score_val = v_adds(gap_b_score_up, gap_open_penalty, wide);
+            __m256i gap_a_score_curr = v_max(match_score_val, gap_a_score_val, wide);
+            gap_a_score_curr = v_max(gap_a_score_curr, gap_b_score_val, wide);
+            gap_a_score_curr = v_max(gap_a_score_curr, min_v, wide);
 
             // Update gap_b_scores[i][j]
             //          gap_b_scores[index]
@@ -153,12 +365,12 @@ void alignment_fill_matrices(aligner_t *aligner) {
             //                         gap_b_scores[index_left] + gap_extend_penalty,
             //                         min);
             // F[i][j] = MAX( 0, H[i][j-1] + gap_open_penalty, E[i][j-1] + gap_open_penalty , F[i][j-1] + gap_extend_penalty )
-            match_score_val = _mm256_add_epi16(match_score_left, gap_open_penalty);
-            gap_a_score_val = _mm256_add_epi16(gap_a_score_left, gap_open_penalty);
-            gap_b_score_val = _mm256_add_epi16(gap_b_score_left, gap_extend_penalty);
-            __m256i gap_b_score_curr = _mm256_max_epi16(match_score_val, gap_a_score_val);
-            gap_b_score_curr = _mm256_max_epi16(gap_b_score_curr, gap_b_score_val);
-            gap_b_score_curr = _mm256_max_epi16(gap_b_score_curr, min_v);
+            match_score_val = v_adds(match_score_left, gap_open_penalty, wide);
+            gap_a_score_val = v_adds(gap_a_score_left, gap_open_penalty, wide);
+            gap_b_score_val = v_adds(gap_b_score_left, gap_extend_penalty, wide);
+            __m256i gap_b_score_curr = v_max(match_score_val, gap_a_score_val, wide);
+            gap_b_score_curr = v_max(gap_b_score_curr, gap_b_score_val, wide);
+            gap_b_score_curr = v_max(gap_b_score_curr, min_v, wide);
 
             // Update the buffers
             _mm256_store_si256((__m256i *) (curr_match_scores + index), match_score_curr);
@@ -181,11 +393,311 @@ void alignment_fill_matrices(aligner_t *aligner) {
         }
     }
 
+    if (ends && len_j > 0) {
+        row_best_ends(aligner, first_lane, len_j - 1, row_best, row_best_i, prev_best, &end_i);
+    }
+
+    if (aligner->seq_b_ends != NULL && aligner->seq_b_ends[len_j] != 0) {
+        max_scores_vec = refill_lanes(aligner, aligner->seq_b_ends[len_j], max_scores_vec, cursor);
+    }
+
     // put back the max scores in this batch
+    if (wide) {
+        _mm256_storeu_si256((__m256i *) (wide_scores + first_lane), max_scores_vec);
+        return;
+    }
     assert(aligner->max_scores != NULL);
     _mm256_storeu_si256((__m256i *) (aligner->max_scores), max_scores_vec);
 }
 
+// Penalty of a gap of len residues
+static inline int32_t gap_penalty(const scoring_t *scoring, size_t len, bool wide) {
+    if (len == 0) return 0;
+    long penalty = scoring->gap_open + (long) scoring->gap_extend * (long) len;
+    return (int32_t) MAX2(penalty, wide ? WIDE_SCORE_UNREACHABLE : SCORE_UNREACHABLE);
+}
+
+bool alignment_global_fits16(const scoring_t *scoring, int min_score, int max_score,
+                             size_t len_a, size_t len_b) {
+    // Every cell is at least a gap down the first column and one along the
+    // row, plus a gap and a substitution, and at most the best substitution
+    // score at each position of the shorter sequence
+    double lowest = 3.0 * scoring->gap_open + (double) scoring->gap_extend * (double) (len_a + len_b + 1) +
+                    MIN2(min_score, 0);
+    double highest = (double) MAX2(max_score, 0) * (double) MIN2(len_a, len_b);
+    return lowest > SCORE_UNREACHABLE && highest < INT16_MAX;
+}
+
+// Global (Needleman-Wunsch) version of fill_matrices: no max with 0, the
+// first row and column hold gap penalties, and the score of each lane is
+// read off once its last row is filled. With free end gaps the first
+// row/column start at 0 and the alignment may end anywhere in the last row
+// (free_query_ends) or column (free_db_ends). Adds saturate, as global
+// scores of long sequences can be very negative: 16-bit scores of pairs
+// whose cells may leave (SCORE_UNREACHABLE, INT16_MAX) need the wide
+// instance. Profile gap penalties aren't used, the gap penalties of the
+// scoring scheme always are.
+static inline __attribute__((always_inline))
+void fill_matrices_global(aligner_t *aligner, bool match_mismatch, bool profile,
+                          bool wide, size_t first_lane, int32_t *wide_scores) {
+    score_t *curr_match_scores = aligner->curr_match_scores;
+    score_t *curr_gap_a_scores = aligner->curr_gap_a_scores;
+    score_t *curr_gap_b_scores = aligner->curr_gap_b_scores;
+    int8_t *seq_b_indices = aligner->seq_b_batch_indexes + first_lane;
+    const scoring_t *scoring = aligner->scoring;
+    const size_t *lens = aligner->seq_b_lens + first_lane;
+    bool free_query = scoring->free_query_ends, free_db = scoring->free_db_ends;
+    size_t len_i = aligner->score_width - 1, len_j = aligner->score_height - 1;
+    size_t lanes = wide ? MIN2(WIDE_VECTOR_SIZE, aligner->vector_size - first_lane)
+                        : aligner->vector_size;
+    size_t i, seq_i, seq_j, index, lane, next_end = SIZE_MAX;
+
+    __m256i gap_open_penalty = v_set1(scoring->gap_extend + scoring->gap_open, wide);
+    __m256i gap_extend_penalty = v_set1(scoring->gap_extend, wide);
+    __m256i unreachable = v_set1(wide ? WIDE_SCORE_UNREACHABLE : SCORE_UNREACHABLE, wide);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i match = v_set1(scoring->match, wide);
+    __m256i mismatch = v_set1(scoring->mismatch, wide);
+
+    assert(aligner->seq_b_lens != NULL);
+    assert(aligner->max_scores != NULL);
+
+    if (wide) memset(wide_scores + first_lane, 0, sizeof(int32_t) * lanes);
+    else memset(aligner->max_scores, 0, sizeof(score_t) * FULL_VECTOR_SIZE);
+    for (lane = 0; lane < lanes; lane++) next_end = MIN2(next_end, lens[lane]);
+
+    // Row 0: query residues against nothing, in gap_b
+    for (i = 1; i <= len_i; i++) {
+        size_t offset = i * FULL_VECTOR_SIZE;
+        __m256i gap = v_set1(gap_penalty(scoring, i, wide), wide);
+        _mm256_store_si256((__m256i *) (curr_match_scores + offset), free_query ? zero : unreachable);
+        _mm256_store_si256((__m256i *) (curr_gap_a_scores + offset), unreachable);
+        _mm256_store_si256((__m256i *) (curr_gap_b_scores + offset), free_query ? unreachable : gap);
+    }
+
+    // best of the three states in the last row/column of the rows filled
+    __m256i row_max = zero;
+    __m256i last_col = free_query ? zero : v_set1(gap_penalty(scoring, len_i, wide), wide);
+    __m256i col_max = last_col;
+
+    for (seq_j = 0; ; seq_j++) {
+        // rows [0, seq_j] are filled, read off the lanes that end here
+        if (seq_j == next_end) {
+            __m256i scores = free_query ? row_max : last_col;
+            if (free_db) scores = v_max(scores, col_max, wide);
+
+            next_end = SIZE_MAX;
+            for (lane = 0; lane < lanes; lane++) {
+                if (lens[lane] == seq_j) {
+                    if (wide) wide_scores[first_lane + lane] = v_lane(scores, lane, true);
+                    else aligner->max_scores[lane] = (score_t) v_lane(scores, lane, false);
+                } else if (lens[lane] > seq_j) {
+                    next_end = MIN2(next_end, lens[lane]);
+                }
+            }
+        }
+        if (seq_j == len_j) break;
+
+        const int8_t *b_indexes = seq_b_indices + (seq_j * FULL_VECTOR_SIZE);
+        __m256i b_row = batch_row(b_indexes, match_mismatch, wide);
+
+        // Column 0: database residues against nothing, in gap_a
+        __m256i gap = v_set1(gap_penalty(scoring, seq_j + 1, wide), wide);
+        __m256i gap_up = v_set1(gap_penalty(scoring, seq_j, wide), wide);
+        __m256i match_score_left = free_db ? zero : unreachable;
+        __m256i gap_a_score_left = free_db ? unreachable : gap;
+        __m256i gap_b_score_left = unreachable;
+        __m256i match_score_up_left = free_db || seq_j == 0 ? zero : unreachable;
+        __m256i gap_a_score_up_left = free_db || seq_j == 0 ? unreachable : gap_up;
+        __m256i gap_b_score_up_left = unreachable;
+        row_max = free_db ? zero : gap;
+
+        index = FULL_VECTOR_SIZE;
+
+        for (seq_i = 0; seq_i < len_i; seq_i++) {
+            __m256i substitution_penalty = query_scores(aligner, seq_i, b_indexes, b_row, match, mismatch,
+                                                        match_mismatch, profile, wide);
+
+            __m256i match_score_up = _mm256_load_si256((__m256i *) (curr_match_scores + index));
+            __m256i gap_a_score_up = _mm256_load_si256((__m256i *) (curr_gap_a_scores + index));
+            __m256i gap_b_score_up = _mm256_load_si256((__m256i *) (curr_gap_b_scores + index));
+
+            // H[i][j] = MAX(H[i-1][j-1], E[i-1][j-1], F[i-1][j-1]) + substitution_penalty
+            __m256i match_score_curr = v_max(match_score_up_left, gap_a_score_up_left, wide);
+            match_score_curr = v_max(match_score_curr, gap_b_score_up_left, wide);
+            match_score_curr = v_adds(match_score_curr, substitution_penalty, wide);
+
+            // E[i][j] = MAX(H[i-1][j] + gap_open_penalty, E[i-1][j] + gap_extend_penalty, F[i-1][j] + gap_open_penalty)
+            __m256i gap_a_score_curr = v_max(v_adds(match_score_up, gap_open_penalty, wide),
+                                             v_adds(gap_a_score_up, gap_extend_penalty, wide), wide);
+            gap_a_score_curr = v_max(gap_a_score_curr,
+                                     v_adds(gap_b_score_up, gap_open_penalty, wide), wide);
+
+            // F[i][j] = MAX(H[i][j-1] + gap_open_penalty, E[i][j-1] + gap_open_penalty, F[i][j-1] + gap_extend_penalty)
+            __m256i gap_b_score_curr = v_max(v_adds(match_score_left, gap_open_penalty, wide),
+                                             v_adds(gap_a_score_left, gap_open_penalty, wide), wide);
+            gap_b_score_curr = v_max(gap_b_score_curr,
+                                     v_adds(gap_b_score_left, gap_extend_penalty, wide), wide);
+
+            if (free_query) {
+                row_max = v_max(row_max, v_max(match_score_curr, gap_a_score_curr, wide), wide);
+                row_max = v_max(row_max, gap_b_score_curr, wide);
+            }
+
+            _mm256_store_si256((__m256i *) (curr_match_scores + index), match_score_curr);
+            _mm256_store_si256((__m256i *) (curr_gap_a_scores + index), gap_a_score_curr);
+            _mm256_store_si256((__m256i *) (curr_gap_b_scores + index), gap_b_score_curr);
+
+            match_score_up_left = match_score_up;
+            gap_a_score_up_left = gap_a_score_up;
+            gap_b_score_up_left = gap_b_score_up;
+
+            match_score_left = match_score_curr;
+            gap_a_score_left = gap_a_score_curr;
+            gap_b_score_left = gap_b_score_curr;
+
+            index += FULL_VECTOR_SIZE;
+        }
+
+        last_col = v_max(v_max(match_score_left, gap_a_score_left, wide), gap_b_score_left, wide);
+        if (free_db) col_max = v_max(col_max, last_col, wide);
+    }
+}
+
+// Each kind of scoring scheme is instantiated with 16-bit scores, and with
+// 32-bit scores (name##_32) that run the lanes of the batch 8 at a time
+#define FILL_MATRICES_KERNEL(name, match_mismatch, affine, profile, position_gaps)      \
+    static void name(aligner_t *aligner) {                                              \
+        fill_matrices(aligner, match_mismatch, affine, profile, position_gaps,          \
+                      false, 0, NULL);                                                  \
+    }                                                                                   \
+    static void name##_32(aligner_t *aligner, int32_t *max_scores) {                    \
+        for (size_t lane = 0; lane < aligner->vector_size; lane += WIDE_VECTOR_SIZE) {  \
+            fill_matrices(aligner, match_mismatch, affine, profile, position_gaps,      \
+                          true, lane, max_scores);                                      \
+        }                                                                               \
+    }
+
+#define FILL_MATRICES_GLOBAL_KERNEL(name, match_mismatch, profile)                      \
+    static void name(aligner_t *aligner) {                                              \
+        fill_matrices_global(aligner, match_mismatch, profile, false, 0, NULL);         \
+    }                                                                                   \
+    static void name##_32(aligner_t *aligner, int32_t *max_scores) {                    \
+        for (size_t lane = 0; lane < aligner->vector_size; lane += WIDE_VECTOR_SIZE) {  \
+            fill_matrices_global(aligner, match_mismatch, profile, true, lane, max_scores); \
+        }                                                                               \
+    }
+
+FILL_MATRICES_KERNEL(fill_matrices_lookup_linear, false, false, false, false)
+FILL_MATRICES_KERNEL(fill_matrices_lookup_affine, false, true, false, false)
+FILL_MATRICES_KERNEL(fill_matrices_match_linear, true, false, false, false)
+FILL_MATRICES_KERNEL(fill_matrices_match_affine, true, true, false, false)
+FILL_MATRICES_KERNEL(fill_matrices_profile_linear, false, false, true, false)
+FILL_MATRICES_KERNEL(fill_matrices_profile_affine, false, true, true, false)
+// gap penalties that vary along the query always take the affine path
+FILL_MATRICES_KERNEL(fill_matrices_profile_gaps, false, true, true, true)
+FILL_MATRICES_GLOBAL_KERNEL(fill_matrices_global_lookup, false, false)
+FILL_MATRICES_GLOBAL_KERNEL(fill_matrices_global_match, true, false)
+FILL_MATRICES_GLOBAL_KERNEL(fill_matrices_global_profile, false, true)
+
+enum {
+    KERNEL_LOOKUP_LINEAR, KERNEL_LOOKUP_AFFINE, KERNEL_MATCH_LINEAR, KERNEL_MATCH_AFFINE,
+    KERNEL_PROFILE_LINEAR, KERNEL_PROFILE_AFFINE, KERNEL_PROFILE_GAPS,
+    KERNEL_GLOBAL_LOOKUP, KERNEL_GLOBAL_MATCH, KERNEL_GLOBAL_PROFILE, NUM_KERNELS
+};
+
+static void (*const kernels[NUM_KERNELS])(aligner_t *) = {
+    fill_matrices_lookup_linear, fill_matrices_lookup_affine,
+    fill_matrices_match_linear, fill_matrices_match_affine,
+    fill_matrices_profile_linear, fill_matrices_profile_affine, fill_matrices_profile_gaps,
+    fill_matrices_global_lookup, fill_matrices_global_match, fill_matrices_global_profile
+};
+
+static void (*const kernels_32[NUM_KERNELS])(aligner_t *, int32_t *) = {
+    fill_matrices_lookup_linear_32, fill_matrices_lookup_affine_32,
+    fill_matrices_match_linear_32, fill_matrices_match_affine_32,
+    fill_matrices_profile_linear_32, fill_matrices_profile_affine_32, fill_matrices_profile_gaps_32,
+    fill_matrices_global_lookup_32, fill_matrices_global_match_32, fill_matrices_global_profile_32
+};
+
+// Instantiation for the aligner's scoring scheme and query
+static size_t kernel_index(const aligner_t *aligner) {
+    const scoring_t *scoring = aligner->scoring;
+    bool affine = !scoring_linear_gaps(scoring);
+
+    if (scoring->mode == ALIGN_GLOBAL) {
+        if (aligner->query_profile != NULL) return KERNEL_GLOBAL_PROFILE;
+        return scoring->use_match_mismatch ? KERNEL_GLOBAL_MATCH : KERNEL_GLOBAL_LOOKUP;
+    }
+    if (aligner->query_gap_open != NULL) return KERNEL_PROFILE_GAPS;
+    if (aligner->query_profile != NULL) return affine ? KERNEL_PROFILE_AFFINE : KERNEL_PROFILE_LINEAR;
+    if (scoring->use_match_mismatch) return affine ? KERNEL_MATCH_AFFINE : KERNEL_MATCH_LINEAR;
+    return affine ? KERNEL_LOOKUP_AFFINE : KERNEL_LOOKUP_LINEAR;
+}
+
+void alignment_fill_matrices(aligner_t *aligner) {
+    kernels[kernel_index(aligner)](aligner);
+}
+
+void alignment_fill_matrices32(aligner_t *aligner, int32_t *max_scores) {
+    kernels_32[kernel_index(aligner)](aligner, max_scores);
+}
+
+// Best ungapped local alignment score of each lane of a batch. Only one
+// diagonal state per cell is kept, so this is much cheaper than
+// alignment_fill_matrices and is used to filter sequences before it.
+static inline __attribute__((always_inline))
+void ungapped_scores(aligner_t *aligner, bool match_mismatch) {
+    score_t *curr_scores = aligner->curr_match_scores;
+    int8_t *seq_a_indices = aligner->seq_a_indexes;
+    int8_t *seq_b_indices = aligner->seq_b_batch_indexes;
+    const scoring_t *scoring = aligner->scoring;
+    size_t len_i = aligner->score_width - 1, len_j = aligner->score_height - 1;
+    size_t i, seq_i, seq_j, index;
+
+    __m256i min_v = _mm256_setzero_si256();
+    __m256i match = _mm256_set1_epi16((int16_t) scoring->match);
+    __m256i mismatch = _mm256_set1_epi16((int16_t) scoring->mismatch);
+    __m256i max_scores_vec = _mm256_setzero_si256();
+
+    assert(curr_scores != NULL);
+    assert(scoring != NULL);
+
+    for (i = 0; i < aligner->score_width; i++) {
+        _mm256_store_si256((__m256i *) (curr_scores + i * FULL_VECTOR_SIZE), min_v);
+    }
+
+    for (seq_j = 0; seq_j < len_j; seq_j++) {
+        const int8_t *b_indexes = seq_b_indices + (seq_j * FULL_VECTOR_SIZE);
+        __m256i b_row = batch_row(b_indexes, match_mismatch, false);
+        __m256i score_up_left = _mm256_setzero_si256();
+        index = FULL_VECTOR_SIZE;
+
+        for (seq_i = 0; seq_i < len_i; seq_i++) {
+            __m256i substitution_penalty = substitution_scores(scoring, seq_a_indices[seq_i], b_indexes,
+                                                               b_row, match, mismatch, match_mismatch, false);
+
+            // U[i][j] = MAX(0, U[i-1][j-1] + substitution_penalty)
+            __m256i score_up = _mm256_load_si256((__m256i *) (curr_scores + index));
+            __m256i score_curr = _mm256_adds_epi16(score_up_left, substitution_penalty);
+            score_curr = _mm256_max_epi16(score_curr, min_v);
+            max_scores_vec = _mm256_max_epi16(score_curr, max_scores_vec);
+
+            _mm256_store_si256((__m256i *) (curr_scores + index), score_curr);
+            score_up_left = score_up;
+            index += FULL_VECTOR_SIZE;
+        }
+    }
+
+    assert(aligner->max_scores != NULL);
+    _mm256_storeu_si256((__m256i *) (aligner->max_scores), max_scores_vec);
+}
+
+void alignment_ungapped_scores(aligner_t *aligner) {
+    if (aligner->scoring->use_match_mismatch) ungapped_scores(aligner, true);
+    else ungapped_scores(aligner, false);
+}
+
 // Note: len_b must be same for all batches
 void aligner_update(aligner_t *aligner,
                     char *seq_a_str, char **seq_b_str_batch,
@@ -221,6 +733,13 @@ aligner_t *aligner_create(char *seq_a_str, char **seq_b_str_batch,
     aligner->vector_size = vector_size;
     aligner->score_width = len_a + 1; // for col of all zeros
     aligner->score_height = len_b + 1; // for the row of all zeros
+    aligner->seq_b_lens = NULL;
+    aligner->query_profile = NULL;
+    aligner->query_gap_open = aligner->query_gap_extend = NULL;
+    aligner->seq_b_ends = NULL;
+    aligner->seq_b_lane_first = NULL;
+    aligner->seq_b_scores = NULL;
+    aligner->best_end_a = aligner->best_end_b = NULL;
 
     aligner->max_scores = aligned_alloc(32, sizeof(score_t) * vector_size);
     // arrays are traversed row by row so h_mem makes sense
@@ -233,6 +752,7 @@ aligner_t *aligner_create(char *seq_a_str, char **seq_b_str_batch,
 }
 
 void aligner_destroy(aligner_t *aligner) {
+    free(aligner->max_scores);
     free(aligner->curr_match_scores);
     free(aligner->curr_gap_a_scores);
     free(aligner->curr_gap_b_scores);
@@ -30,6 +30,23 @@ typedef struct
     char *seq_a_fasta, **seq_b_fasta_batch;  // Pointers to the FASTA names
     size_t vector_size;                // the batch size of b
     size_t score_width, score_height; // Matrix dimensions: width = len(seq_a)+1, height = len(seq_b_batch[i])+1
+    const size_t *seq_b_lens;          // length of each sequence of the batch, for global alignment
+    // Position-specific scores of seq_a (a PSSM), used instead of scoring's
+    // substitution scores when set, and its gap penalties if it has them
+    const int8_t (*query_profile)[32];
+    const score_t *query_gap_open, *query_gap_extend;
+    // Lane refilling, local alignment only: each lane runs several entries
+    // back to back. Bit l of seq_b_ends[j] is set when the entry in lane l
+    // ends before row j (j in [1, len_b]): its best score is written to
+    // seq_b_scores[k] for the next k of lane l, starting from
+    // seq_b_lane_first[l], and the lane starts again from zero.
+    const uint16_t *seq_b_ends;
+    const size_t *seq_b_lane_first;
+    score_t *seq_b_scores;
+    // Where the best local alignment of each lane ends, with the 32-bit
+    // kernel if set: its last residue is query position end_a[l] and
+    // position end_b[l] of the lane's sequence (1-based, 0 if it scores 0)
+    size_t *best_end_a, *best_end_b;
     score_t *curr_match_scores;        // Match/mismatch array from current row
     score_t *curr_gap_a_scores;        //
     score_t *curr_gap_b_scores;        //
@@ -67,8 +84,43 @@ aligner_t * aligner_create(char *seq_a_str, char **seq_b_str_batch,
                    size_t len_a, size_t len_b, size_t vector_size,
                    const scoring_t *scoring);
 
+/**
+ * Best score of the query against each sequence of the batch, into
+ * max_scores: the best local alignment, or with scoring->mode ALIGN_GLOBAL
+ * the best global alignment (seq_b_lens must be set). With query_profile
+ * set, query position i scores query_profile[i], and if query_gap_open is
+ * set its gaps cost query_gap_open[i] and query_gap_extend[i] (local
+ * alignment only).
+ */
 void alignment_fill_matrices(aligner_t * aligner);
 
+/**
+ * alignment_fill_matrices with 32-bit scores, 8 lanes at a time, for pairs
+ * whose scores don't fit in 16 bits: local scores the 16-bit kernel left at
+ * INT16_MAX, where its adds saturate, and global alignments that
+ * alignment_global_fits16 rejects. Lane refilling isn't supported. For local
+ * alignment it also sets best_end_a and best_end_b if they are set, ties
+ * going to the first best cell in query order, then in sequence order.
+ *
+ * @param max_scores   Set to the best score of each lane, room for 16
+ */
+void alignment_fill_matrices32(aligner_t * aligner, int32_t *max_scores);
+
+/**
+ * Whether the 16-bit global kernel is exact for a pair of sequences of these
+ * lengths, whose substitution scores are in [min_score, max_score]: none of
+ * its cells can saturate. Otherwise use alignment_fill_matrices32.
+ */
+bool alignment_global_fits16(const scoring_t *scoring, int min_score, int max_score,
+                             size_t len_a, size_t len_b);
+
+/**
+ * Computes only the best ungapped local alignment score of each sequence in
+ * the batch into max_scores. Never more than the alignment_fill_matrices
+ * score, so it can be used to discard sequences cheaply.
+ */
+void alignment_ungapped_scores(aligner_t * aligner);
+
 /**
  * Frees internal buffers used in the aligner.
  */
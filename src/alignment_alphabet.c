@@ -0,0 +1,127 @@
+/*
+ alignment_alphabet.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <x86intrin.h>
+
+#include "alignment_alphabet.h"
+
+static bool in_alphabet(const scoring_t *scoring, char c) {
+    switch (scoring->alphabet) {
+        case ALPHABET_DNA:
+            return strchr("ACGTacgt", c) != NULL;
+        case ALPHABET_RNA:
+            return strchr("ACGUacgu", c) != NULL;
+        case ALPHABET_PROTEIN:
+        default:
+            // any letter is allowed when there is no substitution matrix, but
+            // not '*', which pads batches and must never match
+            if (scoring->use_match_mismatch) return isalpha((unsigned char) c);
+            return (isalpha((unsigned char) c) || c == '*') &&
+                   get_swap_bit(scoring, letters_to_index(c), letters_to_index(c));
+    }
+}
+
+void alphabet_init(alphabet_t *alphabet, const scoring_t *scoring,
+                   enum UnknownResidues unknown) {
+    int c;
+
+    alphabet->type = scoring->alphabet;
+    alphabet->unknown = unknown;
+    alphabet->unknown_index = letters_to_index(scoring->alphabet == ALPHABET_PROTEIN ? 'X' : 'N');
+
+    int8_t unknown_value = unknown == UNKNOWN_TO_X ? alphabet->unknown_index
+                         : unknown == UNKNOWN_SKIP ? ALPHABET_SPACE
+                         : ALPHABET_UNKNOWN;
+
+    for (c = 0; c < 128; c++) {
+        if (c <= ' ') alphabet->map[c] = ALPHABET_SPACE;
+        else if (in_alphabet(scoring, (char) c)) alphabet->map[c] = letters_to_index((char) c);
+        else alphabet->map[c] = unknown_value;
+    }
+
+    for (c = 0; c < 128; c++) {
+        alphabet->tables[c >> 4][c & 15] = alphabet->map[c];
+        alphabet->tables[c >> 4][(c & 15) + 16] = alphabet->map[c];
+    }
+}
+
+const char *alphabet_name(enum SeqAlphabet type) {
+    switch (type) {
+        case ALPHABET_DNA: return "DNA";
+        case ALPHABET_RNA: return "RNA";
+        case ALPHABET_PROTEIN:
+        default: return "protein";
+    }
+}
+
+static int unknown_residue(const alphabet_t *alphabet, char c) {
+    if (isprint((unsigned char) c)) {
+        fprintf(stderr, "Error: '%c' is not a %s residue\n", c, alphabet_name(alphabet->type));
+    } else {
+        fprintf(stderr, "Error: byte 0x%02x is not a %s residue\n", (unsigned char) c,
+                alphabet_name(alphabet->type));
+    }
+    return -1;
+}
+
+int alphabet_translate(const alphabet_t *alphabet, const char *seq, size_t len,
+                       int8_t *out, size_t stride, size_t *num_residues) {
+    alignas(32) int8_t block_indexes[32];
+    size_t i = 0, k, n = 0;
+
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i space = _mm256_set1_epi8(ALPHABET_SPACE);
+    const __m256i unknown = _mm256_set1_epi8(ALPHABET_UNKNOWN);
+    __m256i tables[8];
+
+    // alphabet may live in a struct that is only 16 byte aligned
+    for (int h = 0; h < 8; h++) {
+        tables[h] = _mm256_loadu_si256((const __m256i *) alphabet->tables[h]);
+    }
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *) (seq + i));
+        __m256i lo = _mm256_and_si256(c, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(c, 4), nibble);
+
+        // look up each byte in the table of its high nibble, bytes >= 128
+        // don't match any table
+        __m256i idx = unknown;
+        for (int h = 0; h < 8; h++) {
+            idx = _mm256_blendv_epi8(idx, _mm256_shuffle_epi8(tables[h], lo),
+                                     _mm256_cmpeq_epi8(hi, _mm256_set1_epi8((char) h)));
+        }
+
+        uint32_t bad = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(idx, unknown));
+        if (bad != 0) return unknown_residue(alphabet, seq[i + (size_t) __builtin_ctz(bad)]);
+
+        _mm256_store_si256((__m256i *) block_indexes, idx);
+
+        uint32_t keep = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(idx, space));
+        if (keep == UINT32_MAX) {
+            for (k = 0; k < 32; k++) out[(n + k) * stride] = block_indexes[k];
+            n += 32;
+        } else {
+            while (keep != 0) {
+                out[n++ * stride] = block_indexes[__builtin_ctz(keep)];
+                keep &= keep - 1;
+            }
+        }
+    }
+
+    for (; i < len; i++) {
+        unsigned char c = (unsigned char) seq[i];
+        int8_t idx = c < 128 ? alphabet->map[c] : ALPHABET_UNKNOWN;
+        if (idx == ALPHABET_UNKNOWN) return unknown_residue(alphabet, seq[i]);
+        if (idx != ALPHABET_SPACE) out[n++ * stride] = idx;
+    }
+
+    *num_residues = n;
+    return 0;
+}
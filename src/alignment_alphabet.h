@@ -0,0 +1,65 @@
+/*
+ alignment_alphabet.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_ALPHABET_HEADER_SEEN
+#define ALIGNMENT_ALPHABET_HEADER_SEEN
+
+#include <stddef.h>
+#include "alignment_scoring.h"
+
+// Values in alphabet_t.map that aren't residue indexes
+#define ALPHABET_SPACE    -1  // dropped: newlines, spaces and skipped residues
+#define ALPHABET_UNKNOWN  -2  // an error
+
+// Byte to residue index translation, with the unknown residue policy
+// already applied. Indexes are those of letters_to_index, so they can be
+// looked up in scoring_t.swap_scores.
+typedef struct
+{
+    enum SeqAlphabet type;
+    enum UnknownResidues unknown;
+    int8_t unknown_index;      // index of X, or N for nucleotides
+    int8_t map[128];           // bytes >= 128 are always unknown
+    // map[16 * h + l] at tables[h][l] and tables[h][l + 16], for pshufb
+    int8_t tables[8][32];
+} alphabet_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Builds the translation of a scoring scheme's alphabet.
+ *
+ * @param alphabet   Struct to fill in
+ * @param scoring    Scoring scheme, for its alphabet and substitution matrix
+ * @param unknown    What to do with residues outside the alphabet
+ */
+void alphabet_init(alphabet_t *alphabet, const scoring_t *scoring,
+                   enum UnknownResidues unknown);
+
+/**
+ * Translates a sequence to residue indexes, 32 bytes at a time.
+ *
+ * @param alphabet       Alphabet from alphabet_init
+ * @param seq            Sequence, may contain newlines
+ * @param len            Number of bytes in seq
+ * @param out            Residue i is written to out[i * stride]
+ * @param stride         Distance between consecutive residues of out
+ * @param num_residues   Set to the number of residues written
+ * @return               0 on success, -1 on an unknown residue with
+ *                       UNKNOWN_ERROR (after printing an error)
+ */
+int alphabet_translate(const alphabet_t *alphabet, const char *seq, size_t len,
+                       int8_t *out, size_t stride, size_t *num_residues);
+
+const char *alphabet_name(enum SeqAlphabet type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_ALPHABET_HEADER_SEEN */
@@ -0,0 +1,345 @@
+/*
+ alignment_cache.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "alignment_cache.h"
+#include "alignment_macros.h"
+
+// File layout: a header, a hash table of slots and a data region of records
+// packed one after another. A record is a cache_record_t followed by the
+// query and the hits, each padded to 8 bytes. When the data region or the
+// table fills up, the least recently used records are dropped until half is
+// free and the rest are moved down to close the gaps.
+#define CACHE_MAGIC "seq-align cache"
+#define CACHE_VERSION 3
+#define CACHE_MIN_SIZE (1UL << 20)
+// Bytes of data region per slot of the table
+#define CACHE_BYTES_PER_SLOT 1024
+
+typedef struct
+{
+    char magic[16];
+    uint64_t version, size, num_slots;
+    uint64_t hit_bytes;   // sizeof(sw_hit_t), records hold hits as they are
+    uint64_t clock;       // stamp of the last lookup or addition
+    uint64_t data_used;   // bytes of the data region taken by records
+    uint64_t num_used;    // slots in use
+    uint64_t dirty;       // set while records are being added or moved
+} cache_header_t;
+
+typedef struct
+{
+    uint64_t key, context;
+    uint64_t last_used;
+    uint64_t offset;   // of the record from the start of the file, 0 if the slot is empty
+    uint64_t bytes;
+} cache_slot_t;
+
+typedef struct
+{
+    uint64_t query_len, num_hits;
+    uint64_t num_entries, num_filtered;
+} cache_record_t;
+
+#define PAD8(n) (((n) + 7) & ~(size_t) 7)
+#define HASH_FIELD(h, field) ((h) = cache_hash(&(field), sizeof(field), (h)))
+
+static cache_header_t *cache_header(const sw_cache_t *cache) {
+    return (cache_header_t *) cache->data;
+}
+
+static cache_slot_t *cache_slots(const sw_cache_t *cache) {
+    return (cache_slot_t *) (cache->data + PAD8(sizeof(cache_header_t)));
+}
+
+static size_t data_start(size_t num_slots) {
+    return PAD8(sizeof(cache_header_t)) + num_slots * sizeof(cache_slot_t);
+}
+
+static size_t record_bytes(size_t query_len, size_t num_hits) {
+    return sizeof(cache_record_t) + PAD8(query_len) + num_hits * sizeof(sw_hit_t);
+}
+
+// MurmurHash64A
+uint64_t cache_hash(const void *data, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const uint8_t *bytes = data;
+    uint64_t h = seed ^ (len * m), k;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&k, bytes + i, 8);
+        k *= m;
+        k ^= k >> 47;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    if (i < len) {
+        k = 0;
+        memcpy(&k, bytes + i, len - i);
+        h ^= k;
+        h *= m;
+    }
+
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    return h;
+}
+
+uint64_t cache_context(const scoring_t *scoring, const sw_search_opts_t *opts,
+                       uint64_t db_fingerprint) {
+    uint64_t h = db_fingerprint;
+
+    // field by field, the padding between them is undefined
+    HASH_FIELD(h, scoring->gap_open);
+    HASH_FIELD(h, scoring->gap_extend);
+    HASH_FIELD(h, scoring->use_match_mismatch);
+    HASH_FIELD(h, scoring->match);
+    HASH_FIELD(h, scoring->mismatch);
+    HASH_FIELD(h, scoring->case_sensitive);
+    HASH_FIELD(h, scoring->mode);
+    HASH_FIELD(h, scoring->free_query_ends);
+    HASH_FIELD(h, scoring->free_db_ends);
+    HASH_FIELD(h, scoring->alphabet);
+    HASH_FIELD(h, scoring->query_unknown);
+    HASH_FIELD(h, scoring->db_unknown);
+    HASH_FIELD(h, scoring->swap_set);
+    HASH_FIELD(h, scoring->swap_scores);
+
+    HASH_FIELD(h, opts->min_score);
+    HASH_FIELD(h, opts->max_hits);
+    HASH_FIELD(h, opts->exact);
+    HASH_FIELD(h, opts->prefilter_score);
+    HASH_FIELD(h, opts->prefilter_word_score);
+    HASH_FIELD(h, opts->ungapped_cutoff);
+    HASH_FIELD(h, opts->stats);
+    HASH_FIELD(h, opts->max_evalue);
+    HASH_FIELD(h, opts->db_residues);
+    HASH_FIELD(h, opts->db_entries);
+    HASH_FIELD(h, opts->ends);
+    return h;
+}
+
+static void cache_reset(sw_cache_t *cache) {
+    cache_header_t *header = cache_header(cache);
+    size_t num_slots = (cache->size - PAD8(sizeof(cache_header_t))) /
+                       (CACHE_BYTES_PER_SLOT + sizeof(cache_slot_t));
+
+    memset(cache->data, 0, data_start(num_slots));
+    memcpy(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header->version = CACHE_VERSION;
+    header->size = cache->size;
+    header->num_slots = num_slots;
+    header->hit_bytes = sizeof(sw_hit_t);
+}
+
+static bool cache_valid(const sw_cache_t *cache) {
+    const cache_header_t *header = cache_header(cache);
+    return memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+           header->version == CACHE_VERSION && header->size == cache->size &&
+           header->hit_bytes == sizeof(sw_hit_t) && header->num_slots > 0 &&
+           data_start(header->num_slots) + header->data_used <= cache->size &&
+           header->dirty == 0;
+}
+
+int cache_open(sw_cache_t *cache, const char *path, size_t size, uint64_t context) {
+    struct flock lock = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+    struct stat st;
+
+    memset(cache, 0, sizeof(sw_cache_t));
+    cache->fd = -1;
+
+    if (size < CACHE_MIN_SIZE) {
+        fprintf(stderr, "Error: cache %s must be at least 1M\n", path);
+        return -1;
+    }
+
+    if ((cache->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(cache->fd, &st) != 0) {
+        fprintf(stderr, "Error: couldn't open cache %s\n", path);
+        cache_close(cache);
+        return -1;
+    }
+    if (fcntl(cache->fd, F_SETLK, &lock) != 0) {
+        fprintf(stderr, "Error: cache %s is in use by another process\n", path);
+        cache_close(cache);
+        return -1;
+    }
+    // a cache of another size starts again rather than being resized
+    if ((size_t) st.st_size != size && (ftruncate(cache->fd, 0) != 0 || ftruncate(cache->fd, (off_t) size) != 0)) {
+        fprintf(stderr, "Error: couldn't resize cache %s\n", path);
+        cache_close(cache);
+        return -1;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: couldn't map cache %s\n", path);
+        cache_close(cache);
+        return -1;
+    }
+
+    cache->data = data;
+    cache->size = size;
+    cache->context = context;
+    if (!cache_valid(cache)) cache_reset(cache);
+    return 0;
+}
+
+void cache_close(sw_cache_t *cache) {
+    if (cache->data != NULL) munmap(cache->data, cache->size);
+    if (cache->fd >= 0) close(cache->fd);
+    cache->data = NULL;
+    cache->fd = -1;
+}
+
+// Slot of a query, or the empty slot it would go in
+static cache_slot_t *find_slot(const sw_cache_t *cache, uint64_t key,
+                               const char *query, size_t query_len) {
+    const cache_header_t *header = cache_header(cache);
+    cache_slot_t *slots = cache_slots(cache);
+    size_t i = key % header->num_slots;
+
+    // the table is never more than half full, so there is always an empty slot
+    for (;; i = (i + 1) % header->num_slots) {
+        cache_slot_t *slot = &slots[i];
+        if (slot->offset == 0) return slot;
+
+        const cache_record_t *record = (const cache_record_t *) (cache->data + slot->offset);
+        if (slot->key == key && slot->context == cache->context &&
+            record->query_len == query_len &&
+            memcmp(record + 1, query, query_len) == 0) {
+            return slot;
+        }
+    }
+}
+
+static int slot_cmp_newest_first(const void *a, const void *b) {
+    const cache_slot_t *x = a, *y = b;
+    return x->last_used > y->last_used ? -1 : (x->last_used < y->last_used);
+}
+
+static int slot_cmp_offset(const void *a, const void *b) {
+    const cache_slot_t *x = a, *y = b;
+    return x->offset < y->offset ? -1 : (x->offset > y->offset);
+}
+
+// Drop the least recently used records until at most half of the data
+// region and a quarter of the table are in use, then pack the rest together
+static void cache_evict(sw_cache_t *cache) {
+    cache_header_t *header = cache_header(cache);
+    cache_slot_t *slots = cache_slots(cache);
+    size_t start = data_start(header->num_slots);
+    size_t data_bytes = cache->size - start;
+    size_t i, n = 0, keep = 0, kept_bytes = 0;
+
+    cache_slot_t *used = malloc(sizeof(cache_slot_t) * MAX2(header->num_used, 1));
+    for (i = 0; i < header->num_slots; i++) {
+        if (slots[i].offset != 0) used[n++] = slots[i];
+    }
+
+    qsort(used, n, sizeof(cache_slot_t), slot_cmp_newest_first);
+    while (keep < n && keep < header->num_slots / 4 &&
+           kept_bytes + used[keep].bytes <= data_bytes / 2) {
+        kept_bytes += used[keep++].bytes;
+    }
+
+    // moving records down in offset order never overwrites one still to move
+    qsort(used, keep, sizeof(cache_slot_t), slot_cmp_offset);
+    memset(slots, 0, sizeof(cache_slot_t) * header->num_slots);
+    header->data_used = 0;
+
+    for (i = 0; i < keep; i++) {
+        cache_slot_t slot = used[i];
+        const cache_record_t *record = (const cache_record_t *) (cache->data + slot.offset);
+        memmove(cache->data + start + header->data_used, record, slot.bytes);
+        slot.offset = start + header->data_used;
+        header->data_used += slot.bytes;
+
+        record = (const cache_record_t *) (cache->data + slot.offset);
+        *find_slot(cache, slot.key, (const char *) (record + 1), record->query_len) = slot;
+    }
+
+    header->num_used = keep;
+    free(used);
+}
+
+bool cache_get(sw_cache_t *cache, const char *query, size_t query_len, sw_results_t *results) {
+    cache_header_t *header = cache_header(cache);
+    uint64_t key = cache_hash(query, query_len, cache->context);
+    cache_slot_t *slot = find_slot(cache, key, query, query_len);
+
+    cache->lookups++;
+    if (slot->offset == 0) return false;
+
+    const cache_record_t *record = (const cache_record_t *) (cache->data + slot->offset);
+    const uint8_t *hits = (const uint8_t *) (record + 1) + PAD8(query_len);
+
+    if (results->capacity < record->num_hits) {
+        results->capacity = record->num_hits;
+        results->hits = realloc(results->hits, sizeof(sw_hit_t) * results->capacity);
+    }
+    if (record->num_hits > 0) memcpy(results->hits, hits, sizeof(sw_hit_t) * record->num_hits);
+    results->num_hits = record->num_hits;
+    results->num_entries = record->num_entries;
+    results->num_filtered = record->num_filtered;
+    results->kernel_time = results->prefilter_time = 0;
+    results->lane_rows = results->padding_rows = 0;
+
+    slot->last_used = ++header->clock;
+    cache->hits++;
+    return true;
+}
+
+void cache_put(sw_cache_t *cache, const char *query, size_t query_len,
+               const sw_results_t *results) {
+    cache_header_t *header = cache_header(cache);
+    size_t start = data_start(header->num_slots);
+    size_t bytes = record_bytes(query_len, results->num_hits);
+    uint64_t key = cache_hash(query, query_len, cache->context);
+
+    if (bytes > (cache->size - start) / 2) return;
+    if (find_slot(cache, key, query, query_len)->offset != 0) return;
+
+    // a crash part way through leaves the file marked, and it is emptied
+    // when next opened
+    header->dirty = 1;
+
+    if (start + header->data_used + bytes > cache->size ||
+        header->num_used + 1 > header->num_slots / 2) {
+        cache_evict(cache);
+    }
+
+    cache_record_t *record = (cache_record_t *) (cache->data + start + header->data_used);
+    record->query_len = query_len;
+    record->num_hits = results->num_hits;
+    record->num_entries = results->num_entries;
+    record->num_filtered = results->num_filtered;
+    memcpy(record + 1, query, query_len);
+    if (results->num_hits > 0) {
+        memcpy((uint8_t *) (record + 1) + PAD8(query_len), results->hits,
+               sizeof(sw_hit_t) * results->num_hits);
+    }
+
+    cache_slot_t *slot = find_slot(cache, key, query, query_len);
+    slot->key = key;
+    slot->context = cache->context;
+    slot->last_used = ++header->clock;
+    slot->offset = start + header->data_used;
+    slot->bytes = bytes;
+
+    header->data_used += bytes;
+    header->num_used++;
+    header->dirty = 0;
+}
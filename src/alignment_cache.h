@@ -0,0 +1,89 @@
+/*
+ alignment_cache.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_CACHE_HEADER_SEEN
+#define ALIGNMENT_CACHE_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include "alignment_search.h"
+
+// Results of earlier searches kept in a memory-mapped file, so that a query
+// searched again against the same database with the same scoring and options
+// is answered without a scan. Entries are looked up by a hash of the query
+// residues within a context: a hash of the scoring scheme, the search
+// options and the database's contents (sw_db_fingerprint). The file has a
+// fixed size, and when it fills up the least recently used results are
+// dropped.
+//
+// One process uses a cache file at a time, it is locked while open.
+
+#define CACHE_DEFAULT_SIZE (64UL << 20)
+
+typedef struct
+{
+    int fd;
+    uint8_t *data;      // the mapped file
+    size_t size;
+    uint64_t context;   // of the searches being looked up and added
+    size_t lookups, hits;
+} sw_cache_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 64-bit hash of a block of memory, for keys and fingerprints rather than
+ * anything cryptographic.
+ */
+uint64_t cache_hash(const void *data, size_t len, uint64_t seed);
+
+/**
+ * Hash of everything but the query that the results of a search depend on.
+ *
+ * @param scoring          Scoring scheme of the database handle
+ * @param opts             Search options
+ * @param db_fingerprint   From sw_db_fingerprint
+ */
+uint64_t cache_context(const scoring_t *scoring, const sw_search_opts_t *opts,
+                       uint64_t db_fingerprint);
+
+/**
+ * Opens a cache file, creating it if need be. A file of another size, or
+ * one left half written by a crash, is emptied.
+ *
+ * @param cache     Struct to fill in, close with cache_close
+ * @param path      Cache file
+ * @param size      Size of the file in bytes, e.g. CACHE_DEFAULT_SIZE
+ * @param context   From cache_context
+ * @return          0 on success, -1 if it couldn't be opened or is in use
+ */
+int cache_open(sw_cache_t *cache, const char *path, size_t size, uint64_t context);
+
+void cache_close(sw_cache_t *cache);
+
+/**
+ * Looks up the results of a query.
+ *
+ * @param results   Results struct (from sw_results_alloc), overwritten on a hit
+ * @return          true if they were found
+ */
+bool cache_get(sw_cache_t *cache, const char *query, size_t query_len, sw_results_t *results);
+
+/**
+ * Adds the results of a query, dropping the least recently used results to
+ * make room. Results too big to fit half of the file aren't kept.
+ */
+void cache_put(sw_cache_t *cache, const char *query, size_t query_len,
+               const sw_results_t *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_CACHE_HEADER_SEEN */
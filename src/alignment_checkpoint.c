@@ -0,0 +1,178 @@
+/*
+ alignment_checkpoint.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "alignment_checkpoint.h"
+
+// File format, one "<key> <value>" per line:
+//
+//     seq-align checkpoint 3
+//     query <path>
+//     database <path>
+//     context <hex>
+//     entries <n>
+//     fingerprint <hex>
+//     output <bytes>
+//     filtered <n>
+//     time <kernel seconds> <prefilter seconds>
+#define CHECKPOINT_MAGIC "seq-align checkpoint 3"
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(const void *data, size_t len, uint64_t h) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++) h = (h ^ bytes[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+#define HASH_FIELD(h, field) ((h) = hash_bytes(&(field), sizeof(field), (h)))
+
+uint64_t checkpoint_context(const scoring_t *scoring, const sw_search_opts_t *opts,
+                            const char *query, size_t query_len, const pssm_t *pssm) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    // field by field, the padding between them is undefined
+    HASH_FIELD(h, scoring->gap_open);
+    HASH_FIELD(h, scoring->gap_extend);
+    HASH_FIELD(h, scoring->use_match_mismatch);
+    HASH_FIELD(h, scoring->match);
+    HASH_FIELD(h, scoring->mismatch);
+    HASH_FIELD(h, scoring->case_sensitive);
+    HASH_FIELD(h, scoring->mode);
+    HASH_FIELD(h, scoring->free_query_ends);
+    HASH_FIELD(h, scoring->free_db_ends);
+    HASH_FIELD(h, scoring->alphabet);
+    HASH_FIELD(h, scoring->query_unknown);
+    HASH_FIELD(h, scoring->db_unknown);
+    HASH_FIELD(h, scoring->swap_set);
+    HASH_FIELD(h, scoring->swap_scores);
+
+    HASH_FIELD(h, opts->min_score);
+    HASH_FIELD(h, opts->max_hits);
+    HASH_FIELD(h, opts->exact);
+    HASH_FIELD(h, opts->prefilter_score);
+    HASH_FIELD(h, opts->prefilter_word_score);
+    HASH_FIELD(h, opts->ungapped_cutoff);
+    HASH_FIELD(h, opts->stats);
+    HASH_FIELD(h, opts->max_evalue);
+    HASH_FIELD(h, opts->db_residues);
+    HASH_FIELD(h, opts->db_entries);
+    HASH_FIELD(h, opts->ends);
+
+    if (pssm != NULL) {
+        h = hash_bytes(pssm->residues, pssm->len, h);
+        h = hash_bytes(pssm->scores, pssm->len * sizeof(pssm->scores[0]), h);
+        if (pssm->gap_open != NULL) {
+            h = hash_bytes(pssm->gap_open, pssm->len * sizeof(score_t), h);
+            h = hash_bytes(pssm->gap_extend, pssm->len * sizeof(score_t), h);
+        }
+    } else {
+        h = hash_bytes(query, query_len, h);
+    }
+    return h;
+}
+
+int checkpoint_save(const char *path, const char *query_path, const char *db_path,
+                    uint64_t context, const sw_checkpoint_t *checkpoint) {
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp_path = malloc(tmp_len);
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error: couldn't write checkpoint %s\n", tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    fprintf(file, CHECKPOINT_MAGIC "\nquery %s\ndatabase %s\ncontext %016" PRIx64 "\n",
+            query_path, db_path, context);
+    fprintf(file, "entries %zu\nfingerprint %016" PRIx64 "\noutput %li\nfiltered %zu\ntime %.17g %.17g\n",
+            checkpoint->entries, checkpoint->fingerprint, checkpoint->output_offset,
+            checkpoint->filtered, checkpoint->kernel_time, checkpoint->prefilter_time);
+
+    // the new file must be complete on disk before it replaces the old one
+    bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(tmp_path, path) == 0;
+
+    if (!ok) {
+        fprintf(stderr, "Error: couldn't write checkpoint %s\n", path);
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    return ok ? 0 : -1;
+}
+
+// The value of a "<key> <value>" line, or NULL if it has another key
+static char *line_value(char *line, const char *key) {
+    size_t key_len = strlen(key);
+    line[strcspn(line, "\r\n")] = '\0';
+    return strncmp(line, key, key_len) == 0 && line[key_len] == ' ' ? line + key_len + 1 : NULL;
+}
+
+int checkpoint_load(const char *path, const char *query_path, const char *db_path,
+                    uint64_t context, sw_checkpoint_t *checkpoint) {
+    char *line = NULL, *value;
+    size_t line_cap = 0;
+    uint64_t saved_context = 0;
+    int fields = 0;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        if (errno == ENOENT) return 1;
+        fprintf(stderr, "Error: couldn't read checkpoint %s\n", path);
+        return -1;
+    }
+
+    memset(checkpoint, 0, sizeof(sw_checkpoint_t));
+
+    if (getline(&line, &line_cap, file) > 0 && strncmp(line, CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC)) == 0) {
+        while (getline(&line, &line_cap, file) > 0) {
+            if ((value = line_value(line, "query")) != NULL) {
+                if (strcmp(value, query_path) != 0) break;
+            } else if ((value = line_value(line, "database")) != NULL) {
+                if (strcmp(value, db_path) != 0) break;
+            } else if ((value = line_value(line, "context")) != NULL) {
+                if (sscanf(value, "%" SCNx64, &saved_context) != 1) break;
+            } else if ((value = line_value(line, "entries")) != NULL) {
+                if (sscanf(value, "%zu", &checkpoint->entries) != 1) break;
+            } else if ((value = line_value(line, "fingerprint")) != NULL) {
+                if (sscanf(value, "%" SCNx64, &checkpoint->fingerprint) != 1) break;
+            } else if ((value = line_value(line, "output")) != NULL) {
+                if (sscanf(value, "%li", &checkpoint->output_offset) != 1) break;
+            } else if ((value = line_value(line, "filtered")) != NULL) {
+                if (sscanf(value, "%zu", &checkpoint->filtered) != 1) break;
+            } else if ((value = line_value(line, "time")) != NULL) {
+                if (sscanf(value, "%lf %lf", &checkpoint->kernel_time,
+                           &checkpoint->prefilter_time) != 2) break;
+            } else {
+                break;
+            }
+            fields++;
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    if (fields != 8) {
+        fprintf(stderr, "Error: checkpoint %s is invalid or not of a search of %s against %s\n",
+                path, query_path, db_path);
+        return -1;
+    }
+    if (saved_context != context) {
+        fprintf(stderr, "Error: checkpoint %s is of a search with another query, scoring scheme "
+                        "or options, start a new scan\n", path);
+        return -1;
+    }
+    return 0;
+}
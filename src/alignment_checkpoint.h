@@ -0,0 +1,74 @@
+/*
+ alignment_checkpoint.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_CHECKPOINT_HEADER_SEEN
+#define ALIGNMENT_CHECKPOINT_HEADER_SEEN
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "alignment_search.h"
+#include "alignment_pssm.h"
+
+// Progress of a query's scan through a database, so that an interrupted
+// search can carry on from the last chunk whose hits were printed rather
+// than from the start. Hits are printed a chunk at a time, so nothing else
+// of a chunk has to be kept. The checkpoint of a finished scan lets a
+// database that has grown since, by appending entries, be searched again
+// for just the new entries.
+typedef struct
+{
+    size_t entries;             // database entries searched and their hits printed
+    uint64_t fingerprint;       // sw_db_fingerprint of those entries
+    long output_offset;         // bytes of output by then, -1 if it isn't a file
+    // Totals of the summary printed at the end
+    size_t filtered;
+    double kernel_time, prefilter_time;
+} sw_checkpoint_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Hash of what the hits of a search depend on besides the database: the
+ * scoring scheme, the search options and the query.
+ *
+ * @param query       Query residues, unless searching with a PSSM
+ * @param query_len
+ * @param pssm        PSSM query, or NULL
+ */
+uint64_t checkpoint_context(const scoring_t *scoring, const sw_search_opts_t *opts,
+                            const char *query, size_t query_len, const pssm_t *pssm);
+
+/**
+ * Writes a checkpoint, replacing the file in one step so that a crash leaves
+ * either the old checkpoint or the new one.
+ *
+ * @param path         Checkpoint file
+ * @param query_path   Query and database of the search, checked on resume
+ * @param db_path
+ * @param context      From checkpoint_context, checked on resume
+ * @return             0 on success, -1 if it couldn't be written
+ */
+int checkpoint_save(const char *path, const char *query_path, const char *db_path,
+                    uint64_t context, const sw_checkpoint_t *checkpoint);
+
+/**
+ * Reads a checkpoint written by checkpoint_save for the same search.
+ *
+ * @return   0 if it was read, 1 if there is no checkpoint file yet, -1 if it
+ *           is invalid or belongs to another query, database, scoring scheme
+ *           or options
+ */
+int checkpoint_load(const char *path, const char *query_path, const char *db_path,
+                    uint64_t context, sw_checkpoint_t *checkpoint);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_CHECKPOINT_HEADER_SEEN */
@@ -18,6 +18,8 @@
 #include <limits.h> // INT_MIN
 #include <stdarg.h> // for va_list
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <omp.h>
 
 #include "seq_file/seq_file.h"
@@ -26,6 +28,13 @@
 
 #include "alignment_scoring_load.h"
 #include "alignment_scoring.h"
+#include "alignment_prefilter.h"
+#include "alignment_reader.h"
+#include "alignment_checkpoint.h"
+#include "alignment_stream.h"
+#include "alignment_perf.h"
+#include "alignment_trace.h"
+#include "alignment_macros.h"
 
 char parse_entire_score_t(char *str, score_t *result) {
     if (sizeof(score_t) == sizeof(int)) {
@@ -95,6 +104,36 @@ char parse_entire_uint(char *str, unsigned int *result) {
     }
 }
 
+// A number of bytes, optionally with a K, M or G suffix
+static char parse_entire_size(char *str, size_t *result) {
+    char *strtol_last_char_ptr = str;
+    unsigned long long tmp = strtoull(str, &strtol_last_char_ptr, 10);
+    int shift = 0;
+    if (strtol_last_char_ptr == str || str[0] == '-') return 0;
+    switch (*strtol_last_char_ptr) {
+        case 'k': case 'K': shift = 10; strtol_last_char_ptr++; break;
+        case 'm': case 'M': shift = 20; strtol_last_char_ptr++; break;
+        case 'g': case 'G': shift = 30; strtol_last_char_ptr++; break;
+    }
+    if (*strtol_last_char_ptr != '\0' || tmp > (SIZE_MAX >> shift)) return 0;
+    *result = (size_t) tmp << shift;
+    return 1;
+}
+
+char parse_entire_double(char *str, double *result) {
+    size_t len = strlen(str);
+
+    char *strtod_last_char_ptr = str;
+    double tmp = strtod(str, &strtod_last_char_ptr);
+
+    if (len == 0 || strtod_last_char_ptr != str + len) {
+        return 0;
+    } else {
+        *result = tmp;
+        return 1;
+    }
+}
+
 static void print_usage(enum SeqAlignCmdType cmd_type, score_t defaults[4],
                         const char *cmdstr, const char *errfmt, ...)
 __attribute__((format(printf, 4, 5)))
@@ -112,14 +151,23 @@ static void print_usage(enum SeqAlignCmdType cmd_type, score_t defaults[4],
         if (errfmt[strlen(errfmt) - 1] != '\n') fprintf(stderr, "\n");
     }
 
-    fprintf(stderr, "usage: %s [OPTIONS] [seq1 seq2]\n", cmdstr);
+    if (cmd_type == SEQ_ALIGN_SERVER_CMD) {
+        fprintf(stderr, "usage: %s [OPTIONS] --database <db> (--socket <path> | --stdin)\n", cmdstr);
 
-    fprintf(stderr,
-            "  %s optimal %s alignment (maximises score).  \n"
-            "  Takes a pair of sequences on the command line, or can read from a\n"
-            "  file and from sequence piped in.  Can read gzip files, FASTA and FASTQ.\n\n",
-            cmd_type == SEQ_ALIGN_SW_CMD ? "Smith-Waterman" : "Needleman-Wunsch",
-            cmd_type == SEQ_ALIGN_SW_CMD ? "local" : "global");
+        fprintf(stderr,
+                "  Smith-Waterman local alignment server.  Loads the database once and\n"
+                "  answers queries, one per line as '<id> <sequence>', read from a unix\n"
+                "  socket or STDIN.  Queries that arrive together share a database pass.\n\n");
+    } else {
+        fprintf(stderr, "usage: %s [OPTIONS] [seq1 seq2]\n", cmdstr);
+
+        fprintf(stderr,
+                "  %s optimal %s alignment (maximises score).  \n"
+                "  Takes a pair of sequences on the command line, or can read from a\n"
+                "  file and from sequence piped in.  Can read gzip files, FASTA and FASTQ.\n\n",
+                cmd_type == SEQ_ALIGN_SW_CMD ? "Smith-Waterman" : "Needleman-Wunsch",
+                cmd_type == SEQ_ALIGN_SW_CMD ? "local" : "global");
+    }
 
     fprintf(stderr,
             "  OPTIONS:\n"
@@ -141,17 +189,92 @@ static void print_usage(enum SeqAlignCmdType cmd_type, score_t defaults[4],
     if (cmd_type == SEQ_ALIGN_SW_CMD) {
         // SW specific
         fprintf(stderr,
-                "    --minscore <score>   Minimum required score\n"
-                "                         [default: match * MAX(0.2 * length, 2)]\n"
+                "    --minscore <score>   Minimum required score [default: 0]\n"
                 "\n"
                 "    --printseq           Print sequences before local alignments\n");
+    } else if (cmd_type == SEQ_ALIGN_SERVER_CMD) {
+        // Server specific
+        fprintf(stderr,
+                "    --database <file>    Database to load and search\n"
+                "    --socket <path>      Listen for queries on a unix domain socket\n"
+                "    --minscore <score>   Only report hits scoring at least this [default: 0]\n"
+                "    --maxhits <n>        Only report the best <n> hits per query [default: all]\n"
+                "\n"
+                "    --database <file>    may be given several times, to search them all\n"
+                "    --shards <n>         Split each database between <n> worker processes\n"
+                "    --worker <path>      Also search the shard of a server on this socket,\n"
+                "                         <path>@<e> numbers its entries after the first <e>\n"
+                "    --shard <i>/<n>      Only load shard <i> (0-based) of <n> of the database\n"
+                "    --dbsize <r>,<e>     Residues and entries of the whole database, for\n"
+                "                         the E-values of a shard\n"
+                "\n"
+                "    --cache <file>       Keep the results of queries in <file>, answering\n"
+                "                         queries searched before without a scan\n"
+                "    --cache-size <size>  Size of the --cache file, e.g. 1G, the least\n"
+                "                         recently used results make room [default: 64M]\n"
+                "\n");
     }
 
+    fprintf(stderr,
+            "    --prefilter <score>  Only align entries sharing a seed word with the query\n"
+            "                         whose ungapped extension scores at least <score>\n"
+            "    --wordscore <score>  Min score of a prefilter seed word [default: %i]\n"
+            "    --ungapped <score>   Only align entries whose best ungapped alignment\n"
+            "                         scores at least <score>\n"
+            "    --exact              Align every entry, even with --prefilter/--ungapped\n"
+            "\n", PREFILTER_WORD_SCORE);
+
+    fprintf(stderr,
+            "    --global             Needleman-Wunsch global alignment of the whole query\n"
+            "                         and database entry\n"
+            "    --freeends <seq>     Semi-global: gaps at the ends of the query, the entry\n"
+            "                         or both are free: query, db or both (implies --global)\n"
+            "\n");
+
+    if (cmd_type == SEQ_ALIGN_SW_CMD) {
+        fprintf(stderr,
+                "    --pssm               The query file is a position-specific scoring matrix\n"
+                "                         (see src/alignment_pssm.h for the format)\n"
+                "\n"
+                "    --checkpoint <file>  Save the progress of the database scan every so often\n"
+                "    --resume             Carry on from the --checkpoint file if there is one,\n"
+                "                         appending to the output (redirect it with >>)\n"
+                "    --max-memory <size>  Memory for the database chunks being searched, e.g.\n"
+                "                         512M [default: 1G]\n"
+                "    --stream             Read each database entry a segment at a time, for\n"
+                "                         entries too long to fit in memory (local alignment)\n"
+                "\n"
+                "    --allvsall <file>    Align every sequence of <file> against every later\n"
+                "                         one, printing '<i> <j> <score>' for each pair\n"
+                "                         scoring at least --minscore\n"
+                "\n");
+    }
+
+    fprintf(stderr,
+            "    --alphabet <a>       Residues of the sequences: protein, dna or rna\n"
+            "                         [default: protein, those in the substitution matrix]\n"
+            "    --unknown <action>   Residues outside the alphabet are turned into X (N for\n"
+            "                         nucleotides), or skipped, or an error: x, skip or error\n"
+            "                         [default: x]\n"
+            "\n");
+
+    fprintf(stderr,
+            "    --stats              Print the bit score and E-value of each hit\n"
+            "    --evalue <E>         Only report hits with an E-value of at most <E>\n"
+            "                         (implies --stats)\n"
+            "    --ends               Print where each hit's best alignment ends, in the\n"
+            "                         query and the entry (1-based, local alignment only)\n"
+            "\n");
+
     fprintf(stderr,
             "    --printmatrices      Print dynamic programming matrices\n"
             "    --printfasta         Print fasta header lines\n"
             "    --pretty             Print with a descriptor line\n"
             "    --colour             Print with colour\n"
+            "    --perf               Report hardware performance counters (cycles, IPC,\n"
+            "                         cache and branch misses) of each stage on exit\n"
+            "    --trace <file>       Write a timeline of what each thread did to <file>,\n"
+            "                         as Chrome trace-event JSON\n"
             "\n");
 
     printf(
@@ -169,9 +292,17 @@ static void print_usage(enum SeqAlignCmdType cmd_type, score_t defaults[4],
 }
 
 void cmdline_free(cmdline_t *cmd) {
+    free(cmd->databases);
+    free(cmd->workers);
+    free(cmd->worker_offsets);
     free(cmd);
 }
 
+static void append_path(char ***paths, size_t *num_paths, char *path) {
+    *paths = realloc(*paths, sizeof(char *) * (*num_paths + 1));
+    (*paths)[(*num_paths)++] = path;
+}
+
 #define usage(fmt,...) print_usage(cmd_type,defaults,argv[0],fmt, ##__VA_ARGS__)
 
 cmdline_t *cmdline_new(int argc, char **argv, scoring_t *scoring,
@@ -216,9 +347,33 @@ cmdline_t *cmdline_new(int argc, char **argv, scoring_t *scoring,
                 cmd->print_pretty = true;
             } else if (strcasecmp(argv[argi], "--colour") == 0) {
                 cmd->print_colour = true;
+            } else if (strcasecmp(argv[argi], "--exact") == 0) {
+                cmd->exact = true;
+            } else if (strcasecmp(argv[argi], "--stats") == 0) {
+                cmd->stats = true;
+            } else if (strcasecmp(argv[argi], "--ends") == 0) {
+                cmd->ends = true;
+            } else if (strcasecmp(argv[argi], "--global") == 0) {
+                scoring->mode = ALIGN_GLOBAL;
+            } else if (strcasecmp(argv[argi], "--pssm") == 0) {
+                if (cmd_type != SEQ_ALIGN_SW_CMD)
+                    usage("--pssm only valid with smith_waterman");
+                cmd->query_pssm = true;
+            } else if (strcasecmp(argv[argi], "--resume") == 0) {
+                if (cmd_type != SEQ_ALIGN_SW_CMD)
+                    usage("--resume only valid with smith_waterman");
+                cmd->resume = true;
+            } else if (strcasecmp(argv[argi], "--stream") == 0) {
+                if (cmd_type != SEQ_ALIGN_SW_CMD)
+                    usage("--stream only valid with smith_waterman");
+                cmd->stream = true;
+            } else if (strcasecmp(argv[argi], "--perf") == 0) {
+                cmd->perf = true;
             } else if (strcasecmp(argv[argi], "--stdin") == 0) {
                 // Similar to --file argument below
-                cmdline_set_files(cmd, "", NULL);
+                // (the server reads queries rather than a file from STDIN)
+                if (cmd_type != SEQ_ALIGN_SERVER_CMD)
+                    cmdline_set_files(cmd, "", NULL);
                 cmd->interactive = true;
             } else if (argi == argc - 1) {
                 // All the remaining options take an extra argument
@@ -264,6 +419,187 @@ cmdline_t *cmdline_new(int argc, char **argv, scoring_t *scoring,
                           argv[argi+1]);
                 }
 
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--minscore") == 0) {
+                if (!parse_entire_score_t(argv[argi + 1], &cmd->min_score)) {
+                    usage("Invalid --minscore argument ('%s') must be an int", argv[argi+1]);
+                }
+
+                cmd->min_score_set = true;
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--maxhits") == 0) {
+                if (cmd_type != SEQ_ALIGN_SERVER_CMD)
+                    usage("--maxhits only valid with the server");
+                if (!parse_entire_uint(argv[argi + 1], &cmd->max_hits_per_alignment)) {
+                    usage("Invalid --maxhits argument ('%s') must be a positive int",
+                          argv[argi+1]);
+                }
+
+                cmd->max_hits_per_alignment_set = true;
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--prefilter") == 0) {
+                if (!parse_entire_score_t(argv[argi + 1], &cmd->prefilter_score)) {
+                    usage("Invalid --prefilter argument ('%s') must be an int", argv[argi+1]);
+                }
+
+                cmd->prefilter_set = true;
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--ungapped") == 0) {
+                if (!parse_entire_score_t(argv[argi + 1], &cmd->ungapped_cutoff)) {
+                    usage("Invalid --ungapped argument ('%s') must be an int", argv[argi+1]);
+                }
+
+                cmd->ungapped_cutoff_set = true;
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--wordscore") == 0) {
+                if (!parse_entire_int(argv[argi + 1], &cmd->prefilter_word_score)) {
+                    usage("Invalid --wordscore argument ('%s') must be an int", argv[argi+1]);
+                }
+
+                cmd->prefilter_word_score_set = true;
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--evalue") == 0) {
+                if (!parse_entire_double(argv[argi + 1], &cmd->max_evalue) ||
+                    !(cmd->max_evalue > 0)) {
+                    usage("Invalid --evalue argument ('%s') must be a positive number",
+                          argv[argi+1]);
+                }
+
+                cmd->stats = true;
+                cmd->max_evalue_set = true;
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--freeends") == 0) {
+                if (strcasecmp(argv[argi + 1], "query") == 0) {
+                    scoring->free_query_ends = true;
+                } else if (strcasecmp(argv[argi + 1], "db") == 0) {
+                    scoring->free_db_ends = true;
+                } else if (strcasecmp(argv[argi + 1], "both") == 0) {
+                    scoring->free_query_ends = scoring->free_db_ends = true;
+                } else {
+                    usage("Invalid --freeends argument ('%s') must be query, db or both",
+                          argv[argi+1]);
+                }
+
+                scoring->mode = ALIGN_GLOBAL;
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--alphabet") == 0) {
+                if (strcasecmp(argv[argi + 1], "protein") == 0) {
+                    scoring->alphabet = ALPHABET_PROTEIN;
+                } else if (strcasecmp(argv[argi + 1], "dna") == 0) {
+                    scoring->alphabet = ALPHABET_DNA;
+                } else if (strcasecmp(argv[argi + 1], "rna") == 0) {
+                    scoring->alphabet = ALPHABET_RNA;
+                } else {
+                    usage("Invalid --alphabet argument ('%s') must be protein, dna or rna",
+                          argv[argi+1]);
+                }
+
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--unknown") == 0) {
+                if (strcasecmp(argv[argi + 1], "x") == 0) {
+                    scoring->query_unknown = scoring->db_unknown = UNKNOWN_TO_X;
+                } else if (strcasecmp(argv[argi + 1], "skip") == 0) {
+                    scoring->query_unknown = scoring->db_unknown = UNKNOWN_SKIP;
+                } else if (strcasecmp(argv[argi + 1], "error") == 0) {
+                    scoring->query_unknown = scoring->db_unknown = UNKNOWN_ERROR;
+                } else {
+                    usage("Invalid --unknown argument ('%s') must be x, skip or error",
+                          argv[argi+1]);
+                }
+
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--database") == 0) {
+                if (cmd_type != SEQ_ALIGN_SERVER_CMD)
+                    usage("--database only valid with the server");
+                if (cmd->file_path2 == NULL) cmd->file_path2 = argv[argi + 1];
+                append_path(&cmd->databases, &cmd->num_databases, argv[argi + 1]);
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--shards") == 0) {
+                if (cmd_type != SEQ_ALIGN_SERVER_CMD)
+                    usage("--shards only valid with the server");
+                if (!parse_entire_uint(argv[argi + 1], &cmd->num_shards) || cmd->num_shards == 0) {
+                    usage("Invalid --shards argument ('%s') must be a positive int",
+                          argv[argi+1]);
+                }
+
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--shard") == 0) {
+                int end = 0;
+                if (cmd_type != SEQ_ALIGN_SERVER_CMD)
+                    usage("--shard only valid with the server");
+                if (sscanf(argv[argi + 1], "%u/%u%n", &cmd->shard, &cmd->shard_of, &end) != 2 ||
+                    argv[argi + 1][end] != '\0' || cmd->shard >= cmd->shard_of) {
+                    usage("Invalid --shard argument ('%s') must be <i>/<n> with i < n",
+                          argv[argi+1]);
+                }
+
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--worker") == 0) {
+                char *at = strrchr(argv[argi + 1], '@');
+                size_t offset = 0;
+                int end = 0;
+                if (cmd_type != SEQ_ALIGN_SERVER_CMD)
+                    usage("--worker only valid with the server");
+                if (at != NULL) {
+                    if (sscanf(at + 1, "%zu%n", &offset, &end) != 1 || at[1 + end] != '\0')
+                        usage("Invalid --worker argument ('%s') must be <path>[@<entries>]",
+                              argv[argi+1]);
+                    *at = '\0';
+                }
+                cmd->worker_offsets = realloc(cmd->worker_offsets,
+                                              sizeof(size_t) * (cmd->num_workers + 1));
+                cmd->worker_offsets[cmd->num_workers] = offset;
+                append_path(&cmd->workers, &cmd->num_workers, argv[argi + 1]);
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--dbsize") == 0) {
+                int end = 0;
+                if (sscanf(argv[argi + 1], "%zu,%zu%n", &cmd->db_residues, &cmd->db_entries, &end) != 2 ||
+                    argv[argi + 1][end] != '\0' || cmd->db_entries == 0) {
+                    usage("Invalid --dbsize argument ('%s') must be <residues>,<entries>",
+                          argv[argi+1]);
+                }
+
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--socket") == 0) {
+                if (cmd_type != SEQ_ALIGN_SERVER_CMD)
+                    usage("--socket only valid with the server");
+                cmd->socket_path = argv[argi + 1];
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--trace") == 0) {
+                cmd->trace_path = argv[argi + 1];
+                argi++;
+            } else if (strcasecmp(argv[argi], "--cache") == 0) {
+                if (cmd_type != SEQ_ALIGN_SERVER_CMD)
+                    usage("--cache only valid with the server");
+                cmd->cache_path = argv[argi + 1];
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--cache-size") == 0) {
+                if (cmd_type != SEQ_ALIGN_SERVER_CMD)
+                    usage("--cache-size only valid with the server");
+                if (!parse_entire_size(argv[argi + 1], &cmd->cache_size) || cmd->cache_size < (1UL << 20)) {
+                    usage("Invalid --cache-size argument ('%s') must be a size of at least 1M",
+                          argv[argi+1]);
+                }
+
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--checkpoint") == 0) {
+                if (cmd_type != SEQ_ALIGN_SW_CMD)
+                    usage("--checkpoint only valid with smith_waterman");
+                cmd->checkpoint_path = argv[argi + 1];
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--max-memory") == 0) {
+                if (cmd_type != SEQ_ALIGN_SW_CMD)
+                    usage("--max-memory only valid with smith_waterman");
+                if (!parse_entire_size(argv[argi + 1], &cmd->max_memory) || cmd->max_memory == 0) {
+                    usage("Invalid --max-memory argument ('%s') must be a size, e.g. 512M",
+                          argv[argi+1]);
+                }
+
+                argi++; // took an argument
+            } else if (strcasecmp(argv[argi], "--allvsall") == 0) {
+                if (cmd_type != SEQ_ALIGN_SW_CMD)
+                    usage("--allvsall only valid with smith_waterman");
+                cmd->all_vs_all_path = argv[argi + 1];
                 argi++; // took an argument
             } else if (strcasecmp(argv[argi], "--file") == 0) {
                 cmdline_set_files(cmd, argv[argi + 1], NULL);
@@ -300,14 +636,82 @@ cmdline_t *cmdline_new(int argc, char **argv, scoring_t *scoring,
         usage("Match value should not be less than mismatch penalty");
     }
 
-    if (cmd->file_path1 == NULL || cmd->file_path2 == NULL) {
+    if (cmd->resume && cmd->checkpoint_path == NULL) {
+        usage("--resume needs the --checkpoint file to resume from");
+    }
+
+    if (cmd->query_pssm && (cmd->prefilter_set || cmd->ungapped_cutoff_set)) {
+        usage("--prefilter and --ungapped don't work with --pssm");
+    }
+
+    if (scoring->mode == ALIGN_GLOBAL) {
+        if (cmd->prefilter_set || cmd->ungapped_cutoff_set)
+            usage("--prefilter and --ungapped only work with local alignment");
+        if (cmd->stats)
+            usage("--stats and --evalue only work with local alignment");
+        if (cmd->ends)
+            usage("--ends only works with local alignment");
+        // global scores are usually negative, report them all
+        if (!cmd->min_score_set) {
+            cmd->min_score = INT16_MIN;
+            cmd->min_score_set = true;
+        }
+    }
+
+    if (cmd_type == SEQ_ALIGN_SERVER_CMD) {
+        if (cmd->num_databases == 0 && cmd->num_workers == 0)
+            usage("No database specified");
+        if (cmd->shard_of > 0 && (cmd->num_databases != 1 || cmd->num_shards > 0 || cmd->num_workers > 0))
+            usage("--shard loads part of a single --database, without --shards or --worker");
+        if (cmd->stats && cmd->num_workers > 0 && cmd->db_entries == 0)
+            usage("--stats with --worker needs the size of the whole database (--dbsize)");
+        if ((cmd->socket_path == NULL) == !cmd->interactive)
+            usage("Specify exactly one of --socket or --stdin");
+        if (cmd->cache_path != NULL && (cmd->num_databases > 1 || cmd->num_shards > 1 || cmd->num_workers > 0))
+            usage("--cache needs a single --database, without --shards or --worker");
+        if (cmd->cache_size != 0 && cmd->cache_path == NULL)
+            usage("--cache-size needs a --cache file");
+        if (cmd->trace_path != NULL && (cmd->num_databases > 1 || cmd->num_shards > 1 || cmd->num_workers > 0))
+            usage("--trace needs a single --database, without --shards or --worker");
+        if (cmd->ends)
+            usage("--ends is only printed by smith_waterman");
+    } else if (cmd->all_vs_all_path != NULL) {
+        if (cmd->file_path1 != NULL || cmd->query_pssm || cmd->checkpoint_path != NULL)
+            usage("--allvsall takes the place of --files, --pssm and --checkpoint");
+        if (cmd->prefilter_set || cmd->ungapped_cutoff_set || cmd->stats || cmd->ends)
+            usage("--allvsall aligns every pair, without filters, --stats or --ends");
+    } else if (cmd->file_path1 == NULL || cmd->file_path2 == NULL) {
         usage("No input specified");
+    } else if (cmd->stream) {
+        if (scoring->mode != ALIGN_LOCAL || cmd->query_pssm)
+            usage("--stream only works with local alignment of a query sequence");
+        if (cmd->prefilter_set || cmd->ungapped_cutoff_set || cmd->stats || cmd->ends)
+            usage("--stream aligns every entry, without filters, --stats or --ends");
+        if (cmd->checkpoint_path != NULL || cmd->print_seq || cmd->max_hits_per_alignment_set)
+            usage("--stream doesn't work with --checkpoint, --printseq or --maxhits");
     }
 
     return cmd;
 }
 
 
+void cmdline_get_search_opts(const cmdline_t *cmd, sw_search_opts_t *opts) {
+    sw_search_opts_init(opts);
+    if (cmd->min_score_set) opts->min_score = cmd->min_score;
+    if (cmd->max_hits_per_alignment_set) opts->max_hits = cmd->max_hits_per_alignment;
+    if (cmd->prefilter_set || cmd->ungapped_cutoff_set) {
+        opts->exact = cmd->exact;
+        opts->prefilter_score = cmd->prefilter_set ? cmd->prefilter_score : 0;
+        opts->ungapped_cutoff = cmd->ungapped_cutoff_set ? cmd->ungapped_cutoff : 0;
+    }
+    if (cmd->prefilter_word_score_set) opts->prefilter_word_score = cmd->prefilter_word_score;
+    opts->stats = cmd->stats;
+    if (cmd->max_evalue_set) opts->max_evalue = cmd->max_evalue;
+    opts->ends = cmd->ends;
+    opts->db_residues = cmd->db_residues;
+    opts->db_entries = cmd->db_entries;
+}
+
 void cmdline_set_files(cmdline_t *cmd, char *query, char *database) {
     cmd->file_path1 = query;
     cmd->file_path2 = database;
@@ -321,219 +725,399 @@ char *cmdline_get_file2(cmdline_t *cmd) {
     return cmd->file_path2;
 }
 
-static double interval(struct timespec start, struct timespec end) {
-    struct timespec temp;
-    temp.tv_sec = end.tv_sec - start.tv_sec;
-    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
-    if (temp.tv_nsec < 0) {
-        temp.tv_sec = temp.tv_sec - 1;
-        temp.tv_nsec = temp.tv_nsec + 1000000000;
-    }
-    return (((double) temp.tv_sec) + ((double) temp.tv_nsec) * 1.0e-9);
-}
-
 static seq_file_t *open_seq_file(const char *path, bool use_zlib) {
     return (strcmp(path, "-") != 0 || use_zlib)
                ? seq_open(path)
                : seq_dopen(fileno(stdin), false, false, 0);
 }
 
-#define BATCH_SIZE_FACTOR 512
+// The database is usually big enough to be worth inflating on its own thread
+static int open_db_reader(seq_reader_t *reader, const char *path, bool use_zlib) {
+    if (strcmp(path, "-") == 0 && !use_zlib) {
+        memset(reader, 0, sizeof(seq_reader_t));
+        reader->file = open_seq_file(path, use_zlib);
+        return reader->file != NULL ? 0 : -1;
+    }
+    return seq_reader_open(reader, path);
+}
 
-void align_from_query_and_db(const char *query_path, const char *db_path, scoring_t *scoring,
-                             void (print_alignment)(aligner_t * aligner, size_t total_cnt),
-                             bool use_zlib) {
-    int num_threads = omp_get_max_threads();
-    int max_batch_size = num_threads * BATCH_SIZE_FACTOR;
+// The database is streamed through the search in chunks. A chunk should take
+// long enough to search that loading it and starting the threads cost little
+// in comparison, and have enough batches to keep every thread busy to the
+// end, but fit in the memory budget along with the search scratch space.
+#define DEFAULT_MAX_MEMORY ((size_t) 1 << 30)
+#define CHUNK_SECONDS 0.5
+#define CHUNK_MIN_BATCHES_PER_THREAD 8
+#define CHUNK_LANES 32 // of the widest batches, nucleotide ones
+#define CHUNK_MAX_GROWTH 4
+
+typedef struct
+{
+    size_t max_memory;
+    size_t min_entries, entries; // entries to load in the next chunk
+    bool warned;
+    // Stats of the chunks so far
+    size_t num_chunks, max_entries, peak_bytes;
+} chunk_sizer_t;
+
+static void chunk_sizer_init(chunk_sizer_t *sizer, size_t max_memory) {
+    memset(sizer, 0, sizeof(chunk_sizer_t));
+    sizer->max_memory = max_memory ? max_memory : DEFAULT_MAX_MEMORY;
+    sizer->min_entries = (size_t) omp_get_max_threads() * CHUNK_MIN_BATCHES_PER_THREAD * CHUNK_LANES;
+    // the first chunk is small, to measure entries of this database
+    sizer->entries = sizer->min_entries;
+}
 
-    size_t VECTOR_SIZE = 32 / sizeof(score_t);
-    seq_file_t *query_file, *db_file;
-    struct timespec time_start, time_stop;
-    size_t i;
+// Bytes to print: in MB, or KB below 1 MB, rounded up so that a small size
+// isn't shown as 0
+static size_t print_size(size_t bytes, const char **unit) {
+    size_t shift = bytes < ((size_t) 1 << 20) ? 10 : 20;
+    *unit = shift == 10 ? "KB" : "MB";
+    return (bytes + ((size_t) 1 << shift) - 1) >> shift;
+}
+
+// Size the next chunk from the memory and search time of the last one
+static void chunk_sizer_update(chunk_sizer_t *sizer, const sw_db_t *chunk, double seconds) {
+    size_t scratch, entries = sw_db_num_entries(chunk);
+    size_t bytes = sw_db_memory(chunk, &scratch);
+
+    sizer->num_chunks++;
+    sizer->max_entries = MAX2(sizer->max_entries, entries);
+    sizer->peak_bytes = MAX2(sizer->peak_bytes, bytes + scratch);
+
+    if (scratch >= sizer->max_memory && !sizer->warned) {
+        const char *unit;
+        size_t size = print_size(scratch / omp_get_max_threads(), &unit);
+        fprintf(stderr, "Warning: searching with this query needs %zu %s for each "
+                        "thread's scratch space alone, more than --max-memory\n", size, unit);
+        sizer->warned = true;
+    }
+
+    double budget = sizer->max_memory > scratch ? (double) (sizer->max_memory - scratch) : 0;
+    double next = MIN2((double) sizer->entries * CHUNK_MAX_GROWTH, budget * entries / bytes);
+    if (seconds > 0) next = MIN2(next, CHUNK_SECONDS * entries / seconds);
+    sizer->entries = MAX2((size_t) next, sizer->min_entries);
+}
+
+// E-values depend on the size of the whole database, but it is only ever
+// loaded a chunk at a time, so it is measured with an extra pass first
+static int count_database(const char *db_path, size_t *num_residues, size_t *num_entries) {
+    if (strcmp(db_path, "-") == 0) {
+        fprintf(stderr, "Error: E-values need the database size, so the database "
+                        "can't be read from STDIN\n");
+        return -1;
+    }
+    return sw_db_size(db_path, num_residues, num_entries);
+}
+
+// Read the query, the first sequence of its file or a PSSM whose residues
+// stand in for its sequence
+static int read_query(const char *query_path, bool query_is_pssm, bool use_zlib,
+                      read_t *query_read, pssm_t *pssm) {
+    seq_file_t *query_file;
+
+    if (query_is_pssm) {
+        if (pssm_load(pssm, query_path) != 0) return -1;
+        strbuf_append_strn(&query_read->name, query_path, strlen(query_path));
+        strbuf_append_strn(&query_read->seq, pssm->residues, pssm->len);
+        return 0;
+    }
 
-    // Open query file
     if ((query_file = open_seq_file(query_path, use_zlib)) == NULL) {
         fprintf(stderr, "Error: couldn't open query file %s\n", query_path);
-        fflush(stderr);
-        return;
+        return -1;
     }
 
-    // Open database file
-    if ((db_file = open_seq_file(db_path, use_zlib)) == NULL) {
-        fprintf(stderr, "Error: couldn't open database file %s\n", db_path);
-        fflush(stderr);
-        seq_close(query_file);
-        return;
+    int status = 0;
+    if (seq_read(query_file, query_read) <= 0 || query_read->seq.end == 0) {
+        fprintf(stderr, "Error: Query file %s is empty or invalid\n", query_path);
+        status = -1;
     }
 
-    // Read the single query sequence
+    seq_close(query_file);
+    return status;
+}
+
+// Seconds between checkpoints of a database scan
+#define CHECKPOINT_INTERVAL 30
+
+// Bytes of output so far if it is a file, synced so that a checkpoint is
+// never ahead of the output, else -1
+static long output_offset(void) {
+    struct stat st;
+    fflush(stdout);
+    if (fstat(fileno(stdout), &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+    fsync(fileno(stdout));
+    return (long) lseek(fileno(stdout), 0, SEEK_CUR);
+}
+
+// On resume, drop what was printed after the checkpoint: the hits of the
+// chunk being searched when the scan stopped
+static void rewind_output(long offset) {
+    struct stat st;
+    fflush(stdout);
+    if (offset < 0 || fstat(fileno(stdout), &st) != 0 || !S_ISREG(st.st_mode)) return;
+
+    if (st.st_size < offset) {
+        fprintf(stderr, "Warning: the output is shorter than at the checkpoint, "
+                        "hits found before it are missing (append with >>)\n");
+    } else if (ftruncate(fileno(stdout), offset) != 0 ||
+               lseek(fileno(stdout), offset, SEEK_SET) < 0) {
+        fprintf(stderr, "Warning: couldn't remove the output printed after the checkpoint\n");
+    }
+}
+
+// Read past the entries searched before a checkpoint, checking that they
+// are the entries that were searched: the database may have grown since, by
+// appending entries, but not changed. A mapped file is hashed as it is,
+// others are loaded a chunk at a time, as for the search, but not aligned.
+static int skip_searched(const char *db_path, const fasta_map_t *map, seq_file_t *file,
+                         const scoring_t *scoring, const sw_checkpoint_t *checkpoint,
+                         size_t chunk_entries) {
+    uint64_t fingerprint = 0;
+    size_t first = 0;
+    sw_db_t *chunk;
+
+    if (map != NULL) {
+        first = MIN2(checkpoint->entries, map->num_entries);
+        fingerprint = sw_db_map_fingerprint(map, first, 0);
+    } else {
+        while (first < checkpoint->entries &&
+               (chunk = sw_db_load(file, scoring, MIN2(chunk_entries, checkpoint->entries - first), first)) != NULL) {
+            fingerprint = sw_db_fingerprint(chunk, fingerprint);
+            first += sw_db_num_entries(chunk);
+            sw_db_close(chunk);
+        }
+    }
+
+    if (first < checkpoint->entries || fingerprint != checkpoint->fingerprint) {
+        fprintf(stderr, "Error: the first %zu entries of %s have changed since the "
+                        "checkpoint, start a new scan\n", checkpoint->entries, db_path);
+        return -1;
+    }
+    return 0;
+}
+
+int align_from_query_and_db(const char *query_path, const char *db_path, scoring_t *scoring,
+                             const sw_search_opts_t *opts, bool query_is_pssm,
+                             const char *checkpoint_path, bool resume, size_t max_memory,
+                             void (print_alignment)(const read_t *query, const sw_db_t *db,
+                                                    const sw_results_t *results),
+                             bool use_zlib) {
+    seq_reader_t db_reader;
+    fasta_map_t db_map;
+    sw_search_opts_t search_opts = *opts;
+
+    // Plain FASTA databases are mapped and packed without copying entries
+    bool mapped = strcmp(db_path, "-") != 0 && fasta_map_open(&db_map, db_path) == 0;
+
+    if (opts->stats && opts->db_residues == 0) {
+        if (mapped) {
+            search_opts.db_residues = db_map.num_residues;
+            search_opts.db_entries = db_map.num_entries;
+        } else if (count_database(db_path, &search_opts.db_residues,
+                                  &search_opts.db_entries) != 0) {
+            fflush(stderr);
+            return -1;
+        }
+    }
+
+    // Read the single query
     read_t query_read;
+    pssm_t pssm;
     seq_read_alloc(&query_read);
 
-    if (seq_read(query_file, &query_read) <= 0) {
-        fprintf(stderr, "Error: Query file %s is empty or invalid\n", query_path);
+    if (read_query(query_path, query_is_pssm, use_zlib, &query_read, &pssm) != 0) {
         fflush(stderr);
-        seq_close(query_file);
-        seq_close(db_file);
+        if (mapped) fasta_map_close(&db_map);
         seq_read_dealloc(&query_read);
-        return;
+        return -1;
     }
 
     assert(query_read.name.end != 0);
-    char *query_seq = query_read.seq.b;
-    char *query_fasta = query_read.name.b;
-    size_t query_seq_len = query_read.seq.end;
-    assert(query_seq_len > 0);
-    // characters are converted into indexes for table lookup
-    int8_t *query_indexes = aligned_alloc(32, query_seq_len * sizeof(int8_t));
-
-    // Replace unknown characters in query with an X
-    for (i = 0; i < query_seq_len; i++) {
-        query_indexes[i] = letters_to_index(query_seq[i]);
-        if (!get_swap_bit(scoring, query_indexes[i], query_indexes[i])) {
-            query_indexes[i] = letters_to_index('X');
-        }
+
+    // Open database file
+    if (!mapped && open_db_reader(&db_reader, db_path, use_zlib) != 0) {
+        fprintf(stderr, "Error: couldn't open database file %s\n", db_path);
+        fflush(stderr);
+        if (query_is_pssm) pssm_dealloc(&pssm);
+        seq_read_dealloc(&query_read);
+        return -1;
     }
 
-    // Read database sequences and align each with the query
-    read_t db_read;
-    seq_read_alloc(&db_read);
+    // Carry on from the last checkpoint, skipping the entries searched before
+    sw_checkpoint_t checkpoint = {.output_offset = -1};
+    uint64_t context = checkpoint_context(scoring, opts, query_read.seq.b, query_read.seq.end,
+                                          query_is_pssm ? &pssm : NULL);
+    int resumed = resume ? checkpoint_load(checkpoint_path, query_path, db_path, context, &checkpoint) : 1;
 
-    // Allocate aligners
-    aligner_t **aligners = malloc(sizeof(aligner_t*) * max_batch_size);
-    // Init aligners to null
-    for (i = 0; i < max_batch_size; i++) {
-        aligners[i] = NULL;
-    }
+    chunk_sizer_t sizer;
+    chunk_sizer_init(&sizer, max_memory);
 
-    int8_t *db_seq_index_vec_batch = NULL;
-    char **db_seq_vec_batch = NULL;
-    char **db_fasta_vec_batch = NULL;
-    size_t vec_elem_cnt = 0;
-    size_t batch_cnt = 0;
-    size_t total_cnt = 0;
+    if (resumed == 0) {
+        fprintf(stderr, "Resuming from entry %zu\n", checkpoint.entries);
+        resumed = skip_searched(db_path, mapped ? &db_map : NULL, mapped ? NULL : db_reader.file,
+                                scoring, &checkpoint, sizer.entries);
+    }
 
-    bool len_set = false;
-    // the max length of the query seq with in the batch
-    size_t max_seq_len_in_vec = 0;
+    if (resumed < 0) {
+        fflush(stderr);
+        if (query_is_pssm) pssm_dealloc(&pssm);
+        if (mapped) fasta_map_close(&db_map);
+        else seq_reader_close(&db_reader);
+        seq_read_dealloc(&query_read);
+        return -1;
+    } else if (resumed == 0) {
+        rewind_output(checkpoint.output_offset);
+    }
 
-    double total_time = 0;
+    sw_results_t results;
+    sw_results_alloc(&results);
+
+    size_t total_cnt = checkpoint.entries;
+    uint64_t fingerprint = checkpoint.fingerprint;
+    size_t filtered_cnt = checkpoint.filtered;
+    double total_time = checkpoint.kernel_time, prefilter_time = checkpoint.prefilter_time;
+    size_t lane_rows = 0, padding_rows = 0;
+    time_t last_checkpoint = time(NULL);
+    sw_db_t *chunk;
+
+    while (true) {
+        // packing a chunk is spread over the threads
+        perf_start(PERF_PARSE, omp_get_max_threads());
+        chunk = mapped ? sw_db_load_map(&db_map, scoring, sizer.entries, total_cnt)
+                       : sw_db_load(db_reader.file, scoring, sizer.entries, total_cnt);
+        perf_stop(PERF_PARSE, omp_get_max_threads(), 0);
+        if (chunk == NULL) break;
+
+        int status = query_is_pssm
+                         ? sw_search_pssm(chunk, &pssm, &search_opts, &results)
+                         : sw_search(chunk, query_read.seq.b, query_read.seq.end, &search_opts, &results);
+        if (status == 0) {
+            total_time += results.kernel_time;
+            prefilter_time += results.prefilter_time;
+            filtered_cnt += results.num_filtered;
+            lane_rows += results.lane_rows;
+            padding_rows += results.padding_rows;
+            perf_start(PERF_OUTPUT, 1);
+            uint64_t print_begin = trace_begin();
+            print_alignment(&query_read, chunk, &results);
+            trace_end(TRACE_PRINT, print_begin, results.num_hits);
+            perf_stop(PERF_OUTPUT, 1, 0);
+        }
+        chunk_sizer_update(&sizer, chunk, status == 0 ? results.kernel_time + results.prefilter_time : 0);
+        total_cnt += sw_db_num_entries(chunk);
+        fingerprint = sw_db_fingerprint(chunk, fingerprint);
+        sw_db_close(chunk);
+
+        if (checkpoint_path != NULL && time(NULL) - last_checkpoint >= CHECKPOINT_INTERVAL) {
+            checkpoint = (sw_checkpoint_t) {total_cnt, fingerprint, output_offset(), filtered_cnt,
+                                            total_time, prefilter_time};
+            checkpoint_save(checkpoint_path, query_path, db_path, context, &checkpoint);
+            last_checkpoint = time(NULL);
+        }
+    }
 
-    int read_status = seq_read(db_file, &db_read);
-    while (read_status > 0) {
-        assert(db_read.name.end != 0);
+    // A finished scan is checkpointed too, so resuming it again prints only the totals
+    if (checkpoint_path != NULL) {
+        checkpoint = (sw_checkpoint_t) {total_cnt, fingerprint, output_offset(), filtered_cnt,
+                                        total_time, prefilter_time};
+        checkpoint_save(checkpoint_path, query_path, db_path, context, &checkpoint);
+    }
 
-        char *seq_b = db_read.seq.b;
-        size_t seq_b_len = db_read.seq.end;
+    printf("Total Time: %f\n", total_time);
+    printf("Total Entries: %lu\n", total_cnt);
+    const char *peak_unit;
+    size_t peak = print_size(sizer.peak_bytes, &peak_unit);
+    printf("Chunks: %zu of up to %zu entries, peak memory %zu %s, padding %.1f%%\n",
+           sizer.num_chunks, sizer.max_entries, peak, peak_unit,
+           lane_rows > 0 ? 100.0 * (double) padding_rows / (double) lane_rows : 0.0);
+    if (!opts->exact) {
+        printf("Prefilter Time: %f\n", prefilter_time);
+        printf("Filtered Entries: %lu\n", filtered_cnt);
+    }
 
-        if (!len_set) {
-            len_set = true;
-            // since db is sorted from longest to shortest, first item in batch
-            // will always be the longest.
-            max_seq_len_in_vec = seq_b_len;
-            db_seq_index_vec_batch = aligned_alloc(32, max_seq_len_in_vec * VECTOR_SIZE * sizeof(int8_t));
-            db_seq_vec_batch = malloc(sizeof(char *) * VECTOR_SIZE);
-            db_fasta_vec_batch = malloc(sizeof(char *) * VECTOR_SIZE);
-        }
+    // Close files and free memory
+    if (query_is_pssm) pssm_dealloc(&pssm);
+    if (mapped) fasta_map_close(&db_map);
+    else seq_reader_close(&db_reader);
+    seq_read_dealloc(&query_read);
+    sw_results_dealloc(&results);
+    return 0;
+}
 
-        assert(max_seq_len_in_vec >= seq_b_len);
-        assert(db_seq_index_vec_batch != NULL);
-        assert(db_seq_vec_batch != NULL);
-        assert(db_fasta_vec_batch != NULL);
+static void print_pairs(const sw_pair_t *pairs, size_t num_pairs, void *arg) {
+    size_t *total_pairs = arg;
+    for (size_t i = 0; i < num_pairs; i++) {
+        printf("%zu\t%zu\t%i\n", pairs[i].a, pairs[i].b, pairs[i].score);
+    }
+    *total_pairs += num_pairs;
+    fflush(stdout);
+}
 
-        for (i = 0; i < seq_b_len; i++) {
-            db_seq_index_vec_batch[i * VECTOR_SIZE + vec_elem_cnt] = letters_to_index(seq_b[i]);
-        }
-        // characters that are too long are matched with *
-        for (i = seq_b_len; i < max_seq_len_in_vec; i++) {
-            db_seq_index_vec_batch[i * VECTOR_SIZE + vec_elem_cnt] = letters_to_index('*');
-        }
-        db_seq_vec_batch[vec_elem_cnt] = strdup(db_read.seq.b);
-        db_fasta_vec_batch[vec_elem_cnt] = strdup(db_read.name.b);
-
-        total_cnt++;
-        vec_elem_cnt++;
-
-        read_status = seq_read(db_file, &db_read);
-
-        if (vec_elem_cnt == VECTOR_SIZE || read_status == 0) {
-            assert(query_seq_len != 0);
-            assert(max_seq_len_in_vec != 0);
-            assert(db_seq_vec_batch != NULL);
-            assert(db_fasta_vec_batch != NULL);
-            assert(db_seq_index_vec_batch != NULL);
-
-
-            if (aligners[batch_cnt] == NULL) {
-                aligners[batch_cnt] = aligner_create(
-                    query_seq,
-                    db_seq_vec_batch,
-                    query_fasta,
-                    db_fasta_vec_batch,
-                    query_indexes,
-                    db_seq_index_vec_batch,
-                    query_seq_len,
-                    max_seq_len_in_vec,
-                    vec_elem_cnt,
-                    scoring);
-            } else {
-                aligner_update(
-                    aligners[batch_cnt],
-                    query_seq,
-                    db_seq_vec_batch,
-                    query_fasta,
-                    db_fasta_vec_batch,
-                    query_indexes,
-                    db_seq_index_vec_batch,
-                    query_seq_len,
-                    max_seq_len_in_vec,
-                    vec_elem_cnt,
-                    scoring);
-            }
+void align_all_vs_all(const char *path, const scoring_t *scoring, score_t min_score) {
+    struct timespec time_start, time_stop;
+    size_t total_pairs = 0;
 
-            // reset variables for the next vector batch
-            len_set = false;
-            vec_elem_cnt = 0;
-            max_seq_len_in_vec = 0;
-            // increment batch
-            batch_cnt++;
+    sw_db_t *db = sw_db_open(path, scoring);
+    if (db == NULL) {
+        fflush(stderr);
+        return;
+    }
 
-            if (batch_cnt == max_batch_size || read_status <= 0) {
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    int status = sw_all_vs_all(db, min_score, &print_pairs, &total_pairs);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+
+    // the summary goes to STDERR, leaving only pairs on STDOUT
+    if (status == 0) {
+        size_t n = sw_db_num_entries(db);
+        fprintf(stderr, "Total Time: %f\n", (double) (time_stop.tv_sec - time_start.tv_sec) +
+                                             (double) (time_stop.tv_nsec - time_start.tv_nsec) * 1e-9);
+        fprintf(stderr, "Total Entries: %zu\n", n);
+        fprintf(stderr, "Pairs: %zu of %zu\n", total_pairs, n * (n - (n > 0)) / 2);
+    }
+    fflush(stderr);
+    sw_db_close(db);
+}
 
-                clock_gettime(CLOCK_REALTIME, &time_start);
-#pragma omp parallel for schedule(dynamic, 1)
-                for (i = 0; i < batch_cnt; i++) {
-                    alignment_fill_matrices(aligners[i]);
-                }
-                clock_gettime(CLOCK_REALTIME, &time_stop);
-                total_time += interval(time_start, time_stop);
-
-                for (i = 0; i < batch_cnt; i++) {
-                    print_alignment(aligners[i], total_cnt - (batch_cnt * VECTOR_SIZE) + (i * VECTOR_SIZE));
-                    // cleanup data specific to this batch since it wont be needed again
-                    free(aligners[i]->seq_b_batch_indexes);
-                    free(aligners[i]->seq_b_str_batch);
-                    free(aligners[i]->seq_b_fasta_batch);
-                    aligners[i]->seq_b_batch_indexes = NULL;
-                    aligners[i]->seq_b_str_batch = NULL;
-                    aligners[i]->seq_b_fasta_batch = NULL;
-                }
+typedef struct
+{
+    const read_t *query;
+    void (*print_hit)(const read_t *query, size_t entry, const char *name, int32_t score);
+    size_t num_hits;
+} stream_printer_t;
+
+static void print_stream_hit(size_t entry, const char *name, int32_t score, void *arg) {
+    stream_printer_t *printer = arg;
+    perf_start(PERF_OUTPUT, 1);
+    uint64_t print_begin = trace_begin();
+    printer->print_hit(printer->query, entry, name, score);
+    trace_end(TRACE_PRINT, print_begin, 1);
+    perf_stop(PERF_OUTPUT, 1, 0);
+    printer->num_hits++;
+}
 
-                // reset batch cnt
-                batch_cnt = 0;
-            }
+void align_stream(const char *query_path, const char *db_path, const scoring_t *scoring,
+                  score_t min_score,
+                  void (print_hit)(const read_t *query, size_t entry, const char *name,
+                                   int32_t score),
+                  bool use_zlib) {
+    read_t query_read;
+    sw_stream_stats_t stats;
 
+    seq_read_alloc(&query_read);
+    if (read_query(query_path, false, use_zlib, &query_read, NULL) == 0) {
+        stream_printer_t printer = {&query_read, print_hit, 0};
+        if (sw_stream_search(db_path, scoring, query_read.seq.b, query_read.seq.end, min_score,
+                             &print_stream_hit, &printer, &stats) == 0) {
+            printf("Total Time: %f\n", stats.kernel_time);
+            printf("Total Entries: %zu\n", stats.num_entries);
+            printf("Segments: %zu of up to %lu residues, longest entry %zu residues\n",
+                   stats.num_segments, STREAM_SEGMENT_RESIDUES, stats.max_len);
         }
     }
 
-    printf("Total Time: %f\n", total_time);
-    printf("Total Entries: %lu\n", total_cnt);
-
-    // Close files and free memory
-    seq_close(query_file);
-    seq_close(db_file);
+    fflush(stderr);
     seq_read_dealloc(&query_read);
-    seq_read_dealloc(&db_read);
-    free(query_indexes);
-    free(aligners);
 }
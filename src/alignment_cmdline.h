@@ -13,8 +13,9 @@
 #include <stdbool.h>
 #include "seq_file/seq_file.h"
 #include "alignment.h"
+#include "alignment_search.h"
 
-enum SeqAlignCmdType {SEQ_ALIGN_SW_CMD};
+enum SeqAlignCmdType {SEQ_ALIGN_SW_CMD, SEQ_ALIGN_SERVER_CMD};
 
 typedef struct
 {
@@ -27,14 +28,66 @@ typedef struct
   // SW specific
   unsigned int max_hits_per_alignment;
   bool max_hits_per_alignment_set;
+  score_t min_score;
+  bool min_score_set;
   bool print_seq;
 
+  // Server specific
+  char *socket_path;
+  // Sharded search: every --database (split into num_shards worker
+  // processes each) and every --worker already running is a shard
+  char **databases, **workers;
+  size_t num_databases, num_workers;
+  // Added to the entry ids of each worker: the entries of the databases
+  // before the one it searches [default: 0]
+  size_t *worker_offsets;
+  unsigned int num_shards;
+  // Worker side: only load shard `shard` of `shard_of` [default: 0 of 0, all]
+  unsigned int shard, shard_of;
+  // Size of the whole database for E-values, when it is sharded
+  size_t db_residues, db_entries;
+  // Keep the results of queries in this file, of cache_size bytes [default:
+  // CACHE_DEFAULT_SIZE], so that repeated queries aren't searched again
+  char *cache_path;
+  size_t cache_size;
+
+  // Filters
+  bool exact, prefilter_set, prefilter_word_score_set, ungapped_cutoff_set;
+  score_t prefilter_score, ungapped_cutoff;
+  int prefilter_word_score;
+
+  // Statistics
+  bool stats, max_evalue_set;
+  double max_evalue;
+  bool ends;   // find where the hits' alignments end
+
   // NW specific?
   bool print_matrices;
 
+  // The query file is a PSSM (see alignment_pssm.h) rather than sequences
+  bool query_pssm;
+
+  // Save progress of the database scan here, and with resume carry on from it
+  char *checkpoint_path;
+  bool resume;
+
+  // Memory budget of the database chunks being searched, 0 for the default
+  size_t max_memory;
+
+  // Read database entries a segment at a time (see alignment_stream.h)
+  bool stream;
+
+  // Align every sequence of this file against every later one
+  char *all_vs_all_path;
+
   // Turns off zlib for stdin
   bool interactive;
 
+  // Report hardware performance counters of each stage on exit
+  bool perf;
+  // Write a timeline of what each thread did to this file on exit
+  char *trace_path;
+
   // General output
   bool print_fasta, print_pretty, print_colour;
 
@@ -45,6 +98,7 @@ char parse_entire_short(char *str, short *result);
 char parse_entire_ushort(char *str, unsigned short *result);
 char parse_entire_int(char *str, int *result);
 char parse_entire_uint(char *str, unsigned int *result);
+char parse_entire_double(char *str, double *result);
 
 cmdline_t* cmdline_new(int argc, char **argv, scoring_t *scoring,
                        enum SeqAlignCmdType cmd_type);
@@ -53,10 +107,28 @@ void cmdline_free(cmdline_t* cmd);
 void cmdline_set_files(cmdline_t* cmd, char* p1, char* p2);
 char* cmdline_get_file1(cmdline_t* cmd);
 char* cmdline_get_file2(cmdline_t* cmd);
+void cmdline_get_search_opts(const cmdline_t* cmd, sw_search_opts_t* opts);
 
 
-void align_from_query_and_db(const char *query_path, const char *db_path, scoring_t * scoring,
-                              void (print_alignment)(aligner_t * aligner, size_t total_cnt),
+/**
+ * Searches the database a chunk at a time, printing each chunk's hits.
+ *
+ * @return   0 on success, -1 if the search couldn't start or carry on from
+ *           the checkpoint (after printing the error)
+ */
+int align_from_query_and_db(const char *query_path, const char *db_path, scoring_t * scoring,
+                              const sw_search_opts_t *opts, bool query_is_pssm,
+                              const char *checkpoint_path, bool resume, size_t max_memory,
+                              void (print_alignment)(const read_t *query, const sw_db_t *db,
+                                                     const sw_results_t *results),
                               bool use_zlib);
 
+void align_stream(const char *query_path, const char *db_path, const scoring_t *scoring,
+                  score_t min_score,
+                  void (print_hit)(const read_t *query, size_t entry, const char *name,
+                                   int32_t score),
+                  bool use_zlib);
+
+void align_all_vs_all(const char *path, const scoring_t *scoring, score_t min_score);
+
 #endif
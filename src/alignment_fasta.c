@@ -0,0 +1,173 @@
+/*
+ alignment_fasta.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <x86intrin.h>
+#include <omp.h>
+
+#include "alignment_fasta.h"
+#include "alignment_macros.h"
+
+// Newlines, spaces and other control characters separate residues
+static inline bool is_space(char c) {
+    return (unsigned char) c <= ' ';
+}
+
+static inline __m256i space_bytes(__m256i c) {
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(c, _mm256_set1_epi8(' ')), c);
+}
+
+// Offset of the first c in data[from, end), or end
+static size_t find_byte(const char *data, size_t from, size_t end, char c) {
+    const __m256i target = _mm256_set1_epi8(c);
+    size_t i = from;
+
+    for (; i + 32 <= end; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (data + i));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, target));
+        if (mask != 0) return i + (size_t) __builtin_ctz(mask);
+    }
+    for (; i < end && data[i] != c; i++) {}
+    return i;
+}
+
+static size_t count_residues(const char *data, size_t from, size_t end) {
+    size_t i = from, n = 0;
+
+    for (; i + 32 <= end; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (data + i));
+        n += 32 - (size_t) __builtin_popcount((uint32_t) _mm256_movemask_epi8(space_bytes(block)));
+    }
+    for (; i < end; i++) n += !is_space(data[i]);
+    return n;
+}
+
+// Header positions are collected in name_offsets, the rest are filled in later
+static void map_add_entry(fasta_map_t *map, size_t *capacity, size_t header) {
+    if (map->num_entries == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        map->name_offsets = realloc(map->name_offsets, sizeof(size_t) * *capacity);
+    }
+    map->name_offsets[map->num_entries++] = header;
+}
+
+int fasta_map_open(fasta_map_t *map, const char *path) {
+    struct stat st;
+    size_t i, e, capacity = 0;
+    int fd;
+
+    memset(map, 0, sizeof(fasta_map_t));
+
+    if ((fd = open(path, O_RDONLY)) < 0) return -1;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    map->data = data;
+    map->size = (size_t) st.st_size;
+    posix_madvise(data, map->size, POSIX_MADV_SEQUENTIAL);
+
+    // Anything but FASTA (e.g. gzip or FASTQ) is left to seq_file
+    for (i = 0; i < map->size && is_space(map->data[i]); i++) {}
+    if (i == map->size || map->data[i] != '>') {
+        fasta_map_close(map);
+        return -1;
+    }
+    map_add_entry(map, &capacity, i);
+
+    // Every other record starts with a '>' just after a newline
+    const __m256i header = _mm256_set1_epi8('>'), newline = _mm256_set1_epi8('\n');
+    for (i++; i + 32 <= map->size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (map->data + i));
+        __m256i prev = _mm256_loadu_si256((const __m256i *) (map->data + i - 1));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(block, header), _mm256_cmpeq_epi8(prev, newline)));
+        while (mask != 0) {
+            map_add_entry(map, &capacity, i + (size_t) __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    for (; i < map->size; i++) {
+        if (map->data[i] == '>' && map->data[i - 1] == '\n') map_add_entry(map, &capacity, i);
+    }
+
+    size_t n = map->num_entries;
+    map->name_lens = malloc(sizeof(size_t) * n);
+    map->seq_offsets = malloc(sizeof(size_t) * n);
+    map->seq_ends = malloc(sizeof(size_t) * n);
+    map->lens = malloc(sizeof(size_t) * n);
+
+    for (e = 0; e < n; e++) {
+        map->seq_ends[e] = e + 1 < n ? map->name_offsets[e + 1] : map->size;
+    }
+
+    size_t num_residues = 0, max_len = 0;
+
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+:num_residues) reduction(max:max_len)
+    for (e = 0; e < n; e++) {
+        size_t start = map->name_offsets[e] + 1;
+        size_t line_end = find_byte(map->data, start, map->seq_ends[e], '\n');
+        size_t name_end = line_end;
+        if (name_end > start && map->data[name_end - 1] == '\r') name_end--;
+
+        map->name_offsets[e] = start;
+        map->name_lens[e] = name_end - start;
+        map->seq_offsets[e] = MIN2(line_end + 1, map->seq_ends[e]);
+        map->lens[e] = count_residues(map->data, map->seq_offsets[e], map->seq_ends[e]);
+
+        num_residues += map->lens[e];
+        max_len = MAX2(max_len, map->lens[e]);
+    }
+
+    map->num_residues = num_residues;
+    map->max_len = max_len;
+    posix_madvise(data, map->size, POSIX_MADV_NORMAL);
+    return 0;
+}
+
+void fasta_map_close(fasta_map_t *map) {
+    if (map->data != NULL) munmap((void *) map->data, map->size);
+    free(map->name_offsets);
+    free(map->name_lens);
+    free(map->seq_offsets);
+    free(map->seq_ends);
+    free(map->lens);
+    memset(map, 0, sizeof(fasta_map_t));
+}
+
+int fasta_map_indexes(const fasta_map_t *map, const alphabet_t *alphabet, size_t entry,
+                      int8_t *out, size_t stride, size_t *num_residues) {
+    return alphabet_translate(alphabet, map->data + map->seq_offsets[entry],
+                              map->seq_ends[entry] - map->seq_offsets[entry],
+                              out, stride, num_residues);
+}
+
+char *fasta_map_name(const fasta_map_t *map, size_t entry) {
+    char *name = malloc(map->name_lens[entry] + 1);
+    memcpy(name, map->data + map->name_offsets[entry], map->name_lens[entry]);
+    name[map->name_lens[entry]] = '\0';
+    return name;
+}
+
+char *fasta_map_seq(const fasta_map_t *map, size_t entry) {
+    char *seq = malloc(map->lens[entry] + 1);
+    size_t i, n = 0;
+    for (i = map->seq_offsets[entry]; i < map->seq_ends[entry]; i++) {
+        if (!is_space(map->data[i])) seq[n++] = map->data[i];
+    }
+    seq[n] = '\0';
+    return seq;
+}
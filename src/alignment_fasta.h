@@ -0,0 +1,68 @@
+/*
+ alignment_fasta.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_FASTA_HEADER_SEEN
+#define ALIGNMENT_FASTA_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include "alignment_alphabet.h"
+
+// An uncompressed FASTA file mapped into memory, with the position of every
+// record found up front. Nothing is copied: names are views into the mapping
+// and residues are translated to indexes straight from it.
+typedef struct
+{
+    const char *data;
+    size_t size;
+
+    size_t num_entries, num_residues, max_len;
+    size_t *name_offsets, *name_lens;  // header line, without the '>'
+    size_t *seq_offsets, *seq_ends;    // sequence lines, newlines included
+    size_t *lens;                      // residues in each entry
+} fasta_map_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maps a FASTA file and indexes its records.
+ *
+ * @param map    Struct to fill in, close with fasta_map_close
+ * @param path   Path to the file
+ * @return       0 on success, -1 if the file can't be mapped or isn't plain
+ *               FASTA (e.g. gzipped or FASTQ), so should be read with seq_file
+ */
+int fasta_map_open(fasta_map_t *map, const char *path);
+
+void fasta_map_close(fasta_map_t *map);
+
+/**
+ * Converts the residues of an entry to indexes.
+ *
+ * @param map            Mapped file
+ * @param alphabet       Translation to use
+ * @param entry          Entry to convert
+ * @param out            Residue i is written to out[i * stride]
+ * @param stride         Distance between consecutive residues of out
+ * @param num_residues   Set to the number of residues written, at most
+ *                       lens[entry] (fewer if unknown residues are skipped)
+ * @return               0 on success, -1 on an unknown residue
+ */
+int fasta_map_indexes(const fasta_map_t *map, const alphabet_t *alphabet, size_t entry,
+                      int8_t *out, size_t stride, size_t *num_residues);
+
+// Copy the name/sequence of an entry into a new NUL terminated string
+char *fasta_map_name(const fasta_map_t *map, size_t entry);
+char *fasta_map_seq(const fasta_map_t *map, size_t entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_FASTA_HEADER_SEEN */
@@ -0,0 +1,100 @@
+/*
+ alignment_interquery.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+#include <x86intrin.h>
+
+#include "alignment_interquery.h"
+#include "alignment_macros.h"
+
+#define LANES 16
+
+// Stands in for gap states that can't be reached, far enough from INT16_MIN
+// that adding penalties doesn't saturate
+#define INTERQUERY_UNREACHABLE (INT16_MIN / 2)
+
+void interquery_init(interquery_t *iq, const scoring_t *scoring,
+                     const int8_t *const *queries, const size_t *query_lens,
+                     size_t num_queries) {
+    size_t lane, i, b;
+
+    iq->num_queries = num_queries;
+    iq->len = 0;
+    for (lane = 0; lane < num_queries; lane++) iq->len = MAX2(iq->len, query_lens[lane]);
+
+    iq->profile = aligned_alloc(32, sizeof(int16_t) * 32 * (iq->len + 1) * LANES);
+
+    for (b = 0; b < 32; b++) {
+        int16_t *row = iq->profile + b * iq->len * LANES;
+        for (i = 0; i < iq->len; i++) {
+            for (lane = 0; lane < LANES; lane++) {
+                // shorter queries and empty lanes are padded with a score no
+                // alignment can gain from, not a residue: '*' scores against
+                // '*' in the entries with matrices such as BLOSUM62
+                row[i * LANES + lane] = lane < num_queries && i < query_lens[lane]
+                                        ? scoring->swap_scores[(size_t) queries[lane][i]][b]
+                                        : INTERQUERY_UNREACHABLE;
+            }
+        }
+    }
+}
+
+void interquery_dealloc(interquery_t *iq) {
+    free(iq->profile);
+    iq->profile = NULL;
+}
+
+void interquery_align(const interquery_t *iq, const scoring_t *scoring,
+                      const int8_t *target, size_t target_len, size_t target_stride,
+                      score_t *scratch, score_t *scores) {
+    score_t *h_row = scratch, *e_row = scratch + iq->len * LANES;
+    size_t i, j;
+
+    __m256i gap_open = _mm256_set1_epi16(scoring->gap_extend + scoring->gap_open);
+    __m256i gap_extend = _mm256_set1_epi16(scoring->gap_extend);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i unreachable = _mm256_set1_epi16(INTERQUERY_UNREACHABLE);
+    __m256i best = zero;
+
+    // Row 0: no entry residues yet
+    for (i = 0; i < iq->len; i++) {
+        _mm256_store_si256((__m256i *) (h_row + i * LANES), zero);
+        _mm256_store_si256((__m256i *) (e_row + i * LANES), unreachable);
+    }
+
+    for (j = 0; j < target_len; j++) {
+        const int16_t *profile = iq->profile + (size_t) target[j * target_stride] * iq->len * LANES;
+        // column 0: no query residues yet
+        __m256i h_diag = zero, h_left = zero, f_left = unreachable;
+
+        for (i = 0; i < iq->len; i++) {
+            __m256i h_up = _mm256_load_si256((__m256i *) (h_row + i * LANES));
+            __m256i e_up = _mm256_load_si256((__m256i *) (e_row + i * LANES));
+            __m256i s = _mm256_load_si256((const __m256i *) (profile + i * LANES));
+
+            // E: gap along the query, F: gap along the entry
+            __m256i e = _mm256_max_epi16(_mm256_adds_epi16(h_up, gap_open),
+                                         _mm256_adds_epi16(e_up, gap_extend));
+            __m256i f = _mm256_max_epi16(_mm256_adds_epi16(h_left, gap_open),
+                                         _mm256_adds_epi16(f_left, gap_extend));
+            __m256i h = _mm256_max_epi16(_mm256_adds_epi16(h_diag, s), zero);
+            h = _mm256_max_epi16(h, _mm256_max_epi16(e, f));
+            best = _mm256_max_epi16(best, h);
+
+            _mm256_store_si256((__m256i *) (h_row + i * LANES), h);
+            _mm256_store_si256((__m256i *) (e_row + i * LANES), e);
+            h_diag = h_up;
+            h_left = h;
+            f_left = f;
+        }
+    }
+
+    alignas(32) score_t lanes[LANES];
+    _mm256_store_si256((__m256i *) lanes, best);
+    memcpy(scores, lanes, sizeof(lanes));
+}
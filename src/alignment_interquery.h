@@ -0,0 +1,72 @@
+/*
+ alignment_interquery.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_INTERQUERY_HEADER_SEEN
+#define ALIGNMENT_INTERQUERY_HEADER_SEEN
+
+#include <stddef.h>
+#include "alignment_scoring.h"
+
+// Local alignment with queries, rather than database entries, in the lanes.
+//
+// The database kernel puts 16 entries in the lanes of a vector and aligns one
+// query against them. With thousands of short queries (peptides) and a few
+// long entries that leaves lanes empty, and the substitution scores have to
+// be looked up lane by lane. Here 16 queries are interleaved instead, as
+// batches of entries are, and a database entry is streamed through them a
+// residue at a time: every lane aligns against the same residue, so a row of
+// scores is one load from a profile of the queries.
+
+// Queries longer than this are left to the database kernel, the profile of
+// a batch of queries grows with their length
+#define INTERQUERY_MAX_LEN 512
+
+typedef struct
+{
+    size_t num_queries;     // at most 16, one per lane
+    size_t len;             // of the longest, the rest are padded
+    // Score of each lane's query residue at position i against residue b:
+    // profile[(b * len + i) * 16 + lane]
+    int16_t *profile;
+} interquery_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Builds the profile of a batch of queries.
+ *
+ * @param queries       Query residue indexes (letters_to_index)
+ * @param query_lens    Length of each query
+ * @param num_queries   Number of queries, at most 16
+ */
+void interquery_init(interquery_t *iq, const scoring_t *scoring,
+                     const int8_t *const *queries, const size_t *query_lens,
+                     size_t num_queries);
+
+void interquery_dealloc(interquery_t *iq);
+
+/**
+ * Best local alignment score of each query of the batch against a database
+ * entry, with affine gaps. Scores saturate at INT16_MAX (the search aligns
+ * those pairs again with 32-bit scores).
+ *
+ * @param target          Entry residue indexes, residue j at target[j * target_stride]
+ * @param target_len      Length of the entry
+ * @param target_stride   Distance between residues, e.g. the lanes of a batch
+ * @param scratch         Row buffers of 2 * len * 16 scores, 32-byte aligned
+ * @param scores          Set to the score of each query, 16 of them
+ */
+void interquery_align(const interquery_t *iq, const scoring_t *scoring,
+                      const int8_t *target, size_t target_len, size_t target_stride,
+                      score_t *scratch, score_t *scores);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_INTERQUERY_HEADER_SEEN */
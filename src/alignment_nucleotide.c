@@ -0,0 +1,250 @@
+/*
+ alignment_nucleotide.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "alignment_nucleotide.h"
+
+bool nt_scoring_init(nt_scoring_t *nt, const scoring_t *scoring) {
+    int a, b, min_score = INT_MAX, max_score = INT_MIN;
+    int scores[NT_UNKNOWN + 1][NT_UNKNOWN];
+
+    // scores are unsigned, so only local alignment fits
+    if (scoring->alphabet == ALPHABET_PROTEIN || scoring->mode != ALIGN_LOCAL) return false;
+
+    const char *bases = scoring->alphabet == ALPHABET_RNA ? "ACGUN" : "ACGTN";
+
+    memset(nt, 0, sizeof(nt_scoring_t));
+    nt->match_mismatch = scoring->use_match_mismatch;
+    nt->affine = !scoring_linear_gaps(scoring);
+
+    for (a = 0; a < 32; a++) nt->index_codes[a] = NT_UNKNOWN;
+    for (a = 0; a <= NT_UNKNOWN; a++) {
+        nt->code_indexes[a] = letters_to_index(bases[a]);
+        nt->index_codes[nt->code_indexes[a]] = (int8_t) a;
+    }
+
+    // query residues (N included) against database residues
+    for (a = 0; a <= NT_UNKNOWN; a++) {
+        for (b = 0; b < NT_UNKNOWN; b++) {
+            if (nt->match_mismatch) scores[a][b] = a == b ? scoring->match : scoring->mismatch;
+            else scores[a][b] = scoring->swap_scores[nt->code_indexes[a]][nt->code_indexes[b]];
+            min_score = MIN2(min_score, scores[a][b]);
+            max_score = MAX2(max_score, scores[a][b]);
+        }
+    }
+
+    int bias = MAX2(-min_score, 0);
+    int gap_open = -(scoring->gap_open + scoring->gap_extend);
+    int gap_extend = -scoring->gap_extend;
+
+    if (max_score <= 0 || bias + max_score >= UINT8_MAX ||
+        gap_open < 0 || gap_open > UINT8_MAX || gap_extend < 0 || gap_extend > UINT8_MAX) {
+        return false;
+    }
+
+    nt->bias = (uint8_t) bias;
+    nt->gap_open = (uint8_t) gap_open;
+    nt->gap_extend = (uint8_t) gap_extend;
+    nt->overflow = (uint8_t) (UINT8_MAX - bias - max_score);
+    nt->match = (uint8_t) (scoring->match + bias);
+    nt->mismatch = (uint8_t) (scoring->mismatch + bias);
+
+    // pshufb looks up each 128-bit half separately, codes past 3 don't occur
+    for (a = 0; a <= NT_UNKNOWN; a++) {
+        memset(nt->profile[a], bias, sizeof(nt->profile[a]));
+        for (b = 0; b < NT_UNKNOWN; b++) {
+            nt->profile[a][b] = nt->profile[a][b + 16] = (uint8_t) (scores[a][b] + bias);
+        }
+    }
+
+    return true;
+}
+
+bool nt_pack_lane(const nt_scoring_t *nt, uint8_t *batch, size_t lane,
+                  const int8_t *indexes, size_t len) {
+    bool unknown = false;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t code = (uint32_t) nt->index_codes[indexes[i]];
+        // as in BLAST's ncbi2na, ambiguous residues get a base that varies
+        // along the sequence, so runs of N don't align to each other
+        if (code == NT_UNKNOWN) {
+            code = ((uint32_t) i * 2654435761u) >> 30;
+            unknown = true;
+        }
+        batch[i / NT_PER_BYTE * NT_VECTOR_SIZE + lane] |= (uint8_t) (code << (2 * (i % NT_PER_BYTE)));
+    }
+    return unknown;
+}
+
+void nt_unpack_lane(const nt_scoring_t *nt, const uint8_t *batch, size_t lane,
+                    size_t len, int8_t *out, size_t stride) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = batch[i / NT_PER_BYTE * NT_VECTOR_SIZE + lane];
+        out[i * stride] = nt->code_indexes[(byte >> (2 * (i % NT_PER_BYTE))) & 3];
+    }
+}
+
+// Codes of every lane at a row of a packed batch
+static inline __m256i row_codes(const uint8_t *batch, size_t row) {
+    __m256i block = _mm256_load_si256((const __m256i *) (batch + row / NT_PER_BYTE * NT_VECTOR_SIZE));
+    // 16-bit shift, the bits brought in from the next byte are masked off
+    __m256i shifted = _mm256_srl_epi16(block, _mm_cvtsi32_si128((int) (2 * (row % NT_PER_BYTE))));
+    return _mm256_and_si256(shifted, _mm256_set1_epi8(3));
+}
+
+// Same recurrence as alignment_fill_matrices, on unsigned bytes where
+// saturating subtraction does the max with 0. Lanes shorter than the batch
+// are read off as their last row is passed, as padding could match.
+// Instantiated below for each kind of scoring scheme.
+static inline __attribute__((always_inline))
+uint32_t fill_matrices(const nt_scoring_t *nt, aligner_t *aligner,
+                       const uint8_t *query_codes, size_t query_len,
+                       const uint8_t *batch, const size_t *lane_lens, size_t lanes,
+                       score_t *scores, bool match_mismatch, bool affine) {
+    // the score_t row buffers hold NT_VECTOR_SIZE bytes per column
+    uint8_t *h_row = (uint8_t *) aligner->curr_match_scores;
+    uint8_t *e_row = (uint8_t *) aligner->curr_gap_a_scores;
+    uint8_t *f_row = (uint8_t *) aligner->curr_gap_b_scores;
+    alignas(32) uint8_t lane_max[NT_VECTOR_SIZE];
+    size_t i, j, lane, rows = 0, next_end = SIZE_MAX;
+    uint32_t overflow = 0;
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set1_epi8((char) nt->bias);
+    const __m256i gap_open = _mm256_set1_epi8((char) nt->gap_open);
+    const __m256i gap_extend = _mm256_set1_epi8((char) nt->gap_extend);
+    const __m256i match = _mm256_set1_epi8((char) nt->match);
+    const __m256i mismatch = _mm256_set1_epi8((char) nt->mismatch);
+    __m256i max_scores_vec = zero;
+
+    assert(lanes <= NT_VECTOR_SIZE);
+    assert(aligner->score_width > query_len);
+
+    for (lane = 0; lane < lanes; lane++) {
+        rows = MAX2(rows, lane_lens[lane]);
+        next_end = MIN2(next_end, lane_lens[lane]);
+    }
+
+    for (i = 0; i <= query_len; i++) {
+        _mm256_store_si256((__m256i *) (h_row + i * NT_VECTOR_SIZE), zero);
+        _mm256_store_si256((__m256i *) (e_row + i * NT_VECTOR_SIZE), zero);
+        _mm256_store_si256((__m256i *) (f_row + i * NT_VECTOR_SIZE), zero);
+    }
+
+    for (j = 0; ; j++) {
+        if (j == next_end) {
+            _mm256_store_si256((__m256i *) lane_max, max_scores_vec);
+            next_end = SIZE_MAX;
+            for (lane = 0; lane < lanes; lane++) {
+                if (lane_lens[lane] == j) {
+                    scores[lane] = lane_max[lane];
+                    if (lane_max[lane] >= nt->overflow) overflow |= 1U << lane;
+                } else if (lane_lens[lane] > j) {
+                    next_end = MIN2(next_end, lane_lens[lane]);
+                }
+            }
+        }
+        if (j == rows) break;
+
+        __m256i codes = row_codes(batch, j);
+
+        __m256i h_left = zero, e_left = zero, f_left = zero;
+        __m256i h_up_left = zero, e_up_left = zero, f_up_left = zero;
+
+        for (i = 0; i < query_len; i++) {
+            size_t index = (i + 1) * NT_VECTOR_SIZE;
+            __m256i substitution;
+
+            if (match_mismatch) {
+                __m256i same = _mm256_cmpeq_epi8(codes, _mm256_set1_epi8((char) query_codes[i]));
+                substitution = _mm256_blendv_epi8(mismatch, match, same);
+            } else {
+                __m256i profile = _mm256_loadu_si256((const __m256i *) nt->profile[query_codes[i]]);
+                substitution = _mm256_shuffle_epi8(profile, codes);
+            }
+
+            __m256i h_up = _mm256_load_si256((__m256i *) (h_row + index));
+
+            if (!affine) {
+                // H[i][j] = MAX(0, H[i-1][j-1] + substitution, H[i-1][j] - extend, H[i][j-1] - extend)
+                __m256i h = _mm256_subs_epu8(_mm256_adds_epu8(h_up_left, substitution), bias);
+                h = _mm256_max_epu8(h, _mm256_subs_epu8(h_up, gap_open));
+                h = _mm256_max_epu8(h, _mm256_subs_epu8(h_left, gap_open));
+                max_scores_vec = _mm256_max_epu8(max_scores_vec, h);
+
+                _mm256_store_si256((__m256i *) (h_row + index), h);
+                h_up_left = h_up;
+                h_left = h;
+                continue;
+            }
+
+            __m256i e_up = _mm256_load_si256((__m256i *) (e_row + index));
+            __m256i f_up = _mm256_load_si256((__m256i *) (f_row + index));
+
+            // H[i][j] = MAX(0, MAX(H, E, F)[i-1][j-1] + substitution)
+            __m256i h = _mm256_max_epu8(_mm256_max_epu8(h_up_left, e_up_left), f_up_left);
+            h = _mm256_subs_epu8(_mm256_adds_epu8(h, substitution), bias);
+            max_scores_vec = _mm256_max_epu8(max_scores_vec, h);
+
+            // E[i][j] = MAX(0, H[i-1][j] - open, E[i-1][j] - extend, F[i-1][j] - open)
+            __m256i e = _mm256_max_epu8(_mm256_subs_epu8(h_up, gap_open),
+                                        _mm256_subs_epu8(e_up, gap_extend));
+            e = _mm256_max_epu8(e, _mm256_subs_epu8(f_up, gap_open));
+
+            // F[i][j] = MAX(0, H[i][j-1] - open, E[i][j-1] - open, F[i][j-1] - extend)
+            __m256i f = _mm256_max_epu8(_mm256_subs_epu8(h_left, gap_open),
+                                        _mm256_subs_epu8(e_left, gap_open));
+            f = _mm256_max_epu8(f, _mm256_subs_epu8(f_left, gap_extend));
+
+            _mm256_store_si256((__m256i *) (h_row + index), h);
+            _mm256_store_si256((__m256i *) (e_row + index), e);
+            _mm256_store_si256((__m256i *) (f_row + index), f);
+
+            h_up_left = h_up;
+            e_up_left = e_up;
+            f_up_left = f_up;
+
+            h_left = h;
+            e_left = e;
+            f_left = f;
+        }
+    }
+
+    return overflow;
+}
+
+#define NT_FILL_MATRICES_KERNEL(name, match_mismatch, affine)                          \
+    static uint32_t name(const nt_scoring_t *nt, aligner_t *aligner,                    \
+                         const uint8_t *query_codes, size_t query_len,                  \
+                         const uint8_t *batch, const size_t *lane_lens, size_t lanes,   \
+                         score_t *scores) {                                             \
+        return fill_matrices(nt, aligner, query_codes, query_len, batch,               \
+                             lane_lens, lanes, scores, match_mismatch, affine);         \
+    }
+
+NT_FILL_MATRICES_KERNEL(fill_matrices_lookup_linear, false, false)
+NT_FILL_MATRICES_KERNEL(fill_matrices_lookup_affine, false, true)
+NT_FILL_MATRICES_KERNEL(fill_matrices_match_linear, true, false)
+NT_FILL_MATRICES_KERNEL(fill_matrices_match_affine, true, true)
+
+uint32_t nt_fill_matrices(const nt_scoring_t *nt, aligner_t *aligner,
+                          const uint8_t *query_codes, size_t query_len,
+                          const uint8_t *batch, const size_t *lane_lens, size_t lanes,
+                          score_t *scores) {
+    // [match_mismatch][affine]
+    static uint32_t (*const kernels[2][2])(const nt_scoring_t *, aligner_t *,
+                                           const uint8_t *, size_t, const uint8_t *,
+                                           const size_t *, size_t, score_t *) = {
+        {fill_matrices_lookup_linear, fill_matrices_lookup_affine},
+        {fill_matrices_match_linear, fill_matrices_match_affine}
+    };
+    return kernels[nt->match_mismatch][nt->affine](nt, aligner, query_codes, query_len,
+                                                  batch, lane_lens, lanes, scores);
+}
@@ -0,0 +1,94 @@
+/*
+ alignment_nucleotide.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_NUCLEOTIDE_HEADER_SEEN
+#define ALIGNMENT_NUCLEOTIDE_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "alignment.h"
+#include "alignment_macros.h"
+
+// DNA/RNA databases are packed 2 bits per residue into batches of
+// NT_VECTOR_SIZE entries, aligned with 8-bit scores. Residue r of lane l is
+// bits [2 * (r % 4), 2 * (r % 4) + 2) of byte (r / 4) * NT_VECTOR_SIZE + l.
+#define NT_VECTOR_SIZE 32
+#define NT_PER_BYTE 4
+// Bytes of a packed batch of rows residues, a multiple of 32 for aligned_alloc
+#define NT_BATCH_BYTES(rows) ((MAX2(rows, 1) + NT_PER_BYTE - 1) / NT_PER_BYTE * NT_VECTOR_SIZE)
+
+// Residue codes: A 0, C 1, G 2, T/U 3. Only queries hold NT_UNKNOWN (N),
+// unknown database residues have no room in 2 bits and become a base, so
+// entries holding them are aligned again from their residues.
+#define NT_UNKNOWN 4
+
+// Scoring scheme in the form the 8-bit kernel uses. Scores are kept unsigned
+// by adding bias to every substitution score.
+typedef struct
+{
+    bool match_mismatch;        // compare codes rather than look scores up
+    bool affine;                // gaps have an opening penalty
+    uint8_t bias, match, mismatch;
+    uint8_t gap_open, gap_extend; // penalties as positive numbers
+    // lanes scoring this much may have saturated and need the 16-bit kernel
+    uint8_t overflow;
+    int8_t code_indexes[NT_UNKNOWN + 1]; // letters_to_index of each code
+    int8_t index_codes[32];              // code of each index, NT_UNKNOWN if none
+    uint8_t profile[NT_UNKNOWN + 1][32]; // biased scores, for pshufb
+} nt_scoring_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Converts a DNA/RNA scoring scheme for the 8-bit kernel.
+ *
+ * @return   false if the scores don't fit in 8 bits (or it isn't a local
+ *           DNA/RNA alignment),
+ *           so the database should be searched with the 16-bit kernel
+ */
+bool nt_scoring_init(nt_scoring_t *nt, const scoring_t *scoring);
+
+/**
+ * Packs an entry, given as residue indexes, into a lane of a batch.
+ * Unknown residues are replaced by a base picked from their position.
+ *
+ * @return   true if the entry had unknown residues, so its lane doesn't
+ *           score as the entry does
+ */
+bool nt_pack_lane(const nt_scoring_t *nt, uint8_t *batch, size_t lane,
+                  const int8_t *indexes, size_t len);
+
+// Unpack len residues of a lane to indexes, residue i to out[i * stride]
+void nt_unpack_lane(const nt_scoring_t *nt, const uint8_t *batch, size_t lane,
+                    size_t len, int8_t *out, size_t stride);
+
+/**
+ * Local alignment scores of a query against every lane of a packed batch,
+ * using the row buffers of an aligner created for at least query_len.
+ *
+ * @param nt            Scoring from nt_scoring_init
+ * @param aligner       Scratch space
+ * @param query_codes   Query residue codes
+ * @param query_len     Length of the query
+ * @param batch         Packed batch
+ * @param lane_lens     Length of the entry in each lane
+ * @param lanes         Number of lanes in use
+ * @param scores        Set to the best score of each lane in use
+ * @return              Bit mask of the lanes whose score reached nt->overflow,
+ *                      which must be aligned again with 16-bit scores
+ */
+uint32_t nt_fill_matrices(const nt_scoring_t *nt, aligner_t *aligner,
+                          const uint8_t *query_codes, size_t query_len,
+                          const uint8_t *batch, const size_t *lane_lens, size_t lanes,
+                          score_t *scores);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_NUCLEOTIDE_HEADER_SEEN */
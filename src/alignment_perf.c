@@ -0,0 +1,231 @@
+/*
+ alignment_perf.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+// request syscall()
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <omp.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "alignment_perf.h"
+
+// Threads whose kernel cycles are reported one by one
+#define PERF_MAX_THREADS 256
+
+typedef struct
+{
+    uint64_t counts[PERF_NUM_COUNTERS];
+    uint64_t cells;
+    double seconds;
+    uint64_t thread_cycles[PERF_MAX_THREADS];
+    int num_threads;
+} perf_totals_t;
+
+// Counters of one thread, opened the first time it starts a stage, and
+// their values when it did
+typedef struct
+{
+    bool opened;
+    int fds[PERF_NUM_COUNTERS];
+    bool started[PERF_NUM_STAGES];
+    uint64_t start[PERF_NUM_STAGES][PERF_NUM_COUNTERS];
+} perf_thread_t;
+
+static const char *const stage_names[PERF_NUM_STAGES] = {"parse", "filter", "kernel", "output"};
+static const char *const counter_names[PERF_NUM_COUNTERS] = {"cycles", "instructions", "L1d misses",
+                                                             "cache misses", "branch misses"};
+
+static bool perf_on = false;
+static bool counter_ok[PERF_NUM_COUNTERS];   // could be opened by perf_open
+static perf_totals_t totals[PERF_NUM_STAGES];
+static struct timespec stage_start[PERF_NUM_STAGES];
+static _Thread_local perf_thread_t thread_perf;
+
+#ifdef __linux__
+static int open_counter(enum PerfCounter counter) {
+    static const uint32_t types[PERF_NUM_COUNTERS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE};
+    static const uint64_t configs[PERF_NUM_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = types[counter];
+    attr.config = configs[counter];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // counters may be multiplexed if the CPU has too few, scaled on reading
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // this thread, on any CPU
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_counter(int fd) {
+    uint64_t values[3]; // count, time enabled, time running
+    if (read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) return 0;
+    return values[2] < values[1] ? (uint64_t) ((double) values[0] * values[1] / values[2]) : values[0];
+}
+#else
+static int open_counter(enum PerfCounter counter) {
+    (void) counter;
+    errno = ENOSYS;
+    return -1;
+}
+
+static uint64_t read_counter(int fd) {
+    (void) fd;
+    return 0;
+}
+#endif
+
+static void thread_open(void) {
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        thread_perf.fds[c] = counter_ok[c] ? open_counter(c) : -1;
+    }
+    thread_perf.opened = true;
+}
+
+static void thread_start(enum PerfStage stage) {
+    if (!thread_perf.opened) thread_open();
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        if (thread_perf.fds[c] >= 0) thread_perf.start[stage][c] = read_counter(thread_perf.fds[c]);
+    }
+    thread_perf.started[stage] = true;
+}
+
+static void thread_stop(enum PerfStage stage, int thread) {
+    perf_totals_t *t = &totals[stage];
+    if (!thread_perf.started[stage]) return;
+
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        if (thread_perf.fds[c] < 0) continue;
+        uint64_t delta = read_counter(thread_perf.fds[c]) - thread_perf.start[stage][c];
+#pragma omp atomic
+        t->counts[c] += delta;
+        if (c == PERF_CYCLES && thread < PERF_MAX_THREADS) t->thread_cycles[thread] += delta;
+    }
+    thread_perf.started[stage] = false;
+}
+
+int perf_open(void) {
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        thread_perf.fds[c] = open_counter(c);
+        counter_ok[c] = thread_perf.fds[c] >= 0;
+    }
+    thread_perf.opened = true;
+
+    if (!counter_ok[PERF_CYCLES]) {
+        fprintf(stderr, "Warning: hardware performance counters aren't available (%s), "
+                        "see /proc/sys/kernel/perf_event_paranoid\n", strerror(errno));
+        for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+            if (thread_perf.fds[c] >= 0) close(thread_perf.fds[c]);
+            thread_perf.fds[c] = -1;
+            counter_ok[c] = false;
+        }
+        return -1;
+    }
+
+    perf_on = true;
+    return 0;
+}
+
+bool perf_enabled(void) {
+    return perf_on;
+}
+
+void perf_start(enum PerfStage stage, int num_threads) {
+    if (!perf_on) return;
+    clock_gettime(CLOCK_MONOTONIC, &stage_start[stage]);
+
+    if (num_threads > 1) {
+#pragma omp parallel num_threads(num_threads)
+        thread_start(stage);
+    } else {
+        thread_start(stage);
+    }
+}
+
+void perf_stop(enum PerfStage stage, int num_threads, uint64_t cells) {
+    perf_totals_t *t = &totals[stage];
+    struct timespec now;
+    if (!perf_on) return;
+
+    // the same threads as started the stage, OpenMP keeps its pool of threads
+    if (num_threads > 1) {
+#pragma omp parallel num_threads(num_threads)
+        thread_stop(stage, omp_get_thread_num());
+    } else {
+        thread_stop(stage, 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    t->seconds += (double) (now.tv_sec - stage_start[stage].tv_sec) +
+                  (double) (now.tv_nsec - stage_start[stage].tv_nsec) * 1e-9;
+    t->cells += cells;
+    if (num_threads > t->num_threads) t->num_threads = num_threads;
+}
+
+void perf_report(FILE *out) {
+    int s, c, i;
+    if (!perf_on) return;
+
+    fprintf(out, "Perf counters (user space, summed over threads):\n");
+    for (s = 0; s < PERF_NUM_STAGES; s++) {
+        const perf_totals_t *t = &totals[s];
+        if (t->seconds == 0) continue;
+
+        double instructions = (double) t->counts[PERF_INSTRUCTIONS];
+        fprintf(out, "  %-7s %.3f s, %.3g cycles", stage_names[s], t->seconds,
+                (double) t->counts[PERF_CYCLES]);
+        if (counter_ok[PERF_INSTRUCTIONS] && t->counts[PERF_CYCLES] > 0) {
+            fprintf(out, ", %.3g instructions, IPC %.2f", instructions,
+                    instructions / (double) t->counts[PERF_CYCLES]);
+        }
+        if (t->cells > 0) {
+            fprintf(out, ", %.3g cells, %.2f cycles/cell", (double) t->cells,
+                    (double) t->counts[PERF_CYCLES] / (double) t->cells);
+        }
+        fprintf(out, "\n");
+
+        // misses per thousand instructions, and per cell of the kernel
+        for (c = PERF_L1D_MISSES; c < PERF_NUM_COUNTERS; c++) {
+            fprintf(out, "          %-14s", counter_names[c]);
+            if (!counter_ok[c]) {
+                fprintf(out, "n/a\n");
+                continue;
+            }
+            fprintf(out, "%.3g", (double) t->counts[c]);
+            if (instructions > 0) fprintf(out, ", %.2f per 1k instructions", 1000 * (double) t->counts[c] / instructions);
+            if (t->cells > 0) fprintf(out, ", %.4f per cell", (double) t->counts[c] / (double) t->cells);
+            fprintf(out, "\n");
+        }
+    }
+
+    // an uneven split of the kernel's work shows up as uneven cycles
+    const perf_totals_t *kernel = &totals[PERF_KERNEL];
+    if (kernel->num_threads > 1) {
+        fprintf(out, "  kernel cycles by thread:");
+        for (i = 0; i < kernel->num_threads && i < PERF_MAX_THREADS; i++) {
+            fprintf(out, " %.3g", (double) kernel->thread_cycles[i]);
+        }
+        fprintf(out, "\n");
+    }
+}
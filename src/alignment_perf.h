@@ -0,0 +1,67 @@
+/*
+ alignment_perf.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_PERF_HEADER_SEEN
+#define ALIGNMENT_PERF_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+// Hardware performance counters (Linux perf_event_open) read around each
+// stage of a search, on every thread that works on it, to tell whether the
+// kernel is bound by instructions, cache misses or branch misses rather
+// than guessing from wall time. Off unless perf_open is called, when the
+// calls below do nothing. Counters only count user space, so they work with
+// the default perf_event_paranoid of 2, and any the CPU, kernel or container
+// doesn't allow are left out of the report.
+
+enum PerfStage {PERF_PARSE, PERF_FILTER, PERF_KERNEL, PERF_OUTPUT, PERF_NUM_STAGES};
+
+enum PerfCounter {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_CACHE_MISSES,
+                  PERF_BRANCH_MISSES, PERF_NUM_COUNTERS};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Turns counting on, if this thread can open the cycle counter.
+ *
+ * @return   0 on success, -1 (with a warning) if counters aren't available,
+ *           in which case counting stays off
+ */
+int perf_open(void);
+
+bool perf_enabled(void);
+
+/**
+ * Starts counting a stage.
+ *
+ * @param num_threads   Threads of the OpenMP team that works on the stage,
+ *                      counted on each of them, or 1 for this thread only
+ */
+void perf_start(enum PerfStage stage, int num_threads);
+
+/**
+ * Stops counting a stage started with the same number of threads.
+ *
+ * @param cells   Dynamic programming cells (query x entry residues) the
+ *                stage filled, for misses per cell, or 0
+ */
+void perf_stop(enum PerfStage stage, int num_threads, uint64_t cells);
+
+/**
+ * Prints the counts of each stage: IPC, misses per 1000 instructions and
+ * per cell, and the cycles of each thread in the kernel.
+ */
+void perf_report(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_PERF_HEADER_SEEN */
@@ -0,0 +1,168 @@
+/*
+ alignment_prefilter.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "alignment_prefilter.h"
+#include "alignment_macros.h"
+
+// Residue indexes fit in 5 bits, so words are packed 5 bits per residue
+#define WORD_BITS (5 * PREFILTER_WORD_LEN)
+#define NUM_WORDS ((size_t) 1 << WORD_BITS)
+#define WORD_MASK (NUM_WORDS - 1)
+
+typedef struct
+{
+    const scoring_t *scoring;
+    const int8_t *query_word;  // query residues the word is scored against
+    const int8_t *alphabet;    // residues of the substitution matrix
+    size_t alphabet_len;
+    int max_suffix[PREFILTER_WORD_LEN + 1]; // best possible score of the rest of the word
+    int word_score;
+    uint32_t position;
+    size_t *word_offsets;
+    uint32_t *positions;       // NULL when only counting
+} neighbourhood_t;
+
+// Enumerate every word scoring at least word_score against the query word,
+// pruning prefixes that can't reach it
+static void neighbourhood_visit(neighbourhood_t *nb, size_t depth, size_t word, int score) {
+    if (depth == PREFILTER_WORD_LEN) {
+        if (nb->positions == NULL) nb->word_offsets[word + 1]++;
+        else nb->positions[nb->word_offsets[word]++] = nb->position;
+        return;
+    }
+
+    const int8_t *row = nb->scoring->swap_scores[nb->query_word[depth]];
+    for (size_t a = 0; a < nb->alphabet_len; a++) {
+        int s = score + row[nb->alphabet[a]];
+        if (s + nb->max_suffix[depth + 1] >= nb->word_score) {
+            neighbourhood_visit(nb, depth + 1, (word << 5) | (size_t) nb->alphabet[a], s);
+        }
+    }
+}
+
+static void neighbourhood_walk(neighbourhood_t *nb, const int8_t *query_indexes,
+                               size_t query_len) {
+    size_t i, a;
+    int t;
+
+    for (i = 0; i + PREFILTER_WORD_LEN <= query_len; i++) {
+        nb->query_word = query_indexes + i;
+        nb->position = (uint32_t) i;
+
+        nb->max_suffix[PREFILTER_WORD_LEN] = 0;
+        for (t = PREFILTER_WORD_LEN - 1; t >= 0; t--) {
+            const int8_t *row = nb->scoring->swap_scores[nb->query_word[t]];
+            int best = INT8_MIN;
+            for (a = 0; a < nb->alphabet_len; a++) best = MAX2(best, row[nb->alphabet[a]]);
+            nb->max_suffix[t] = nb->max_suffix[t + 1] + best;
+        }
+
+        neighbourhood_visit(nb, 0, 0, 0);
+    }
+}
+
+void prefilter_alloc(prefilter_t *prefilter, const scoring_t *scoring,
+                     const int8_t *query_indexes, size_t query_len,
+                     int word_score) {
+    int8_t alphabet[32];
+    size_t alphabet_len = 0, w;
+
+    // Only residues in the substitution matrix can be seeds
+    for (int8_t a = 0; a < 32; a++) {
+        if (get_swap_bit(scoring, a, a)) alphabet[alphabet_len++] = a;
+    }
+
+    prefilter->scoring = scoring;
+    prefilter->query_indexes = query_indexes;
+    prefilter->query_len = query_len;
+    prefilter->word_offsets = calloc(NUM_WORDS + 1, sizeof(size_t));
+
+    neighbourhood_t nb = {
+        .scoring = scoring, .alphabet = alphabet, .alphabet_len = alphabet_len,
+        .word_score = word_score, .word_offsets = prefilter->word_offsets,
+        .positions = NULL
+    };
+
+    // Count the query positions of each word, then fill them in
+    neighbourhood_walk(&nb, query_indexes, query_len);
+    for (w = 0; w < NUM_WORDS; w++) {
+        prefilter->word_offsets[w + 1] += prefilter->word_offsets[w];
+    }
+
+    prefilter->positions = malloc(sizeof(uint32_t) * MAX2(prefilter->word_offsets[NUM_WORDS], 1));
+    nb.positions = prefilter->positions;
+    neighbourhood_walk(&nb, query_indexes, query_len);
+
+    // filling advanced each offset to the start of the next word
+    memmove(prefilter->word_offsets + 1, prefilter->word_offsets, sizeof(size_t) * NUM_WORDS);
+    prefilter->word_offsets[0] = 0;
+}
+
+void prefilter_dealloc(prefilter_t *prefilter) {
+    free(prefilter->word_offsets);
+    free(prefilter->positions);
+    memset(prefilter, 0, sizeof(prefilter_t));
+}
+
+int prefilter_score(const prefilter_t *prefilter,
+                    const int8_t *seq, size_t stride, size_t len,
+                    int stop_score, size_t *diag_end) {
+    const int8_t *query = prefilter->query_indexes;
+    size_t query_len = prefilter->query_len;
+    int best = 0;
+    size_t i, j, k, p, word = 0;
+
+    if (len < PREFILTER_WORD_LEN || query_len < PREFILTER_WORD_LEN) return 0;
+
+    // diag_end[d] is the first database position on diagonal d that hasn't
+    // been covered by an extension yet
+    memset(diag_end, 0, sizeof(size_t) * (query_len + len + 1));
+
+    for (j = 0; j + 1 < PREFILTER_WORD_LEN; j++) {
+        word = (word << 5) | (size_t) seq[j * stride];
+    }
+
+    for (j = 0; j + PREFILTER_WORD_LEN <= len; j++) {
+        word = ((word << 5) | (size_t) seq[(j + PREFILTER_WORD_LEN - 1) * stride]) & WORD_MASK;
+
+        for (p = prefilter->word_offsets[word]; p < prefilter->word_offsets[word + 1]; p++) {
+            i = prefilter->positions[p];
+            size_t d = j + query_len - i;
+            if (j < diag_end[d]) continue;
+
+            int score = 0;
+            for (k = 0; k < PREFILTER_WORD_LEN; k++) {
+                score += prefilter->scoring->swap_scores[query[i + k]][seq[(j + k) * stride]];
+            }
+
+            // Extend right, then left from the best right end
+            int run = score;
+            size_t qi = i + PREFILTER_WORD_LEN, dj = j + PREFILTER_WORD_LEN;
+            for (; qi < query_len && dj < len; qi++, dj++) {
+                run += prefilter->scoring->swap_scores[query[qi]][seq[dj * stride]];
+                if (run > score) score = run;
+                else if (score - run >= PREFILTER_X_DROP) break;
+            }
+            diag_end[d] = dj;
+
+            run = score;
+            for (qi = i, dj = j; qi > 0 && dj > 0; qi--, dj--) {
+                run += prefilter->scoring->swap_scores[query[qi - 1]][seq[(dj - 1) * stride]];
+                if (run > score) score = run;
+                else if (score - run >= PREFILTER_X_DROP) break;
+            }
+
+            best = MAX2(best, score);
+            if (best >= stop_score) return best;
+        }
+    }
+
+    return best;
+}
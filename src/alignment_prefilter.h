@@ -0,0 +1,70 @@
+/*
+ alignment_prefilter.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_PREFILTER_HEADER_SEEN
+#define ALIGNMENT_PREFILTER_HEADER_SEEN
+
+#include <stddef.h>
+#include "alignment_scoring.h"
+
+// Length of the words seeded from the query
+#define PREFILTER_WORD_LEN 3
+// Default minimum score of a word against the query to be used as a seed
+#define PREFILTER_WORD_SCORE 11
+// Ungapped extensions stop once they fall this far below their best score
+#define PREFILTER_X_DROP 20
+
+// Index of every word scoring at least word_score against some query
+// position (the query's substitution matrix neighbourhood)
+typedef struct
+{
+    const scoring_t *scoring;
+    const int8_t *query_indexes;
+    size_t query_len;
+    size_t *word_offsets;  // query positions of word w are
+    uint32_t *positions;   // positions[word_offsets[w]..word_offsets[w+1]]
+} prefilter_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Builds the word index for a query.
+ *
+ * @param prefilter       Struct to fill in, free with prefilter_dealloc
+ * @param scoring         Scoring scheme
+ * @param query_indexes   Query converted with letters_to_index
+ * @param query_len       Length of the query
+ * @param word_score      Minimum score of a neighbourhood word
+ */
+void prefilter_alloc(prefilter_t *prefilter, const scoring_t *scoring,
+                     const int8_t *query_indexes, size_t query_len,
+                     int word_score);
+
+void prefilter_dealloc(prefilter_t *prefilter);
+
+/**
+ * Finds the best ungapped extension of any seed word shared by the query and
+ * a database sequence.
+ *
+ * @param prefilter    Query word index
+ * @param seq          Database sequence indexes, seq[i * stride] is residue i
+ * @param stride       Distance between consecutive residues of seq
+ * @param len          Length of the database sequence
+ * @param stop_score   Return as soon as an extension scores at least this
+ * @param diag_end     Scratch space for query_len + len + 1 ints
+ * @return             Best ungapped extension score, 0 if there were no seeds
+ */
+int prefilter_score(const prefilter_t *prefilter,
+                    const int8_t *seq, size_t stride, size_t len,
+                    int stop_score, size_t *diag_end);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_PREFILTER_HEADER_SEEN */
@@ -0,0 +1,180 @@
+/*
+ alignment_pssm.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h> // strcasecmp
+#include <limits.h>
+#include <ctype.h>
+
+#include "alignment_pssm.h"
+#include "alignment_macros.h"
+
+// Column kinds other than residue indexes
+#define COLUMN_GAP_OPEN -1
+#define COLUMN_GAP_EXTEND -2
+
+#define MAX_COLUMNS 64
+
+static bool is_residue(const char *token) {
+    return token[1] == '\0' && (isalpha((unsigned char) token[0]) || token[0] == '*');
+}
+
+static bool is_number(const char *token, long min, long max, long *value) {
+    char *end;
+    *value = strtol(token, &end, 10);
+    return end != token && *end == '\0' && *value >= min && *value <= max;
+}
+
+// Split line into whitespace separated tokens, returns how many there were
+static size_t tokenize(char *line, char **tokens, size_t max_tokens) {
+    size_t n = 0;
+    char *save = NULL, *token;
+    for (token = strtok_r(line, " \t\r\n", &save); token != NULL;
+         token = strtok_r(NULL, " \t\r\n", &save)) {
+        if (n == max_tokens) return max_tokens + 1;
+        tokens[n++] = token;
+    }
+    return n;
+}
+
+static int parse_header(int *columns, size_t *num_columns, char **tokens, size_t num_tokens) {
+    bool seen[32] = {false}, gap_open = false, gap_extend = false;
+
+    if (num_tokens == 0 || num_tokens > MAX_COLUMNS) return -1;
+
+    for (size_t c = 0; c < num_tokens; c++) {
+        if (strcasecmp(tokens[c], "open") == 0 && !gap_open) {
+            columns[c] = COLUMN_GAP_OPEN;
+            gap_open = true;
+        } else if (strcasecmp(tokens[c], "extend") == 0 && !gap_extend) {
+            columns[c] = COLUMN_GAP_EXTEND;
+            gap_extend = true;
+        } else if (is_residue(tokens[c]) && !seen[letters_to_index(tokens[c][0])]) {
+            columns[c] = letters_to_index(tokens[c][0]);
+            seen[columns[c]] = true;
+        } else {
+            return -1;
+        }
+    }
+
+    *num_columns = num_tokens;
+    return gap_open == gap_extend ? 0 : -1;
+}
+
+static void pssm_add_position(pssm_t *pssm, size_t *capacity) {
+    if (pssm->len == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 256;
+        pssm->residues = realloc(pssm->residues, *capacity + 1);
+        pssm->scores = realloc(pssm->scores, sizeof(pssm->scores[0]) * *capacity);
+        pssm->gap_open = realloc(pssm->gap_open, sizeof(score_t) * *capacity);
+        pssm->gap_extend = realloc(pssm->gap_extend, sizeof(score_t) * *capacity);
+    }
+    pssm->len++;
+}
+
+// Parse a position row into position pssm->len - 1
+static int parse_row(pssm_t *pssm, const int *columns, size_t num_columns,
+                     char **tokens, size_t num_tokens) {
+    size_t i = pssm->len - 1, t = 0, c;
+    long value;
+    int8_t *scores = pssm->scores[i];
+    bool seen[32] = {false};
+    int lowest = 0;
+
+    if (num_tokens > 0 && is_number(tokens[0], 0, LONG_MAX, &value)) t++;
+    if (t == num_tokens || !is_residue(tokens[t]) || tokens[t][0] == '*') return -1;
+    pssm->residues[i] = tokens[t++][0];
+    if (num_tokens - t != num_columns) return -1;
+
+    for (c = 0; c < num_columns; c++, t++) {
+        if (columns[c] == COLUMN_GAP_OPEN || columns[c] == COLUMN_GAP_EXTEND) {
+            if (!is_number(tokens[t], INT8_MIN, 0, &value)) return -1;
+            if (columns[c] == COLUMN_GAP_OPEN) pssm->gap_open[i] = (score_t) value;
+            else pssm->gap_extend[i] = (score_t) value;
+        } else {
+            if (!is_number(tokens[t], INT8_MIN + 1, INT8_MAX, &value)) return -1;
+            scores[columns[c]] = (int8_t) value;
+            seen[columns[c]] = true;
+            lowest = MIN2(lowest, (int) value);
+        }
+    }
+
+    // '*' pads batches, so it must never raise a score either
+    for (c = 0; c < 32; c++) {
+        if (!seen[c]) scores[c] = (int8_t) lowest;
+    }
+    return 0;
+}
+
+int pssm_load(pssm_t *pssm, const char *path) {
+    int columns[MAX_COLUMNS];
+    char *tokens[MAX_COLUMNS + 2];
+    char *line = NULL;
+    size_t line_cap = 0, line_num = 0, num_columns = 0, capacity = 0, num_tokens;
+    bool header = false;
+    int status = 0;
+
+    memset(pssm, 0, sizeof(pssm_t));
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: couldn't open PSSM file %s\n", path);
+        return -1;
+    }
+
+    while (status == 0 && getline(&line, &line_cap, file) > 0) {
+        line_num++;
+        if (line[0] == '#') continue;
+        num_tokens = tokenize(line, tokens, MAX_COLUMNS + 2);
+        if (num_tokens == 0) continue;
+
+        if (!header) {
+            status = parse_header(columns, &num_columns, tokens, num_tokens);
+            header = true;
+        } else {
+            pssm_add_position(pssm, &capacity);
+            status = parse_row(pssm, columns, num_columns, tokens, num_tokens);
+        }
+
+        if (status != 0) {
+            fprintf(stderr, "Error: %s:%zu: bad PSSM %s\n", path, line_num,
+                    pssm->len == 0 ? "column headings" : "row");
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    if (status == 0 && pssm->len == 0) {
+        fprintf(stderr, "Error: PSSM file %s has no positions\n", path);
+        status = -1;
+    }
+    if (status != 0) {
+        pssm_dealloc(pssm);
+        return -1;
+    }
+
+    pssm->residues[pssm->len] = '\0';
+
+    bool gaps = false;
+    for (size_t c = 0; c < num_columns; c++) gaps |= columns[c] == COLUMN_GAP_OPEN;
+    if (!gaps) {
+        free(pssm->gap_open);
+        free(pssm->gap_extend);
+        pssm->gap_open = pssm->gap_extend = NULL;
+    }
+    return 0;
+}
+
+void pssm_dealloc(pssm_t *pssm) {
+    free(pssm->residues);
+    free(pssm->scores);
+    free(pssm->gap_open);
+    free(pssm->gap_extend);
+    memset(pssm, 0, sizeof(pssm_t));
+}
@@ -0,0 +1,58 @@
+/*
+ alignment_pssm.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_PSSM_HEADER_SEEN
+#define ALIGNMENT_PSSM_HEADER_SEEN
+
+#include <stddef.h>
+#include "alignment_scoring.h"
+
+// A position-specific scoring matrix query, e.g. built from a protein family.
+// Each query position has its own row of scores against the database residues
+// and may have its own gap penalties.
+//
+// Text format, blank lines and lines starting with '#' are skipped:
+//
+//          A   R   N   D  ...  open extend
+//     1 M -1  -2  -2  -3  ...   -11     -1
+//     2 K -1   2   0  -1  ...   -11     -1
+//
+// The first line names the columns: residues, then optionally the gap
+// penalty columns "open" and "extend". Each following line is a query
+// position: an optional position number, the query residue, then a value
+// per column. Residues without a column score the lowest score of the
+// position (and never more than 0).
+typedef struct
+{
+    size_t len;                 // number of positions
+    char *residues;             // query residue of each position, NUL terminated
+    int8_t (*scores)[32];       // scores[i][letters_to_index(c)]: residue c at position i
+    // Gap penalties of each position (negative, as in scoring_t), or NULL to
+    // use those of the scoring scheme. A gap is charged the penalties of the
+    // query position it is next to.
+    score_t *gap_open, *gap_extend;
+} pssm_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Reads a PSSM from a text file.
+ *
+ * @param pssm   Set to the matrix, free with pssm_dealloc
+ * @param path   Path of the file
+ * @return       0 on success, -1 if the file couldn't be read or parsed
+ */
+int pssm_load(pssm_t *pssm, const char *path);
+
+void pssm_dealloc(pssm_t *pssm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_PSSM_HEADER_SEEN */
@@ -0,0 +1,129 @@
+/*
+ alignment_reader.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+// for F_SETPIPE_SZ
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "alignment_reader.h"
+
+static bool is_gzipped(const char *path) {
+    unsigned char magic[2];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    bool gzipped = read(fd, magic, 2) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    close(fd);
+    return gzipped;
+}
+
+static bool write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+static void *inflate_thread(void *arg) {
+    seq_reader_t *reader = arg;
+    char *buf = malloc(INFLATE_BUFFER_SIZE);
+    int n = 0;
+
+    while (!atomic_load(&reader->stop) &&
+           (n = gzread(reader->gz, buf, INFLATE_BUFFER_SIZE)) > 0) {
+        if (!write_all(reader->write_fd, buf, (size_t) n)) break;
+    }
+
+    if (n < 0 && !atomic_load(&reader->stop)) {
+        int err;
+        fprintf(stderr, "Error: couldn't decompress database: %s\n", gzerror(reader->gz, &err));
+    }
+
+    // the reader sees the end of the file
+    close(reader->write_fd);
+    free(buf);
+    return NULL;
+}
+
+// Unblock the thread if it is waiting for the pipe to drain, then wait for
+// it to close its end
+static void stop_thread(seq_reader_t *reader) {
+    char buf[4096];
+    ssize_t n;
+
+    atomic_store(&reader->stop, true);
+    do {
+        n = read(reader->read_fd, buf, sizeof(buf));
+    } while (n > 0 || (n < 0 && errno == EINTR));
+    pthread_join(reader->thread, NULL);
+    gzclose(reader->gz);
+}
+
+int seq_reader_open(seq_reader_t *reader, const char *path) {
+    int fds[2];
+
+    memset(reader, 0, sizeof(seq_reader_t));
+    atomic_init(&reader->stop, false);
+
+    if (strcmp(path, "-") == 0 || !is_gzipped(path)) {
+        reader->file = seq_open(path);
+        return reader->file != NULL ? 0 : -1;
+    }
+
+    if ((reader->gz = gzopen(path, "r")) == NULL) return -1;
+    gzbuffer(reader->gz, INFLATE_BUFFER_SIZE);
+
+    if (pipe(fds) != 0) {
+        gzclose(reader->gz);
+        return -1;
+    }
+
+#ifdef F_SETPIPE_SZ
+    // Let the thread run a whole block ahead (best effort, capped by the
+    // system's pipe-max-size)
+    fcntl(fds[1], F_SETPIPE_SZ, INFLATE_BUFFER_SIZE);
+#endif
+
+    reader->read_fd = fds[0];
+    reader->write_fd = fds[1];
+
+    if (pthread_create(&reader->thread, NULL, inflate_thread, reader) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        gzclose(reader->gz);
+        return -1;
+    }
+
+    // the file takes ownership of the pipe's read end
+    reader->file = seq_dopen(reader->read_fd, false, false, 0);
+    if (reader->file == NULL) {
+        stop_thread(reader);
+        close(reader->read_fd);
+        return -1;
+    }
+    reader->threaded = true;
+    return 0;
+}
+
+void seq_reader_close(seq_reader_t *reader) {
+    if (reader->threaded) stop_thread(reader);
+
+    // closes the pipe's read end too
+    if (reader->file != NULL) seq_close(reader->file);
+
+    memset(reader, 0, sizeof(seq_reader_t));
+}
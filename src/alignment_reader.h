@@ -0,0 +1,54 @@
+/*
+ alignment_reader.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_READER_HEADER_SEEN
+#define ALIGNMENT_READER_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "seq_file/seq_file.h"
+
+// Size of each block inflated from a gzipped file
+#define INFLATE_BUFFER_SIZE (1 << 20)
+
+// A sequence file whose gzip decompression, if any, runs on a thread of its
+// own. The thread inflates blocks into a pipe that file reads from, so
+// inflating the next block overlaps with parsing and packing this one.
+// The thread points at the struct, so it must not be moved while open.
+typedef struct
+{
+    seq_file_t *file;   // read entries from this
+
+    bool threaded;      // false if the file isn't gzipped
+    gzFile gz;
+    int read_fd, write_fd;
+    pthread_t thread;
+    atomic_bool stop;
+} seq_reader_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Opens a sequence file, starting a decompression thread if it is gzipped.
+ * "-" reads STDIN on the calling thread.
+ *
+ * @param reader   Struct to fill in, close with seq_reader_close
+ * @param path     Path to a FASTA/FASTQ file (may be gzipped)
+ * @return         0 on success, -1 if the file couldn't be opened
+ */
+int seq_reader_open(seq_reader_t *reader, const char *path);
+
+// Stops the decompression thread (the file need not have been read to the end)
+void seq_reader_close(seq_reader_t *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_READER_HEADER_SEEN */
@@ -43,7 +43,18 @@ void scoring_init(scoring_t *scoring,
 
     scoring->case_sensitive = case_sensitive;
 
+    scoring->mode = ALIGN_LOCAL;
+    scoring->free_query_ends = false;
+    scoring->free_db_ends = false;
+
+    scoring->alphabet = ALPHABET_PROTEIN;
+    scoring->query_unknown = UNKNOWN_TO_X;
+    scoring->db_unknown = UNKNOWN_TO_X;
+
     memset(scoring->swap_set, 0, sizeof(scoring->swap_set));
+    // pairs missing from a substitution matrix, such as the '*' that pads
+    // batches, score 0 which never raises a local alignment score
+    memset(scoring->swap_scores, 0, sizeof(scoring->swap_scores));
 
     scoring->min_penalty = MIN2(match, mismatch);
     scoring->max_penalty = MAX2(match, mismatch);
@@ -67,6 +78,23 @@ void scoring_add_mutation(scoring_t *scoring, char a, char b, int score) {
     scoring->max_penalty = MAX2(scoring->max_penalty, score);
 }
 
+/**
+ * Fills swap_scores with the match/mismatch scores, so kernels can always
+ * look scores up. Does nothing when a substitution matrix is used.
+ *
+ * @param scoring          Pointer to the scoring_t structure.
+ */
+void scoring_fill_match_mismatch(scoring_t *scoring) {
+    if (!scoring->use_match_mismatch) return;
+    for (int a = 0; a < 32; a++) {
+        for (int b = 0; b < 32; b++) {
+            scoring->swap_scores[a][b] = (int8_t) (a == b ? scoring->match : scoring->mismatch);
+        }
+    }
+    // '*' pads batches, so never matches
+    scoring->swap_scores[31][31] = (int8_t) scoring->mismatch;
+}
+
 int8_t letters_to_index(char c) {
     if (c >= 97 && c < 123) {
         return c - 96;
@@ -18,6 +18,13 @@
 typedef int16_t score_t;
 #define SCORE_MIN INT_MIN
 
+// Residues that sequences are made of, see alignment_alphabet.h
+enum SeqAlphabet {ALPHABET_PROTEIN, ALPHABET_DNA, ALPHABET_RNA};
+// What to do with residues that aren't in the alphabet
+enum UnknownResidues {UNKNOWN_TO_X, UNKNOWN_SKIP, UNKNOWN_ERROR};
+// Smith-Waterman local or Needleman-Wunsch global alignment
+enum AlignMode {ALIGN_LOCAL, ALIGN_GLOBAL};
+
 typedef struct
 {
   score_t gap_open, gap_extend;
@@ -28,6 +35,16 @@ typedef struct
 
   bool case_sensitive;
 
+  enum AlignMode mode;
+  // Global alignment only: gaps before/after the query or the database
+  // sequence are free (semi-global), e.g. to fit a read into a reference
+  bool free_query_ends, free_db_ends;
+
+  // Protein residues are those in the substitution matrix (any letter without
+  // one), unknown residues become X for proteins and N for nucleotides
+  enum SeqAlphabet alphabet;
+  enum UnknownResidues query_unknown, db_unknown;
+
   // Array of characters that match to everything with the same penalty (i.e. 'N's)
   uint32_t swap_set[32];
   // The penalty or the reward for a match/mismatch between two characters.
@@ -43,6 +60,9 @@ typedef struct
         ((scoring)->swap_set[(size_t)(a)] |= (1U << (b)))
 #endif
 
+// Gaps cost gap_extend per residue, with nothing extra to open them
+#define scoring_linear_gaps(scoring) ((scoring)->gap_open == 0)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -53,6 +73,8 @@ void scoring_init(scoring_t* scoring, int match, int mismatch,
 
 void scoring_add_mutation(scoring_t* scoring, char a, char b, int score);
 
+void scoring_fill_match_mismatch(scoring_t *scoring);
+
 int8_t letters_to_index(char c);
 
 char index_to_letters(int8_t c);
@@ -17,35 +17,26 @@
 #include "alignment_scoring_load.h"
 
 /*
- * Helper function to handle errors during matrix or substitution pair loading.
- * Exits the program after printing the error message, file path, and line number.
+ * Helper function to handle errors during matrix loading.
+ * Records the error message and line number for the caller to report.
  *
  * Parameters:
- *   err_msg     - The error message to display.
- *   file_path   - The path of the file being processed.
- *   line_num    - The line number in the file where the error occurred.
- *   is_matrix   - Flag indicating whether the error occurred in a substitution matrix (1) 
- *                 or a substitution pair (0).
+ *   err_msg     - The error message.
+ *   line_num    - The line number in the file where the error occurred, or -1.
+ *   msg, line   - Where to record them.
  */
-static void _loading_error(const char *err_msg, const char *file_path,
-                           int line_num, char is_matrix)
-__attribute__((noreturn));
-
-static void _loading_error(const char *err_msg, const char *file_path,
-                           int line_num, char is_matrix) {
-    if (is_matrix) fprintf(stderr, "Error: substitution matrix : %s\n", err_msg);
-    else fprintf(stderr, "Error: substitution pairs : %s\n", err_msg);
-
-    if (file_path != NULL) fprintf(stderr, "File: %s\n", file_path);
-    if (line_num != -1) fprintf(stderr, "Line: %s\n", file_path);
-
-    exit(EXIT_FAILURE);
+static void _loading_error(const char *err_msg, int line_num,
+                           const char **msg, int *line) {
+    *msg = err_msg;
+    *line = line_num;
 }
 
 /*
  * Function to load a scoring matrix for sequence alignment.
  * Reads a file and populates scoring values for character pair mutations based on
  * either a whitespace-separated or custom-separator format.
+ * Exits the program after printing the error message, file path, and line number
+ * if the file is malformed.
  *
  * Parameters:
  *   file           - A gzFile pointer to the input file containing the scoring matrix.
@@ -56,7 +47,31 @@ static void _loading_error(const char *err_msg, const char *file_path,
  */
 void align_scoring_load_matrix(gzFile file, const char *file_path,
                                scoring_t *scoring, char case_sensitive) {
+    const char *err_msg;
+    int line_num;
+
+    if (align_scoring_try_load_matrix(file, scoring, case_sensitive, &err_msg, &line_num) != 0) {
+        fprintf(stderr, "Error: substitution matrix : %s\n", err_msg);
+        if (file_path != NULL) fprintf(stderr, "File: %s\n", file_path);
+        if (line_num != -1) fprintf(stderr, "Line: %i\n", line_num);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * As align_scoring_load_matrix, but returns -1 on a malformed file instead of
+ * exiting, for callers that report errors themselves.
+ *
+ * Parameters:
+ *   err_msg, err_line - Set to the error message and the line number it
+ *                       occurred on (-1 if none) when -1 is returned.
+ *
+ * Returns 0 on success, -1 on a malformed file.
+ */
+int align_scoring_try_load_matrix(gzFile file, scoring_t *scoring, char case_sensitive,
+                                  const char **err_msg, int *err_line) {
     StrBuf *sbuf = strbuf_new(500);
+    char *characters = NULL;
     size_t read_length;
     int line_num = 0;
 
@@ -70,7 +85,8 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
             // Read first line
 
             if (sbuf->end < 2) {
-                _loading_error("Too few column headings", file_path, line_num, 1);
+                _loading_error("Too few column headings", line_num, err_msg, err_line);
+                goto fail;
             }
 
             break;
@@ -80,7 +96,8 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
     }
 
     if (line_num == 0 && sbuf->end <= 0) {
-        _loading_error("Empty file", file_path, -1, 0);
+        _loading_error("Empty file", -1, err_msg, err_line);
+        goto fail;
     }
 
     // If the separator character is whitespace,
@@ -89,10 +106,11 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
 
     if ((sep >= (int) '0' && sep <= (int) '9') || sep == '-') {
         _loading_error("Numbers (0-9) and dashes (-) do not make good separators",
-                       file_path, line_num, 0);
+                       line_num, err_msg, err_line);
+        goto fail;
     }
 
-    char *characters = (char *) malloc(sbuf->end);
+    characters = (char *) malloc(sbuf->end);
     int num_of_chars = 0;
 
     if (isspace(sep)) {
@@ -125,7 +143,8 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
 
                 if (!isspace(*score_txt)) {
                     _loading_error("Expected whitespace between elements - found character",
-                                   file_path, line_num, 1);
+                                   line_num, err_msg, err_line);
+                    goto fail;
                 }
 
                 score_txt = string_next_nonwhitespace(score_txt + 1);
@@ -135,7 +154,8 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
 
                 // If pointer to end of number string hasn't moved -> error
                 if (strtol_last_char_ptr == score_txt) {
-                    _loading_error("Missing number value on line", file_path, line_num, 1);
+                    _loading_error("Missing number value on line", line_num, err_msg, err_line);
+                    goto fail;
                 }
 
                 scoring_add_mutation(scoring, from_char, to_char, score);
@@ -144,7 +164,8 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
             }
 
             if (*score_txt != '\0' && !string_is_all_whitespace(score_txt)) {
-                _loading_error("Too many columns on row", file_path, line_num, 1);
+                _loading_error("Too many columns on row", line_num, err_msg, err_line);
+                goto fail;
             }
 
             line_num++;
@@ -154,7 +175,8 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
 
         for (i = 0; i < sbuf->end; i += 2) {
             if (sbuf->b[i] != sep) {
-                _loading_error("Separator missing from line", file_path, line_num, 1);
+                _loading_error("Separator missing from line", line_num, err_msg, err_line);
+                goto fail;
             }
 
             char c = case_sensitive ? sbuf->b[i + 1] : tolower(sbuf->b[i + 1]);
@@ -183,7 +205,8 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
                 to_char = characters[to_char_index++];
 
                 if (*str_pos != sep) {
-                    _loading_error("Separator missing from line", file_path, line_num, 1);
+                    _loading_error("Separator missing from line", line_num, err_msg, err_line);
+                    goto fail;
                 }
 
                 // Move past separator
@@ -194,11 +217,13 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
 
                 // If pointer to end of number string hasn't moved -> error
                 if (str_pos == after_num_str) {
-                    _loading_error("Missing number value on line", file_path, line_num, 1);
+                    _loading_error("Missing number value on line", line_num, err_msg, err_line);
+                    goto fail;
                 }
 
                 if (to_char_index >= num_of_chars) {
-                    _loading_error("Too many columns on row", file_path, line_num, 1);
+                    _loading_error("Too many columns on row", line_num, err_msg, err_line);
+                    goto fail;
                 }
 
                 scoring_add_mutation(scoring, from_char, to_char, score);
@@ -212,4 +237,10 @@ void align_scoring_load_matrix(gzFile file, const char *file_path,
 
     free(characters);
     strbuf_free(sbuf);
+    return 0;
+
+fail:
+    free(characters);
+    strbuf_free(sbuf);
+    return -1;
 }
\ No newline at end of file
@@ -14,4 +14,7 @@
 void align_scoring_load_matrix(gzFile file, const char* file_path,
                                scoring_t* scoring, char case_sensitive);
 
+int align_scoring_try_load_matrix(gzFile file, scoring_t* scoring, char case_sensitive,
+                                  const char** err_msg, int* err_line);
+
 #endif
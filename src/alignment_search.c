@@ -0,0 +1,1501 @@
+/*
+ alignment_search.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <omp.h>
+
+#include "alignment_search.h"
+#include "alignment_prefilter.h"
+#include "alignment_stats.h"
+#include "alignment_reader.h"
+#include "alignment_fasta.h"
+#include "alignment_alphabet.h"
+#include "alignment_nucleotide.h"
+#include "alignment_wavefront.h"
+#include "alignment_interquery.h"
+#include "alignment_cache.h"
+#include "alignment_perf.h"
+#include "alignment_trace.h"
+#include "alignment_macros.h"
+
+#define VECTOR_SIZE (32 / sizeof(score_t))
+// Bytes of a packed batch of rows residues, a multiple of 32 for aligned_alloc
+#define BATCH_BYTES(rows) ((MAX2(rows, 1) + 1) / 2 * 2 * VECTOR_SIZE)
+
+struct sw_db_t
+{
+    scoring_t scoring;
+    alphabet_t query_alphabet, db_alphabet;
+
+    // Entries, in file order. When read from a mapped file, entry i is entry
+    // first_entry + i of map and names/seqs are only copied out on request.
+    const fasta_map_t *map;
+    fasta_map_t *owned_map;
+    size_t first_entry, num_entries, capacity;
+    char **names, **seqs;
+    size_t *lens, max_len, num_residues;
+    size_t text_bytes;        // of the names and seqs read into the handle
+
+    // Statistical parameters of the scoring scheme, found on first use
+    int karlin_state; // 0 not yet looked up, 1 found, -1 none
+    karlin_t karlin;
+
+    // Batch b holds entries [b*batch_lanes, (b+1)*batch_lanes) interleaved,
+    // padded with '*' to the length of its longest entry. DNA/RNA databases
+    // whose scores fit in 8 bits are instead packed 2 bits per residue into
+    // batches of NT_VECTOR_SIZE entries, see alignment_nucleotide.h.
+    bool nucleotide;
+    nt_scoring_t nt;
+    size_t batch_lanes;
+    size_t num_batches;
+    int8_t **batch_indexes;
+    size_t *batch_rows;
+    // Lanes of each nucleotide batch whose entries have unknown residues,
+    // packed as bases, which the 16-bit kernel aligns again
+    uint32_t *nt_unknown;
+
+    // Scratch space kept alive between searches
+    int num_threads;
+    size_t scratch_len;       // longest query the aligners were created for
+    size_t scratch_queries;   // number of queries the buffers below fit
+    size_t query_stride;      // distance between queries in query_indexes
+    aligner_t **aligners;     // one per thread
+    int8_t *query_indexes;    // scratch_queries x query_stride
+    uint8_t *query_codes;     // query_indexes as nucleotide codes
+    size_t *query_lens;       // residues of each query once translated
+    const pssm_t *const *query_pssms; // profile of each query of the search, or NULL
+    int32_t *batch_scores;    // scratch_queries x num_batches x batch_lanes
+};
+
+static double interval(struct timespec start, struct timespec end) {
+    struct timespec temp;
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+    if (temp.tv_nsec < 0) {
+        temp.tv_sec = temp.tv_sec - 1;
+        temp.tv_nsec = temp.tv_nsec + 1000000000;
+    }
+    return (((double) temp.tv_sec) + ((double) temp.tv_nsec) * 1.0e-9);
+}
+
+static void db_add_entry(sw_db_t *db, const read_t *r) {
+    if (db->num_entries == db->capacity) {
+        db->capacity = db->capacity ? db->capacity * 2 : 1024;
+        db->names = realloc(db->names, sizeof(char *) * db->capacity);
+        db->seqs = realloc(db->seqs, sizeof(char *) * db->capacity);
+        db->lens = realloc(db->lens, sizeof(size_t) * db->capacity);
+    }
+    db->names[db->num_entries] = strdup(r->name.b);
+    db->seqs[db->num_entries] = strdup(r->seq.b);
+    db->lens[db->num_entries] = r->seq.end;
+    db->max_len = MAX2(db->max_len, r->seq.end);
+    db->num_residues += r->seq.end;
+    db->text_bytes += r->name.end + r->seq.end + 2;
+    db->num_entries++;
+}
+
+// Convert entry e to indexes, shrinking it if it has unknown residues that
+// are skipped
+static int db_translate_entry(sw_db_t *db, size_t e, int8_t *out, size_t stride) {
+    size_t *len = &db->lens[e];
+    if (db->map != NULL) {
+        return fasta_map_indexes(db->map, &db->db_alphabet, db->first_entry + e,
+                                 out, stride, len);
+    }
+    return alphabet_translate(&db->db_alphabet, db->seqs[e], *len, out, stride, len);
+}
+
+// Convert the entries of batch b to indexes and interleave them
+static int db_pack_batch(sw_db_t *db, size_t b) {
+    size_t first = b * db->batch_lanes;
+    size_t lanes = MIN2(db->batch_lanes, db->num_entries - first);
+    size_t rows = 0, lane;
+    int status = 0;
+
+    for (lane = 0; lane < lanes; lane++) {
+        rows = MAX2(rows, db->lens[first + lane]);
+    }
+
+    if (db->nucleotide) {
+        // the kernel reads each lane up to its own length, so there's no padding
+        uint8_t *packed = aligned_alloc(32, NT_BATCH_BYTES(rows));
+        int8_t *entry = malloc(MAX2(rows, 1));
+        memset(packed, 0, NT_BATCH_BYTES(rows));
+
+        for (lane = 0; lane < lanes && status == 0; lane++) {
+            status = db_translate_entry(db, first + lane, entry, 1);
+            if (nt_pack_lane(&db->nt, packed, lane, entry, db->lens[first + lane])) {
+                db->nt_unknown[b] |= 1U << lane;
+            }
+        }
+
+        free(entry);
+        db->batch_indexes[b] = (int8_t *) packed;
+        db->batch_rows[b] = rows;
+        return status;
+    }
+
+    // lanes past the end of the database and residues past the end of
+    // shorter entries are matched with *
+    int8_t *indexes = aligned_alloc(32, BATCH_BYTES(rows));
+    memset(indexes, letters_to_index('*'), BATCH_BYTES(rows));
+
+    for (lane = 0; lane < lanes && status == 0; lane++) {
+        status = db_translate_entry(db, first + lane, indexes + lane, VECTOR_SIZE);
+    }
+
+    db->batch_indexes[b] = indexes;
+    db->batch_rows[b] = rows;
+    return status;
+}
+
+// Call at the end of a parallel loop with nowait, so the trace shows how
+// long each thread waits for the others
+static void trace_barrier(void) {
+    uint64_t begin = trace_begin();
+#pragma omp barrier
+    trace_end(TRACE_WAIT, begin, 0);
+}
+
+static int db_pack(sw_db_t *db) {
+    size_t b, i;
+    int status = 0;
+
+    db->num_batches = (db->num_entries + db->batch_lanes - 1) / db->batch_lanes;
+    db->batch_indexes = calloc(db->num_batches, sizeof(int8_t *));
+    db->batch_rows = malloc(sizeof(size_t) * db->num_batches);
+    if (db->nucleotide) db->nt_unknown = calloc(db->num_batches, sizeof(uint32_t));
+
+#pragma omp parallel num_threads(db->num_threads)
+    {
+#pragma omp for schedule(dynamic, 1) reduction(min:status) nowait
+        for (b = 0; b < db->num_batches; b++) {
+            uint64_t begin = trace_begin();
+            int batch_status = db_pack_batch(db, b); // MIN2 evaluates its arguments twice
+            status = MIN2(status, batch_status);
+            trace_end(TRACE_PACK, begin, b);
+        }
+        trace_barrier();
+    }
+
+    db->num_residues = 0;
+    for (i = 0; i < db->num_entries; i++) db->num_residues += db->lens[i];
+    return status;
+}
+
+static sw_db_t *db_new(const scoring_t *scoring, size_t first_entry) {
+    // scoring holds vectors, so the handle needs their alignment
+    sw_db_t *db = aligned_alloc(alignof(sw_db_t), sizeof(sw_db_t));
+    memset(db, 0, sizeof(sw_db_t));
+    db->scoring = *scoring;
+    db->first_entry = first_entry;
+    db->num_threads = omp_get_max_threads();
+    scoring_fill_match_mismatch(&db->scoring);
+    db->nucleotide = nt_scoring_init(&db->nt, &db->scoring);
+    db->batch_lanes = db->nucleotide ? NT_VECTOR_SIZE : VECTOR_SIZE;
+    alphabet_init(&db->query_alphabet, scoring, scoring->query_unknown);
+    alphabet_init(&db->db_alphabet, scoring, scoring->db_unknown);
+    return db;
+}
+
+// A shard without entries, when there are more shards than entries
+static sw_db_t *db_empty(const scoring_t *scoring, size_t first_entry) {
+    sw_db_t *db = db_new(scoring, first_entry);
+    db_pack(db);
+    return db;
+}
+
+sw_db_t *sw_db_load(seq_file_t *file, const scoring_t *scoring,
+                    size_t max_entries, size_t first_entry) {
+    read_t r;
+    seq_read_alloc(&r);
+
+    sw_db_t *db = db_new(scoring, first_entry);
+
+    uint64_t begin = trace_begin();
+    while (db->num_entries < max_entries && seq_read(file, &r) > 0) {
+        assert(r.name.end != 0);
+        db_add_entry(db, &r);
+    }
+    trace_end(TRACE_READ, begin, db->num_entries);
+
+    seq_read_dealloc(&r);
+
+    if (db->num_entries == 0 || db_pack(db) != 0) {
+        sw_db_close(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+sw_db_t *sw_db_load_map(const fasta_map_t *map, const scoring_t *scoring,
+                        size_t max_entries, size_t first_entry) {
+    size_t i;
+
+    if (first_entry >= map->num_entries) return NULL;
+
+    sw_db_t *db = db_new(scoring, first_entry);
+    db->map = map;
+    db->num_entries = db->capacity = MIN2(max_entries, map->num_entries - first_entry);
+
+    db->names = calloc(db->num_entries, sizeof(char *));
+    db->seqs = calloc(db->num_entries, sizeof(char *));
+    db->lens = malloc(sizeof(size_t) * db->num_entries);
+    memcpy(db->lens, map->lens + first_entry, sizeof(size_t) * db->num_entries);
+
+    for (i = 0; i < db->num_entries; i++) {
+        db->max_len = MAX2(db->max_len, db->lens[i]);
+    }
+
+    if (db_pack(db) != 0) {
+        sw_db_close(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+int sw_db_size(const char *db_path, size_t *num_residues, size_t *num_entries) {
+    seq_reader_t reader;
+    fasta_map_t map;
+    read_t r;
+
+    if (fasta_map_open(&map, db_path) == 0) {
+        *num_residues = map.num_residues;
+        *num_entries = map.num_entries;
+        fasta_map_close(&map);
+        return 0;
+    }
+
+    if (seq_reader_open(&reader, db_path) != 0) {
+        fprintf(stderr, "Error: couldn't open database file %s\n", db_path);
+        return -1;
+    }
+
+    seq_read_alloc(&r);
+    *num_residues = *num_entries = 0;
+    while (seq_read(reader.file, &r) > 0) {
+        *num_residues += r.seq.end;
+        (*num_entries)++;
+    }
+    seq_read_dealloc(&r);
+    seq_reader_close(&reader);
+    return 0;
+}
+
+sw_db_t *sw_db_open_shard(const char *db_path, const scoring_t *scoring,
+                          size_t shard, size_t num_shards) {
+    seq_reader_t reader;
+    read_t r;
+    size_t num_residues, num_entries, i;
+    fasta_map_t *map = malloc(sizeof(fasta_map_t));
+
+    assert(shard < num_shards);
+
+    // Plain FASTA is packed straight from a mapping of the file
+    if (fasta_map_open(map, db_path) == 0) {
+        size_t first = map->num_entries * shard / num_shards;
+        size_t end = map->num_entries * (shard + 1) / num_shards;
+        if (first == end && map->num_entries > 0) {
+            fasta_map_close(map);
+            free(map);
+            return db_empty(scoring, first);
+        }
+        sw_db_t *db = first < end ? sw_db_load_map(map, scoring, end - first, first) : NULL;
+        if (db == NULL) {
+            fprintf(stderr, "Error: database file %s is invalid\n", db_path);
+            fasta_map_close(map);
+            free(map);
+            return NULL;
+        }
+        db->owned_map = map;
+        return db;
+    }
+    free(map);
+
+    // Only the whole file can be read without counting it first
+    num_entries = SIZE_MAX;
+    if (num_shards > 1 && sw_db_size(db_path, &num_residues, &num_entries) != 0) return NULL;
+    size_t first = num_shards > 1 ? num_entries * shard / num_shards : 0;
+    size_t end = num_shards > 1 ? num_entries * (shard + 1) / num_shards : SIZE_MAX;
+    if (first == end && num_entries > 0) return db_empty(scoring, first);
+
+    if (seq_reader_open(&reader, db_path) != 0) {
+        fprintf(stderr, "Error: couldn't open database file %s\n", db_path);
+        return NULL;
+    }
+
+    seq_read_alloc(&r);
+    for (i = 0; i < first && seq_read(reader.file, &r) > 0; i++) {}
+    seq_read_dealloc(&r);
+
+    sw_db_t *db = first < end ? sw_db_load(reader.file, scoring, end - first, first) : NULL;
+    seq_reader_close(&reader);
+
+    if (db == NULL) {
+        fprintf(stderr, "Error: database file %s is empty or invalid\n", db_path);
+    }
+
+    return db;
+}
+
+sw_db_t *sw_db_open(const char *db_path, const scoring_t *scoring) {
+    return sw_db_open_shard(db_path, scoring, 0, 1);
+}
+
+static void db_free_aligners(sw_db_t *db) {
+    if (db->aligners != NULL) {
+        for (int t = 0; t < db->num_threads; t++) {
+            aligner_destroy(db->aligners[t]);
+            free(db->aligners[t]);
+        }
+        free(db->aligners);
+    }
+    db->aligners = NULL;
+    db->scratch_len = 0;
+}
+
+static void db_free_scratch(sw_db_t *db) {
+    db_free_aligners(db);
+    free(db->query_indexes);
+    free(db->query_codes);
+    free(db->query_lens);
+    free(db->batch_scores);
+    db->query_indexes = NULL;
+    db->query_codes = NULL;
+    db->query_lens = NULL;
+    db->batch_scores = NULL;
+    db->scratch_queries = 0;
+}
+
+// Make sure there is a row buffer per thread wide enough for the longest
+// query, and index/score buffers for num_queries queries
+static void db_reserve_scratch(sw_db_t *db, size_t max_query_len, size_t num_queries) {
+    if (max_query_len > db->scratch_len) {
+        db_free_aligners(db);
+
+        // aligners are always sized for a full vector, the last batch of a
+        // database may use fewer lanes
+        db->aligners = malloc(sizeof(aligner_t *) * db->num_threads);
+        for (int t = 0; t < db->num_threads; t++) {
+            db->aligners[t] = aligner_create(NULL, NULL, NULL, NULL, NULL, NULL,
+                                             max_query_len, 0, VECTOR_SIZE, &db->scoring);
+        }
+        db->scratch_len = max_query_len;
+        // force the query buffers to be resized too
+        db->scratch_queries = 0;
+    }
+
+    if (num_queries > db->scratch_queries) {
+        free(db->query_indexes);
+        free(db->query_codes);
+        free(db->query_lens);
+        free(db->batch_scores);
+        db->query_stride = (db->scratch_len + 31) / 32 * 32;
+        db->query_indexes = aligned_alloc(32, db->query_stride * num_queries);
+        db->query_codes = db->nucleotide ? malloc(db->query_stride * num_queries) : NULL;
+        db->query_lens = malloc(sizeof(size_t) * num_queries);
+        db->batch_scores = aligned_alloc(32, sizeof(int32_t) * db->batch_lanes *
+                                             db->num_batches * num_queries);
+        db->scratch_queries = num_queries;
+    }
+}
+
+void sw_db_close(sw_db_t *db) {
+    size_t i;
+    if (db == NULL) return;
+
+    db_free_scratch(db);
+
+    for (i = 0; i < db->num_entries; i++) {
+        free(db->names[i]);
+        free(db->seqs[i]);
+    }
+    if (db->batch_indexes != NULL) {
+        for (i = 0; i < db->num_batches; i++) {
+            free(db->batch_indexes[i]);
+        }
+    }
+
+    free(db->names);
+    free(db->seqs);
+    free(db->lens);
+    free(db->batch_indexes);
+    free(db->batch_rows);
+    free(db->nt_unknown);
+
+    if (db->owned_map != NULL) {
+        fasta_map_close(db->owned_map);
+        free(db->owned_map);
+    }
+    free(db);
+}
+
+size_t sw_db_num_entries(const sw_db_t *db) {
+    return db->num_entries;
+}
+
+const char *sw_db_entry_name(const sw_db_t *db, size_t entry) {
+    assert(entry >= db->first_entry && entry - db->first_entry < db->num_entries);
+    char **name = &db->names[entry - db->first_entry];
+    if (*name == NULL) *name = fasta_map_name(db->map, entry);
+    return *name;
+}
+
+size_t sw_db_num_residues(const sw_db_t *db) {
+    return db->num_residues;
+}
+
+// Residue indexes of entry e, as packed into its batch, residue i to
+// out[i * stride]. Nucleotide entries with unknown residues are translated
+// again, as their batch holds bases in their place.
+static void db_entry_indexes(const sw_db_t *db, size_t e, int8_t *out, size_t stride) {
+    size_t b = e / db->batch_lanes, lane = e % db->batch_lanes, i;
+    if (db->nucleotide && (db->nt_unknown[b] >> lane & 1)) {
+        size_t len = db->lens[e];
+        if (db->map != NULL) {
+            fasta_map_indexes(db->map, &db->db_alphabet, db->first_entry + e, out, stride, &len);
+        } else {
+            alphabet_translate(&db->db_alphabet, db->seqs[e], len, out, stride, &len);
+        }
+        return;
+    }
+    if (db->nucleotide) {
+        nt_unpack_lane(&db->nt, (const uint8_t *) db->batch_indexes[b], lane, db->lens[e], out, stride);
+        return;
+    }
+    for (i = 0; i < db->lens[e]; i++) out[i * stride] = db->batch_indexes[b][i * VECTOR_SIZE + lane];
+}
+
+// The text of each entry, header line included, straight from the mapped
+// file, so that checking the entries before a checkpoint doesn't pack them
+static uint64_t map_fingerprint(const fasta_map_t *map, size_t first, size_t num_entries,
+                                uint64_t seed) {
+    uint64_t h = seed;
+    for (size_t e = first; e < first + num_entries; e++) {
+        h = cache_hash(map->data + map->name_offsets[e], map->seq_ends[e] - map->name_offsets[e], h);
+    }
+    return h;
+}
+
+uint64_t sw_db_map_fingerprint(const fasta_map_t *map, size_t num_entries, uint64_t seed) {
+    return map_fingerprint(map, 0, MIN2(num_entries, map->num_entries), seed);
+}
+
+uint64_t sw_db_fingerprint(const sw_db_t *db, uint64_t seed) {
+    if (db->map != NULL) return map_fingerprint(db->map, db->first_entry, db->num_entries, seed);
+
+    int8_t *residues = malloc(MAX2(db->max_len, 1));
+    uint64_t h = seed;
+
+    for (size_t e = 0; e < db->num_entries; e++) {
+        db_entry_indexes(db, e, residues, 1);
+        h = cache_hash(residues, db->lens[e], h);
+    }
+
+    free(residues);
+    return h;
+}
+
+size_t sw_db_memory(const sw_db_t *db, size_t *scratch_bytes) {
+    size_t b, bytes = sizeof(sw_db_t) + db->text_bytes;
+
+    bytes += db->capacity * (2 * sizeof(char *) + sizeof(size_t));
+    bytes += db->num_batches * (sizeof(int8_t *) + sizeof(size_t));
+    if (db->nucleotide) bytes += db->num_batches * sizeof(uint32_t);
+    for (b = 0; b < db->num_batches; b++) {
+        bytes += db->nucleotide ? NT_BATCH_BYTES(db->batch_rows[b]) : BATCH_BYTES(db->batch_rows[b]);
+    }
+    // one score per entry per query
+    bytes += sizeof(int32_t) * db->batch_lanes * db->num_batches * db->scratch_queries;
+
+    if (scratch_bytes != NULL) {
+        // row buffers of each thread's aligner, see aligner_create
+        size_t row_bytes = sizeof(score_t) * (db->scratch_len + 1) * VECTOR_SIZE;
+        *scratch_bytes = db->aligners == NULL ? 0 : db->num_threads * (3 * row_bytes +
+                                                                      sizeof(score_t) * VECTOR_SIZE);
+        *scratch_bytes += (db->query_stride * (db->nucleotide ? 2 : 1) + sizeof(size_t)) *
+                          db->scratch_queries;
+    }
+    return bytes;
+}
+
+const char *sw_db_entry_seq(const sw_db_t *db, size_t entry) {
+    assert(entry >= db->first_entry && entry - db->first_entry < db->num_entries);
+    char **seq = &db->seqs[entry - db->first_entry];
+    if (*seq == NULL) *seq = fasta_map_seq(db->map, entry);
+    return *seq;
+}
+
+size_t sw_db_entry_len(const sw_db_t *db, size_t entry) {
+    assert(entry >= db->first_entry && entry - db->first_entry < db->num_entries);
+    return db->lens[entry - db->first_entry];
+}
+
+void sw_search_opts_init(sw_search_opts_t *opts) {
+    opts->min_score = 0;
+    opts->max_hits = 0;
+    opts->exact = true;
+    opts->prefilter_score = 0;
+    opts->prefilter_word_score = PREFILTER_WORD_SCORE;
+    opts->ungapped_cutoff = 0;
+    opts->stats = false;
+    opts->max_evalue = 0;
+    opts->db_residues = 0;
+    opts->db_entries = 0;
+    opts->ends = false;
+}
+
+void sw_results_alloc(sw_results_t *results) {
+    memset(results, 0, sizeof(sw_results_t));
+}
+
+void sw_results_dealloc(sw_results_t *results) {
+    free(results->hits);
+    memset(results, 0, sizeof(sw_results_t));
+}
+
+static void results_add(sw_results_t *results, size_t entry, int32_t score) {
+    if (results->num_hits == results->capacity) {
+        results->capacity = results->capacity ? results->capacity * 2 : 256;
+        results->hits = realloc(results->hits, sizeof(sw_hit_t) * results->capacity);
+    }
+    results->hits[results->num_hits].entry = entry;
+    results->hits[results->num_hits].score = score;
+    results->hits[results->num_hits].bit_score = 0;
+    results->hits[results->num_hits].evalue = 0;
+    results->hits[results->num_hits].query_end = 0;
+    results->hits[results->num_hits].entry_end = 0;
+    results->num_hits++;
+}
+
+static int hit_cmp_best_first(const void *a, const void *b) {
+    const sw_hit_t *x = a, *y = b;
+    if (x->score != y->score) return x->score > y->score ? -1 : 1;
+    return x->entry < y->entry ? -1 : (x->entry > y->entry);
+}
+
+static const karlin_t *db_karlin(sw_db_t *db) {
+    // chunks of a streamed database each have a handle, only warn once
+    static bool warned = false;
+
+    if (db->karlin_state == 0) {
+        db->karlin_state = karlin_params_init(&db->scoring, &db->karlin) ? 1 : -1;
+
+        if (db->karlin_state < 0) {
+            fprintf(stderr, "Error: scoring scheme has no alignment statistics "
+                            "(its expected score is not negative)\n");
+        } else if (!db->karlin.gapped && !warned) {
+            warned = true;
+            fprintf(stderr, "Warning: no gapped statistics for this matrix and gap "
+                            "penalties, E-values use ungapped statistics and will be too low\n");
+        }
+    }
+    return db->karlin_state > 0 ? &db->karlin : NULL;
+}
+
+// Entries removed by the prefilter are given this score
+#define SCORE_FILTERED -1
+
+// Set the aligner up to align query q, with its profile if it is a PSSM
+static void aligner_set_query_profile(const sw_db_t *db, aligner_t *aligner, size_t q) {
+    const pssm_t *pssm = db->query_pssms != NULL ? db->query_pssms[q] : NULL;
+    aligner->query_profile = pssm != NULL ? (const int8_t (*)[32]) pssm->scores : NULL;
+    aligner->query_gap_open = pssm != NULL ? pssm->gap_open : NULL;
+    aligner->query_gap_extend = pssm != NULL ? pssm->gap_extend : NULL;
+}
+
+// Align query q again against a list of entries, VECTOR_SIZE at a time,
+// unpacked from their batches: with 16-bit scores, or 32-bit scores when
+// wide. Sets scores[k] to the score of entries[k], and with query_ends set
+// (wide only) where its best alignment ends to query_ends[k] and entry_ends[k].
+static void align_entry_list(sw_db_t *db, aligner_t *aligner, const size_t *entries,
+                             size_t num_entries, const size_t *query_lens, size_t q,
+                             bool wide, int32_t *scores, size_t *query_ends, size_t *entry_ends) {
+    alignas(32) int32_t wide_scores[VECTOR_SIZE];
+    size_t lens[VECTOR_SIZE], end_a[VECTOR_SIZE], end_b[VECTOR_SIZE], i, k;
+
+    for (i = 0; i < num_entries; i += VECTOR_SIZE) {
+        size_t n = MIN2(VECTOR_SIZE, num_entries - i), rows = 0;
+        for (k = 0; k < n; k++) {
+            lens[k] = db->lens[entries[i + k]];
+            rows = MAX2(rows, lens[k]);
+        }
+
+        int8_t *indexes = aligned_alloc(32, BATCH_BYTES(rows));
+        memset(indexes, letters_to_index('*'), BATCH_BYTES(rows));
+        for (k = 0; k < n; k++) db_entry_indexes(db, entries[i + k], indexes + k, VECTOR_SIZE);
+
+        aligner_update(aligner, NULL, NULL, NULL, NULL,
+                       db->query_indexes + q * db->query_stride, indexes,
+                       query_lens[q], rows, n, &db->scoring);
+        aligner_set_query_profile(db, aligner, q);
+        aligner->seq_b_lens = lens;
+        aligner->best_end_a = query_ends != NULL ? end_a : NULL;
+        aligner->best_end_b = query_ends != NULL ? end_b : NULL;
+
+        if (wide) {
+            alignment_fill_matrices32(aligner, wide_scores);
+            for (k = 0; k < n; k++) scores[i + k] = wide_scores[k];
+            for (k = 0; k < n && query_ends != NULL; k++) {
+                query_ends[i + k] = end_a[k];
+                entry_ends[i + k] = end_b[k];
+            }
+        } else {
+            alignment_fill_matrices(aligner);
+            for (k = 0; k < n; k++) scores[i + k] = aligner->max_scores[k];
+        }
+        aligner->best_end_a = aligner->best_end_b = NULL;
+        free(indexes);
+    }
+}
+
+// Align query q again with 16-bit scores against the lanes of nucleotide
+// batch b that saturated the 8-bit kernel or hold unknown residues
+static void align_nt_overflow(sw_db_t *db, aligner_t *aligner, size_t b,
+                              const size_t *query_lens, size_t q, uint32_t overflow,
+                              int32_t *scores) {
+    size_t entries[NT_VECTOR_SIZE], num_lanes = 0, k;
+    int32_t lane_scores[NT_VECTOR_SIZE];
+
+    for (; overflow != 0; overflow &= overflow - 1) {
+        entries[num_lanes++] = b * NT_VECTOR_SIZE + (size_t) __builtin_ctz(overflow);
+    }
+
+    align_entry_list(db, aligner, entries, num_lanes, query_lens, q, false, lane_scores, NULL, NULL);
+    for (k = 0; k < num_lanes; k++) scores[entries[k] % NT_VECTOR_SIZE] = lane_scores[k];
+}
+
+// Align query q against batch b of lanes entries, writing its scores to
+// batch_scores. Nucleotide batches are always those of the database, PSSM
+// queries align them with 16-bit scores.
+static void align_query_batch(sw_db_t *db, aligner_t *aligner, int8_t *const *batch_indexes,
+                              const size_t *batch_rows, size_t b, size_t lanes,
+                              const size_t *query_lens, size_t q, int32_t *batch_scores) {
+    size_t first = b * db->batch_lanes, lane;
+
+    if (db->nucleotide && db->query_pssms != NULL && db->query_pssms[q] != NULL) {
+        uint32_t all = lanes == 32 ? UINT32_MAX : (1U << lanes) - 1;
+        align_nt_overflow(db, aligner, b, query_lens, q, all, batch_scores);
+        return;
+    }
+
+    if (db->nucleotide) {
+        score_t nt_scores[NT_VECTOR_SIZE];
+        // lanes aligned again leave the aligner set up for their own query
+        aligner_update(aligner, NULL, NULL, NULL, NULL, NULL, NULL,
+                       query_lens[q], batch_rows[b], lanes, &db->scoring);
+        uint32_t overflow = nt_fill_matrices(&db->nt, aligner,
+                                             db->query_codes + q * db->query_stride,
+                                             query_lens[q], (const uint8_t *) batch_indexes[b],
+                                             db->lens + first, lanes, nt_scores);
+        for (lane = 0; lane < lanes; lane++) batch_scores[lane] = nt_scores[lane];
+        overflow |= db->nt_unknown[b];
+        if (overflow != 0) {
+            align_nt_overflow(db, aligner, b, query_lens, q, overflow, batch_scores);
+        }
+        return;
+    }
+
+    aligner_update(aligner,
+                   NULL, NULL, NULL, NULL,
+                   db->query_indexes + q * db->query_stride, batch_indexes[b],
+                   query_lens[q], batch_rows[b], lanes, &db->scoring);
+    aligner_set_query_profile(db, aligner, q);
+    // global alignment reads each lane off at the end of its entry
+    aligner->seq_b_lens = db->lens + first;
+    alignment_fill_matrices(aligner);
+    for (lane = 0; lane < VECTOR_SIZE; lane++) batch_scores[lane] = aligner->max_scores[lane];
+}
+
+// Align queries [first_query, first_query + num_queries) against packed
+// batches holding num_lanes entries, writing the scores of query q and batch b
+// to scores[(q - first_query) * scores_stride + b * db->batch_lanes].
+static void align_batches(sw_db_t *db, int8_t *const *batch_indexes, const size_t *batch_rows,
+                          size_t num_batches, size_t num_lanes,
+                          const size_t *query_lens, size_t first_query, size_t num_queries,
+                          int32_t *scores, size_t scores_stride) {
+    size_t b, q;
+
+    // Each batch is aligned against every query while it is still in cache
+#pragma omp parallel num_threads(db->num_threads) private(q)
+    {
+#pragma omp for schedule(dynamic, 1) nowait
+        for (b = 0; b < num_batches; b++) {
+            uint64_t begin = trace_begin();
+            aligner_t *aligner = db->aligners[omp_get_thread_num()];
+            size_t first = b * db->batch_lanes;
+            for (q = first_query; q < first_query + num_queries; q++) {
+                align_query_batch(db, aligner, batch_indexes, batch_rows, b,
+                                  MIN2(db->batch_lanes, num_lanes - first), query_lens, q,
+                                  scores + (q - first_query) * scores_stride + first);
+            }
+            trace_end(TRACE_KERNEL, begin, b);
+        }
+        trace_barrier();
+    }
+}
+
+// With fewer entries than the lanes of all the threads, the batch kernel
+// leaves lanes or whole cores idle, so big enough pairs are aligned one at a
+// time by the wavefront kernel on every thread instead
+static bool use_wavefront(const sw_db_t *db, size_t max_query_len) {
+    return db->scoring.mode == ALIGN_LOCAL && db->query_pssms == NULL &&
+           db->num_entries < (size_t) db->num_threads * db->batch_lanes &&
+           max_query_len * db->max_len >= WAVEFRONT_MIN_CELLS;
+}
+
+// Align every query against every entry with the wavefront kernel, writing
+// the scores of query q to scores[q * scores_stride]
+static void align_wavefront(sw_db_t *db, const size_t *query_lens, size_t num_queries,
+                            int32_t *scores, size_t scores_stride) {
+    int8_t *unpacked = db->nucleotide ? malloc(MAX2(db->max_len, 1)) : NULL;
+    size_t e, q;
+
+    for (e = 0; e < db->num_entries; e++) {
+        size_t b = e / db->batch_lanes, lane = e % db->batch_lanes;
+        const int8_t *target = db->batch_indexes[b] + lane;
+        size_t target_stride = VECTOR_SIZE;
+
+        if (db->nucleotide) {
+            db_entry_indexes(db, e, unpacked, 1);
+            target = unpacked;
+            target_stride = 1;
+        }
+
+        for (q = 0; q < num_queries; q++) {
+            uint64_t begin = trace_begin();
+            scores[q * scores_stride + e] =
+                alignment_wavefront_score(&db->scoring, db->query_indexes + q * db->query_stride,
+                                          query_lens[q], target, db->lens[e], target_stride,
+                                          db->num_threads);
+            trace_end(TRACE_KERNEL, begin, b);
+        }
+    }
+    free(unpacked);
+}
+
+// Lane refilling: rather than run every lane of a batch for as many rows as
+// its longest entry, entries are dealt to the lanes of a stream, longest
+// first to the lane with the fewest rows so far, and each lane runs its
+// entries back to back, starting again from zero as one ends (as SWIPE
+// does). Only the tail of the stream is padded, whatever the lengths.
+
+// Entries per stream, enough for the lanes to even out
+#define REFILL_ENTRIES (32 * VECTOR_SIZE)
+
+typedef struct
+{
+    int8_t *indexes;        // rows x VECTOR_SIZE, padded with '*'
+    uint16_t *ends;         // lanes whose entry ends before each row, rows + 1
+    size_t rows;
+    size_t *order;          // positions of the entries in the list, lane by lane
+    size_t lane_first[VECTOR_SIZE + 1]; // lane l holds order[lane_first[l], lane_first[l + 1])
+    score_t *scores;        // score of each entry of order
+} lane_stream_t;
+
+typedef struct
+{
+    size_t len, pos;
+} entry_len_t;
+
+// Longest first, in list order when tied so streams are reproducible
+static int entry_len_cmp(const void *a, const void *b) {
+    const entry_len_t *x = a, *y = b;
+    if (x->len != y->len) return x->len > y->len ? -1 : 1;
+    return x->pos < y->pos ? -1 : (x->pos > y->pos);
+}
+
+// Entry at position k of a list, NULL for all the entries in order
+#define LIST_ENTRY(entries, k) ((entries) != NULL ? (entries)[k] : (k))
+
+// Deal the entries at positions [first, first + num_entries) of a list to the
+// lanes of a stream, empty entries are left out. Positions in the stream are
+// relative to first. Returns the rows of residues, rather than padding.
+static size_t stream_build(const sw_db_t *db, const size_t *entries, size_t first,
+                           size_t num_entries, lane_stream_t *stream) {
+    entry_len_t *sorted = malloc(sizeof(entry_len_t) * MAX2(num_entries, 1));
+    uint8_t *lane_of = malloc(MAX2(num_entries, 1));
+    size_t lane_rows[VECTOR_SIZE] = {0}, lane_count[VECTOR_SIZE] = {0};
+    size_t k, lane, i, residues = 0;
+
+    for (k = 0; k < num_entries; k++) {
+        sorted[k].len = db->lens[LIST_ENTRY(entries, first + k)];
+        sorted[k].pos = k;
+    }
+    qsort(sorted, num_entries, sizeof(entry_len_t), entry_len_cmp);
+
+    for (k = 0; k < num_entries && sorted[k].len > 0; k++) {
+        size_t best = 0;
+        for (lane = 1; lane < VECTOR_SIZE; lane++) {
+            if (lane_rows[lane] < lane_rows[best]) best = lane;
+        }
+        lane_of[k] = (uint8_t) best;
+        lane_rows[best] += sorted[k].len;
+        lane_count[best]++;
+        residues += sorted[k].len;
+    }
+    size_t num_placed = k;
+
+    stream->rows = 0;
+    stream->lane_first[0] = 0;
+    for (lane = 0; lane < VECTOR_SIZE; lane++) {
+        stream->rows = MAX2(stream->rows, lane_rows[lane]);
+        stream->lane_first[lane + 1] = stream->lane_first[lane] + lane_count[lane];
+        lane_rows[lane] = 0;
+        lane_count[lane] = 0;
+    }
+
+    stream->indexes = aligned_alloc(32, BATCH_BYTES(stream->rows));
+    memset(stream->indexes, letters_to_index('*'), BATCH_BYTES(stream->rows));
+    stream->ends = calloc(stream->rows + 1, sizeof(uint16_t));
+    stream->order = malloc(sizeof(size_t) * MAX2(num_placed, 1));
+    stream->scores = malloc(sizeof(score_t) * MAX2(num_placed, 1));
+
+    for (k = 0; k < num_placed; k++) {
+        size_t e = LIST_ENTRY(entries, first + sorted[k].pos), start;
+        const int8_t *src = db->batch_indexes[e / VECTOR_SIZE] + e % VECTOR_SIZE;
+        lane = lane_of[k];
+        start = lane_rows[lane];
+
+        for (i = 0; i < sorted[k].len; i++) {
+            stream->indexes[(start + i) * VECTOR_SIZE + lane] = src[i * VECTOR_SIZE];
+        }
+        stream->ends[start + sorted[k].len] |= (uint16_t) (1U << lane);
+        stream->order[stream->lane_first[lane] + lane_count[lane]++] = sorted[k].pos;
+        lane_rows[lane] += sorted[k].len;
+    }
+
+    free(sorted);
+    free(lane_of);
+    return residues;
+}
+
+static void stream_free(lane_stream_t *stream) {
+    free(stream->indexes);
+    free(stream->ends);
+    free(stream->order);
+    free(stream->scores);
+}
+
+// Align queries [first_query, first_query + num_queries) against the
+// entries of a list (NULL for the whole database) by refilling lanes, writing the score of query q and the
+// k-th entry to scores[(q - first_query) * scores_stride + k]. Protein
+// databases and local alignment only. Adds the lane rows run through the
+// kernel, and how many of them were padding, to the totals.
+static void align_entries(sw_db_t *db, const size_t *entries, size_t num_entries,
+                          const size_t *query_lens, size_t first_query, size_t num_queries,
+                          int32_t *scores, size_t scores_stride,
+                          size_t *lane_rows, size_t *padding_rows) {
+    size_t threads = (size_t) db->num_threads;
+    size_t group = (num_entries / (threads * 4) + VECTOR_SIZE - 1) / VECTOR_SIZE * VECTOR_SIZE;
+    group = MIN2(MAX2(group, VECTOR_SIZE), REFILL_ENTRIES);
+    size_t num_groups = (num_entries + group - 1) / group;
+    size_t g, q, k, stream_rows = 0, residues = 0;
+
+    // Each stream is aligned against every query while it is still in cache
+#pragma omp parallel num_threads(db->num_threads) private(q, k)
+    {
+#pragma omp for schedule(dynamic, 1) reduction(+:stream_rows, residues) nowait
+        for (g = 0; g < num_groups; g++) {
+            uint64_t begin = trace_begin();
+            aligner_t *aligner = db->aligners[omp_get_thread_num()];
+            size_t first = g * group, n = MIN2(group, num_entries - first);
+            lane_stream_t stream;
+
+            residues += stream_build(db, entries, first, n, &stream);
+            stream_rows += stream.rows;
+
+            for (q = first_query; q < first_query + num_queries; q++) {
+                int32_t *group_scores = scores + (q - first_query) * scores_stride + first;
+
+                // empty entries aren't in the stream
+                for (k = 0; k < n; k++) group_scores[k] = 0;
+                if (stream.rows == 0) continue;
+
+                aligner_update(aligner, NULL, NULL, NULL, NULL,
+                               db->query_indexes + q * db->query_stride, stream.indexes,
+                               query_lens[q], stream.rows, VECTOR_SIZE, &db->scoring);
+                aligner_set_query_profile(db, aligner, q);
+                aligner->seq_b_ends = stream.ends;
+                aligner->seq_b_lane_first = stream.lane_first;
+                aligner->seq_b_scores = stream.scores;
+                alignment_fill_matrices(aligner);
+                aligner->seq_b_ends = NULL;
+
+                for (k = 0; k < stream.lane_first[VECTOR_SIZE]; k++) {
+                    group_scores[stream.order[k]] = stream.scores[k];
+                }
+            }
+            stream_free(&stream);
+            trace_end(TRACE_KERNEL, begin, g);
+        }
+        trace_barrier();
+    }
+
+    *lane_rows += stream_rows * VECTOR_SIZE;
+    *padding_rows += stream_rows * VECTOR_SIZE - residues;
+}
+
+// Lane rows of the database batches and how many of them are padding
+static void batch_padding(const sw_db_t *db, size_t *lane_rows, size_t *padding_rows) {
+    size_t b, rows = 0;
+    for (b = 0; b < db->num_batches; b++) rows += db->batch_rows[b];
+    *lane_rows = rows * db->batch_lanes;
+    *padding_rows = *lane_rows - db->num_residues;
+}
+
+// Local alignment of protein databases refills lanes, nucleotide databases
+// have their own kernel and global alignment reads each lane off at its end
+static bool use_refill(const sw_db_t *db) {
+    return !db->nucleotide && db->scoring.mode == ALIGN_LOCAL;
+}
+
+// With many short queries, queries go in the lanes instead of entries, a
+// batch of 16 queries at a time, as long as there are enough pairs of a
+// batch and an entry to keep the threads busy. Protein databases and local
+// alignment only.
+static bool use_interquery(const sw_db_t *db, size_t num_queries, size_t max_query_len) {
+    size_t num_groups = (num_queries + VECTOR_SIZE - 1) / VECTOR_SIZE;
+    return use_refill(db) && db->query_pssms == NULL && num_queries >= VECTOR_SIZE &&
+           max_query_len <= INTERQUERY_MAX_LEN &&
+           num_groups * db->num_entries >= (size_t) db->num_threads;
+}
+
+// Align every query against every entry with queries in the lanes, writing
+// the scores of query q to scores[q * scores_stride]. Padding is counted in
+// query columns, the lanes past the end of the shorter queries of a batch.
+static void align_interquery(sw_db_t *db, const size_t *query_lens, size_t num_queries,
+                             int32_t *scores, size_t scores_stride,
+                             size_t *lane_rows, size_t *padding_rows) {
+    size_t num_groups = (num_queries + VECTOR_SIZE - 1) / VECTOR_SIZE;
+    entry_len_t *sorted = malloc(sizeof(entry_len_t) * num_queries);
+    interquery_t *groups = malloc(sizeof(interquery_t) * num_groups);
+    size_t g, k, w, max_len = 0;
+
+    // queries of similar lengths share a batch, so little of it is padding
+    for (k = 0; k < num_queries; k++) {
+        sorted[k].len = query_lens[k];
+        sorted[k].pos = k;
+        max_len = MAX2(max_len, query_lens[k]);
+    }
+    qsort(sorted, num_queries, sizeof(entry_len_t), entry_len_cmp);
+
+    for (g = 0; g < num_groups; g++) {
+        const int8_t *queries[VECTOR_SIZE];
+        size_t lens[VECTOR_SIZE], n = MIN2(VECTOR_SIZE, num_queries - g * VECTOR_SIZE);
+        for (k = 0; k < n; k++) {
+            size_t q = sorted[g * VECTOR_SIZE + k].pos;
+            queries[k] = db->query_indexes + q * db->query_stride;
+            lens[k] = query_lens[q];
+        }
+        interquery_init(&groups[g], &db->scoring, queries, lens, n);
+        *lane_rows += groups[g].len * VECTOR_SIZE;
+        for (k = 0; k < n; k++) *padding_rows += groups[g].len - lens[k];
+        *padding_rows += groups[g].len * (VECTOR_SIZE - n);
+    }
+
+#pragma omp parallel num_threads(db->num_threads) private(k)
+    {
+        score_t *scratch = aligned_alloc(32, sizeof(score_t) * 2 * (max_len + 1) * VECTOR_SIZE);
+        score_t group_scores[VECTOR_SIZE];
+
+        // every batch of queries against every entry
+#pragma omp for schedule(dynamic, 1) nowait
+        for (w = 0; w < num_groups * db->num_entries; w++) {
+            uint64_t begin = trace_begin();
+            size_t e = w % db->num_entries, group = w / db->num_entries;
+            interquery_align(&groups[group], &db->scoring,
+                             db->batch_indexes[e / VECTOR_SIZE] + e % VECTOR_SIZE, db->lens[e],
+                             VECTOR_SIZE, scratch, group_scores);
+            for (k = 0; k < groups[group].num_queries; k++) {
+                scores[sorted[group * VECTOR_SIZE + k].pos * scores_stride + e] = group_scores[k];
+            }
+            trace_end(TRACE_KERNEL, begin, w);
+        }
+        free(scratch);
+        trace_barrier();
+    }
+
+    for (g = 0; g < num_groups; g++) interquery_dealloc(&groups[g]);
+    free(groups);
+    free(sorted);
+}
+
+// Smallest and largest substitution scores of query q, for
+// alignment_global_fits16
+static void query_score_range(const sw_db_t *db, size_t q, size_t query_len, int *lo, int *hi) {
+    const pssm_t *pssm = db->query_pssms != NULL ? db->query_pssms[q] : NULL;
+    const int8_t *indexes = db->query_indexes + q * db->query_stride;
+    size_t i, b;
+
+    *lo = *hi = 0;
+    for (i = 0; i < query_len; i++) {
+        for (b = 0; b < 32; b++) {
+            int score = pssm != NULL ? pssm->scores[i][b] : db->scoring.swap_scores[indexes[i]][b];
+            *lo = MIN2(*lo, score);
+            *hi = MAX2(*hi, score);
+        }
+    }
+    if (pssm == NULL && db->scoring.use_match_mismatch) {
+        *lo = MIN2(db->scoring.mismatch, 0);
+        *hi = MAX2(db->scoring.match, 0);
+    }
+}
+
+// Align entries [first, num_entries) again with 32-bit scores where the
+// 16-bit score of query q may have saturated: local scores at INT16_MAX, and
+// global alignments whose cells may leave the range of 16 bits. These are
+// pairs of long, similar sequences, few enough to align again whole.
+static void align_saturated(sw_db_t *db, const size_t *query_lens, size_t q, size_t first,
+                            int32_t *scores) {
+    bool global = db->scoring.mode == ALIGN_GLOBAL;
+    size_t *entries = NULL, num_entries = 0, capacity = 0, e, k;
+    int lo = 0, hi = 0;
+
+    if (global) query_score_range(db, q, query_lens[q], &lo, &hi);
+
+    for (e = first; e < db->num_entries; e++) {
+        bool saturated = global ? !alignment_global_fits16(&db->scoring, lo, hi, query_lens[q], db->lens[e])
+                                : scores[e] == INT16_MAX;
+        if (!saturated) continue;
+        if (num_entries == capacity) {
+            capacity = MAX2(capacity * 2, 64);
+            entries = realloc(entries, sizeof(size_t) * capacity);
+        }
+        entries[num_entries++] = e;
+    }
+    if (num_entries == 0) return;
+
+    int32_t *wide_scores = malloc(sizeof(int32_t) * num_entries);
+#pragma omp parallel for schedule(dynamic, 1) num_threads(db->num_threads)
+    for (k = 0; k < num_entries; k += VECTOR_SIZE) {
+        align_entry_list(db, db->aligners[omp_get_thread_num()], entries + k,
+                         MIN2(VECTOR_SIZE, num_entries - k), query_lens, q, true, wide_scores + k,
+                         NULL, NULL);
+    }
+
+    for (k = 0; k < num_entries; k++) scores[entries[k]] = wide_scores[k];
+    free(wide_scores);
+    free(entries);
+}
+
+// Align query q again against its hits with 32-bit scores, to find where
+// their best alignments end
+static void hit_ends(sw_db_t *db, const size_t *query_lens, size_t q, sw_results_t *results) {
+    size_t num_hits = results->num_hits, k;
+    if (num_hits == 0) return;
+
+    size_t *entries = malloc(sizeof(size_t) * 3 * num_hits);
+    size_t *query_ends = entries + num_hits, *entry_ends = entries + 2 * num_hits;
+    int32_t *scores = malloc(sizeof(int32_t) * num_hits);
+    for (k = 0; k < num_hits; k++) entries[k] = results->hits[k].entry - db->first_entry;
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(db->num_threads)
+    for (k = 0; k < num_hits; k += VECTOR_SIZE) {
+        align_entry_list(db, db->aligners[omp_get_thread_num()], entries + k,
+                         MIN2(VECTOR_SIZE, num_hits - k), query_lens, q, true, scores + k,
+                         query_ends + k, entry_ends + k);
+    }
+
+    for (k = 0; k < num_hits; k++) {
+        results->hits[k].query_end = query_ends[k];
+        results->hits[k].entry_end = entry_ends[k];
+    }
+    free(scores);
+    free(entries);
+}
+
+// Run the filters for query q, then align only the entries that pass them,
+// repacked into dense batches. Returns the number of entries filtered out.
+static size_t search_filtered(sw_db_t *db, const size_t *query_lens, size_t q,
+                              const sw_search_opts_t *opts, int32_t *scores,
+                              sw_results_t *res) {
+    struct timespec time_start, time_mid, time_stop;
+    size_t query_len = query_lens[q];
+    int8_t *query_indexes = db->query_indexes + q * db->query_stride;
+    size_t i, b, lane, num_cands = 0;
+
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    perf_start(PERF_FILTER, db->num_threads);
+
+    bool *passed = malloc(sizeof(bool) * db->num_entries);
+    for (i = 0; i < db->num_entries; i++) passed[i] = true;
+
+    // Seed words and ungapped extensions along their diagonals
+    if (opts->prefilter_score > 0) {
+        prefilter_t prefilter;
+        prefilter_alloc(&prefilter, &db->scoring, query_indexes, query_len,
+                        opts->prefilter_word_score);
+
+#pragma omp parallel num_threads(db->num_threads) private(i)
+        {
+            size_t *diag_end = malloc(sizeof(size_t) * (query_len + db->max_len + 1));
+#pragma omp for schedule(dynamic, VECTOR_SIZE)
+            for (i = 0; i < db->num_entries; i++) {
+                const int8_t *seq = db->batch_indexes[i / VECTOR_SIZE] + i % VECTOR_SIZE;
+                passed[i] = prefilter_score(&prefilter, seq, VECTOR_SIZE, db->lens[i],
+                                            opts->prefilter_score, diag_end) >= opts->prefilter_score;
+            }
+            free(diag_end);
+        }
+
+        prefilter_dealloc(&prefilter);
+    }
+
+    // Best ungapped score of every lane, on the database batches as they are
+    if (opts->ungapped_cutoff > 0) {
+#pragma omp parallel for schedule(dynamic, 1) num_threads(db->num_threads) private(lane)
+        for (b = 0; b < db->num_batches; b++) {
+            size_t first = b * VECTOR_SIZE;
+            size_t lanes = MIN2(VECTOR_SIZE, db->num_entries - first);
+            bool any = false;
+
+            for (lane = 0; lane < lanes; lane++) any |= passed[first + lane];
+            if (!any) continue;
+
+            aligner_t *aligner = db->aligners[omp_get_thread_num()];
+            aligner_update(aligner, NULL, NULL, NULL, NULL,
+                           query_indexes, db->batch_indexes[b],
+                           query_len, db->batch_rows[b], lanes, &db->scoring);
+            alignment_ungapped_scores(aligner);
+
+            for (lane = 0; lane < lanes; lane++) {
+                passed[first + lane] &= aligner->max_scores[lane] >= opts->ungapped_cutoff;
+            }
+        }
+    }
+
+    size_t *cands = malloc(sizeof(size_t) * db->num_entries);
+    for (i = 0; i < db->num_entries; i++) {
+        if (passed[i]) cands[num_cands++] = i;
+        else scores[i] = SCORE_FILTERED;
+    }
+
+    perf_stop(PERF_FILTER, db->num_threads, 0);
+    clock_gettime(CLOCK_REALTIME, &time_mid);
+    perf_start(PERF_KERNEL, db->num_threads);
+
+    // the candidates are dealt straight out of the database batches
+    int32_t *cand_scores = malloc(sizeof(int32_t) * MAX2(num_cands, 1));
+    res->lane_rows = res->padding_rows = 0;
+    align_entries(db, cands, num_cands, query_lens, q, 1, cand_scores, 0,
+                  &res->lane_rows, &res->padding_rows);
+
+    perf_stop(PERF_KERNEL, db->num_threads,
+              (uint64_t) (res->lane_rows - res->padding_rows) * query_len);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+
+    for (i = 0; i < num_cands; i++) {
+        scores[cands[i]] = cand_scores[i];
+    }
+
+    free(cand_scores);
+    free(cands);
+    free(passed);
+
+    res->prefilter_time = interval(time_start, time_mid);
+    res->kernel_time = interval(time_mid, time_stop);
+    return db->num_entries - num_cands;
+}
+
+// Search with queries given as residues, pssms holds the profile of each
+// query that is a PSSM (or is NULL if none are)
+static int search_queries(sw_db_t *db, const char *const *queries, const size_t *query_lens,
+                          const pssm_t *const *pssms, size_t num_queries,
+                          const sw_search_opts_t *opts, sw_results_t *results) {
+    sw_search_opts_t default_opts;
+    struct timespec time_start, time_stop;
+    size_t i, q, max_query_len = 0;
+    bool position_gaps = false;
+
+    db->query_pssms = pssms;
+
+    if (opts == NULL) {
+        sw_search_opts_init(&default_opts);
+        opts = &default_opts;
+    }
+
+    for (q = 0; q < num_queries; q++) {
+        if (query_lens[q] == 0) {
+            fprintf(stderr, "Error: empty query sequence\n");
+            return -1;
+        }
+        max_query_len = MAX2(max_query_len, query_lens[q]);
+        position_gaps |= pssms != NULL && pssms[q] != NULL && pssms[q]->gap_open != NULL;
+    }
+
+    if (num_queries == 0) return 0;
+
+    if (!opts->exact && pssms != NULL) {
+        fprintf(stderr, "Error: the prefilter and ungapped filter don't work with PSSM queries\n");
+        return -1;
+    }
+    if (position_gaps && db->scoring.mode != ALIGN_LOCAL) {
+        fprintf(stderr, "Error: PSSM gap penalties only work with local alignment\n");
+        return -1;
+    }
+
+    if (!opts->exact && db->scoring.mode != ALIGN_LOCAL) {
+        fprintf(stderr, "Error: the prefilter and ungapped filter only work with local alignment\n");
+        return -1;
+    }
+    if (!opts->exact && db->nucleotide) {
+        fprintf(stderr, "Error: the prefilter and ungapped filter don't work on "
+                        "2-bit packed nucleotide databases\n");
+        return -1;
+    }
+    if (opts->stats && db->scoring.mode != ALIGN_LOCAL) {
+        fprintf(stderr, "Error: E-values are only defined for local alignment\n");
+        return -1;
+    }
+    if (opts->ends && db->scoring.mode != ALIGN_LOCAL) {
+        fprintf(stderr, "Error: alignment end positions are only found for local alignment\n");
+        return -1;
+    }
+
+    const karlin_t *karlin = NULL;
+    if (opts->stats && (karlin = db_karlin(db)) == NULL) return -1;
+
+    db_reserve_scratch(db, max_query_len, num_queries);
+
+    // Unknown residues are handled as the scoring scheme says, so the
+    // lengths of the translated queries may differ from query_lens
+    for (q = 0; q < num_queries; q++) {
+        if (pssms != NULL && pssms[q] != NULL) {
+            // a row per position, so the residues can't be dropped or changed
+            int8_t *indexes = db->query_indexes + q * db->query_stride;
+            for (i = 0; i < query_lens[q]; i++) indexes[i] = letters_to_index(queries[q][i]);
+            db->query_lens[q] = query_lens[q];
+        } else if (alphabet_translate(&db->query_alphabet, queries[q], query_lens[q],
+                                      db->query_indexes + q * db->query_stride, 1,
+                                      &db->query_lens[q]) != 0) {
+            return -1;
+        }
+        if (db->query_lens[q] == 0) {
+            fprintf(stderr, "Error: query sequence has no residues\n");
+            return -1;
+        }
+        if (db->nucleotide) {
+            const int8_t *indexes = db->query_indexes + q * db->query_stride;
+            uint8_t *codes = db->query_codes + q * db->query_stride;
+            for (i = 0; i < db->query_lens[q]; i++) codes[i] = (uint8_t) db->nt.index_codes[indexes[i]];
+        }
+        results[q].num_filtered = 0;
+        results[q].prefilter_time = 0;
+    }
+
+    size_t scores_stride = db->num_batches * db->batch_lanes;
+
+    if (opts->exact) {
+        clock_gettime(CLOCK_REALTIME, &time_start);
+        perf_start(PERF_KERNEL, db->num_threads);
+        size_t lane_rows = 0, padding_rows = 0, query_residues = 0;
+        // the wavefront kernel falls back on 32-bit scores itself
+        bool wavefront = false;
+        if (use_interquery(db, num_queries, max_query_len)) {
+            align_interquery(db, db->query_lens, num_queries, db->batch_scores, scores_stride,
+                             &lane_rows, &padding_rows);
+        } else if (use_wavefront(db, max_query_len)) {
+            align_wavefront(db, db->query_lens, num_queries, db->batch_scores, scores_stride);
+            lane_rows = db->num_residues;
+            wavefront = true;
+        } else if (use_refill(db)) {
+            align_entries(db, NULL, db->num_entries, db->query_lens, 0, num_queries,
+                          db->batch_scores, scores_stride, &lane_rows, &padding_rows);
+        } else {
+            align_batches(db, db->batch_indexes, db->batch_rows, db->num_batches, db->num_entries,
+                          db->query_lens, 0, num_queries, db->batch_scores, scores_stride);
+            batch_padding(db, &lane_rows, &padding_rows);
+        }
+        for (q = 0; q < num_queries && !wavefront; q++) {
+            align_saturated(db, db->query_lens, q, 0, db->batch_scores + q * scores_stride);
+        }
+        for (q = 0; q < num_queries; q++) query_residues += db->query_lens[q];
+        perf_stop(PERF_KERNEL, db->num_threads, (uint64_t) db->num_residues * query_residues);
+        clock_gettime(CLOCK_REALTIME, &time_stop);
+
+        for (q = 0; q < num_queries; q++) {
+            results[q].kernel_time = interval(time_start, time_stop);
+            results[q].lane_rows = lane_rows;
+            results[q].padding_rows = padding_rows;
+        }
+    } else {
+        // each query has its own set of candidates, so they can't share a pass
+        for (q = 0; q < num_queries; q++) {
+            results[q].num_filtered =
+                search_filtered(db, db->query_lens, q, opts,
+                                db->batch_scores + q * scores_stride, &results[q]);
+            align_saturated(db, db->query_lens, q, 0, db->batch_scores + q * scores_stride);
+        }
+    }
+
+    for (q = 0; q < num_queries; q++) {
+        const int32_t *scores = db->batch_scores + q * scores_stride;
+        sw_results_t *res = &results[q];
+
+        int32_t min_score = opts->min_score;
+        double search_space = 0;
+
+        res->num_hits = 0;
+        res->num_entries = db->num_entries;
+
+        if (karlin != NULL) {
+            search_space = karlin_search_space(karlin, db->query_lens[q],
+                                               opts->db_residues ? opts->db_residues : db->num_residues,
+                                               opts->db_entries ? opts->db_entries : db->num_entries);
+            // the E-value cutoff as a score, so weak hits are dropped up front
+            if (opts->max_evalue > 0) {
+                int cutoff = karlin_min_score(karlin, opts->max_evalue, search_space);
+                min_score = MAX2(min_score, cutoff);
+            }
+        }
+
+        for (i = 0; i < db->num_entries; i++) {
+            // global scores can be SCORE_FILTERED, but aren't filtered
+            if ((opts->exact || scores[i] != SCORE_FILTERED) && scores[i] >= min_score) {
+                results_add(res, db->first_entry + i, scores[i]);
+            }
+        }
+
+        if (karlin != NULL) {
+            for (i = 0; i < res->num_hits; i++) {
+                sw_hit_t *hit = &res->hits[i];
+                hit->bit_score = karlin_bit_score(karlin, hit->score);
+                hit->evalue = karlin_evalue(karlin, hit->score, search_space);
+            }
+        }
+
+        if (opts->max_hits > 0) {
+            qsort(res->hits, res->num_hits, sizeof(sw_hit_t), hit_cmp_best_first);
+            res->num_hits = MIN2(res->num_hits, opts->max_hits);
+        }
+
+        if (opts->ends) hit_ends(db, db->query_lens, q, res);
+    }
+
+    return 0;
+}
+
+int sw_search_batch(sw_db_t *db, const char *const *queries, const size_t *query_lens,
+                    size_t num_queries, const sw_search_opts_t *opts,
+                    sw_results_t *results) {
+    return search_queries(db, queries, query_lens, NULL, num_queries, opts, results);
+}
+
+int sw_search(sw_db_t *db, const char *query, size_t query_len,
+              const sw_search_opts_t *opts, sw_results_t *results) {
+    return sw_search_batch(db, &query, &query_len, 1, opts, results);
+}
+
+int sw_search_pssm(sw_db_t *db, const pssm_t *pssm,
+                   const sw_search_opts_t *opts, sw_results_t *results) {
+    const char *residues = pssm->residues;
+    return search_queries(db, &residues, &pssm->len, &pssm, 1, opts, results);
+}
+
+// Query entries aligned together in an all-vs-all pass, sharing each batch
+// while it is in cache
+#define ALL_VS_ALL_QUERIES 64
+
+// Scores of (a, b) and (b, a) are the same
+static bool scoring_symmetric(const scoring_t *scoring) {
+    int a, b;
+    if (scoring->mode == ALIGN_GLOBAL && scoring->free_query_ends != scoring->free_db_ends) {
+        return false;
+    }
+    for (a = 0; a < 32; a++) {
+        for (b = 0; b < a; b++) {
+            if (scoring->swap_scores[a][b] != scoring->swap_scores[b][a]) return false;
+        }
+    }
+    return true;
+}
+
+int sw_all_vs_all(sw_db_t *db, score_t min_score,
+                  void (callback)(const sw_pair_t *pairs, size_t num_pairs, void *arg),
+                  void *arg) {
+    size_t first_query, k, b, e;
+    sw_pair_t *pairs = NULL;
+    size_t num_pairs, pairs_capacity = 0;
+
+    if (!scoring_symmetric(&db->scoring)) {
+        fprintf(stderr, "Error: all-vs-all needs symmetric scoring, the substitution matrix "
+                        "and free ends must be the same both ways round\n");
+        return -1;
+    }
+
+    db->query_pssms = NULL;
+    db_reserve_scratch(db, MAX2(db->max_len, 1), ALL_VS_ALL_QUERIES);
+    size_t scores_stride = db->num_batches * db->batch_lanes;
+
+    // the last entry has no later entries to align against
+    for (first_query = 0; first_query + 1 < db->num_entries; first_query += ALL_VS_ALL_QUERIES) {
+        size_t num_queries = MIN2(ALL_VS_ALL_QUERIES, db->num_entries - 1 - first_query);
+
+        for (k = 0; k < num_queries; k++) {
+            int8_t *indexes = db->query_indexes + k * db->query_stride;
+            db_entry_indexes(db, first_query + k, indexes, 1);
+            db->query_lens[k] = db->lens[first_query + k];
+            if (db->nucleotide) {
+                uint8_t *codes = db->query_codes + k * db->query_stride;
+                for (e = 0; e < db->query_lens[k]; e++) codes[e] = (uint8_t) db->nt.index_codes[indexes[e]];
+            }
+        }
+
+        // Only the upper triangle: each query against the batches holding
+        // entries after it
+#pragma omp parallel num_threads(db->num_threads) private(k)
+        {
+#pragma omp for schedule(dynamic, 1) nowait
+            for (b = (first_query + 1) / db->batch_lanes; b < db->num_batches; b++) {
+                uint64_t begin = trace_begin();
+                aligner_t *aligner = db->aligners[omp_get_thread_num()];
+                size_t first = b * db->batch_lanes;
+                size_t lanes = MIN2(db->batch_lanes, db->num_entries - first);
+                for (k = 0; k < num_queries && first_query + k + 1 < first + lanes; k++) {
+                    if (db->query_lens[k] == 0) continue;
+                    align_query_batch(db, aligner, db->batch_indexes, db->batch_rows, b, lanes,
+                                      db->query_lens, k, db->batch_scores + k * scores_stride + first);
+                }
+                trace_end(TRACE_KERNEL, begin, b);
+            }
+            trace_barrier();
+        }
+
+        for (k = 0; k < num_queries; k++) {
+            if (db->query_lens[k] == 0) continue;
+            align_saturated(db, db->query_lens, k, first_query + k + 1,
+                            db->batch_scores + k * scores_stride);
+        }
+
+        num_pairs = 0;
+        for (k = 0; k < num_queries; k++) {
+            const int32_t *scores = db->batch_scores + k * scores_stride;
+            if (db->query_lens[k] == 0) continue;
+            for (e = first_query + k + 1; e < db->num_entries; e++) {
+                if (scores[e] < min_score) continue;
+                if (num_pairs == pairs_capacity) {
+                    pairs_capacity = MAX2(pairs_capacity * 2, 1024);
+                    pairs = realloc(pairs, sizeof(sw_pair_t) * pairs_capacity);
+                }
+                pairs[num_pairs].a = db->first_entry + first_query + k;
+                pairs[num_pairs].b = db->first_entry + e;
+                pairs[num_pairs].score = scores[e];
+                num_pairs++;
+            }
+        }
+        callback(pairs, num_pairs, arg);
+    }
+
+    free(pairs);
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ alignment_search.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_SEARCH_HEADER_SEEN
+#define ALIGNMENT_SEARCH_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "seq_file/seq_file.h"
+#include "alignment.h"
+#include "alignment_fasta.h"
+#include "alignment_pssm.h"
+
+// Opaque handle on a database that has been read, converted to substitution
+// matrix indexes and packed into interleaved batches ready for the kernel.
+// The handle also owns the per-thread scratch aligners, so repeated searches
+// against the same database pay no setup cost.
+// A handle must not be searched from two threads at the same time.
+typedef struct sw_db_t sw_db_t;
+
+typedef struct
+{
+    size_t entry;   // 0-based position of the entry in the database file
+    int32_t score;  // best local alignment score, or global with scoring_t.mode
+    // only set when sw_search_opts_t.stats is on
+    double bit_score, evalue;
+    // only set when sw_search_opts_t.ends is on: the best alignment's last
+    // residues are query position query_end and entry position entry_end
+    // (1-based, residues as aligned, 0 if the score is 0)
+    size_t query_end, entry_end;
+} sw_hit_t;
+
+// A pair of database entries found by sw_all_vs_all
+typedef struct
+{
+    size_t a, b;    // entries, as in sw_hit_t, with a < b
+    int32_t score;
+} sw_pair_t;
+
+typedef struct
+{
+    // only report hits scoring at least this, global alignment scores may be
+    // negative [default: 0]
+    score_t min_score;
+    size_t max_hits;   // report only the best max_hits hits, 0 for all [default: 0]
+
+    // Filters: with exact off, only entries passing every enabled filter are
+    // aligned, the rest are not reported
+    bool exact;                 // align every entry [default: true]
+    // entries need a seed word shared with the query whose ungapped
+    // extension scores at least this, 0 to disable [default: 0]
+    score_t prefilter_score;
+    int prefilter_word_score;   // min score of a seed word [default: PREFILTER_WORD_SCORE]
+    // entries need a best ungapped alignment scoring at least this,
+    // 0 to disable [default: 0]
+    score_t ungapped_cutoff;
+
+    // Statistics: give each hit a bit score and E-value [default: false]
+    bool stats;
+    double max_evalue;     // only report hits with at most this E-value,
+                           // 0 for no limit, needs stats [default: 0]
+    // Size of the whole database for the search space, when the handle only
+    // holds part of it, 0 to use the handle's own size [default: 0]
+    size_t db_residues, db_entries;
+
+    // Find where each hit's best alignment ends, local alignment only: the
+    // kernel keeps only scores, so the hits are aligned again [default: false]
+    bool ends;
+} sw_search_opts_t;
+
+typedef struct
+{
+    // Hits are in database order, unless max_hits is set in which case they
+    // are sorted best first (ties broken by database order)
+    sw_hit_t *hits;
+    size_t num_hits, capacity;
+
+    // Stats for the last search
+    size_t num_entries;   // database entries scanned
+    double kernel_time;   // seconds spent in alignment_fill_matrices (shared
+                          // by all queries of a sw_search_batch call)
+    size_t num_filtered;  // entries skipped by the filters
+    double prefilter_time;
+    // Rows run through the kernel times its lanes, and how many of those
+    // were padding rather than residues
+    size_t lane_rows, padding_rows;
+} sw_results_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Reads a whole database into memory and packs it for searching. Plain
+ * FASTA files are mapped rather than read.
+ *
+ * @param db_path   Path to a FASTA/FASTQ file (may be gzipped)
+ * @param scoring   Scoring scheme, copied into the handle
+ * @return          New handle or NULL if the file couldn't be read
+ */
+sw_db_t *sw_db_open(const char *db_path, const scoring_t *scoring);
+
+/**
+ * Reads one shard of a database: entries [n * shard / num_shards,
+ * n * (shard + 1) / num_shards) of its n entries, keeping their ids in the
+ * whole file. Lets a database too big for one process be searched by
+ * several. A shard is empty when there are more shards than entries.
+ *
+ * Only plain FASTA files are mapped and can go straight to the shard. Others
+ * (gzipped, FASTQ) are read through once to count their entries and again
+ * up to the start of the shard, so each of n workers decompresses the whole
+ * file and then on average half of it again.
+ *
+ * @return   New handle, without entries if the shard is empty, or NULL if the
+ *           file couldn't be read or has no entries
+ */
+sw_db_t *sw_db_open_shard(const char *db_path, const scoring_t *scoring,
+                          size_t shard, size_t num_shards);
+
+/**
+ * Counts the entries and residues of a database file without loading it,
+ * e.g. for the search space of E-values when it is searched in shards.
+ *
+ * @return   0 on success, -1 if the file couldn't be read
+ */
+int sw_db_size(const char *db_path, size_t *num_residues, size_t *num_entries);
+
+/**
+ * Reads at most max_entries entries from an open file into a new handle.
+ * Used to stream a large database through the search in chunks.
+ *
+ * @param file          File to read from
+ * @param scoring       Scoring scheme, copied into the handle
+ * @param max_entries   Maximum number of entries to read
+ * @param first_entry   Id given to the first entry read (entries read before)
+ * @return              New handle or NULL if there were no more entries
+ */
+sw_db_t *sw_db_load(seq_file_t *file, const scoring_t *scoring,
+                    size_t max_entries, size_t first_entry);
+
+/**
+ * Packs at most max_entries entries of a mapped FASTA file into a new handle,
+ * starting at entry first_entry. The map must outlive the handle.
+ *
+ * @return   New handle or NULL if there were no more entries
+ */
+sw_db_t *sw_db_load_map(const fasta_map_t *map, const scoring_t *scoring,
+                        size_t max_entries, size_t first_entry);
+
+void sw_db_close(sw_db_t *db);
+
+size_t sw_db_num_entries(const sw_db_t *db);
+const char *sw_db_entry_name(const sw_db_t *db, size_t entry);
+size_t sw_db_num_residues(const sw_db_t *db);
+const char *sw_db_entry_seq(const sw_db_t *db, size_t entry);
+size_t sw_db_entry_len(const sw_db_t *db, size_t entry);
+
+/**
+ * Hash of the entries of a handle, in order. Keys a cache of results
+ * (alignment_cache.h) to a database release, and checks that the part of a
+ * database searched before is unchanged. Handles of a mapped FASTA file
+ * hash the text of each entry, header included, others the residues only,
+ * so the two fingerprints of a database differ.
+ *
+ * @param seed   Hash to carry on from: the fingerprint of the chunks before,
+ *               so that the chunks of a database chain to the same hash
+ *               however it was split
+ */
+uint64_t sw_db_fingerprint(const sw_db_t *db, uint64_t seed);
+
+/**
+ * sw_db_fingerprint of the first num_entries entries of a mapped FASTA file,
+ * read straight from the mapping rather than packed into handles.
+ */
+uint64_t sw_db_map_fingerprint(const fasta_map_t *map, size_t num_entries, uint64_t seed);
+
+/**
+ * Bytes of memory held by a handle, not counting a mapped file, which is
+ * paged in as needed.
+ *
+ * @param scratch_bytes   If not NULL, set to the bytes of search scratch
+ *                        space, which grow with the query and the number of
+ *                        threads rather than with the database
+ * @return                Bytes held for the database's entries and scores
+ */
+size_t sw_db_memory(const sw_db_t *db, size_t *scratch_bytes);
+
+void sw_search_opts_init(sw_search_opts_t *opts);
+
+void sw_results_alloc(sw_results_t *results);
+void sw_results_dealloc(sw_results_t *results);
+
+/**
+ * Aligns a query against every entry of the database.
+ *
+ * @param db          Database handle
+ * @param query       Query residues (need not be NUL terminated)
+ * @param query_len   Number of residues in query
+ * @param opts        Search options, or NULL for the defaults
+ * @param results     Results struct (from sw_results_alloc), overwritten
+ * @return            0 on success, -1 on error
+ */
+int sw_search(sw_db_t *db, const char *query, size_t query_len,
+              const sw_search_opts_t *opts, sw_results_t *results);
+
+/**
+ * Aligns several queries against the database in a single pass. Each packed
+ * batch of the database is aligned against every query while it is in cache,
+ * so this is cheaper than calling sw_search once per query. With the
+ * prefilter on, each query gets a pass over its own candidates instead.
+ *
+ * @param db            Database handle
+ * @param queries       Query residues
+ * @param query_lens    Number of residues in each query
+ * @param num_queries   Number of queries
+ * @param opts          Search options, or NULL for the defaults
+ * @param results       One results struct per query, overwritten
+ * @return              0 on success, -1 on error
+ */
+int sw_search_batch(sw_db_t *db, const char *const *queries, const size_t *query_lens,
+                    size_t num_queries, const sw_search_opts_t *opts,
+                    sw_results_t *results);
+
+/**
+ * Aligns a position-specific scoring matrix against every entry of the
+ * database, with the same kernel as sequence queries. The filters aren't
+ * available, and position-specific gap penalties need local alignment.
+ * E-values use the statistics of the scoring scheme, so the PSSM should be
+ * in the same units (as PSI-BLAST's are).
+ *
+ * @param db        Database handle
+ * @param pssm      Query profile, from pssm_load
+ * @param opts      Search options, or NULL for the defaults
+ * @param results   Results struct (from sw_results_alloc), overwritten
+ * @return          0 on success, -1 on error
+ */
+int sw_search_pssm(sw_db_t *db, const pssm_t *pssm,
+                   const sw_search_opts_t *opts, sw_results_t *results);
+
+/**
+ * Aligns every entry of the database against every later one, e.g. to
+ * cluster a set of sequences. The scoring must be symmetric, as each pair is
+ * aligned once rather than both ways round. Entries with no residues are
+ * never the first of a pair.
+ *
+ * @param db          Database handle
+ * @param min_score   Only report pairs scoring at least this
+ * @param callback    Called with the pairs of each group of entries as they
+ *                    are found, ordered by a then b, along with arg
+ * @return            0 on success, -1 if the scoring isn't symmetric
+ */
+int sw_all_vs_all(sw_db_t *db, score_t min_score,
+                  void (callback)(const sw_pair_t *pairs, size_t num_pairs, void *arg),
+                  void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_SEARCH_HEADER_SEEN */
@@ -0,0 +1,364 @@
+/*
+ alignment_shard.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+// request decent POSIX version
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "alignment_shard.h"
+#include "alignment_macros.h"
+
+void sw_shards_init(sw_shards_t *shards, bool stats) {
+    memset(shards, 0, sizeof(sw_shards_t));
+    shards->stats = stats;
+}
+
+static void shards_add(sw_shards_t *shards, int in_fd, int out_fd, pid_t pid,
+                       size_t entry_offset) {
+    shards->workers = realloc(shards->workers, sizeof(shard_worker_t) * (shards->num_workers + 1));
+    shard_worker_t *w = &shards->workers[shards->num_workers++];
+    memset(w, 0, sizeof(shard_worker_t));
+    w->in_fd = in_fd;
+    w->out_fd = out_fd;
+    w->pid = pid;
+    w->entry_offset = entry_offset;
+    w->size = 4096;
+    w->buf = malloc(w->size);
+
+    // requests are written as the worker takes them, while reading its results
+    fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+}
+
+int sw_shards_spawn(sw_shards_t *shards, char *const *argv, size_t entry_offset) {
+    int to_worker[2], from_worker[2];
+
+    if (pipe(to_worker) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    if (pipe(from_worker) != 0) {
+        perror("pipe");
+        close(to_worker[0]);
+        close(to_worker[1]);
+        return -1;
+    }
+
+    // workers started later mustn't hold our ends open, or this one would
+    // never see the end of its input
+    fcntl(to_worker[1], F_SETFD, FD_CLOEXEC);
+    fcntl(from_worker[0], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(to_worker[0]);
+        close(to_worker[1]);
+        close(from_worker[0]);
+        close(from_worker[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        dup2(to_worker[0], STDIN_FILENO);
+        dup2(from_worker[1], STDOUT_FILENO);
+        close(to_worker[0]);
+        close(from_worker[1]);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    close(to_worker[0]);
+    close(from_worker[1]);
+    shards_add(shards, to_worker[1], from_worker[0], pid, entry_offset);
+    return 0;
+}
+
+int sw_shards_connect(sw_shards_t *shards, const char *socket_path, size_t entry_offset) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", socket_path);
+        return -1;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror(socket_path);
+        close(fd);
+        return -1;
+    }
+
+    // the socket is duplicated so each direction can be closed on its own
+    shards_add(shards, fd, dup(fd), 0, entry_offset);
+    return 0;
+}
+
+void sw_shards_close(sw_shards_t *shards) {
+    size_t i;
+
+    // closing their input is what stops the workers
+    for (i = 0; i < shards->num_workers; i++) {
+        close(shards->workers[i].in_fd);
+        close(shards->workers[i].out_fd);
+    }
+    for (i = 0; i < shards->num_workers; i++) {
+        if (shards->workers[i].pid > 0) waitpid(shards->workers[i].pid, NULL, 0);
+        free(shards->workers[i].buf);
+        free(shards->workers[i].out);
+    }
+    free(shards->workers);
+    memset(shards, 0, sizeof(sw_shards_t));
+}
+
+void sw_shard_results_alloc(sw_shard_results_t *results) {
+    memset(results, 0, sizeof(sw_shard_results_t));
+}
+
+static void shard_results_reset(sw_shard_results_t *results) {
+    for (size_t h = 0; h < results->num_hits; h++) free(results->names[h]);
+    results->num_hits = 0;
+    results->failed = false;
+}
+
+void sw_shard_results_dealloc(sw_shard_results_t *results) {
+    shard_results_reset(results);
+    free(results->hits);
+    free(results->names);
+    memset(results, 0, sizeof(sw_shard_results_t));
+}
+
+static void shard_results_add(sw_shard_results_t *results, const sw_hit_t *hit, const char *name) {
+    if (results->num_hits == results->capacity) {
+        results->capacity = results->capacity ? results->capacity * 2 : 256;
+        results->hits = realloc(results->hits, sizeof(sw_hit_t) * results->capacity);
+        results->names = realloc(results->names, sizeof(char *) * results->capacity);
+    }
+    results->hits[results->num_hits] = *hit;
+    results->names[results->num_hits] = strdup(name);
+    results->num_hits++;
+}
+
+static void worker_queue(shard_worker_t *w, const char *str, size_t len) {
+    if (w->out_len + len > w->out_size) {
+        w->out_size = MAX2(w->out_size * 2, w->out_len + len);
+        w->out = realloc(w->out, w->out_size);
+    }
+    memcpy(w->out + w->out_len, str, len);
+    w->out_len += len;
+}
+
+// Parse a result line of the sw_server protocol:
+//   <q>\t<entry>\t<score>[\t<bits>\t<E-value>]\t<name>, <q>\tEND\t<n> or <q>\tERROR\t<msg>
+// Returns the query it is for or -1 if it is malformed, and sets *end if
+// the worker has finished with that query.
+static long parse_result(const sw_shards_t *shards, const shard_worker_t *w, char *line,
+                         size_t num_queries, sw_shard_results_t *results, bool *end) {
+    char *field = line, *next;
+    sw_hit_t hit;
+
+    long q = strtol(field, &next, 10);
+    if (next == field || *next != '\t' || q < 0 || (size_t) q >= num_queries) return -1;
+    field = next + 1;
+
+    *end = true;
+    if (strncmp(field, "END\t", 4) == 0) return q;
+    if (strncmp(field, "ERROR\t", 6) == 0) {
+        fprintf(stderr, "Error: shard worker: %s\n", field + 6);
+        results[q].failed = true;
+        return q;
+    }
+    *end = false;
+
+    memset(&hit, 0, sizeof(hit));
+    hit.entry = strtoull(field, &next, 10) + w->entry_offset;
+    if (next == field || *next != '\t') return -1;
+    field = next + 1;
+
+    long score = strtol(field, &next, 10);
+    if (next == field || *next != '\t') return -1;
+    hit.score = (int32_t) score;
+    field = next + 1;
+
+    if (shards->stats) {
+        hit.bit_score = strtod(field, &next);
+        if (next == field || *next != '\t') return -1;
+        field = next + 1;
+        hit.evalue = strtod(field, &next);
+        if (next == field || *next != '\t') return -1;
+        field = next + 1;
+    }
+
+    shard_results_add(&results[q], &hit, field);
+    return q;
+}
+
+// A hit with its name, so the two are sorted together
+typedef struct
+{
+    sw_hit_t hit;
+    char *name;
+} named_hit_t;
+
+static int hit_cmp_entry(const void *a, const void *b) {
+    const named_hit_t *x = a, *y = b;
+    return x->hit.entry < y->hit.entry ? -1 : (x->hit.entry > y->hit.entry);
+}
+
+static int hit_cmp_best_first(const void *a, const void *b) {
+    const named_hit_t *x = a, *y = b;
+    if (x->hit.score != y->hit.score) return x->hit.score > y->hit.score ? -1 : 1;
+    return hit_cmp_entry(a, b);
+}
+
+// Sort the hits of a query gathered from every shard and keep the best max_hits
+static void shard_results_merge(sw_shard_results_t *results, size_t max_hits) {
+    size_t h, n = results->num_hits;
+    named_hit_t *sorted = malloc(sizeof(named_hit_t) * MAX2(n, 1));
+
+    for (h = 0; h < n; h++) {
+        sorted[h].hit = results->hits[h];
+        sorted[h].name = results->names[h];
+    }
+    qsort(sorted, n, sizeof(named_hit_t), max_hits > 0 ? hit_cmp_best_first : hit_cmp_entry);
+
+    if (max_hits > 0 && n > max_hits) {
+        for (h = max_hits; h < n; h++) free(sorted[h].name);
+        n = results->num_hits = max_hits;
+    }
+    for (h = 0; h < n; h++) {
+        results->hits[h] = sorted[h].hit;
+        results->names[h] = sorted[h].name;
+    }
+
+    free(sorted);
+}
+
+// Take in what the worker has sent, handling each complete line.
+// Returns -1 if the worker has gone or sent something malformed.
+static int worker_read(const sw_shards_t *shards, shard_worker_t *w, size_t num_queries,
+                       sw_shard_results_t *results, size_t *ends) {
+    if (w->size - w->len < 4096) {
+        w->size *= 2;
+        w->buf = realloc(w->buf, w->size);
+    }
+
+    ssize_t n = read(w->out_fd, w->buf + w->len, w->size - w->len - 1);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+    if (n <= 0) {
+        fprintf(stderr, "Error: shard worker exited\n");
+        return -1;
+    }
+
+    w->len += (size_t) n;
+    w->buf[w->len] = '\0';
+
+    char *start = w->buf, *eol;
+    while ((eol = memchr(start, '\n', w->buf + w->len - start)) != NULL) {
+        bool end;
+        *eol = '\0';
+        if (parse_result(shards, w, start, num_queries, results, &end) < 0) {
+            fprintf(stderr, "Error: bad line from shard worker: %s\n", start);
+            return -1;
+        }
+        *ends += end;
+        start = eol + 1;
+    }
+
+    w->len -= (size_t) (start - w->buf);
+    memmove(w->buf, start, w->len);
+    return 0;
+}
+
+// Write as much of the queued requests as the worker will take
+static int worker_write(shard_worker_t *w) {
+    ssize_t n = write(w->in_fd, w->out + w->out_pos, w->out_len - w->out_pos);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+    if (n < 0) {
+        perror("shard worker");
+        return -1;
+    }
+    w->out_pos += (size_t) n;
+    return 0;
+}
+
+int sw_shards_search(sw_shards_t *shards, const char *const *queries, size_t num_queries,
+                     size_t max_hits, sw_shard_results_t *results) {
+    size_t i, q, ends = 0, expected = shards->num_workers * num_queries;
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * 2 * MAX2(shards->num_workers, 1));
+    int status = 0;
+
+    for (q = 0; q < num_queries; q++) shard_results_reset(&results[q]);
+
+    // the query's index is its id, so results map straight back to it
+    for (i = 0; i < shards->num_workers; i++) {
+        shard_worker_t *w = &shards->workers[i];
+        char id[32];
+        w->out_len = w->out_pos = 0;
+        for (q = 0; q < num_queries; q++) {
+            int len = snprintf(id, sizeof(id), "%zu ", q);
+            worker_queue(w, id, (size_t) len);
+            worker_queue(w, queries[q], strlen(queries[q]));
+            worker_queue(w, "\n", 1);
+        }
+    }
+
+    // Workers answer while they are still being sent requests, so both
+    // directions are polled to keep either pipe from filling up
+    while (status == 0 && ends < expected) {
+        size_t nfds = 0;
+        for (i = 0; i < shards->num_workers; i++) {
+            shard_worker_t *w = &shards->workers[i];
+            fds[nfds].fd = w->out_fd;
+            fds[nfds++].events = POLLIN;
+            fds[nfds].fd = w->out_pos < w->out_len ? w->in_fd : -1;
+            fds[nfds++].events = POLLOUT;
+        }
+
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            status = -1;
+            break;
+        }
+
+        for (i = 0; i < shards->num_workers && status == 0; i++) {
+            shard_worker_t *w = &shards->workers[i];
+            if (fds[2 * i + 1].revents & (POLLOUT | POLLERR | POLLHUP)) status = worker_write(w);
+            if (status == 0 && (fds[2 * i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                status = worker_read(shards, w, num_queries, results, &ends);
+            }
+        }
+    }
+
+    free(fds);
+
+    for (q = 0; q < num_queries; q++) {
+        if (status != 0) results[q].failed = true;
+        shard_results_merge(&results[q], max_hits);
+    }
+    return status;
+}
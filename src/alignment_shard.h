@@ -0,0 +1,99 @@
+/*
+ alignment_shard.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_SHARD_HEADER_SEEN
+#define ALIGNMENT_SHARD_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "alignment_search.h"
+
+// A search split across workers that each hold a shard of the database.
+// Workers are sw_server processes, spawned with pipes to their STDIN/STDOUT
+// or already listening on a unix socket, so they can run anywhere the socket
+// reaches. Each query is sent to every worker and their hits are merged.
+// Callers should ignore SIGPIPE, so a worker that dies is an error rather
+// than the end of the process.
+
+typedef struct
+{
+    int in_fd, out_fd;      // requests to the worker, results from it
+    pid_t pid;              // 0 if we didn't start it
+    size_t entry_offset;    // added to the entry ids it reports
+    char *buf;              // partial line read
+    size_t len, size;
+    char *out;              // requests not yet written
+    size_t out_len, out_pos, out_size;
+} shard_worker_t;
+
+typedef struct
+{
+    shard_worker_t *workers;
+    size_t num_workers;
+    bool stats;             // workers report bit scores and E-values
+} sw_shards_t;
+
+typedef struct
+{
+    // Hits are in entry order, unless max_hits is set in which case they
+    // are sorted best first (ties broken by entry)
+    sw_hit_t *hits;
+    char **names;           // name of each hit's entry
+    size_t num_hits, capacity;
+    bool failed;            // a worker couldn't search this query
+} sw_shard_results_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sw_shards_init(sw_shards_t *shards, bool stats);
+
+/**
+ * Starts a worker process that reads requests on STDIN and writes results
+ * to STDOUT, as sw_server --stdin does.
+ *
+ * @param argv           Program and arguments, NULL terminated
+ * @param entry_offset   Added to the entry ids it reports, e.g. the number
+ *                       of entries in the database files before its own
+ * @return               0 on success, -1 on error
+ */
+int sw_shards_spawn(sw_shards_t *shards, char *const *argv, size_t entry_offset);
+
+/**
+ * Adds a worker already listening on a unix socket, as sw_server --socket.
+ *
+ * @return   0 on success, -1 if it couldn't be reached
+ */
+int sw_shards_connect(sw_shards_t *shards, const char *socket_path, size_t entry_offset);
+
+// Stops the workers we started and waits for them to exit
+void sw_shards_close(sw_shards_t *shards);
+
+void sw_shard_results_alloc(sw_shard_results_t *results);
+void sw_shard_results_dealloc(sw_shard_results_t *results);
+
+/**
+ * Searches every shard with each query and merges the hits. Workers search
+ * the queries in parallel, each query once per shard.
+ *
+ * @param queries       Query residues, NUL terminated letters
+ * @param num_queries   Number of queries
+ * @param max_hits      Keep only the best max_hits of each query, 0 for all
+ *                      (workers should be run with the same limit)
+ * @param results       One results struct per query, overwritten
+ * @return              0 on success, -1 if a worker failed, after which
+ *                      the shards can't be searched again
+ */
+int sw_shards_search(sw_shards_t *shards, const char *const *queries, size_t num_queries,
+                     size_t max_hits, sw_shard_results_t *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_SHARD_HEADER_SEEN */
@@ -0,0 +1,251 @@
+/*
+ alignment_stats.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "alignment_stats.h"
+#include "alignment_macros.h"
+
+#define NUM_AMINO_ACIDS 20
+
+static const char amino_acids[NUM_AMINO_ACIDS + 1] = "ARNDCQEGHILKMFPSTWYV";
+
+// Robinson & Robinson (1991) amino acid background frequencies
+static const double amino_acid_freqs[NUM_AMINO_ACIDS] = {
+    0.07805, 0.05129, 0.04487, 0.05364, 0.01925, 0.04264, 0.06295,
+    0.07377, 0.02199, 0.05142, 0.09019, 0.05744, 0.02243, 0.03856,
+    0.05203, 0.07120, 0.05841, 0.01330, 0.03216, 0.06441
+};
+
+// Gapped parameters estimated by simulation, as published with NCBI BLAST.
+// Each row is {gap open, gap extend, lambda, K, H}, where a gap of length N
+// costs open + N * extend.
+typedef struct
+{
+    const char *name;
+    int8_t diagonal[NUM_AMINO_ACIDS]; // identifies the matrix: A-A, R-R, ...
+    size_t num_rows;
+    double rows[16][5];
+} gapped_table_t;
+
+static const gapped_table_t gapped_tables[] = {
+    {"BLOSUM62", {4, 5, 6, 6, 9, 5, 5, 6, 8, 4, 4, 5, 5, 6, 7, 4, 5, 11, 7, 4}, 11, {
+        {11, 2, 0.297, 0.082, 0.27}, {10, 2, 0.291, 0.075, 0.23},
+        {9, 2, 0.279, 0.058, 0.19}, {8, 2, 0.264, 0.045, 0.15},
+        {7, 2, 0.239, 0.027, 0.10}, {6, 2, 0.201, 0.012, 0.061},
+        {13, 1, 0.292, 0.071, 0.23}, {12, 1, 0.283, 0.059, 0.19},
+        {11, 1, 0.267, 0.041, 0.14}, {10, 1, 0.243, 0.024, 0.10},
+        {9, 1, 0.206, 0.010, 0.052}}},
+    {"BLOSUM45", {5, 7, 6, 7, 12, 6, 6, 7, 10, 5, 5, 5, 6, 8, 9, 4, 5, 15, 8, 5}, 15, {
+        {13, 3, 0.207, 0.049, 0.14}, {12, 3, 0.199, 0.039, 0.11},
+        {11, 3, 0.190, 0.031, 0.095}, {10, 3, 0.179, 0.023, 0.075},
+        {16, 2, 0.210, 0.051, 0.14}, {15, 2, 0.203, 0.041, 0.12},
+        {14, 2, 0.195, 0.032, 0.10}, {13, 2, 0.185, 0.024, 0.084},
+        {12, 2, 0.171, 0.016, 0.061}, {19, 1, 0.205, 0.040, 0.11},
+        {18, 1, 0.198, 0.032, 0.10}, {17, 1, 0.189, 0.024, 0.079},
+        {16, 1, 0.176, 0.016, 0.063}, {15, 1, 0.163, 0.012, 0.045}}},
+    {"PAM250", {2, 6, 2, 4, 12, 4, 4, 5, 6, 5, 6, 5, 6, 9, 6, 2, 3, 17, 10, 4}, 15, {
+        {15, 3, 0.205, 0.049, 0.13}, {14, 3, 0.200, 0.043, 0.12},
+        {13, 3, 0.194, 0.036, 0.10}, {12, 3, 0.186, 0.029, 0.085},
+        {11, 3, 0.174, 0.020, 0.070}, {17, 2, 0.204, 0.047, 0.12},
+        {16, 2, 0.198, 0.038, 0.11}, {15, 2, 0.191, 0.031, 0.087},
+        {14, 2, 0.182, 0.024, 0.073}, {13, 2, 0.171, 0.017, 0.059},
+        {21, 1, 0.205, 0.045, 0.11}, {20, 1, 0.199, 0.037, 0.10},
+        {19, 1, 0.192, 0.029, 0.083}, {18, 1, 0.183, 0.021, 0.070},
+        {17, 1, 0.171, 0.014, 0.052}}},
+};
+
+#define NUM_GAPPED_TABLES (sizeof(gapped_tables) / sizeof(gapped_tables[0]))
+
+// Stop summing the series for K once terms are this small
+#define K_SUM_LIMIT 1e-6
+#define K_MAX_ITERATIONS 200
+
+static bool lookup_gapped(const scoring_t *scoring, karlin_t *params) {
+    size_t t, r, i;
+
+    if (scoring->use_match_mismatch) return false;
+
+    for (t = 0; t < NUM_GAPPED_TABLES; t++) {
+        const gapped_table_t *table = &gapped_tables[t];
+
+        for (i = 0; i < NUM_AMINO_ACIDS; i++) {
+            int8_t a = letters_to_index(amino_acids[i]);
+            if (!get_swap_bit(scoring, a, a) ||
+                scoring->swap_scores[a][a] != table->diagonal[i]) break;
+        }
+        if (i < NUM_AMINO_ACIDS) continue;
+
+        for (r = 0; r < table->num_rows; r++) {
+            if (-scoring->gap_open == table->rows[r][0] &&
+                -scoring->gap_extend == table->rows[r][1]) {
+                params->lambda = table->rows[r][2];
+                params->K = table->rows[r][3];
+                params->H = table->rows[r][4];
+                params->gapped = true;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static int gcd(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Ungapped parameters from the distribution of scores of a random pair of
+// residues, probs[s - low] for scores low..high
+static bool ungapped_params(const double *probs, int low, int high, karlin_t *params) {
+    int s, k, delta = 0;
+    double expected = 0;
+
+    for (s = low; s <= high; s++) {
+        expected += s * probs[s - low];
+        if (probs[s - low] > 0) delta = gcd(delta, abs(s));
+    }
+    if (expected >= 0 || high <= 0 || low >= 0) return false;
+
+    // lambda is the positive root of sum p(s) exp(lambda s) = 1
+    double lo = 0, hi = 0.5, f;
+    for (;;) {
+        for (f = -1, s = low; s <= high; s++) f += probs[s - low] * exp(hi * s);
+        if (f > 0) break;
+        lo = hi;
+        hi *= 2;
+    }
+    for (k = 0; k < 100; k++) {
+        double mid = (lo + hi) / 2;
+        for (f = -1, s = low; s <= high; s++) f += probs[s - low] * exp(mid * s);
+        if (f > 0) hi = mid;
+        else lo = mid;
+    }
+    double lambda = (lo + hi) / 2;
+
+    double H = 0;
+    for (s = low; s <= high; s++) H += probs[s - low] * s * exp(lambda * s);
+    H *= lambda;
+
+    // K = lambda delta exp(-2 sigma) / (H (1 - exp(-lambda delta))), where
+    // sigma = sum_k 1/k (E[exp(lambda S_k); S_k < 0] + P(S_k >= 0)) over sums
+    // S_k of k random pair scores
+    int range = high - low;
+    double *dist = calloc((size_t) range * K_MAX_ITERATIONS + 1, sizeof(double));
+    double *next = calloc((size_t) range * K_MAX_ITERATIONS + 1, sizeof(double));
+    double sigma = 0;
+    dist[0] = 1; // S_0 = 0
+
+    for (k = 1; k <= K_MAX_ITERATIONS; k++) {
+        // dist[x] is P(S_k = x + k * low)
+        int width = (k - 1) * range;
+        memset(next, 0, sizeof(double) * ((size_t) k * range + 1));
+        for (int x = 0; x <= width; x++) {
+            if (dist[x] == 0) continue;
+            for (s = 0; s <= range; s++) next[x + s] += dist[x] * probs[s];
+        }
+        double *tmp = dist;
+        dist = next;
+        next = tmp;
+
+        double term = 0;
+        for (int x = 0; x <= k * range; x++) {
+            int score = x + k * low;
+            term += score < 0 ? dist[x] * exp(lambda * score) : dist[x];
+        }
+        term /= k;
+        sigma += term;
+        if (term < K_SUM_LIMIT) break;
+    }
+
+    free(dist);
+    free(next);
+
+    params->lambda = lambda;
+    params->H = H;
+    params->K = lambda * delta * exp(-2 * sigma) / (H * (1 - exp(-lambda * delta)));
+    params->gapped = false;
+    return true;
+}
+
+bool karlin_params_init(const scoring_t *scoring, karlin_t *params) {
+    if (lookup_gapped(scoring, params)) return true;
+
+    int low = 0, high = 0;
+    size_t i, j;
+
+    if (scoring->use_match_mismatch) {
+        // uniform nucleotides: a match a quarter of the time
+        low = MIN2(scoring->mismatch, 0);
+        high = MAX2(scoring->match, 0);
+        double *probs = calloc((size_t) (high - low + 1), sizeof(double));
+        probs[scoring->match - low] += 0.25;
+        probs[scoring->mismatch - low] += 0.75;
+        bool ok = ungapped_params(probs, low, high, params);
+        free(probs);
+        return ok;
+    }
+
+    for (i = 0; i < NUM_AMINO_ACIDS; i++) {
+        for (j = 0; j < NUM_AMINO_ACIDS; j++) {
+            int s = scoring->swap_scores[(int) letters_to_index(amino_acids[i])]
+                                        [(int) letters_to_index(amino_acids[j])];
+            low = MIN2(low, s);
+            high = MAX2(high, s);
+        }
+    }
+
+    double total = 0;
+    for (i = 0; i < NUM_AMINO_ACIDS; i++) total += amino_acid_freqs[i];
+
+    double *probs = calloc((size_t) (high - low + 1), sizeof(double));
+    for (i = 0; i < NUM_AMINO_ACIDS; i++) {
+        for (j = 0; j < NUM_AMINO_ACIDS; j++) {
+            int s = scoring->swap_scores[(int) letters_to_index(amino_acids[i])]
+                                        [(int) letters_to_index(amino_acids[j])];
+            probs[s - low] += amino_acid_freqs[i] * amino_acid_freqs[j] / (total * total);
+        }
+    }
+
+    bool ok = ungapped_params(probs, low, high, params);
+    free(probs);
+    return ok;
+}
+
+double karlin_search_space(const karlin_t *params, size_t query_len,
+                           size_t db_residues, size_t db_entries) {
+    double m = (double) query_len, n = (double) db_residues, N = (double) db_entries;
+    double min_len = 1.0 / params->K;
+    double ell = 0;
+
+    // Expected length of a chance alignment, ell = ln(K m' n') / H
+    for (int i = 0; i < 20; i++) {
+        double mp = MAX2(m - ell, min_len), np = MAX2(n - N * ell, min_len);
+        double next = log(params->K * mp * np) / params->H;
+        ell = MAX2(next, 0);
+    }
+
+    return MAX2(m - ell, min_len) * MAX2(n - N * ell, min_len);
+}
+
+double karlin_bit_score(const karlin_t *params, int score) {
+    return (params->lambda * score - log(params->K)) / log(2.0);
+}
+
+double karlin_evalue(const karlin_t *params, int score, double search_space) {
+    return params->K * search_space * exp(-params->lambda * score);
+}
+
+int karlin_min_score(const karlin_t *params, double evalue, double search_space) {
+    return (int) ceil((log(params->K * search_space) - log(evalue)) / params->lambda);
+}
@@ -0,0 +1,62 @@
+/*
+ alignment_stats.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_STATS_HEADER_SEEN
+#define ALIGNMENT_STATS_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "alignment_scoring.h"
+
+// Karlin-Altschul parameters of a scoring scheme
+typedef struct
+{
+    double lambda, K, H;
+    // false if the gap penalties/matrix aren't in the built-in tables and the
+    // ungapped parameters (which overstate significance) are used instead
+    bool gapped;
+} karlin_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Finds the statistical parameters of a scoring scheme. Gapped parameters
+ * are looked up for BLOSUM45, BLOSUM62 and PAM250 with the usual gap
+ * penalties, otherwise ungapped parameters are computed from the matrix with
+ * Robinson & Robinson background frequencies.
+ *
+ * @param scoring   Scoring scheme
+ * @param params    Filled in on success
+ * @return          false if the scheme has a non-negative expected score, in
+ *                  which case local alignment scores have no statistics
+ */
+bool karlin_params_init(const scoring_t *scoring, karlin_t *params);
+
+/**
+ * Effective search space of a query against a database, with the lengths
+ * reduced by the expected length of a chance alignment.
+ *
+ * @param params        Karlin-Altschul parameters
+ * @param query_len     Query length
+ * @param db_residues   Total length of the database
+ * @param db_entries    Number of sequences in the database
+ */
+double karlin_search_space(const karlin_t *params, size_t query_len,
+                           size_t db_residues, size_t db_entries);
+
+double karlin_bit_score(const karlin_t *params, int score);
+double karlin_evalue(const karlin_t *params, int score, double search_space);
+
+// Lowest score with an E-value of at most evalue
+int karlin_min_score(const karlin_t *params, double evalue, double search_space);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_STATS_HEADER_SEEN */
@@ -0,0 +1,215 @@
+/*
+ alignment_stream.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <omp.h>
+
+#include "alignment_stream.h"
+#include "alignment_alphabet.h"
+#include "alignment_wavefront.h"
+#include "alignment_perf.h"
+#include "alignment_trace.h"
+#include "alignment_macros.h"
+
+int fasta_stream_open(fasta_stream_t *fs, const char *path) {
+    memset(fs, 0, sizeof(fasta_stream_t));
+    fs->file = strcmp(path, "-") == 0 ? gzdopen(fileno(stdin), "r") : gzopen(path, "r");
+    if (fs->file == NULL) {
+        fprintf(stderr, "Error: couldn't open database file %s\n", path);
+        return -1;
+    }
+    gzbuffer(fs->file, STREAM_BUFFER_SIZE);
+    fs->buf = malloc(STREAM_BUFFER_SIZE);
+    fs->line_start = true;
+    fs->entry_done = true;
+    strbuf_alloc(&fs->name, 256);
+    return 0;
+}
+
+void fasta_stream_close(fasta_stream_t *fs) {
+    if (fs->file != NULL) gzclose(fs->file);
+    free(fs->buf);
+    strbuf_dealloc(&fs->name);
+    memset(fs, 0, sizeof(fasta_stream_t));
+}
+
+// false at the end of the file or on an error
+static bool refill(fasta_stream_t *fs) {
+    int n = gzread(fs->file, fs->buf, STREAM_BUFFER_SIZE);
+    if (n < 0) fs->failed = true;
+    fs->len = n > 0 ? (size_t) n : 0;
+    fs->pos = 0;
+    return n > 0;
+}
+
+// Sequence lines up to the next header, copied to seq unless it is NULL
+static size_t read_residues(fasta_stream_t *fs, char *seq, size_t max) {
+    size_t n = 0;
+
+    while (n < max && !fs->entry_done) {
+        if (fs->pos == fs->len && !refill(fs)) {
+            fs->entry_done = true;
+            break;
+        }
+        if (fs->line_start) {
+            if (fs->buf[fs->pos] == '>') {
+                fs->entry_done = true;
+                break;
+            }
+            fs->line_start = false;
+        }
+
+        const char *start = fs->buf + fs->pos;
+        size_t avail = MIN2(fs->len - fs->pos, max - n);
+        const char *newline = memchr(start, '\n', avail);
+        size_t take = newline != NULL ? (size_t) (newline - start) : avail;
+
+        if (seq != NULL) memcpy(seq + n, start, take);
+        n += take;
+        fs->pos += take;
+        if (newline != NULL) {
+            fs->pos++;
+            fs->line_start = true;
+        }
+    }
+    return n;
+}
+
+size_t fasta_stream_read(fasta_stream_t *fs, char *seq, size_t max) {
+    return read_residues(fs, seq, max);
+}
+
+int fasta_stream_next(fasta_stream_t *fs) {
+    while (!fs->entry_done) read_residues(fs, NULL, SIZE_MAX);
+
+    // blank lines before the header
+    while (true) {
+        if (fs->pos == fs->len && !refill(fs)) return fs->failed ? -1 : 0;
+        char c = fs->buf[fs->pos];
+        if (c != '\n' && c != '\r' && c != ' ' && c != '\t') break;
+        fs->pos++;
+    }
+
+    if (fs->buf[fs->pos] != '>') {
+        fprintf(stderr, "Error: only FASTA databases can be streamed (found '%c' where "
+                        "an entry should start)\n", fs->buf[fs->pos]);
+        return -1;
+    }
+    fs->pos++;
+
+    strbuf_reset(&fs->name);
+    while (fs->pos < fs->len || refill(fs)) {
+        const char *start = fs->buf + fs->pos;
+        const char *newline = memchr(start, '\n', fs->len - fs->pos);
+        size_t take = newline != NULL ? (size_t) (newline - start) : fs->len - fs->pos;
+        strbuf_append_strn(&fs->name, start, take);
+        fs->pos += take;
+        if (newline != NULL) {
+            fs->pos++;
+            break;
+        }
+    }
+    if (fs->failed) return -1;
+    strbuf_chomp(&fs->name);
+
+    fs->line_start = true;
+    fs->entry_done = false;
+    return 1;
+}
+
+static double interval(struct timespec start, struct timespec stop) {
+    return (double) (stop.tv_sec - start.tv_sec) + (double) (stop.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+int sw_stream_search(const char *db_path, const scoring_t *scoring,
+                     const char *query, size_t query_len, score_t min_score,
+                     void (callback)(size_t entry, const char *name, int32_t score, void *arg),
+                     void *arg, sw_stream_stats_t *stats) {
+    alphabet_t query_alphabet, db_alphabet;
+    sw_stream_stats_t totals;
+    struct timespec time_start, time_stop;
+    fasta_stream_t fs;
+    int status;
+
+    memset(&totals, 0, sizeof(totals));
+
+    if (scoring->mode != ALIGN_LOCAL) {
+        fprintf(stderr, "Error: only local alignment can be streamed\n");
+        return -1;
+    }
+
+    alphabet_init(&query_alphabet, scoring, scoring->query_unknown);
+    alphabet_init(&db_alphabet, scoring, scoring->db_unknown);
+
+    int8_t *query_indexes = malloc(MAX2(query_len, 1));
+    if (alphabet_translate(&query_alphabet, query, query_len, query_indexes, 1, &query_len) != 0) {
+        free(query_indexes);
+        return -1;
+    }
+
+    if (fasta_stream_open(&fs, db_path) != 0) {
+        free(query_indexes);
+        return -1;
+    }
+
+    int num_threads = omp_get_max_threads();
+    wavefront_stream_t *ws = wavefront_stream_new(scoring, query_indexes, query_len, num_threads, true);
+    char *segment = malloc(STREAM_SEGMENT_RESIDUES);
+    int8_t *segment_indexes = malloc(STREAM_SEGMENT_RESIDUES);
+
+    while ((status = fasta_stream_next(&fs)) == 1) {
+        size_t entry = totals.num_entries, entry_len = 0, segment_len, num_residues;
+        uint64_t begin = trace_begin();
+
+        while ((segment_len = fasta_stream_read(&fs, segment, STREAM_SEGMENT_RESIDUES)) > 0) {
+            trace_end(TRACE_READ, begin, 1);
+            if (alphabet_translate(&db_alphabet, segment, segment_len, segment_indexes, 1,
+                                   &num_residues) != 0) {
+                status = -1;
+                break;
+            }
+
+            begin = trace_begin();
+            perf_start(PERF_KERNEL, num_threads);
+            clock_gettime(CLOCK_REALTIME, &time_start);
+            wavefront_stream_feed(ws, segment_indexes, num_residues, 1);
+            clock_gettime(CLOCK_REALTIME, &time_stop);
+            perf_stop(PERF_KERNEL, num_threads, (uint64_t) num_residues * query_len);
+            trace_end(TRACE_KERNEL, begin, entry);
+
+            totals.kernel_time += interval(time_start, time_stop);
+            totals.num_segments++;
+            entry_len += num_residues;
+            begin = trace_begin();
+        }
+        if (status != 1 || fs.failed) {
+            status = -1;
+            break;
+        }
+
+        int32_t score = wavefront_stream_finish(ws);
+        totals.num_entries++;
+        totals.num_residues += entry_len;
+        totals.max_len = MAX2(totals.max_len, entry_len);
+        if (score >= min_score) callback(entry, fs.name.b, score, arg);
+    }
+
+    if (status < 0 && fs.failed) {
+        fprintf(stderr, "Error: couldn't read database file %s\n", db_path);
+    }
+
+    free(segment);
+    free(segment_indexes);
+    wavefront_stream_free(ws);
+    fasta_stream_close(&fs);
+    free(query_indexes);
+
+    if (stats != NULL) *stats = totals;
+    return status < 0 ? -1 : 0;
+}
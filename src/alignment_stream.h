@@ -0,0 +1,102 @@
+/*
+ alignment_stream.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_STREAM_HEADER_SEEN
+#define ALIGNMENT_STREAM_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "seq_file/seq_file.h"
+#include "alignment_scoring.h"
+
+// Search of a database whose entries may be too long to hold in memory,
+// such as whole chromosomes. The database loader reads an entry whole and
+// packs it into batches, so memory grows with the longest entry. Here each
+// entry is read from the file a segment of residues at a time and each
+// segment is aligned by the wavefront kernel, carrying its bottom row and
+// best score on to the next segment. Memory is a few rows the length of the
+// query and one segment, however long the entries are.
+
+// Residues read and aligned at a time. The tests build with far fewer, so
+// that entries short enough to check cross segment boundaries
+#ifndef STREAM_SEGMENT_RESIDUES
+  #define STREAM_SEGMENT_RESIDUES (1UL << 22)
+#endif
+
+#define STREAM_BUFFER_SIZE (1 << 16)
+
+// A FASTA file, gzipped or not, read an entry and a segment at a time
+typedef struct
+{
+    gzFile file;
+    char *buf;
+    size_t len, pos;
+    bool line_start;   // buf[pos] starts a line
+    bool entry_done;   // the current entry's residues have all been read
+    bool failed;       // the file couldn't be read
+    StrBuf name;       // of the current entry
+} fasta_stream_t;
+
+typedef struct
+{
+    size_t num_entries, num_residues, max_len;
+    size_t num_segments;
+    double kernel_time;
+} sw_stream_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @param path   FASTA file, may be gzipped, "-" for STDIN
+ * @return       0 on success, -1 if the file can't be opened
+ */
+int fasta_stream_open(fasta_stream_t *fs, const char *path);
+
+void fasta_stream_close(fasta_stream_t *fs);
+
+/**
+ * Moves on to the next entry, skipping what is left of the current one.
+ *
+ * @return   1 with the entry's name in fs->name, 0 at the end of the file,
+ *           -1 if the file can't be read or isn't FASTA
+ */
+int fasta_stream_next(fasta_stream_t *fs);
+
+/**
+ * Reads the next bytes of the current entry's sequence, without newlines.
+ *
+ * @param seq   Buffer of at least max bytes
+ * @return      Bytes read, 0 at the end of the entry
+ */
+size_t fasta_stream_read(fasta_stream_t *fs, char *seq, size_t max);
+
+/**
+ * Local alignment of a query against every entry of a FASTA file, streaming
+ * each entry through the wavefront kernel STREAM_SEGMENT_RESIDUES at a time.
+ *
+ * @param db_path     FASTA file, may be gzipped, "-" for STDIN
+ * @param scoring     Scoring scheme, local alignment
+ * @param query       Query sequence, as text
+ * @param min_score   Only entries scoring at least this are passed to callback
+ * @param callback    Called with each entry scoring at least min_score, its
+ *                    0-based position in the file and its name, in file order.
+ *                    Scores are 32-bit, as an entry can't be aligned again
+ *                    once it has been streamed past
+ * @param stats       Set to the totals of the search, may be NULL
+ * @return            0 on success, -1 on an error (after printing it)
+ */
+int sw_stream_search(const char *db_path, const scoring_t *scoring,
+                     const char *query, size_t query_len, score_t min_score,
+                     void (callback)(size_t entry, const char *name, int32_t score, void *arg),
+                     void *arg, sw_stream_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_STREAM_HEADER_SEEN */
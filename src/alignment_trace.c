@@ -0,0 +1,147 @@
+/*
+ alignment_trace.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alignment_trace.h"
+
+// Threads with a ring, any more aren't traced
+#define TRACE_MAX_THREADS 1024
+
+typedef struct
+{
+    uint64_t begin, end;    // nanoseconds
+    uint64_t arg;
+    enum TraceEvent event;
+} trace_event_t;
+
+typedef struct
+{
+    trace_event_t *events;  // TRACE_RING_EVENTS, the oldest overwritten
+    size_t count;           // events ever added
+    size_t tid;
+} trace_ring_t;
+
+static const char *const event_names[TRACE_NUM_EVENTS] = {"read", "pack", "kernel", "print", "wait"};
+static const char *const arg_names[TRACE_NUM_EVENTS] = {"entries", "batch", "batch", "hits", NULL};
+
+static bool trace_on = false;
+static FILE *trace_file = NULL;
+static uint64_t trace_start;
+static trace_ring_t *rings[TRACE_MAX_THREADS];
+static atomic_size_t num_rings;
+
+// the ring of this thread, NULL until its first event
+static _Thread_local trace_ring_t *ring = NULL;
+static _Thread_local bool untraced = false;
+
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000UL + (uint64_t) t.tv_nsec;
+}
+
+static trace_ring_t *ring_new(void) {
+    size_t tid = atomic_fetch_add(&num_rings, 1);
+    if (tid >= TRACE_MAX_THREADS) {
+        untraced = true;
+        return NULL;
+    }
+
+    trace_ring_t *r = malloc(sizeof(trace_ring_t));
+    r->events = malloc(sizeof(trace_event_t) * TRACE_RING_EVENTS);
+    r->count = 0;
+    r->tid = tid;
+    rings[tid] = r;
+    return r;
+}
+
+int trace_open(const char *path) {
+    if ((trace_file = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Error: couldn't write trace %s\n", path);
+        return -1;
+    }
+    atomic_init(&num_rings, 0);
+    trace_start = now_ns();
+    trace_on = true;
+    // the calling thread is the first in the viewer
+    ring = ring_new();
+    return 0;
+}
+
+uint64_t trace_begin(void) {
+    return trace_on ? now_ns() : 0;
+}
+
+void trace_end(enum TraceEvent event, uint64_t begin, uint64_t arg) {
+    if (!trace_on || begin == 0) return;
+    if (ring == NULL && (untraced || (ring = ring_new()) == NULL)) return;
+
+    trace_event_t *e = &ring->events[ring->count++ % TRACE_RING_EVENTS];
+    e->begin = begin;
+    e->end = now_ns();
+    e->arg = arg;
+    e->event = event;
+}
+
+static void write_event(FILE *out, const trace_event_t *e, size_t tid, int pid) {
+    // microseconds from the start of the trace
+    fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"seq-align\",\"ph\":\"X\",\"pid\":%i,\"tid\":%zu,"
+                 "\"ts\":%.3f,\"dur\":%.3f",
+            event_names[e->event], pid, tid, (double) (e->begin - trace_start) / 1000.0,
+            (double) (e->end - e->begin) / 1000.0);
+    if (arg_names[e->event] != NULL) {
+        fprintf(out, ",\"args\":{\"%s\":%" PRIu64 "}", arg_names[e->event], e->arg);
+    }
+    fputc('}', out);
+}
+
+void trace_close(void) {
+    size_t t, i, dropped = 0;
+    int pid = (int) getpid();
+    if (!trace_on) return;
+    trace_on = false;
+
+    size_t n = atomic_load(&num_rings);
+    n = n < TRACE_MAX_THREADS ? n : TRACE_MAX_THREADS;
+
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":0,"
+                        "\"args\":{\"name\":\"seq-align\"}}", pid);
+
+    for (t = 0; t < n; t++) {
+        const trace_ring_t *r = rings[t];
+        fprintf(trace_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":%zu,"
+                            "\"args\":{\"name\":\"", pid, r->tid);
+        if (t == 0) fprintf(trace_file, "main\"}}");
+        else fprintf(trace_file, "thread %zu\"}}", r->tid);
+
+        // oldest first
+        size_t first = r->count > TRACE_RING_EVENTS ? r->count - TRACE_RING_EVENTS : 0;
+        for (i = first; i < r->count; i++) {
+            write_event(trace_file, &r->events[i % TRACE_RING_EVENTS], r->tid, pid);
+        }
+        dropped += first;
+
+        free(r->events);
+        free(rings[t]);
+        rings[t] = NULL;
+    }
+
+    fprintf(trace_file, "\n]}\n");
+    fclose(trace_file);
+    trace_file = NULL;
+    ring = NULL;
+
+    if (dropped > 0) {
+        fprintf(stderr, "Warning: the trace has the last %lu events of each thread, "
+                        "%zu earlier ones were dropped\n", TRACE_RING_EVENTS, dropped);
+    }
+}
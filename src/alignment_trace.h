@@ -0,0 +1,62 @@
+/*
+ alignment_trace.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_TRACE_HEADER_SEEN
+#define ALIGNMENT_TRACE_HEADER_SEEN
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+// Timeline of what every thread was doing: reading the database, packing
+// its batches, aligning a batch or stream, printing hits, and waiting at the
+// barrier at the end of a parallel loop. Each thread appends timestamped
+// events to a ring buffer of its own, without locks, and on trace_close they
+// are written as Chrome trace-event JSON, for chrome://tracing or Perfetto.
+// A ring keeps the last TRACE_RING_EVENTS events of its thread.
+//
+// Off unless trace_open is called, when the calls below do nothing.
+
+#define TRACE_RING_EVENTS (1UL << 17)
+
+enum TraceEvent {TRACE_READ, TRACE_PACK, TRACE_KERNEL, TRACE_PRINT, TRACE_WAIT,
+                 TRACE_NUM_EVENTS};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Starts tracing, to be written to path by trace_close. Only once per process.
+ *
+ * @return   0 on success, -1 if path can't be written
+ */
+int trace_open(const char *path);
+
+/**
+ * Writes the events of all the threads and stops tracing. Call it once no
+ * thread is adding events.
+ */
+void trace_close(void);
+
+/**
+ * @return   Timestamp to pass to trace_end when the event is over, 0 if not
+ *           tracing
+ */
+uint64_t trace_begin(void);
+
+/**
+ * Adds an event that started at begin to this thread's ring.
+ *
+ * @param arg   Shown with the event: the entries read, the batch packed or
+ *              aligned, the hits printed (0 for waiting)
+ */
+void trace_end(enum TraceEvent event, uint64_t begin, uint64_t arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_TRACE_HEADER_SEEN */
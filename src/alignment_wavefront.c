@@ -0,0 +1,481 @@
+/*
+ alignment_wavefront.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <x86intrin.h>
+#include <omp.h>
+
+#include "alignment_wavefront.h"
+#include "alignment_macros.h"
+
+// Lanes of 16-bit scores, and of 32-bit scores when wide. A band row of
+// either is 32 bytes, LANES score_t.
+#define LANES 16
+#define WIDE_LANES 8
+#define NUM_LANES(wide) ((wide) ? WIDE_LANES : LANES)
+
+// A thread takes this many target rows at a time, and fills them this many
+// query columns at a time. Several blocks per thread balance the load, and
+// several tiles per block keep the threads waiting on each other close
+// behind rather than a whole block behind.
+#define BLOCKS_PER_THREAD 4
+#define TILES_PER_THREAD 4
+#define MIN_BLOCK_ROWS 256
+#define MAX_BLOCK_ROWS 8192 // the state of a block stays in cache
+#define MIN_TILE_COLS 256
+#define MAX_TILE_COLS 8192
+
+// Stands in for gap states that can't be reached, far enough from the
+// smallest score that adding penalties doesn't saturate (or wrap)
+#define WAVEFRONT_UNREACHABLE (INT16_MIN / 2)
+#define WIDE_WAVEFRONT_UNREACHABLE (INT32_MIN / 2)
+#define UNREACHABLE(wide) ((wide) ? WIDE_WAVEFRONT_UNREACHABLE : WAVEFRONT_UNREACHABLE)
+
+// Spins before a waiting thread gives up its core
+#define WAIT_SPINS 1024
+
+struct wavefront_stream_t
+{
+    const scoring_t *scoring;
+    int16_t *query_rev;             // query reversed, padded with LANES each side
+    size_t query_len;
+    int num_threads;
+    bool wide;                      // 32-bit scores in WIDE_LANES lanes
+    // The segment of the target being fed
+    const int8_t *target;
+    size_t target_len, target_stride;
+
+    size_t block_rows, tile_cols, num_blocks, num_tiles;
+    // Bottom row of the block above, per query column: H and vertical gap
+    // scores. Block i reads a tile's columns and overwrites them with its own
+    // bottom row, after block i-1 and before block i+1. After the last block
+    // of a segment they are the top of the next segment.
+    int32_t *top_h, *top_f;
+    int32_t best;                   // of the segments fed so far
+    // A block is padded to whole bands, and padding rows would be carried
+    // on to the next segment, so the rows past the last whole band of a
+    // segment wait here to go first in the next one
+    int8_t tail[LANES];
+    size_t tail_len;
+    atomic_size_t *progress;        // tiles of each block that are done
+    size_t progress_capacity;
+    atomic_size_t next_block;
+    alignas(32) int32_t lookup[32 * 32]; // swap_scores for gathers, [query][target]
+};
+
+typedef struct wavefront_stream_t wavefront_t;
+
+static size_t round_up(size_t x, size_t multiple) {
+    return (x + multiple - 1) / multiple * multiple;
+}
+
+// The kernel below is instantiated for 16 lanes of 16-bit scores, whose
+// adds saturate at INT16_MAX, or when wide 8 lanes of 32-bit scores
+static inline __attribute__((always_inline))
+__m256i v_set1(int32_t x, bool wide) {
+    return wide ? _mm256_set1_epi32(x) : _mm256_set1_epi16((int16_t) x);
+}
+
+static inline __attribute__((always_inline))
+__m256i v_adds(__m256i a, __m256i b, bool wide) {
+    return wide ? _mm256_add_epi32(a, b) : _mm256_adds_epi16(a, b);
+}
+
+static inline __attribute__((always_inline))
+__m256i v_max(__m256i a, __m256i b, bool wide) {
+    return wide ? _mm256_max_epi32(a, b) : _mm256_max_epi16(a, b);
+}
+
+// Lanes move up one, lane 0 is set to x
+static inline __attribute__((always_inline))
+__m256i shift_in(__m256i v, int32_t x, bool wide) {
+    __m256i low_up = _mm256_permute2x128_si256(v, v, 0x08); // [0, low half]
+    if (wide) return _mm256_insert_epi32(_mm256_alignr_epi8(v, low_up, 12), x, 0);
+    return _mm256_insert_epi16(_mm256_alignr_epi8(v, low_up, 14), (int16_t) x, 0);
+}
+
+// Score in the last lane
+static inline __attribute__((always_inline))
+int32_t last_lane(__m256i v, bool wide) {
+    return wide ? _mm256_extract_epi32(v, WIDE_LANES - 1) : (int16_t) _mm256_extract_epi16(v, LANES - 1);
+}
+
+// Substitution scores of a query residue per lane (times 32 for lookups)
+// against a row of target residues
+static inline __attribute__((always_inline))
+__m256i lane_scores(const wavefront_t *wf, __m256i query_row, __m256i b_row,
+                    __m256i match, __m256i mismatch, bool match_mismatch, bool wide) {
+    if (match_mismatch) {
+        __m256i same = wide ? _mm256_cmpeq_epi32(b_row, query_row) : _mm256_cmpeq_epi16(b_row, query_row);
+        return _mm256_blendv_epi8(mismatch, match, same);
+    }
+    // each lane has its own row of the matrix, so gather [query][target]
+    if (wide) return _mm256_i32gather_epi32(wf->lookup, _mm256_add_epi32(query_row, b_row), 4);
+    __m256i idx = _mm256_add_epi16(query_row, b_row);
+    __m256i lo = _mm256_i32gather_epi32(wf->lookup, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(idx)), 4);
+    __m256i hi = _mm256_i32gather_epi32(wf->lookup, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(idx, 1)), 4);
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+}
+
+// State carried from one step of a tile to the next
+typedef struct
+{
+    __m256i up_h, up_f;     // bottom row of the band above, for row 0 of each band
+    __m256i diag_h;         // and the cell left of it
+    __m256i prev_bottom;    // bottom row of each band at the last step
+    __m256i best;
+} tile_state_t;
+
+// Step t of a tile: band l fills column t - l. Steps where a band is before
+// the tile or past its end are masked so those bands keep their state.
+static inline __attribute__((always_inline))
+void fill_step(const wavefront_t *wf, tile_state_t *st, const int8_t *block, size_t rows,
+               score_t *h_col, score_t *e_col, int32_t *top_h, int32_t *top_f,
+               const int16_t *query, size_t cols, size_t t,
+               bool match_mismatch, bool masked, bool wide) {
+    const scoring_t *scoring = wf->scoring;
+    const size_t lanes = NUM_LANES(wide);
+    __m256i gap_open = v_set1(scoring->gap_extend + scoring->gap_open, wide);
+    __m256i gap_extend = v_set1(scoring->gap_extend, wide);
+    __m256i match = v_set1(scoring->match, wide);
+    __m256i mismatch = v_set1(scoring->mismatch, wide);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i active = _mm256_set1_epi16(-1);
+    size_t r;
+
+    if (masked) {
+        // bands [first, last] are inside the tile
+        int first = t >= cols ? (int) (t - cols + 1) : 0, last = (int) MIN2(t, lanes - 1);
+        if (wide) {
+            __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            active = _mm256_and_si256(_mm256_cmpgt_epi32(lane, _mm256_set1_epi32(first - 1)),
+                                      _mm256_cmpgt_epi32(_mm256_set1_epi32(last + 1), lane));
+        } else {
+            __m256i lane = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+            active = _mm256_and_si256(_mm256_cmpgt_epi16(lane, _mm256_set1_epi16((int16_t) (first - 1))),
+                                      _mm256_cmpgt_epi16(_mm256_set1_epi16((int16_t) (last + 1)), lane));
+        }
+    }
+
+    // lane l aligns query residue c0 + t - l
+    __m256i query_row = wide ? _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (query - t)))
+                             : _mm256_loadu_si256((const __m256i *) (query - t));
+    if (!match_mismatch) query_row = wide ? _mm256_slli_epi32(query_row, 5) : _mm256_slli_epi16(query_row, 5);
+
+    __m256i h_up = st->up_h, f_up = st->up_f, h_diag = st->diag_h;
+
+    for (r = 0; r < rows; r++) {
+        __m256i b_row = wide ? _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (block + r * lanes)))
+                             : _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i *) (block + r * lanes)));
+        __m256i s = lane_scores(wf, query_row, b_row, match, mismatch, match_mismatch, wide);
+        __m256i h_left = _mm256_load_si256((__m256i *) (h_col + r * LANES));
+        __m256i e_left = _mm256_load_si256((__m256i *) (e_col + r * LANES));
+
+        // E: gap along the query, F: gap along the target
+        __m256i e = v_max(v_adds(h_left, gap_open, wide), v_adds(e_left, gap_extend, wide), wide);
+        __m256i f = v_max(v_adds(h_up, gap_open, wide), v_adds(f_up, gap_extend, wide), wide);
+        __m256i h = v_max(v_adds(h_diag, s, wide), zero, wide);
+        h = v_max(h, v_max(e, f, wide), wide);
+
+        if (masked) {
+            h = _mm256_blendv_epi8(h_left, h, active);
+            e = _mm256_blendv_epi8(e_left, e, active);
+        }
+
+        // kept states are real scores too, so they can't raise the best
+        st->best = v_max(st->best, h, wide);
+        _mm256_store_si256((__m256i *) (h_col + r * LANES), h);
+        _mm256_store_si256((__m256i *) (e_col + r * LANES), e);
+
+        h_diag = h_left;
+        h_up = h;
+        f_up = f;
+    }
+
+    // The last band's bottom row is the top of the block below
+    if (t >= lanes - 1 && t - (lanes - 1) < cols) {
+        top_h[t - (lanes - 1)] = last_lane(h_up, wide);
+        top_f[t - (lanes - 1)] = last_lane(f_up, wide);
+    }
+
+    // Each band's bottom row moves down a lane, the first band reads the
+    // block above
+    st->diag_h = shift_in(st->prev_bottom, t < cols ? top_h[t] : 0, wide);
+    st->up_h = shift_in(h_up, t + 1 < cols ? top_h[t + 1] : 0, wide);
+    st->up_f = shift_in(f_up, t + 1 < cols ? top_f[t + 1] : UNREACHABLE(wide), wide);
+    st->prev_bottom = h_up;
+}
+
+// Fill query columns [c0, c0 + cols) of a block whose bands are rows long.
+// h_col and e_col hold the block's column left of the tile, and are left
+// holding its last column. corner is the H score above and left of the tile.
+static inline __attribute__((always_inline))
+__m256i fill_tile(const wavefront_t *wf, const int8_t *block, size_t rows,
+                  score_t *h_col, score_t *e_col, size_t c0, size_t cols, int32_t corner,
+                  __m256i best, bool match_mismatch, bool wide) {
+    const size_t lanes = NUM_LANES(wide);
+    int32_t *top_h = wf->top_h + c0, *top_f = wf->top_f + c0;
+    const int16_t *query = wf->query_rev + LANES + (wf->query_len - 1 - c0);
+    size_t t, steps = cols + lanes - 1;
+    tile_state_t st;
+
+    st.up_h = shift_in(_mm256_setzero_si256(), top_h[0], wide);
+    st.up_f = shift_in(v_set1(UNREACHABLE(wide), wide), top_f[0], wide);
+    st.diag_h = shift_in(_mm256_setzero_si256(), corner, wide);
+    st.prev_bottom = _mm256_load_si256((__m256i *) (h_col + (rows - 1) * LANES));
+    st.best = best;
+
+    for (t = 0; t < steps; t++) {
+        if (t < lanes - 1 || t >= cols) {
+            fill_step(wf, &st, block, rows, h_col, e_col, top_h, top_f, query, cols, t,
+                      match_mismatch, true, wide);
+        } else {
+            fill_step(wf, &st, block, rows, h_col, e_col, top_h, top_f, query, cols, t,
+                      match_mismatch, false, wide);
+        }
+    }
+    return st.best;
+}
+
+#define FILL_TILE_KERNEL(name, match_mismatch, wide)                                       \
+    static __m256i name(const wavefront_t *wf, const int8_t *block, size_t rows,           \
+                        score_t *h_col, score_t *e_col, size_t c0, size_t cols,            \
+                        int32_t corner, __m256i best) {                                    \
+        return fill_tile(wf, block, rows, h_col, e_col, c0, cols, corner, best,            \
+                         match_mismatch, wide);                                            \
+    }
+
+FILL_TILE_KERNEL(fill_tile_lookup, false, false)
+FILL_TILE_KERNEL(fill_tile_match, true, false)
+FILL_TILE_KERNEL(fill_tile_lookup_32, false, true)
+FILL_TILE_KERNEL(fill_tile_match_32, true, true)
+
+static void wait_for_tiles(atomic_size_t *progress, size_t tiles) {
+    unsigned int spins = 0;
+    while (atomic_load_explicit(progress, memory_order_acquire) < tiles) {
+        if (spins < WAIT_SPINS) {
+            spins++;
+            _mm_pause();
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+// Interleave the rows of block i into bands, one per lane, padded with '*'.
+// Returns the length of the bands.
+static size_t pack_block(const wavefront_t *wf, size_t i, int8_t *block) {
+    size_t lanes = NUM_LANES(wf->wide), first = i * wf->block_rows;
+    size_t rows = MIN2(wf->block_rows, wf->target_len - first);
+    size_t band_rows = (rows + lanes - 1) / lanes, lane, r;
+
+    memset(block, letters_to_index('*'), band_rows * lanes);
+    for (lane = 0; lane < lanes; lane++) {
+        for (r = 0; r < band_rows && lane * band_rows + r < rows; r++) {
+            block[r * lanes + lane] = wf->target[(first + lane * band_rows + r) * wf->target_stride];
+        }
+    }
+    return band_rows;
+}
+
+// Fill every tile of block i, left to right, each once the block above has
+// filled it
+static __m256i fill_block(wavefront_t *wf, size_t i, int8_t *block,
+                          score_t *h_col, score_t *e_col, __m256i best) {
+    size_t band_rows = pack_block(wf, i, block), r, j;
+    __m256i unreachable = v_set1(UNREACHABLE(wf->wide), wf->wide);
+    int32_t corner = 0;
+
+    for (r = 0; r < band_rows; r++) {
+        _mm256_store_si256((__m256i *) (h_col + r * LANES), _mm256_setzero_si256());
+        _mm256_store_si256((__m256i *) (e_col + r * LANES), unreachable);
+    }
+
+    for (j = 0; j < wf->num_tiles; j++) {
+        size_t c0 = j * wf->tile_cols, cols = MIN2(wf->tile_cols, wf->query_len - c0);
+        if (i > 0) wait_for_tiles(&wf->progress[i - 1], j + 1);
+
+        // the next tile's corner, before this tile writes over it
+        int32_t next_corner = wf->top_h[c0 + cols - 1];
+        if (wf->wide) {
+            best = wf->scoring->use_match_mismatch
+                       ? fill_tile_match_32(wf, block, band_rows, h_col, e_col, c0, cols, corner, best)
+                       : fill_tile_lookup_32(wf, block, band_rows, h_col, e_col, c0, cols, corner, best);
+        } else {
+            best = wf->scoring->use_match_mismatch
+                       ? fill_tile_match(wf, block, band_rows, h_col, e_col, c0, cols, corner, best)
+                       : fill_tile_lookup(wf, block, band_rows, h_col, e_col, c0, cols, corner, best);
+        }
+        corner = next_corner;
+
+        atomic_store_explicit(&wf->progress[i], j + 1, memory_order_release);
+    }
+    return best;
+}
+
+// The top of the matrix: nothing above the first row
+static void reset_top(wavefront_t *wf) {
+    for (size_t i = 0; i < wf->query_len; i++) {
+        wf->top_h[i] = 0;
+        wf->top_f[i] = UNREACHABLE(wf->wide);
+    }
+    wf->best = 0;
+    wf->tail_len = 0;
+}
+
+wavefront_stream_t *wavefront_stream_new(const scoring_t *scoring,
+                                         const int8_t *query, size_t query_len,
+                                         int num_threads, bool wide) {
+    wavefront_t *wf = aligned_alloc(32, round_up(sizeof(wavefront_t), 32));
+    size_t i, a, b;
+
+    memset(wf, 0, sizeof(wavefront_t));
+    wf->scoring = scoring;
+    wf->query_len = query_len;
+    wf->num_threads = MAX2(num_threads, 1);
+    wf->wide = wide;
+
+    size_t threads = (size_t) wf->num_threads;
+    wf->tile_cols = query_len / (threads * TILES_PER_THREAD) + 1;
+    wf->tile_cols = MIN2(MAX2(wf->tile_cols, MIN_TILE_COLS), MAX_TILE_COLS);
+    wf->num_tiles = (query_len + wf->tile_cols - 1) / wf->tile_cols;
+
+    wf->query_rev = calloc(query_len + 2 * LANES, sizeof(int16_t));
+    for (i = 0; i < query_len; i++) wf->query_rev[LANES + i] = query[query_len - 1 - i];
+
+    for (a = 0; a < 32; a++) {
+        for (b = 0; b < 32; b++) wf->lookup[a * 32 + b] = scoring->swap_scores[a][b];
+    }
+
+    wf->top_h = malloc(sizeof(int32_t) * MAX2(query_len, 1));
+    wf->top_f = malloc(sizeof(int32_t) * MAX2(query_len, 1));
+    reset_top(wf);
+    return wf;
+}
+
+// Fill the rows of target, following on from the rows filled before
+static void fill_rows(wavefront_t *wf, const int8_t *target, size_t target_len,
+                      size_t target_stride) {
+    size_t i;
+    int32_t best = 0;
+
+    if (target_len == 0) return;
+
+    wf->target = target;
+    wf->target_len = target_len;
+    wf->target_stride = target_stride;
+
+    size_t threads = (size_t) wf->num_threads;
+    wf->block_rows = round_up(target_len / (threads * BLOCKS_PER_THREAD) + 1, LANES);
+    wf->block_rows = MIN2(MAX2(wf->block_rows, MIN_BLOCK_ROWS), MAX_BLOCK_ROWS);
+    wf->num_blocks = (target_len + wf->block_rows - 1) / wf->block_rows;
+
+    if (wf->num_blocks > wf->progress_capacity) {
+        free(wf->progress);
+        wf->progress = malloc(sizeof(atomic_size_t) * wf->num_blocks);
+        wf->progress_capacity = wf->num_blocks;
+    }
+    for (i = 0; i < wf->num_blocks; i++) atomic_init(&wf->progress[i], 0);
+    atomic_init(&wf->next_block, 0);
+
+    // no more threads than blocks, the rest would have nothing to do
+    int used_threads = (int) MIN2(threads, wf->num_blocks);
+
+#pragma omp parallel num_threads(used_threads) reduction(max:best)
+    {
+        size_t band_bytes = round_up(wf->block_rows, 32); // a multiple of the alignment
+        int8_t *block = aligned_alloc(32, band_bytes);
+        // a band row of scores is 32 bytes, 4 per target row when wide
+        score_t *h_col = aligned_alloc(32, sizeof(int32_t) * band_bytes);
+        score_t *e_col = aligned_alloc(32, sizeof(int32_t) * band_bytes);
+        __m256i best_vec = _mm256_setzero_si256();
+        alignas(32) score_t lanes[LANES];
+        alignas(32) int32_t wide_lanes[WIDE_LANES];
+        size_t blk, lane;
+
+        // blocks are handed out in order, so the block a thread waits on has
+        // always been taken by a running thread
+        while ((blk = atomic_fetch_add(&wf->next_block, 1)) < wf->num_blocks) {
+            best_vec = fill_block(wf, blk, block, h_col, e_col, best_vec);
+        }
+
+        if (wf->wide) {
+            _mm256_store_si256((__m256i *) wide_lanes, best_vec);
+            for (lane = 0; lane < WIDE_LANES; lane++) best = MAX2(best, wide_lanes[lane]);
+        } else {
+            _mm256_store_si256((__m256i *) lanes, best_vec);
+            for (lane = 0; lane < LANES; lane++) best = MAX2(best, lanes[lane]);
+        }
+
+        free(block);
+        free(h_col);
+        free(e_col);
+    }
+
+    wf->best = MAX2(wf->best, best);
+}
+
+void wavefront_stream_feed(wavefront_stream_t *wf, const int8_t *target, size_t target_len,
+                           size_t target_stride) {
+    size_t i;
+
+    if (wf->query_len == 0 || target_len == 0) return;
+
+    if (wf->tail_len > 0) {
+        size_t n = MIN2(LANES - wf->tail_len, target_len);
+        for (i = 0; i < n; i++) wf->tail[wf->tail_len++] = target[i * target_stride];
+        target += n * target_stride;
+        target_len -= n;
+        if (wf->tail_len < LANES) return;
+        fill_rows(wf, wf->tail, LANES, 1);
+        wf->tail_len = 0;
+    }
+
+    size_t whole = target_len / LANES * LANES;
+    fill_rows(wf, target, whole, target_stride);
+    for (i = whole; i < target_len; i++) wf->tail[wf->tail_len++] = target[i * target_stride];
+}
+
+int32_t wavefront_stream_finish(wavefront_stream_t *wf) {
+    // the end of the target, where padding no longer matters
+    if (wf->tail_len > 0) fill_rows(wf, wf->tail, wf->tail_len, 1);
+    int32_t best = wf->best;
+    reset_top(wf);
+    return best;
+}
+
+void wavefront_stream_free(wavefront_stream_t *wf) {
+    if (wf == NULL) return;
+    free(wf->query_rev);
+    free(wf->top_h);
+    free(wf->top_f);
+    free(wf->progress);
+    free(wf);
+}
+
+int32_t alignment_wavefront_score(const scoring_t *scoring,
+                                  const int8_t *query, size_t query_len,
+                                  const int8_t *target, size_t target_len, size_t target_stride,
+                                  int num_threads) {
+    int32_t best = 0;
+    bool wide;
+
+    if (query_len == 0 || target_len == 0) return 0;
+
+    // 16-bit scores first, twice the lanes, and 32-bit scores if they saturated
+    for (wide = false; ; wide = true) {
+        wavefront_t *wf = wavefront_stream_new(scoring, query, query_len, num_threads, wide);
+        wavefront_stream_feed(wf, target, target_len, target_stride);
+        best = wavefront_stream_finish(wf);
+        wavefront_stream_free(wf);
+        if (wide || best < INT16_MAX) return best;
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ alignment_wavefront.h
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+#ifndef ALIGNMENT_WAVEFRONT_HEADER_SEEN
+#define ALIGNMENT_WAVEFRONT_HEADER_SEEN
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "alignment_scoring.h"
+
+// Local alignment of a single pair of long sequences on several threads.
+//
+// The database kernel aligns a query against 16 entries at once, one per
+// lane, and a batch per thread, so a single entry (a chromosome, a giant
+// protein) keeps one lane of one core busy. Here the dynamic programming
+// matrix of one pair is split into tiles of target rows x query columns.
+// Each thread takes a block of target rows and fills its tiles left to
+// right, waiting on a ready counter of the block above before each tile, so
+// the tiles being filled move down the matrix as an anti-diagonal wavefront.
+// Inside a tile the rows are split into 16 bands, one per lane, with each
+// band a column behind the band above it so that lanes hand the bottom row
+// of their band down to the next lane. Scores are 16-bit, or 32-bit in 8
+// lanes (wide) for pairs whose scores don't fit.
+
+// The target can also be fed a segment at a time, for targets too long to
+// hold in memory: the bottom row of each segment is kept as the top of the
+// next, so the state between segments is a row the length of the query.
+
+// Pairs with fewer cells than this are aligned by the database kernel
+#define WAVEFRONT_MIN_CELLS (1UL << 22)
+
+typedef struct wavefront_stream_t wavefront_stream_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Best local alignment score of a query against a target, with the scoring
+ * scheme's substitution scores and affine gaps. The pair is aligned with
+ * 16-bit scores, which saturate at INT16_MAX, and again with 32-bit scores
+ * if they do.
+ *
+ * @param scoring         Scoring scheme, local alignment
+ * @param query           Query residue indexes (letters_to_index)
+ * @param query_len       Length of the query
+ * @param target          Target residue indexes, residue i at target[i * target_stride]
+ * @param target_len      Length of the target
+ * @param target_stride   Distance between target residues, e.g. the lanes
+ *                        of a database batch
+ * @param num_threads     Threads to fill the matrix with
+ * @return                Best score
+ */
+int32_t alignment_wavefront_score(const scoring_t *scoring,
+                                  const int8_t *query, size_t query_len,
+                                  const int8_t *target, size_t target_len, size_t target_stride,
+                                  int num_threads);
+
+/**
+ * Starts aligning a query against a target fed in segments.
+ *
+ * @param scoring       Scoring scheme, local alignment, kept until freed
+ * @param query         Query residue indexes (letters_to_index), copied
+ * @param query_len     Length of the query
+ * @param num_threads   Threads to fill the matrix with
+ * @param wide          Use 32-bit scores, otherwise scores saturate at INT16_MAX
+ * @return              Free with wavefront_stream_free
+ */
+wavefront_stream_t *wavefront_stream_new(const scoring_t *scoring,
+                                         const int8_t *query, size_t query_len,
+                                         int num_threads, bool wide);
+
+/**
+ * Aligns the next segment of the target, rows on from the last segment.
+ *
+ * @param target          Residue indexes, residue i at target[i * target_stride],
+ *                        only read during the call
+ * @param target_len      Length of the segment
+ * @param target_stride   Distance between target residues
+ */
+void wavefront_stream_feed(wavefront_stream_t *ws, const int8_t *target, size_t target_len,
+                           size_t target_stride);
+
+/**
+ * Ends the target, starting again from the top for the next one.
+ *
+ * @return   Best score of the target, over all its segments
+ */
+int32_t wavefront_stream_finish(wavefront_stream_t *ws);
+
+void wavefront_stream_free(wavefront_stream_t *ws);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_WAVEFRONT_HEADER_SEEN */
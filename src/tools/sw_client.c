@@ -0,0 +1,130 @@
+/*
+ tools/sw_client.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+// request decent POSIX version
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "seq_file/seq_file.h"
+
+// Test client for sw_server: sends every sequence in a FASTA/FASTQ file to
+// the server, then prints the hits in the same format as smith_waterman
+
+static void print_usage(const char *cmdstr) __attribute__((noreturn));
+
+static void print_usage(const char *cmdstr) {
+    fprintf(stderr,
+            "usage: %s --socket <path> <queries>\n"
+            "  Send each sequence in <queries> to a running sw_server and print the hits.\n",
+            cmdstr);
+    exit(EXIT_FAILURE);
+}
+
+static int connect_to_socket(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return -1;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4 || strcmp(argv[1], "--socket") != 0)
+        print_usage(argv[0]);
+
+    const char *socket_path = argv[2];
+    const char *query_path = argv[3];
+
+    seq_file_t *query_file = seq_open(query_path);
+    if (query_file == NULL) {
+        fprintf(stderr, "Error: couldn't open query file %s\n", query_path);
+        return EXIT_FAILURE;
+    }
+
+    int fd = connect_to_socket(socket_path);
+    if (fd < 0) {
+        seq_close(query_file);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = fdopen(fd, "w");
+    FILE *in = fdopen(dup(fd), "r");
+
+    // Send all queries up front, the server batches them into shared passes
+    read_t r;
+    seq_read_alloc(&r);
+    size_t num_queries = 0;
+    while (seq_read(query_file, &r) > 0) {
+        fprintf(out, "%zu %s\n", num_queries++, r.seq.b);
+    }
+    fflush(out);
+    shutdown(fd, SHUT_WR);
+    seq_read_dealloc(&r);
+    seq_close(query_file);
+
+    // Replies for different queries are not interleaved
+    char *line = NULL;
+    size_t line_size = 0, num_done = 0;
+    ssize_t len;
+    int status = EXIT_SUCCESS;
+
+    while (num_done < num_queries && (len = getline(&line, &line_size, in)) > 0) {
+        char *id = strtok(line, "\t\n");
+        char *field = strtok(NULL, "\t\n");
+        char *value = strtok(NULL, "\t\n");
+
+        if (id == NULL || field == NULL || value == NULL) {
+            fprintf(stderr, "Error: malformed reply from server\n");
+            status = EXIT_FAILURE;
+            break;
+        } else if (strcmp(field, "END") == 0) {
+            printf("Query #%s: %s hits\n\n", id, value);
+            num_done++;
+        } else if (strcmp(field, "ERROR") == 0) {
+            fprintf(stderr, "Error: query #%s: %s\n", id, value);
+            status = EXIT_FAILURE;
+            num_done++;
+        } else {
+            printf("Entry #%s:\nscore: %s\n\n", field, value);
+        }
+    }
+
+    if (num_done < num_queries) {
+        fprintf(stderr, "Error: server closed the connection early\n");
+        status = EXIT_FAILURE;
+    }
+
+    free(line);
+    fclose(in);
+    fclose(out);
+    return status;
+}
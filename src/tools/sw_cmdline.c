@@ -20,6 +20,8 @@
 // Alignment scoring and loading
 #include "alignment_scoring_load.h"
 #include "alignment_cmdline.h"
+#include "alignment_perf.h"
+#include "alignment_trace.h"
 #include "alignment_macros.h"
 
 cmdline_t *cmd;
@@ -34,52 +36,70 @@ static void sw_set_default_scoring(scoring_t * scoring) {
     scoring->gap_extend = -1;
 }
 
-// Align two sequences against each other to find local alignments between them
-void print_alignment_info(aligner_t * aligner, size_t total_cnt) {
+// seqA, once rather than for every chunk
+static void print_query(const read_t *query) {
+    static bool printed_query = false;
 
-    if (cmd->print_matrices) {
-        //alignment_print_matrices(aligner);
-    }
-
-    // seqA
-    if (cmd->print_fasta && aligner->seq_a_fasta != NULL) {
-        fputs(aligner->seq_a_fasta, stdout);
+    if (cmd->print_fasta && !printed_query) {
+        fputs(query->name.b, stdout);
         putc('\n', stdout);
     }
 
-    if (cmd->print_seq) {
-        fputs(aligner->seq_a_str, stdout);
+    if (cmd->print_seq && !printed_query) {
+        fputs(query->seq.b, stdout);
         putc('\n', stdout);
     }
+    printed_query = true;
+}
+
+// Print the local alignment scores of the query against a chunk of the database
+void print_alignment_info(const read_t *query, const sw_db_t *db, const sw_results_t *results) {
 
-    for (size_t b = 0; b < aligner->vector_size; b++) {
-        printf("Entry #%lu:\n", total_cnt + b);
-        assert(aligner->seq_b_fasta_batch != NULL);
+    print_query(query);
+
+    for (size_t h = 0; h < results->num_hits; h++) {
+        const sw_hit_t *hit = &results->hits[h];
+        printf("Entry #%lu:\n", hit->entry);
         // seqB
-        if (cmd->print_fasta && aligner->seq_b_fasta_batch[b] != NULL) {
-            fputs(aligner->seq_b_fasta_batch[b], stdout);
+        if (cmd->print_fasta) {
+            fputs(sw_db_entry_name(db, hit->entry), stdout);
             putc('\n', stdout);
         }
 
         if (cmd->print_seq) {
-            fputs(aligner->seq_b_str_batch[b], stdout);
+            fputs(sw_db_entry_seq(db, hit->entry), stdout);
             putc('\n', stdout);
         }
 
-        fflush(stdout);
-
-        printf("score: %i\n\n", aligner->max_scores[b]);
+        printf("score: %i\n", hit->score);
+        if (cmd->stats) printf("bits: %.1f\nevalue: %.3g\n", hit->bit_score, hit->evalue);
+        if (cmd->ends) printf("ends: %zu %zu\n", hit->query_end, hit->entry_end);
+        putc('\n', stdout);
     }
 
     fflush(stdout);
 }
 
+// Print the score of an entry streamed from the database, as soon as it's
+// been aligned
+void print_stream_info(const read_t *query, size_t entry, const char *name, int32_t score) {
+    print_query(query);
+    printf("Entry #%zu:\n", entry);
+    if (cmd->print_fasta) {
+        fputs(name, stdout);
+        putc('\n', stdout);
+    }
+    printf("score: %i\n\n", score);
+    fflush(stdout);
+}
+
 int main(int argc, char *argv[]) {
 #ifdef SEQ_ALIGN_VERBOSE
     printf("VERBOSE: on\n");
 #endif
 
     scoring_t scoring;
+    int status = EXIT_SUCCESS;
     sw_set_default_scoring(&scoring);
     cmd = cmdline_new(argc, argv, &scoring, SEQ_ALIGN_SW_CMD);
 
@@ -87,14 +107,34 @@ int main(int argc, char *argv[]) {
     const char *query_file = cmdline_get_file1(cmd);
     const char *db_file = cmdline_get_file2(cmd);
 
-    if (query_file != NULL && db_file != NULL) {
-        align_from_query_and_db(query_file, db_file, &scoring, &print_alignment_info, !cmd->interactive);
+    // carry on without counters if they aren't allowed
+    if (cmd->perf) perf_open();
+    if (cmd->trace_path != NULL && trace_open(cmd->trace_path) != 0) {
+        cmdline_free(cmd);
+        return EXIT_FAILURE;
+    }
+
+    if (cmd->all_vs_all_path != NULL) {
+        align_all_vs_all(cmd->all_vs_all_path, &scoring, cmd->min_score);
+    } else if (query_file != NULL && db_file != NULL && cmd->stream) {
+        align_stream(query_file, db_file, &scoring, cmd->min_score, &print_stream_info,
+                     !cmd->interactive);
+    } else if (query_file != NULL && db_file != NULL) {
+        sw_search_opts_t opts;
+        cmdline_get_search_opts(cmd, &opts);
+        if (align_from_query_and_db(query_file, db_file, &scoring, &opts, cmd->query_pssm,
+                                    cmd->checkpoint_path, cmd->resume, cmd->max_memory,
+                                    &print_alignment_info, !cmd->interactive) != 0) {
+            status = EXIT_FAILURE;
+        }
     } else {
         fprintf(stderr, "Error: Both query and database files must be provided\n");
         fflush(stderr);
     }
 
+    perf_report(stderr);
+    trace_close();
     cmdline_free(cmd);
 
-    return EXIT_SUCCESS;
+    return status;
 }
@@ -0,0 +1,635 @@
+/*
+ tools/sw_server.c
+ url: https://github.com/noporpoise/seq-align
+ license: Public Domain, no warranty
+ */
+
+// request decent POSIX version
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <omp.h>
+
+// my utility functions
+#include "seq_file/seq_file.h"
+
+// Alignment scoring and loading
+#include "alignment_scoring_load.h"
+#include "alignment_cmdline.h"
+#include "alignment_search.h"
+#include "alignment_shard.h"
+#include "alignment_cache.h"
+#include "alignment_perf.h"
+#include "alignment_trace.h"
+#include "alignment_macros.h"
+
+// Protocol (one request / response per line, fields separated by tabs):
+//   request:   <id> <sequence>
+//   response:  <id>\t<entry>\t<score>\t<entry name>   for each hit, or with --stats
+//              <id>\t<entry>\t<score>\t<bits>\t<E-value>\t<entry name>
+//              <id>\tEND\t<number of hits>             once all hits are sent
+//              <id>\tERROR\t<message>                  instead, on a bad request
+//
+// With several databases, --shards or --worker the server is a coordinator:
+// it starts a worker sw_server per shard (speaking this protocol over pipes)
+// or connects to running ones, sends each query to all of them and merges
+// their hits. Entry ids are those of the databases one after another.
+
+// Max queries aligned together in one database pass
+#define MAX_QUERIES_PER_PASS 64
+#define MAX_CLIENTS 256
+// Replies waiting for a client to read them, beyond which it is dropped
+#define MAX_CLIENT_OUTPUT (1UL << 28)
+
+typedef struct
+{
+    int in_fd, out_fd;     // the same socket, or STDIN / STDOUT
+    char *buf;             // partial line being read
+    size_t len, size;
+    // Replies not written yet, from out_pos on. Sockets are non-blocking and
+    // written as they take more, so a client that stops reading doesn't hold
+    // up the others; STDOUT blocks.
+    StrBuf out;
+    size_t out_pos;
+    bool hung_up;          // sent all of its requests, removed once answered
+    bool closed;           // went away or fell too far behind, drop its replies
+} client_t;
+
+typedef struct
+{
+    client_t *client;
+    char *id, *seq;
+    size_t seq_len;
+} request_t;
+
+static cmdline_t *cmd;
+static const char *socket_path = NULL;
+
+static client_t *clients[MAX_CLIENTS];
+static size_t num_clients = 0;
+
+static request_t *pending = NULL;
+static size_t num_pending = 0, pending_size = 0;
+
+// Coordinator only: the workers searching the shards
+static sw_shards_t *shards = NULL;
+
+// Results of queries searched before, with --cache
+static sw_cache_t cache;
+static bool use_cache = false;
+
+static void sw_set_default_scoring(scoring_t *scoring) {
+    scoring_system_default(scoring);
+
+    // Change slightly
+    scoring->match = 2;
+    scoring->mismatch = -2;
+    scoring->gap_open = -2;
+    scoring->gap_extend = -1;
+}
+
+static void remove_socket(void) {
+    if (socket_path != NULL) unlink(socket_path);
+}
+
+static void handle_signal(int sig) {
+    (void) sig;
+    remove_socket();
+    _exit(EXIT_SUCCESS);
+}
+
+static int listen_on_socket(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return -1;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    socket_path = path;
+    return fd;
+}
+
+static client_t *client_new(int in_fd, int out_fd) {
+    client_t *c = calloc(1, sizeof(client_t));
+    c->in_fd = in_fd;
+    c->out_fd = out_fd;
+    c->size = 4096;
+    c->buf = malloc(c->size);
+    strbuf_alloc(&c->out, 4096);
+    return c;
+}
+
+static void client_free(client_t *c) {
+    if (c->in_fd != STDIN_FILENO) close(c->in_fd);
+    free(c->buf);
+    strbuf_dealloc(&c->out);
+    free(c);
+}
+
+static bool client_has_output(const client_t *c) {
+    return !c->closed && c->out_pos < c->out.end;
+}
+
+// Write as much of the replies as the client takes without blocking
+static void client_flush(client_t *c) {
+    while (client_has_output(c)) {
+        ssize_t n = write(c->out_fd, c->out.b + c->out_pos, c->out.end - c->out_pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            // client went away, drop its remaining results
+            c->closed = true;
+            break;
+        }
+        c->out_pos += (size_t) n;
+    }
+
+    if (!client_has_output(c)) {
+        strbuf_reset(&c->out);
+        c->out_pos = 0;
+    } else if (c->out_pos > c->out.end / 2) {
+        c->out.end -= c->out_pos;
+        memmove(c->out.b, c->out.b + c->out_pos, c->out.end);
+        c->out_pos = 0;
+    }
+}
+
+// Call after adding replies to c->out
+static void client_queued(client_t *c) {
+    if (c->out.end - c->out_pos > MAX_CLIENT_OUTPUT) {
+        fprintf(stderr, "Warning: dropping a client that isn't reading its results\n");
+        c->closed = true;
+    }
+}
+
+static void reply_error(client_t *c, const char *id, const char *msg) {
+    if (c->closed) return;
+    strbuf_sprintf(&c->out, "%s\tERROR\t%s\n", id, msg);
+    client_queued(c);
+}
+
+// Residues must be letters or '*' to be looked up in the substitution matrix
+static bool valid_sequence(const char *seq, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!isalpha((unsigned char) seq[i]) && seq[i] != '*') return false;
+    }
+    return len > 0;
+}
+
+// Parse '<id> <sequence>' and queue it for the next database pass
+static void queue_request(client_t *c, char *line) {
+    char *id = strtok(line, " \t\r");
+    char *seq = id != NULL ? strtok(NULL, " \t\r") : NULL;
+
+    if (id == NULL) return; // blank line
+
+    if (seq == NULL || strtok(NULL, " \t\r") != NULL) {
+        reply_error(c, id, "expected '<id> <sequence>'");
+        return;
+    }
+
+    size_t seq_len = strlen(seq);
+    if (!valid_sequence(seq, seq_len)) {
+        reply_error(c, id, "invalid sequence");
+        return;
+    }
+
+    if (num_pending == pending_size) {
+        pending_size = pending_size ? pending_size * 2 : 64;
+        pending = realloc(pending, sizeof(request_t) * pending_size);
+    }
+    pending[num_pending].client = c;
+    pending[num_pending].id = strdup(id);
+    pending[num_pending].seq = strdup(seq);
+    pending[num_pending].seq_len = seq_len;
+    num_pending++;
+}
+
+// Read whatever is available and queue any complete lines.
+// Returns false once the client has disconnected.
+static bool client_read(client_t *c) {
+    if (c->size - c->len < 4096) {
+        c->size *= 2;
+        c->buf = realloc(c->buf, c->size);
+    }
+
+    ssize_t n = read(c->in_fd, c->buf + c->len, c->size - c->len - 1);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return true;
+    if (n <= 0) {
+        // treat a final line without a newline as complete
+        if (c->len > 0) {
+            c->buf[c->len] = '\0';
+            queue_request(c, c->buf);
+            c->len = 0;
+        }
+        return false;
+    }
+
+    c->len += (size_t) n;
+    c->buf[c->len] = '\0';
+
+    char *start = c->buf, *end;
+    while ((end = memchr(start, '\n', c->buf + c->len - start)) != NULL) {
+        *end = '\0';
+        queue_request(c, start);
+        start = end + 1;
+    }
+
+    c->len -= (size_t) (start - c->buf);
+    memmove(c->buf, start, c->len);
+    return true;
+}
+
+static void reply_hit(client_t *c, const char *id, const sw_hit_t *hit, const char *name,
+                      const sw_search_opts_t *opts) {
+    if (c->closed) return;
+    if (opts->stats) {
+        strbuf_sprintf(&c->out, "%s\t%zu\t%i\t%.1f\t%.3g\t%s\n", id,
+                       hit->entry, hit->score, hit->bit_score, hit->evalue, name);
+    } else {
+        strbuf_sprintf(&c->out, "%s\t%zu\t%i\t%s\n", id, hit->entry, hit->score, name);
+    }
+    client_queued(c);
+}
+
+static void reply_end(client_t *c, const char *id, size_t num_hits) {
+    if (c->closed) return;
+    strbuf_sprintf(&c->out, "%s\tEND\t%zu\n", id, num_hits);
+    client_queued(c);
+}
+
+static void reply_results(sw_db_t *db, const request_t *req, const sw_results_t *results,
+                          const sw_search_opts_t *opts) {
+    perf_start(PERF_OUTPUT, 1);
+    uint64_t begin = trace_begin();
+    for (size_t h = 0; h < results->num_hits && !req->client->closed; h++) {
+        const sw_hit_t *hit = &results->hits[h];
+        reply_hit(req->client, req->id, hit, sw_db_entry_name(db, hit->entry), opts);
+    }
+    reply_end(req->client, req->id, results->num_hits);
+    trace_end(TRACE_PRINT, begin, results->num_hits);
+    perf_stop(PERF_OUTPUT, 1, 0);
+}
+
+static void search_pending(sw_db_t *db, const sw_search_opts_t *opts, size_t start, size_t n) {
+    const char *queries[MAX_QUERIES_PER_PASS];
+    size_t query_lens[MAX_QUERIES_PER_PASS];
+    request_t *reqs[MAX_QUERIES_PER_PASS];
+    sw_results_t results[MAX_QUERIES_PER_PASS];
+    size_t q, m = 0;
+
+    for (q = 0; q < n; q++) sw_results_alloc(&results[q]);
+
+    // queries searched before are answered straight away, the rest share a pass
+    for (q = 0; q < n; q++) {
+        request_t *req = &pending[start + q];
+        if (use_cache && cache_get(&cache, req->seq, req->seq_len, &results[m])) {
+            reply_results(db, req, &results[m], opts);
+        } else {
+            reqs[m] = req;
+            queries[m] = req->seq;
+            query_lens[m] = req->seq_len;
+            m++;
+        }
+    }
+
+    if (m > 0 && sw_search_batch(db, queries, query_lens, m, opts, results) != 0) {
+        for (q = 0; q < m; q++) reply_error(reqs[q]->client, reqs[q]->id, "search failed");
+    } else {
+        for (q = 0; q < m; q++) {
+            reply_results(db, reqs[q], &results[q], opts);
+            if (use_cache) cache_put(&cache, queries[q], query_lens[q], &results[q]);
+        }
+    }
+
+    for (q = 0; q < n; q++) sw_results_dealloc(&results[q]);
+}
+
+// Coordinator version of search_pending: the workers search their shards
+// in parallel and their hits are merged
+static void search_pending_shards(const sw_search_opts_t *opts, size_t start, size_t n) {
+    const char *queries[MAX_QUERIES_PER_PASS];
+    sw_shard_results_t results[MAX_QUERIES_PER_PASS];
+    size_t q, h;
+
+    for (q = 0; q < n; q++) {
+        queries[q] = pending[start + q].seq;
+        sw_shard_results_alloc(&results[q]);
+    }
+
+    if (sw_shards_search(shards, queries, n, opts->max_hits, results) != 0) {
+        // the shards are gone, so stop taking requests
+        fprintf(stderr, "Error: lost a shard worker, exiting\n");
+        remove_socket();
+        exit(EXIT_FAILURE);
+    }
+
+    for (q = 0; q < n; q++) {
+        request_t *req = &pending[start + q];
+        if (results[q].failed) {
+            reply_error(req->client, req->id, "search failed");
+            continue;
+        }
+        for (h = 0; h < results[q].num_hits && !req->client->closed; h++) {
+            reply_hit(req->client, req->id, &results[q].hits[h], results[q].names[h], opts);
+        }
+        reply_end(req->client, req->id, results[q].num_hits);
+    }
+
+    for (q = 0; q < n; q++) sw_shard_results_dealloc(&results[q]);
+}
+
+// Align queued requests against the database, several per pass, and stream
+// the hits back to whoever asked for them
+static void run_pending(sw_db_t *db, const sw_search_opts_t *opts) {
+    size_t start, q;
+
+    for (start = 0; start < num_pending; start += MAX_QUERIES_PER_PASS) {
+        size_t n = MIN2(num_pending - start, MAX_QUERIES_PER_PASS);
+        if (shards != NULL) search_pending_shards(opts, start, n);
+        else search_pending(db, opts, start, n);
+    }
+
+    for (q = 0; q < num_pending; q++) {
+        free(pending[q].id);
+        free(pending[q].seq);
+    }
+    num_pending = 0;
+}
+
+static void remove_client(size_t i) {
+    size_t q, keep = 0;
+
+    // drop anything it still has queued
+    for (q = 0; q < num_pending; q++) {
+        if (pending[q].client == clients[i]) {
+            free(pending[q].id);
+            free(pending[q].seq);
+        } else {
+            pending[keep++] = pending[q];
+        }
+    }
+    num_pending = keep;
+
+    client_free(clients[i]);
+    clients[i] = clients[--num_clients];
+}
+
+static void serve(sw_db_t *db, int listen_fd, const sw_search_opts_t *opts) {
+    struct pollfd fds[MAX_CLIENTS + 1];
+    size_t i;
+
+    while (listen_fd >= 0 || num_clients > 0) {
+        size_t nfds = 0;
+
+        if (listen_fd >= 0) {
+            fds[nfds].fd = listen_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        // only sockets are left with replies to write, which are read from
+        // the same fd
+        for (i = 0; i < num_clients; i++) {
+            fds[nfds].fd = clients[i]->in_fd;
+            fds[nfds++].events = (clients[i]->hung_up ? 0 : POLLIN) |
+                                 (client_has_output(clients[i]) ? POLLOUT : 0);
+        }
+
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return;
+        }
+
+        // Gather every request that has arrived, so that requests sent
+        // while the last pass was running are batched into the next one
+        size_t first_client = listen_fd >= 0 ? 1 : 0;
+        for (i = num_clients; i-- > 0;) {
+            client_t *c = clients[i];
+            short revents = fds[first_client + i].revents;
+            if (!c->hung_up && (revents & (POLLIN | POLLHUP | POLLERR)) && !client_read(c)) {
+                // answer what it sent before hanging up, e.g. a STDIN pipe
+                run_pending(db, opts);
+                c->hung_up = true;
+            }
+        }
+
+        if (listen_fd >= 0 && (fds[0].revents & POLLIN)) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0 && num_clients < MAX_CLIENTS) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                clients[num_clients++] = client_new(fd, fd);
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        if (num_pending > 0) run_pending(db, opts);
+
+        for (i = num_clients; i-- > 0;) {
+            client_flush(clients[i]);
+            if (clients[i]->hung_up && !client_has_output(clients[i])) remove_client(i);
+        }
+    }
+}
+
+// Options of ours that workers mustn't be given, and whether they take an argument
+static bool coordinator_option(const char *arg, bool *takes_value) {
+    static const char *const with_value[] = {"--database", "--shards", "--worker",
+                                             "--socket", "--dbsize"};
+    *takes_value = false;
+    for (size_t i = 0; i < sizeof(with_value) / sizeof(with_value[0]); i++) {
+        if (strcasecmp(arg, with_value[i]) == 0) return (*takes_value = true);
+    }
+    return strcasecmp(arg, "--stdin") == 0;
+}
+
+// Start a worker process for each shard of each database, with our scoring
+// and search options, and connect to the workers given with --worker
+static int start_shards(int argc, char **argv) {
+    char self[4096], shard_arg[64], dbsize_arg[64];
+    size_t residues, total_residues = 0, total_entries = 0, offset = 0;
+    size_t d, i, n = 0;
+    bool takes_value;
+
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len > 0) self[len] = '\0';
+    else snprintf(self, sizeof(self), "%s", argv[0]);
+
+    // Workers number entries within their file, so those of each file follow
+    // on from the entries of the files before it. E-values need the size of
+    // all of the databases together.
+    size_t *entries = malloc(sizeof(size_t) * (cmd->num_databases + 1));
+    for (d = 0; d < cmd->num_databases; d++) {
+        if (sw_db_size(cmd->databases[d], &residues, &entries[d]) != 0) {
+            free(entries);
+            return -1;
+        }
+        total_residues += residues;
+        total_entries += entries[d];
+    }
+    if (cmd->db_entries != 0) {
+        total_residues = cmd->db_residues;
+        total_entries = cmd->db_entries;
+    }
+    snprintf(dbsize_arg, sizeof(dbsize_arg), "%zu,%zu", total_residues, total_entries);
+
+    char **worker_argv = malloc(sizeof(char *) * (size_t) (argc + 10));
+    worker_argv[n++] = self;
+    for (i = 1; i < (size_t) argc; i++) {
+        if (coordinator_option(argv[i], &takes_value)) i += takes_value;
+        else worker_argv[n++] = argv[i];
+    }
+    worker_argv[n++] = "--stdin";
+
+    unsigned int num_shards = MAX2(cmd->num_shards, 1);
+    int status = 0;
+
+    for (d = 0; d < cmd->num_databases && status == 0; d++) {
+        size_t m = n;
+        worker_argv[m++] = "--database";
+        worker_argv[m++] = cmd->databases[d];
+        if (cmd->stats) {
+            worker_argv[m++] = "--dbsize";
+            worker_argv[m++] = dbsize_arg;
+        }
+        if (num_shards > 1) worker_argv[m++] = "--shard";
+        worker_argv[m + 1] = NULL;
+
+        for (unsigned int s = 0; s < num_shards && status == 0; s++) {
+            snprintf(shard_arg, sizeof(shard_arg), "%u/%u", s, num_shards);
+            worker_argv[m] = num_shards > 1 ? shard_arg : NULL;
+            status = sw_shards_spawn(shards, worker_argv, offset);
+        }
+        offset += entries[d];
+    }
+
+    for (i = 0; i < cmd->num_workers && status == 0; i++) {
+        status = sw_shards_connect(shards, cmd->workers[i], cmd->worker_offsets[i]);
+    }
+
+    free(worker_argv);
+    free(entries);
+
+    if (status == 0) {
+        fprintf(stderr, "Started %zu shard workers\n", shards->num_workers);
+    }
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    scoring_t scoring;
+    sw_shards_t coordinator;
+    sw_db_t *db = NULL;
+
+    sw_set_default_scoring(&scoring);
+    cmd = cmdline_new(argc, argv, &scoring, SEQ_ALIGN_SERVER_CMD);
+
+    sw_search_opts_t opts;
+    cmdline_get_search_opts(cmd, &opts);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (cmd->num_databases > 1 || cmd->num_shards > 1 || cmd->num_workers > 0) {
+        shards = &coordinator;
+        sw_shards_init(shards, opts.stats);
+        if (start_shards(argc, argv) != 0) {
+            sw_shards_close(shards);
+            cmdline_free(cmd);
+            return EXIT_FAILURE;
+        }
+    } else {
+        // the workers of a coordinator report their own counters
+        if (cmd->perf) perf_open();
+        if (cmd->trace_path != NULL && trace_open(cmd->trace_path) != 0) {
+            cmdline_free(cmd);
+            return EXIT_FAILURE;
+        }
+
+        perf_start(PERF_PARSE, omp_get_max_threads());
+        db = cmd->shard_of > 0
+                 ? sw_db_open_shard(cmd->file_path2, &scoring, cmd->shard, cmd->shard_of)
+                 : sw_db_open(cmd->file_path2, &scoring);
+        perf_stop(PERF_PARSE, omp_get_max_threads(), 0);
+        if (db == NULL) {
+            cmdline_free(cmd);
+            return EXIT_FAILURE;
+        }
+
+        fprintf(stderr, "Loaded %zu entries from %s\n", sw_db_num_entries(db), cmd->file_path2);
+
+        if (cmd->cache_path != NULL) {
+            // the shard too, as hits are numbered from its first entry
+            uint64_t shard = ((uint64_t) cmd->shard << 32) | cmd->shard_of;
+            uint64_t context = cache_context(&scoring, &opts, sw_db_fingerprint(db, shard));
+            if (cache_open(&cache, cmd->cache_path, cmd->cache_size ? cmd->cache_size : CACHE_DEFAULT_SIZE,
+                           context) != 0) {
+                sw_db_close(db);
+                cmdline_free(cmd);
+                return EXIT_FAILURE;
+            }
+            use_cache = true;
+        }
+    }
+
+    int listen_fd = -1;
+    if (cmd->socket_path != NULL) {
+        if ((listen_fd = listen_on_socket(cmd->socket_path)) < 0) {
+            sw_db_close(db);
+            cmdline_free(cmd);
+            return EXIT_FAILURE;
+        }
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
+        fprintf(stderr, "Listening on %s\n", cmd->socket_path);
+    } else {
+        clients[num_clients++] = client_new(STDIN_FILENO, STDOUT_FILENO);
+    }
+
+    serve(db, listen_fd, &opts);
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        remove_socket();
+    }
+    free(pending);
+    if (use_cache) {
+        fprintf(stderr, "Cache: answered %zu of %zu queries\n", cache.hits, cache.lookups);
+        cache_close(&cache);
+    }
+    if (shards != NULL) sw_shards_close(shards);
+    perf_report(stderr);
+    trace_close();
+    sw_db_close(db);
+    cmdline_free(cmd);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+
+"""
+Writes the FASTA files that run_tests.sh compares the modified tool with the
+original on, one set for each search path. The sequences are random but
+seeded, so every run writes the same files.
+"""
+
+import os
+import random
+import sys
+
+AMINO_ACIDS = 'ACDEFGHIKLMNPQRSTVWY'
+BASES = 'ACGT'
+
+
+def random_seq(rng, length, alphabet=AMINO_ACIDS):
+    return ''.join(rng.choice(alphabet) for _ in range(length))
+
+
+def w_rich_seq(rng, length):
+    """
+    Mostly tryptophan, which scores 17 against itself in PAM250, so a long
+    enough sequence scores more than 32767 against itself.
+    """
+    return ''.join('W' if rng.random() < 0.85 else rng.choice(AMINO_ACIDS)
+                   for _ in range(length))
+
+
+def mutate(rng, seq, rate, alphabet=AMINO_ACIDS):
+    """
+    Substitute, delete and insert residues of seq, each at about rate.
+    """
+    out = []
+    for c in seq:
+        r = rng.random()
+        if r < rate:
+            out.append(rng.choice(alphabet))
+        elif r < 1.5 * rate:
+            continue
+        elif r < 2 * rate:
+            out.append(c + rng.choice(alphabet))
+        else:
+            out.append(c)
+    return ''.join(out)
+
+
+def write_fasta(path, seqs, names=None):
+    with open(path, 'w') as f:
+        for i, seq in enumerate(seqs):
+            f.write(f'>{names[i] if names else f"entry{i}"}\n')
+            for start in range(0, len(seq), 60):
+                f.write(seq[start:start + 60] + '\n')
+
+
+def server(rng, out_dir):
+    """
+    A few queries and entries holding mutated parts of them, the entries
+    named with descriptions, some of them longer than a socket's buffer.
+    """
+    queries = [random_seq(rng, rng.randint(20, 300)) for _ in range(6)]
+    entries = []
+    names = []
+    for i in range(30):
+        query = rng.choice(queries)
+        start = rng.randrange(len(query))
+        part = mutate(rng, query[start:start + rng.randint(20, 150)], 0.1)
+        entries.append(random_seq(rng, rng.randint(0, 200)) + part + random_seq(rng, rng.randint(0, 200)))
+        names.append(f'entry{i} ' + ' '.join(random_seq(rng, 8) for _ in range(rng.choice([1, 10, 30000]))))
+    write_fasta(os.path.join(out_dir, 'sv_queries.fasta'), queries)
+    write_fasta(os.path.join(out_dir, 'sv_db.fasta'), entries, names)
+
+
+def filters(rng, out_dir):
+    """
+    Entries holding parts of the query mutated from barely to beyond
+    recognition, and as many unrelated entries, for the prefilter and the
+    ungapped filter to keep some and drop the rest.
+    """
+    query = random_seq(rng, 300)
+    entries = []
+    for i in range(100):
+        entry = random_seq(rng, rng.randint(20, 300))
+        if i % 2:
+            start = rng.randrange(len(query) - 20)
+            part = mutate(rng, query[start:start + rng.randint(10, 120)], rng.uniform(0.05, 0.6))
+            pos = rng.randint(0, len(entry))
+            entry = entry[:pos] + part + entry[pos:]
+        entries.append(entry)
+    write_fasta(os.path.join(out_dir, 'ft_query.fasta'), [query])
+    write_fasta(os.path.join(out_dir, 'ft_db.fasta'), entries)
+
+
+def nucleotide(rng, out_dir):
+    """
+    A DNA query and entries holding mutated parts of it, half of them with
+    ambiguity codes that packing can't hold, and a copy of the whole query
+    that outgrows 8- and 16-bit scores with a large match score.
+    """
+    query = random_seq(rng, 1500, BASES)
+    entries = []
+    for i in range(100):
+        entry = random_seq(rng, rng.randint(20, 600), BASES)
+        start = rng.randrange(len(query) - 40)
+        part = mutate(rng, query[start:start + rng.randint(40, 400)], 0.08, BASES)
+        pos = rng.randint(0, len(entry))
+        entry = list(entry[:pos] + part + entry[pos:])
+        if i % 2 == 0:
+            for k in rng.sample(range(len(entry)), rng.randint(1, 10)):
+                entry[k] = rng.choice('NRY')
+        entries.append(''.join(entry))
+    entries.insert(42, query)
+    write_fasta(os.path.join(out_dir, 'nt_query.fasta'), [query])
+    write_fasta(os.path.join(out_dir, 'nt_db.fasta'), entries)
+
+
+def global_alignment(rng, out_dir):
+    """
+    Entries for global and semi-global alignment: mutated copies of the
+    query, copies inside longer sequences, parts of it and unrelated
+    sequences. The long set is a query with an exact and a mutated copy, to
+    score more than 32767 with a large match score.
+    """
+    query = random_seq(rng, 200)
+    entries = [query]
+    for _ in range(10):
+        entries.append(mutate(rng, query, rng.choice([0.02, 0.1, 0.3])))
+    for _ in range(10):
+        entries.append(random_seq(rng, rng.randint(1, 80)) + mutate(rng, query, 0.05) +
+                       random_seq(rng, rng.randint(1, 80)))
+    for _ in range(10):
+        start = rng.randrange(150)
+        entries.append(mutate(rng, query[start:start + rng.randint(20, 200 - start)], 0.05))
+    for _ in range(10):
+        entries.append(random_seq(rng, rng.randint(1, 300)))
+    rng.shuffle(entries)
+    write_fasta(os.path.join(out_dir, 'gl_query.fasta'), [query])
+    write_fasta(os.path.join(out_dir, 'gl_db.fasta'), entries)
+
+    query = random_seq(rng, 900)
+    write_fasta(os.path.join(out_dir, 'gl_long_query.fasta'), [query])
+    write_fasta(os.path.join(out_dir, 'gl_long_db.fasta'),
+                [query, mutate(rng, query, 0.02), random_seq(rng, 850)])
+
+
+def chunks(rng, out_dir):
+    """
+    Many more entries than the smallest chunk of a thread, so that a small
+    --max-memory splits the database into several, a third of them holding a
+    mutated part of the query.
+    """
+    query = random_seq(rng, 200)
+    entries = []
+    for i in range(900):
+        entry = random_seq(rng, rng.randint(20, 200))
+        if i % 3 == 0:
+            start = rng.randrange(len(query) - 20)
+            part = mutate(rng, query[start:start + rng.randint(20, 100)], 0.2)
+            pos = rng.randint(0, len(entry))
+            entry = entry[:pos] + part + entry[pos:]
+        entries.append(entry)
+    write_fasta(os.path.join(out_dir, 'ch_query.fasta'), [query])
+    write_fasta(os.path.join(out_dir, 'ch_db.fasta'), entries)
+
+
+def wavefront(rng, out_dir):
+    """
+    Fewer entries than lanes, each long enough for the wavefront kernel, the
+    first two scoring more than 32767.
+    """
+    query = w_rich_seq(rng, 2600)
+    write_fasta(os.path.join(out_dir, 'wf_query.fasta'), [query])
+    write_fasta(os.path.join(out_dir, 'wf_db.fasta'),
+                [query, mutate(rng, query, 0.02), random_seq(rng, 2400)])
+
+
+def refill(rng, out_dir):
+    """
+    Hundreds of entries of very different lengths, most holding a mutated
+    part of the query, for lane refilling. The query and entries stay short
+    of the wavefront kernel's size; two entries hold the whole query, to
+    score more than 32767 with a large match score.
+    """
+    query = random_seq(rng, 1200)
+    entries = []
+    for _ in range(300):
+        entry = random_seq(rng, rng.randint(5, 400))
+        if rng.random() < 0.7:
+            start = rng.randrange(len(query) - 30)
+            part = mutate(rng, query[start:start + rng.randint(30, 300)], 0.15)
+            pos = rng.randint(0, len(entry))
+            entry = entry[:pos] + part + entry[pos:]
+        entries.append(entry)
+    entries.insert(17, query)
+    entries.insert(200, random_seq(rng, 100) + mutate(rng, query, 0.01) + random_seq(rng, 100))
+    write_fasta(os.path.join(out_dir, 'rf_query.fasta'), [query])
+    write_fasta(os.path.join(out_dir, 'rf_db.fasta'), entries)
+
+
+def interquery(rng, out_dir):
+    """
+    Short queries, enough to fill the lanes of the inter-query kernel, and
+    entries holding mutated parts of them. One entry holds the whole of the
+    longest query, to score more than 32767 with a large match score. Some
+    entries end in stop codons ('*'), which score against '*' in BLOSUM62,
+    and one holds the shortest query followed by a run of them, past where
+    its lane is padded.
+    """
+    queries = [random_seq(rng, rng.randint(8, 500)) for _ in range(23)]
+    queries.insert(5, random_seq(rng, 480))
+    entries = []
+    for _ in range(25):
+        entry = random_seq(rng, rng.randint(50, 1000))
+        for query in rng.sample(queries, 3):
+            start = rng.randrange(len(query))
+            part = mutate(rng, query[start:start + rng.randint(8, 200)], 0.1)
+            pos = rng.randint(0, len(entry))
+            entry = entry[:pos] + part + entry[pos:]
+        if rng.random() < 0.3:
+            entry += '*'
+        entries.append(entry)
+    entries.insert(11, random_seq(rng, 200) + queries[5] + random_seq(rng, 200))
+    entries.append(min(queries, key=len) + '*' * 20)
+    write_fasta(os.path.join(out_dir, 'iq_queries.fasta'), queries)
+    write_fasta(os.path.join(out_dir, 'iq_db.fasta'), entries)
+
+
+SETS = [server, filters, nucleotide, global_alignment, chunks, wavefront, refill, interquery]
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(f'usage: {sys.argv[0]} <output directory>')
+    out_dir = sys.argv[1]
+    os.makedirs(out_dir, exist_ok=True)
+    for make_set in SETS:
+        make_set(random.Random(make_set.__name__), out_dir)
+
+
+if __name__ == '__main__':
+    main()
@@ -1 +1,82 @@
-python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman ../database/query.fasta ../database/test-db.fasta ../scoring/PAM250.txt
\ No newline at end of file
+set -e
+
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman ../database/query.fasta ../database/test-db.fasta ../scoring/PAM250.txt
+
+python make_data.py data
+
+# sw_server: entries with names longer than a socket's buffer, while another client isn't reading
+python tests.py --original_cmd ./smith_waterman --server_cmd ../bin/sw_server data/sv_queries.fasta data/sv_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+
+# Prefilter: the entries whose seed extensions fall short are dropped, against a model of it in tests.py
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --modified_args="--prefilter 40" data/ft_query.fasta data/ft_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --modified_args="--prefilter 50 --wordscore 13" data/ft_query.fasta data/ft_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+
+# Ungapped filter, alone and after the prefilter
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --modified_args="--ungapped 40" data/ft_query.fasta data/ft_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --modified_args="--prefilter 25 --ungapped 45" data/ft_query.fasta data/ft_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+
+# Bit scores and E-values, against BLAST's published parameters of the scoring scheme, and the hits --evalue drops
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --stats 0.267 0.041 0.14 data/ft_query.fasta data/ft_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --modified_args="--evalue 1e-5" --stats 0.243 0.024 0.10 data/ft_query.fasta data/ft_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -10 --gapextend -1"
+
+# Packed nucleotides: entries with ambiguity codes, and a copy of the query scoring more than 32767
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --args "--match 2 --mismatch -3 --gapopen -5 --gapextend -2" --modified_args "--alphabet dna" data/nt_query.fasta data/nt_db.fasta
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --args "--match 25 --mismatch -8 --gapopen -20 --gapextend -5" --modified_args "--alphabet dna" data/nt_query.fasta data/nt_db.fasta
+
+# Global and semi-global alignment, against a Needleman-Wunsch reference in tests.py
+python tests.py --modified_cmd ../bin/smith_waterman --global data/gl_query.fasta data/gl_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+for ends in query db both; do
+    python tests.py --modified_cmd ../bin/smith_waterman --freeends $ends data/gl_query.fasta data/gl_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+done
+python tests.py --modified_cmd ../bin/smith_waterman --global --args "--match 40 --mismatch -20 --gapopen -10 --gapextend -1" data/gl_long_query.fasta data/gl_long_db.fasta
+python tests.py --modified_cmd ../bin/smith_waterman --freeends both --args "--match 40 --mismatch -20 --gapopen -10 --gapextend -1" data/gl_long_query.fasta data/gl_long_db.fasta
+
+# PSSM queries: the query written as a PSSM scores as the query itself, one copy scoring more than 32767
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --pssm plain data/ft_query.fasta data/ft_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --pssm gaps data/ft_query.fasta data/ft_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --pssm gaps --args "--match 40 --mismatch -20 --gapopen -10 --gapextend -1" data/gl_long_query.fasta data/gl_long_db.fasta
+
+# Sharded search: worker processes, more shards than entries, and servers on the shards of a second file numbered after the first
+python tests.py --original_cmd ./smith_waterman --server_cmd ../bin/sw_server --modified_args="--shards 3" data/sv_queries.fasta data/sv_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --server_cmd ../bin/sw_server --modified_args="--shards 40" data/sv_queries.fasta data/sv_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --server_cmd ../bin/sw_server --workers 20 data/sv_queries.fasta data/sv_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+
+# Checkpoints: half the database searched, the rest appended and resumed, plain and gzipped; other options, changed entries and a corrupt checkpoint refused
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --resume data/ft_query.fasta data/ft_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+
+# Chunk sizing: one thread's smallest chunks, as many as a 64K --max-memory allows
+OMP_NUM_THREADS=1 python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --modified_args="--max-memory 64K" --chunks 4 data/ch_query.fasta data/ch_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+
+# Wavefront kernel: a few long entries, two scoring more than 32767
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman data/wf_query.fasta data/wf_db.fasta ../scoring/PAM250.txt
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --args "--match 20 --mismatch -20 --gapopen 0" data/wf_query.fasta data/wf_db.fasta
+
+# All-vs-all: every pair of the server set once, those below --minscore left out
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --allvsall --modified_args="--minscore 30" data/sv_db.fasta data/sv_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+
+# Lane refilling: entries of very different lengths, two scoring more than 32767
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman data/rf_query.fasta data/rf_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --args "--match 30 --mismatch -10" data/rf_query.fasta data/rf_db.fasta
+
+# Inter-query kernel: 24 short queries searched together through sw_server, one scoring more than 32767
+python tests.py --original_cmd ./smith_waterman --server_cmd ../bin/sw_server data/iq_queries.fasta data/iq_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --server_cmd ../bin/sw_server --args "--match 70 --mismatch -30" data/iq_queries.fasta data/iq_db.fasta
+
+# Result cache: answered from the file a second time, but not with other scoring or a changed database
+python tests.py --original_cmd ./smith_waterman --server_cmd ../bin/sw_server --cache data/sv_queries.fasta data/sv_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+
+# Where each best alignment ends (--ends), against the original's alignment
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --ends data/rf_query.fasta data/rf_db.fasta ../scoring/BLOSUM62.txt --args "--gapopen -11 --gapextend -1"
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --ends data/wf_query.fasta data/wf_db.fasta ../scoring/PAM250.txt
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --ends --args "--match 2 --mismatch -3 --gapopen -5 --gapextend -2" --modified_args "--alphabet dna" data/nt_query.fasta data/nt_db.fasta
+
+# Python bindings: scores and ends of a batch of queries, the hit fields' buffers and matrix errors
+make -C .. python
+python test_python.py --original_cmd ./smith_waterman data/sv_queries.fasta data/sv_db.fasta ../scoring/BLOSUM62.txt
+
+# Streaming: 32-bit scores of the wavefront set, and entries crossing segment
+# boundaries with a build that streams 997 residues at a time
+python tests.py --original_cmd ./smith_waterman --modified_cmd ../bin/smith_waterman --modified_args=--stream data/wf_query.fasta data/wf_db.fasta ../scoring/PAM250.txt
+make -C .. test/sw_small_segments
+python tests.py --original_cmd ./smith_waterman --modified_cmd ./sw_small_segments --modified_args=--stream data/wf_query.fasta data/wf_db.fasta ../scoring/PAM250.txt
+python tests.py --original_cmd ./smith_waterman --modified_cmd ./sw_small_segments --modified_args=--stream --args "--match 30 --mismatch -10" data/rf_query.fasta data/rf_db.fasta
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+
+"""
+Checks the seqalign extension (make python) against the original tool: the
+scores and ends of a batch of queries, the hit fields as strided read-only
+buffers, and errors in a substitution matrix raised as exceptions.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+from tests import parse_fasta, extract_first_score_from_original
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'python'))
+import seqalign  # noqa: E402
+
+
+def check(cond, msg):
+    if not cond:
+        sys.exit(f"Error: {msg}")
+
+
+def check_buffers(res):
+    """
+    Each field is a read-only view of the hit array, one hit apart, that
+    keeps the results alive.
+    """
+    fields = [res.entries, res.scores, res.query_ends, res.entry_ends]
+    hits = [f.tolist() for f in fields]
+    check(len(set(f.strides for f in fields)) == 1 and fields[0].strides[0] > 8,
+          f"fields aren't strided over the hits: {[f.strides for f in fields]}")
+    for f in fields:
+        check(len(f) == len(res), "a field's length differs from the number of hits")
+        try:
+            f[0] = 0
+            sys.exit("Error: a hit field is writable")
+        except (ValueError, TypeError):
+            pass
+    base = fields[0]
+    while type(base).__name__ != '_HitField':
+        base = base.obj if isinstance(base, memoryview) else base.base
+    view = memoryview(base)
+    check(view.readonly and not view.c_contiguous and view.tolist() == hits[0],
+          "the buffer of a hit field isn't a read-only strided view of the hits")
+    del res
+    check([f.tolist() for f in fields] == hits, "fields changed once the results were freed")
+
+
+def main():
+    p = argparse.ArgumentParser(description="Compare the seqalign module with the original tool")
+    p.add_argument('query', help='Path to query FASTA')
+    p.add_argument('database', help='Path to DB FASTA')
+    p.add_argument('matrix', help='Substitution matrix file')
+    p.add_argument('--original_cmd', default='smith_waterman',
+                   help='Name/path of the original SW executable')
+    p.add_argument('--gapopen', type=int, default=-11)
+    p.add_argument('--gapextend', type=int, default=-1)
+    args = p.parse_args()
+
+    queries = [seq for _, seq in parse_fasta(args.query)]
+    db_list = parse_fasta(args.database)
+    scoring = ['--substitution_matrix', args.matrix,
+               '--gapopen', str(args.gapopen), '--gapextend', str(args.gapextend)]
+
+    db = seqalign.Database(args.database, matrix=args.matrix,
+                           gap_open=args.gapopen, gap_extend=args.gapextend)
+    batch = db.search_batch(queries, ends=True)
+    check(len(batch) == len(queries), f"{len(batch)} results for {len(queries)} queries")
+
+    for q_idx, (q_seq, res) in enumerate(zip(queries, batch)):
+        check(res.scores.tolist() == db.search(q_seq, ends=True).scores.tolist(),
+              f"search and search_batch differ for query #{q_idx}")
+        got = dict(zip(res.entries.tolist(),
+                       zip(res.scores.tolist(), res.query_ends.tolist(), res.entry_ends.tolist())))
+        for idx, (_, db_seq) in enumerate(db_list):
+            try:
+                orig = extract_first_score_from_original(args.original_cmd, scoring, q_seq, db_seq,
+                                                         ends=True)
+            except (FileNotFoundError, subprocess.CalledProcessError, ValueError) as e:
+                sys.exit(f"Error running original SW on query #{q_idx}, entry #{idx}: {e}")
+            if got.get(idx, (0, 0, 0)) != orig:
+                print(f"Query: {q_seq}\n{db_seq}", file=sys.stderr)
+                sys.exit(f"Query #{q_idx}, entry #{idx}: seqalign (score, query end, entry end) = "
+                         f"{got.get(idx)}, original = {orig}")
+        check_buffers(res)
+
+    check(len(db.search(queries[0], min_score=32767).scores) == 0, "hits above any score")
+    try:
+        db.search(queries[0], min_score=1 << 16)
+        sys.exit("Error: a min_score beyond 16 bits was taken")
+    except ValueError:
+        pass
+
+    with tempfile.TemporaryDirectory() as tmp:
+        bad = os.path.join(tmp, 'bad.txt')
+        with open(bad, 'w') as f:
+            f.write('  A  C\nA  1 -1\nC -1\n')
+        try:
+            seqalign.Database(args.database, matrix=bad)
+            sys.exit("Error: a malformed matrix was loaded")
+        except ValueError as e:
+            check(f'{bad}: line 1: ' in str(e), f"unexpected matrix error '{e}'")
+        try:
+            seqalign.Database(args.database, matrix=os.path.join(tmp, 'missing.txt'))
+            sys.exit("Error: a missing matrix was loaded")
+        except OSError:
+            pass
+
+    print("All seqalign scores match the original tool.")
+
+
+if __name__ == '__main__':
+    main()
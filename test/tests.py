@@ -6,9 +6,18 @@ Prompts used: https://chatgpt.com/share/680dee2a-0b2c-800f-a7eb-0ebf92dfe9b6
 """
 
 import argparse
+import contextlib
+import gzip
+import math
 import subprocess
 import re
+import shlex
+import socket
 import sys
+import tempfile
+import time
+
+AMINO_ACIDS = 'ACDEFGHIKLMNPQRSTVWY'
 
 def parse_fasta(path):
     """
@@ -33,35 +42,483 @@ def parse_fasta(path):
             seqs.append((header, ''.join(lines)))
     return seqs
 
-def extract_modified_scores(mod_cmd, matrix, query, db):
+def scoring_args(matrix, args):
+    """
+    Options giving both tools the same scoring: the substitution matrix, if
+    any, then the extra options from --args.
+    """
+    return (['--substitution_matrix', matrix] if matrix else []) + shlex.split(args)
+
+def load_matrix(path):
+    """
+    Read a substitution matrix file; returns {(a, b): score}.
+    """
+    scores = {}
+    columns = None
+    with open(path) as f:
+        for l in f:
+            fields = l.split()
+            if not fields or fields[0].startswith('#'):
+                continue
+            if columns is None:
+                columns = fields
+            else:
+                for b, s in zip(columns, fields[1:]):
+                    scores[(fields[0], b)] = int(s)
+    return scores
+
+def global_score(query, entry, substitution, gap_open, gap_extend,
+                 free_query, free_db):
+    """
+    Score of the best Needleman-Wunsch alignment of query and entry with
+    affine gaps (a gap of k residues costs gap_open + k * gap_extend), the
+    reference for --global. free_query and free_db make gaps before and
+    after the query or the entry free, as --freeends does.
+    """
+    unreachable = -(1 << 60)
+    n = len(query)
+    gap_first = gap_open + gap_extend
+    def gap(k):
+        return gap_open + gap_extend * k
+
+    # H ends in a substitution, E in a gap in the query, F in a gap in the entry
+    H = [0] + [0 if free_query else unreachable] * n
+    E = [unreachable] * (n + 1)
+    F = [unreachable] + [unreachable if free_query else gap(i) for i in range(1, n + 1)]
+    best_col = max(H[n], F[n])
+
+    for j, b in enumerate(entry, 1):
+        row = [substitution(a, b) for a in query]
+        nH = [0 if free_db else unreachable]
+        nE = [unreachable if free_db else gap(j)]
+        nF = [unreachable]
+        for i in range(1, n + 1):
+            nH.append(max(H[i - 1], E[i - 1], F[i - 1]) + row[i - 1])
+            nE.append(max(H[i] + gap_first, E[i] + gap_extend, F[i] + gap_first))
+            nF.append(max(nH[i - 1] + gap_first, nE[i - 1] + gap_first, nF[i - 1] + gap_extend))
+        H, E, F = nH, nE, nF
+        best_col = max(best_col, H[n], E[n], F[n])
+
+    if free_query:
+        best = max(max(h, e, f) for h, e, f in zip(H, E, F))
+    else:
+        best = max(H[n], E[n], F[n])
+    return max(best, best_col) if free_db else best
+
+def parse_scoring(matrix, args):
+    """
+    The scoring the tools get from the matrix and --args: a function scoring
+    residue a against b, and the gap penalties (None if --args leaves them
+    to the tools' defaults).
+    """
+    p = argparse.ArgumentParser(prog='--args')
+    p.add_argument('--match', type=int, default=1)
+    p.add_argument('--mismatch', type=int, default=-2)
+    p.add_argument('--gapopen', type=int)
+    p.add_argument('--gapextend', type=int)
+    opts, _ = p.parse_known_args(shlex.split(args))
+
+    if matrix:
+        scores = load_matrix(matrix)
+        substitution = lambda a, b: scores[(a.upper(), b.upper())]
+    else:
+        substitution = lambda a, b: opts.match if a.upper() == b.upper() else opts.mismatch
+    return substitution, opts.gapopen, opts.gapextend
+
+def global_reference(matrix, args, freeends):
+    """
+    A function scoring (query, entry) with global_score, from the matrix and
+    the scoring options in --args, which must give the gap penalties.
+    """
+    substitution, gap_open, gap_extend = parse_scoring(matrix, args)
+    if gap_open is None or gap_extend is None:
+        sys.exit("Error: --global needs --gapopen and --gapextend in --args")
+    free_query = freeends in ('query', 'both')
+    free_db = freeends in ('db', 'both')
+    return lambda query, entry: global_score(query, entry, substitution, gap_open,
+                                             gap_extend, free_query, free_db)
+
+# Seed words of the prefilter, and how far an extension may fall below its best
+PREFILTER_WORD_LEN = 3
+PREFILTER_X_DROP = 20
+
+def prefilter_score(query, entry, substitution, residues, word_score):
+    """
+    Best ungapped extension of a seed word, as --prefilter scores an entry. A
+    word of the entry seeds at each query position that it scores at least
+    word_score against, if all its residues are in the matrix. It is extended
+    along its diagonal to the right, then to the left, each way until the
+    score falls PREFILTER_X_DROP below its best. Seeds on the part of a
+    diagonal that an extension covered are skipped.
+    """
+    w = PREFILTER_WORD_LEN
+    n, m = len(query), len(entry)
+    seeds = {}
+    diag_end = [0] * (n + m + 1)
+    best = 0
+
+    for j in range(m - w + 1):
+        word = entry[j:j + w]
+        if word not in seeds:
+            seeds[word] = [i for i in range(n - w + 1) if set(word) <= residues and
+                           sum(substitution(query[i + k], word[k]) for k in range(w)) >= word_score]
+        for i in seeds[word]:
+            d = j + n - i
+            if j < diag_end[d]:
+                continue
+            score = sum(substitution(query[i + k], word[k]) for k in range(w))
+
+            run, qi, dj = score, i + w, j + w
+            while qi < n and dj < m:
+                run += substitution(query[qi], entry[dj])
+                if run > score:
+                    score = run
+                elif score - run >= PREFILTER_X_DROP:
+                    break
+                qi, dj = qi + 1, dj + 1
+            diag_end[d] = dj
+
+            run, qi, dj = score, i, j
+            while qi > 0 and dj > 0:
+                run += substitution(query[qi - 1], entry[dj - 1])
+                if run > score:
+                    score = run
+                elif score - run >= PREFILTER_X_DROP:
+                    break
+                qi, dj = qi - 1, dj - 1
+            best = max(best, score)
+    return best
+
+def ungapped_score(query, entry, substitution):
+    """
+    Score of the best ungapped local alignment, as --ungapped scores an entry.
+    """
+    best = 0
+    for d in range(1 - len(query), len(entry)):
+        run = 0
+        for i in range(max(0, -d), min(len(query), len(entry) - d)):
+            run = max(0, run + substitution(query[i], entry[i + d]))
+            best = max(best, run)
+    return best
+
+def filter_reference(matrix, args, modified_args):
+    """
+    A function telling whether the --prefilter and --ungapped cutoffs in the
+    modified tool's options keep (query, entry), or None without them.
+    """
+    p = argparse.ArgumentParser(prog='--modified_args')
+    p.add_argument('--prefilter', type=int, default=0)
+    p.add_argument('--ungapped', type=int, default=0)
+    p.add_argument('--wordscore', type=int, default=11)
+    p.add_argument('--exact', action='store_true')
+    opts, _ = p.parse_known_args(modified_args)
+    if opts.exact or (opts.prefilter <= 0 and opts.ungapped <= 0):
+        return None
+    if not matrix:
+        sys.exit("Error: the filters are only compared with a substitution matrix")
+
+    scores = load_matrix(matrix)
+    residues = {a for a, _ in scores}
+    substitution = lambda a, b: scores[(a, b)]
+
+    def passes(query, entry):
+        query, entry = query.upper(), entry.upper()
+        if opts.prefilter > 0 and prefilter_score(query, entry, substitution, residues,
+                                                  opts.wordscore) < opts.prefilter:
+            return False
+        return opts.ungapped <= 0 or ungapped_score(query, entry, substitution) >= opts.ungapped
+    return passes
+
+def karlin_reference(params, query_len, db_list, modified_args):
+    """
+    A function giving the (bits, evalue) that --stats prints for a score, as
+    formatted, from the Karlin-Altschul parameters (lambda, K, H) of the
+    scoring scheme, and the lowest score --evalue in the modified tool's
+    options lets through (None without it). The search space is that of the
+    query against the whole database, with the lengths reduced by the
+    expected length of a chance alignment as in BLAST.
+    """
+    lam, K, H = params
+    m, n, N = float(query_len), float(sum(len(seq) for _, seq in db_list)), float(len(db_list))
+    min_len = 1.0 / K
+    ell = 0.0
+    for _ in range(20):
+        ell = max(math.log(K * max(m - ell, min_len) * max(n - N * ell, min_len)) / H, 0)
+    space = max(m - ell, min_len) * max(n - N * ell, min_len)
+
+    p = argparse.ArgumentParser(prog='--modified_args')
+    p.add_argument('--evalue', type=float)
+    opts, _ = p.parse_known_args(modified_args)
+    min_score = None
+    if opts.evalue is not None:
+        min_score = math.ceil((math.log(K * space) - math.log(opts.evalue)) / lam)
+
+    def stats(score):
+        bits = (lam * score - math.log(K)) / math.log(2.0)
+        return f'{bits:.1f}', f'{K * space * math.exp(-lam * score):.3g}'
+    return stats, min_score
+
+def write_pssm(path, query, matrix, args, gaps):
+    """
+    Write the query as a PSSM scoring each position as the matrix or
+    --match/--mismatch score its residue, so searching with it gives the
+    scores of the query itself. With gaps, each position also has the gap
+    penalties of --args in its open and extend columns.
+    """
+    substitution, gap_open, gap_extend = parse_scoring(matrix, args)
+    if gaps and (gap_open is None or gap_extend is None):
+        sys.exit("Error: --pssm gaps needs --gapopen and --gapextend in --args")
+    with open(path, 'w') as f:
+        f.write(' '.join(AMINO_ACIDS) + (' open extend' if gaps else '') + '\n')
+        for i, a in enumerate(query, 1):
+            row = [str(substitution(a, b)) for b in AMINO_ACIDS]
+            if gaps:
+                row += [str(gap_open), str(gap_extend)]
+            f.write(f'{i} {a} ' + ' '.join(row) + '\n')
+
+def extract_modified_scores(mod_cmd, scoring, query, db, min_chunks=0):
     """
     Run the modified smith_waterman2 tool once and parse its output
     for lines like:
       Entry #557023:
       score: 16
-    Returns dict {entry_index: score_int}.
+    followed by 'bits: <b>' and 'evalue: <e>' lines with --stats, or
+    'ends: <query end> <entry end>' with --ends.
+    Returns dict {entry_index: score_int}, with the stats
+    {entry_index: (score, bits_str, evalue_str)}, or with the ends
+    {entry_index: (score, query_end, entry_end)}.
+    With min_chunks, its 'Chunks:' line must report at least that many
+    chunks and a peak memory other than 0.
     """
     proc = subprocess.run(
-        [mod_cmd, '--substitution_matrix', matrix, '--files', query, db],
+        [mod_cmd] + scoring + ['--files', query, db],
         stdout=subprocess.PIPE,
         stderr=subprocess.PIPE,
         text=True,
         check=True
     )
-    out = proc.stdout
-    entry_rx = re.compile(r'Entry\s+#(\d+):\s*score:\s*([+-]?\d+)', re.IGNORECASE)
+    if min_chunks:
+        m = re.search(r'Chunks:\s*(\d+) of up to \d+ entries, peak memory (\d+) [KM]B', proc.stdout)
+        if not m or int(m.group(1)) < min_chunks or int(m.group(2)) == 0:
+            raise ValueError(f"expected {min_chunks} chunks or more and their peak memory, "
+                             f"got '{m.group(0) if m else None}'")
+    return parse_modified_output(proc.stdout)
+
+def parse_modified_output(out):
+    entry_rx = re.compile(r'Entry\s+#(\d+):\s*score:\s*([+-]?\d+)'
+                          r'(?:\s*bits:\s*(\S+)\s*evalue:\s*(\S+))?'
+                          r'(?:\s*ends:\s*(\d+)\s+(\d+))?', re.IGNORECASE)
     d = {}
     for m in entry_rx.finditer(out):
-        d[int(m.group(1))] = int(m.group(2))
+        if m.group(3) is not None:
+            d[int(m.group(1))] = (int(m.group(2)), m.group(3), m.group(4))
+        elif m.group(5) is not None:
+            d[int(m.group(1))] = (int(m.group(2)), int(m.group(5)), int(m.group(6)))
+        else:
+            d[int(m.group(1))] = int(m.group(2))
+    return d
+
+def extract_resumed_scores(mod_cmd, scoring, query, db_list):
+    """
+    Search the first half of the database with --checkpoint, then append the
+    rest of the entries to the file and carry on with --resume, appending to
+    the output as a user would, so that every entry must be printed once.
+    The checkpoint must be refused by a search with other options, and once
+    it is corrupt; and the update once an entry searched before has changed.
+    Done with the database as plain FASTA and gzipped, which are read
+    differently. Returns dict {entry_index: score_int}.
+    """
+    scores = []
+    for db_name, open_db in (('db.fasta', open), ('db.fasta.gz', gzip.open)):
+        with tempfile.TemporaryDirectory() as tmp:
+            db, ckpt, out = f'{tmp}/{db_name}', f'{tmp}/scan.ckpt', f'{tmp}/hits.txt'
+            cmd = [mod_cmd] + scoring + ['--checkpoint', ckpt, '--resume', '--files', query, db]
+
+            def write_db(entries):
+                with open_db(db, 'wt') as f:
+                    f.writelines(f'>{hdr}\n{seq}\n' for hdr, seq in entries)
+
+            for end in (len(db_list) // 2, len(db_list)):
+                write_db(db_list[:end])
+                with open(out, 'a') as f:
+                    subprocess.run(cmd, stdout=f, stderr=subprocess.PIPE, text=True, check=True)
+            with open(out) as f:
+                output = f.read()
+            entries = re.findall(r'Entry\s+#(\d+):', output)
+            if len(entries) != len(set(entries)):
+                raise ValueError("entries printed again after resuming")
+            scores.append(parse_modified_output(output))
+
+            if not checkpoint_refused(cmd[:1] + ['--minscore', '1000'] + cmd[1:]):
+                raise ValueError("resumed the checkpoint of a search with other options")
+            hdr, seq = db_list[0]
+            write_db([(hdr, seq[::-1])] + db_list[1:])
+            proc = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+            if proc.returncode != 1 or 'have changed' not in proc.stderr:
+                raise ValueError("updated a search whose entries have changed")
+            with open(ckpt) as f:
+                lines = f.read().replace('entries', 'entries x', 1)
+            with open(ckpt, 'w') as f:
+                f.write(lines)
+            if not checkpoint_refused(cmd):
+                raise ValueError("resumed a corrupt checkpoint")
+
+    if scores[0] != scores[1]:
+        raise ValueError("plain and gzipped databases resumed to other scores")
+    return scores[0]
+
+def checkpoint_refused(cmd):
+    proc = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    return 'Error: checkpoint' in proc.stderr
+
+def extract_server_scores(server_cmd, scoring, queries, db, db_list, workers):
+    """
+    Send all the queries to the modified sw_server's socket at once, so they
+    are searched together, and parse its lines
+      q<i>\t<entry>\t<score>\t<name>
+    They are sent again while another client holding a few MB of results
+    doesn't read them, which mustn't hold up the first.
+    With workers, the server searches the first half of the database itself
+    and the rest through that many servers already listening, each started
+    on a --shard of a file of its own, so that their entries are numbered
+    after the first half's (--worker <path>@<entries>).
+    Returns dict {(query_index, entry_index): (score_int, name)}.
+    """
+    lines = ''.join(f'q{i} {seq}\n' for i, seq in enumerate(queries)).encode()
+    with tempfile.TemporaryDirectory() as tmp, contextlib.ExitStack() as stack:
+        path = f'{tmp}/sw.sock'
+        db_args = ['--database', db]
+        if workers:
+            head = len(db_list) // 2
+            for name, entries in (('head', db_list[:head]), ('tail', db_list[head:])):
+                with open(f'{tmp}/{name}.fasta', 'w') as f:
+                    f.writelines(f'>{hdr}\n{seq}\n' for hdr, seq in entries)
+            db_args = ['--database', f'{tmp}/head.fasta']
+            for i in range(workers):
+                worker_path = f'{tmp}/w{i}.sock'
+                worker = start_server(stack, [server_cmd] + scoring + [
+                    '--socket', worker_path, '--database', f'{tmp}/tail.fasta',
+                    '--shard', f'{i}/{workers}'])
+                connect_server(worker, worker_path).close()
+                db_args += ['--worker', f'{worker_path}@{head}']
+        server = start_server(stack, [server_cmd] + scoring + ['--socket', path] + db_args)
+        output = search_server(server, path, lines)
+        if not output:
+            raise ValueError("the server returned no results")
+        copies = 1 + (4 << 20) // len(output)
+        stalled = connect_server(server, path)
+        stalled.sendall(lines * copies)
+        if search_server(server, path, lines) != output:
+            raise ValueError("results differ between clients")
+        stalled.shutdown(socket.SHUT_WR)
+        if read_all(stalled) != output * copies:
+            raise ValueError("results of the stalled client differ")
+    return parse_server_output(output.decode())
+
+def extract_cached_scores(server_cmd, scoring, queries, db_list):
+    """
+    Send all the queries to the modified sw_server on its STDIN with a
+    --cache, then again from the cache, which must answer every one with the
+    same results. A search with other scoring, or of a database with an
+    entry changed, must answer none from it and match a search without the
+    cache; the first search, coming back, finds its results still there.
+    Returns dict {(query_index, entry_index): (score_int, name)}.
+    """
+    lines = ''.join(f'q{i} {seq}\n' for i, seq in enumerate(queries))
+    with tempfile.TemporaryDirectory() as tmp:
+        db, changed_db, cache = f'{tmp}/db.fasta', f'{tmp}/changed.fasta', f'{tmp}/sw.cache'
+        hdr, seq = db_list[0]
+        for path, entries in ((db, db_list), (changed_db, [(hdr, seq[::-1])] + db_list[1:])):
+            with open(path, 'w') as f:
+                f.writelines(f'>{h}\n{s}\n' for h, s in entries)
+
+        def search(options, answered=None):
+            proc = subprocess.run(
+                [server_cmd] + scoring + options + ['--stdin'],
+                input=lines,
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+                text=True,
+                check=True
+            )
+            if answered is not None and \
+                    f'Cache: answered {answered} of {len(queries)} queries' not in proc.stderr:
+                raise ValueError(f"the cache didn't answer {answered} of {len(queries)} queries")
+            return proc.stdout
+
+        output = search(['--database', db, '--cache', cache], 0)
+        if search(['--database', db, '--cache', cache], len(queries)) != output:
+            raise ValueError("results differ once answered from the cache")
+        for options in (['--database', db, '--gapextend', '-2'], ['--database', changed_db]):
+            if search(options + ['--cache', cache], 0) != search(options):
+                raise ValueError(f"results with {' '.join(options)} differ with the cache")
+        if search(['--database', db, '--cache', cache], len(queries)) != output:
+            raise ValueError("results differ once answered from the cache again")
+    return parse_server_output(output)
+
+def parse_server_output(output):
+    d = {}
+    for l in output.splitlines():
+        fields = l.split('\t')
+        if len(fields) == 4:
+            d[(int(fields[0][1:]), int(fields[1]))] = (int(fields[2]), fields[3])
     return d
 
-def extract_first_score_from_original(orig_cmd, matrix, seq1, seq2):
+def start_server(stack, cmd):
+    """
+    Start a server, terminated when the stack is closed.
+    """
+    server = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    stack.callback(server.wait)
+    stack.callback(server.terminate)
+    return server
+
+def connect_server(server, path):
+    """
+    Connect to the server's unix socket, once it is listening.
+    """
+    for _ in range(600):
+        if server.poll() is not None:
+            raise subprocess.CalledProcessError(server.returncode, server.args,
+                                                stderr=server.stderr.read())
+        s = socket.socket(socket.AF_UNIX)
+        try:
+            s.connect(path)
+            return s
+        except (FileNotFoundError, ConnectionRefusedError):
+            s.close()
+            time.sleep(0.1)
+    raise TimeoutError("server did not start listening")
+
+def search_server(server, path, lines):
+    """
+    Send the request lines to the server and return all its results.
+    """
+    client = connect_server(server, path)
+    client.settimeout(60)
+    client.sendall(lines)
+    client.shutdown(socket.SHUT_WR)
+    return read_all(client)
+
+def read_all(s):
+    chunks = []
+    while True:
+        b = s.recv(1 << 16)
+        if not b:
+            return b''.join(chunks)
+        chunks.append(b)
+
+def extract_first_score_from_original(orig_cmd, scoring, seq1, seq2, ends=False):
     """
     Run the original smith_waterman tool on two raw sequences,
     capture its stdout, and return the first integer after 'score:'.
+    Without a --minscore it leaves out hits it deems too weak, so it is
+    given one; a pair without any hit scores 0. With ends, returns
+    (score, query_end, entry_end), the 1-based ends being pos + len of
+    the hit's '[pos: <p>; len: <l>]' lines, or 0 without a hit.
     """
     proc = subprocess.run(
-        [orig_cmd, '--substitution_matrix', matrix, seq1, seq2],
+        [orig_cmd, '--minscore', '1'] + scoring + [seq1, seq2],
         stdout=subprocess.PIPE,
         stderr=subprocess.PIPE,
         text=True,
@@ -69,16 +526,118 @@ def extract_first_score_from_original(orig_cmd, matrix, seq1, seq2):
     )
     m = re.search(r'score:\s*([+-]?\d+)', proc.stdout)
     if not m:
+        if '== Alignment' in proc.stdout:
+            return (0, 0, 0) if ends else 0
         raise ValueError("No 'score:' line found in original SW output")
+    if ends:
+        pos = re.findall(r'\[pos:\s*(\d+);\s*len:\s*(\d+)\]', proc.stdout[m.end():])
+        if len(pos) < 2:
+            raise ValueError("No '[pos: ...]' lines found in original SW output")
+        return (int(m.group(1)), int(pos[0][0]) + int(pos[0][1]), int(pos[1][0]) + int(pos[1][1]))
     return int(m.group(1))
 
+def compare_server(args, scoring, queries, db_list):
+    """
+    Compare the scores of each query against each entry from sw_server with
+    the original tool's, and exit.
+    """
+    try:
+        if args.cache:
+            server_scores = extract_cached_scores(
+                args.server_cmd, scoring + shlex.split(args.modified_args), queries, db_list
+            )
+        else:
+            server_scores = extract_server_scores(
+                args.server_cmd, scoring + shlex.split(args.modified_args),
+                queries, args.database, db_list, args.workers
+            )
+    except (FileNotFoundError, subprocess.CalledProcessError, OSError, ValueError) as e:
+        sys.exit(f"Error running server: {e}")
+
+    for q_idx, q_seq in enumerate(queries):
+        for idx, (hdr, db_seq) in enumerate(db_list):
+            if (q_idx, idx) not in server_scores:
+                sys.exit(f"Missing server score for query #{q_idx}, Entry #{idx}")
+            server_score, name = server_scores[(q_idx, idx)]
+            if name != hdr:
+                sys.exit(f"Server names entry #{idx} '{name[:80]}...', not '{hdr[:80]}...'")
+            try:
+                orig_score = extract_first_score_from_original(
+                    args.original_cmd, scoring, q_seq, db_seq
+                )
+            except (FileNotFoundError, subprocess.CalledProcessError, ValueError) as e:
+                sys.exit(f"Error running original SW on query #{q_idx}, entry #{idx}: {e}")
+
+            if orig_score != server_score:
+                print(f"Query: {q_seq}", file=sys.stderr)
+                print(f"> {hdr}\n{db_seq}", file=sys.stderr)
+                print(f"Query ID: {q_idx}, Entry ID: {idx}", file=sys.stderr)
+                print(f"Server score = {server_score}, original score = {orig_score}",
+                      file=sys.stderr)
+                sys.exit(1)
+
+    print("All scores match between server and original tools.")
+    sys.exit(0)
+
+def compare_allvsall(args, scoring, modified_args, db_list):
+    """
+    Align every pair of entries of the database with --allvsall and compare
+    the '<i> <j> <score>' lines with the original tool's score of each pair
+    i < j, a pair scoring less than a --minscore in --modified_args being
+    left out, and exit.
+    """
+    p = argparse.ArgumentParser(prog='--modified_args')
+    p.add_argument('--minscore', type=int, default=0)
+    min_score = p.parse_known_args(modified_args)[0].minscore
+    try:
+        proc = subprocess.run(
+            [args.modified_cmd] + scoring + modified_args + ['--allvsall', args.database],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            text=True,
+            check=True
+        )
+    except (FileNotFoundError, subprocess.CalledProcessError) as e:
+        sys.exit(f"Error running modified tool: {e}")
+    pairs = {}
+    for l in proc.stdout.splitlines():
+        i, j, score = map(int, l.split())
+        if i >= j or (i, j) in pairs:
+            sys.exit(f"Pair {i} {j} printed out of order or twice")
+        pairs[(i, j)] = score
+
+    num_left_out = 0
+    for i, (_, seq_i) in enumerate(db_list):
+        for j in range(i + 1, len(db_list)):
+            try:
+                orig_score = extract_first_score_from_original(
+                    args.original_cmd, scoring, seq_i, db_list[j][1]
+                )
+            except (FileNotFoundError, subprocess.CalledProcessError, ValueError) as e:
+                sys.exit(f"Error running original SW on entries #{i} and #{j}: {e}")
+            if orig_score < min_score:
+                if (i, j) in pairs:
+                    sys.exit(f"Pair {i} {j} scores {pairs[(i, j)]}, less than --minscore")
+                num_left_out += 1
+            elif pairs.get((i, j)) != orig_score:
+                print(f"{seq_i}\n{db_list[j][1]}", file=sys.stderr)
+                sys.exit(f"Pair {i} {j}: modified score = {pairs.get((i, j))}, "
+                         f"original score = {orig_score}")
+
+    if min_score > 0 and num_left_out in (0, len(db_list) * (len(db_list) - 1) // 2):
+        sys.exit(f"Error: --minscore left out {num_left_out} pairs, the test doesn't tell which")
+    print("All pair scores match between modified and original tools.")
+    sys.exit(0)
+
 def main():
     p = argparse.ArgumentParser(
         description="Compare modified vs. original Smith-Waterman"
     )
     p.add_argument('query', help='Path to query FASTA (1 sequence)')
     p.add_argument('database', help='Path to DB FASTA (≥1 sequence)')
-    p.add_argument('matrix', help='Substitution matrix file')
+    p.add_argument('matrix', nargs='?',
+                   help='Substitution matrix file, leave out to score with '
+                        '--match/--mismatch in --args')
     p.add_argument(
         '--modified_cmd',
         default='smith_waterman2',
@@ -89,38 +648,169 @@ def main():
         default='smith_waterman',
         help='Name/path of the original SW executable'
     )
+    p.add_argument(
+        '--args',
+        default='',
+        help='Scoring options for both tools, e.g. "--gapopen -11 --gapextend -1"'
+    )
+    p.add_argument(
+        '--modified_args',
+        default='',
+        help='Options for the modified tool only, e.g. "--prefilter 40" (a lone option as --modified_args=--stream)'
+    )
+    p.add_argument(
+        '--server_cmd',
+        help='Search all the sequences of the query FASTA together with this '
+             'sw_server instead of the modified tool, sent at once on its socket'
+    )
+    p.add_argument(
+        '--stats',
+        nargs=3,
+        type=float,
+        metavar=('LAMBDA', 'K', 'H'),
+        help='Also compare the bit scores and E-values of --stats with those '
+             'of these Karlin-Altschul parameters of the scoring scheme, and '
+             'which hits an --evalue in --modified_args drops'
+    )
+    p.add_argument(
+        '--global',
+        dest='global_',
+        action='store_true',
+        help='Global alignment, compared with a Needleman-Wunsch reference '
+             'rather than the original tool (which is local only)'
+    )
+    p.add_argument(
+        '--freeends',
+        choices=['query', 'db', 'both'],
+        help='Semi-global alignment with free end gaps (implies --global)'
+    )
+    p.add_argument(
+        '--pssm',
+        choices=['plain', 'gaps'],
+        help='Search with the query written as a PSSM, with the gap penalties '
+             'of the scoring scheme (plain) or its own columns of them (gaps)'
+    )
+    p.add_argument(
+        '--workers',
+        type=int,
+        default=0,
+        help='With --server_cmd, search the second half of the database with '
+             'this many more servers on its shards, added with --worker'
+    )
+    p.add_argument(
+        '--resume',
+        action='store_true',
+        help='Search the first half of the database with --checkpoint, then '
+             'the rest with --resume'
+    )
+    p.add_argument(
+        '--chunks',
+        type=int,
+        default=0,
+        help='The modified tool must search the database in at least this '
+             'many chunks, e.g. with a small --max-memory in --modified_args'
+    )
+    p.add_argument(
+        '--allvsall',
+        action='store_true',
+        help='Align every pair of entries of the database with --allvsall, '
+             'the query being ignored'
+    )
+    p.add_argument(
+        '--cache',
+        action='store_true',
+        help='With --server_cmd, search through a --cache, answered from it '
+             'unless the scoring or the database has changed'
+    )
+    p.add_argument(
+        '--ends',
+        action='store_true',
+        help='Also compare where each best alignment ends (--ends of the '
+             'modified tool) with the original alignment'
+    )
     args = p.parse_args()
+    scoring = scoring_args(args.matrix, args.args)
+    modified_args = shlex.split(args.modified_args)
+    reference = None
+    passes = filter_reference(args.matrix, args.args, modified_args)
+    if args.global_ or args.freeends:
+        reference = global_reference(args.matrix, args.args, args.freeends)
+        modified_args += ['--global'] + (['--freeends', args.freeends] if args.freeends else [])
+    if args.ends:
+        modified_args += ['--ends']
+    if args.stats:
+        modified_args += ['--stats']
+
+    # load database
+    db_list = parse_fasta(args.database)
+    if not db_list:
+        sys.exit("Error: no sequences found in database FASTA")
+
+    if args.allvsall:
+        compare_allvsall(args, scoring, modified_args, db_list)
 
     # load query
     q_list = parse_fasta(args.query)
-    if len(q_list) != 1:
+    if args.server_cmd is None and len(q_list) != 1:
         sys.exit(f"Error: expected 1 sequence in query FASTA, found {len(q_list)}")
     _, q_seq = q_list[0]
 
-    # load database
-    db_list = parse_fasta(args.database)
-    if not db_list:
-        sys.exit("Error: no sequences found in database FASTA")
+    if args.server_cmd is not None:
+        compare_server(args, scoring, [seq for _, seq in q_list], db_list)
+
+    min_score = None
+    if args.stats:
+        stats, min_score = karlin_reference(args.stats, len(q_seq), db_list, modified_args)
 
     # 1) run modified tool once
-    try:
-        mod_scores = extract_modified_scores(
-            args.modified_cmd, args.matrix, args.query, args.database
-        )
-    except (FileNotFoundError, subprocess.CalledProcessError) as e:
-        sys.exit(f"Error running modified tool: {e}")
+    with tempfile.TemporaryDirectory() as tmp:
+        query_path = args.query
+        if args.pssm:
+            query_path = f'{tmp}/query.pssm'
+            write_pssm(query_path, q_seq, args.matrix, args.args, args.pssm == 'gaps')
+            modified_args += ['--pssm']
+        try:
+            if args.resume:
+                mod_scores = extract_resumed_scores(
+                    args.modified_cmd, scoring + modified_args, query_path, db_list
+                )
+            else:
+                mod_scores = extract_modified_scores(
+                    args.modified_cmd, scoring + modified_args,
+                    query_path, args.database, args.chunks
+                )
+        except (FileNotFoundError, subprocess.CalledProcessError, ValueError) as e:
+            sys.exit(f"Error running modified tool: {e}")
 
-    # 2) compare against original for each entry index
+    # 2) compare against original for each entry index, those the filters
+    # drop must be missing
+    num_filtered = 0
     for idx, (hdr, db_seq) in enumerate(db_list):
-        if idx not in mod_scores:
-            sys.exit(f"Missing modified score for Entry #{idx}")
+        if passes is not None and not passes(q_seq, db_seq):
+            if idx in mod_scores:
+                sys.exit(f"Entry #{idx} should have been filtered out")
+            num_filtered += 1
+            continue
         try:
-            orig_score = extract_first_score_from_original(
-                args.original_cmd, args.matrix, q_seq, db_seq
-            )
+            if reference is not None:
+                orig_score = reference(q_seq, db_seq)
+            else:
+                orig_score = extract_first_score_from_original(
+                    args.original_cmd, scoring, q_seq, db_seq, args.ends
+                )
         except (FileNotFoundError, subprocess.CalledProcessError, ValueError) as e:
             sys.exit(f"Error running original SW on entry #{idx}: {e}")
 
+        if args.stats:
+            if min_score is not None and orig_score < min_score:
+                if idx in mod_scores:
+                    sys.exit(f"Entry #{idx} should have been dropped by --evalue")
+                num_filtered += 1
+                continue
+            orig_score = (orig_score,) + stats(orig_score)
+
+        if idx not in mod_scores:
+            sys.exit(f"Missing modified score for Entry #{idx}")
         if orig_score != mod_scores[idx]:
             # print full FASTA record, sequence, and entry id
             print(f"> {hdr}\n{db_seq}", file=sys.stderr)
@@ -129,6 +819,9 @@ def main():
             print(f"Modified score = {mod_scores[idx]}, original score = {orig_score}", file=sys.stderr)
             sys.exit(1)
 
+    if (passes is not None or min_score is not None) and num_filtered in (0, len(db_list)):
+        sys.exit(f"Error: the filters dropped {num_filtered} of {len(db_list)} entries, "
+                 "the test doesn't tell which they drop")
     print("All scores match between modified and original tools.")
     sys.exit(0)
 